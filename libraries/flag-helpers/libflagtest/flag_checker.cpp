@@ -14,9 +14,18 @@
  * limitations under the License.
  */
 
+#include <stdio.h>
+
+#include <atomic>
 #include <string>
+#include <string_view>
+#include <sstream>
 #include <utility>
 #include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
 #include <vector>
 
 #include <flag_checker.h>
@@ -25,16 +34,205 @@
 #include <android-base/stringprintf.h>
 #include <android-base/properties.h>
 
+#if defined(__BIONIC__)
+#include <sys/system_properties.h>
+#endif
+
 #define SYSTEM_PROPERTY_PREFIX "persist.device_config."
 
 namespace android::test::flag {
 
+namespace {
+
+typedef std::unordered_map<std::string, std::string> property_map;
+
+// The counters of GetFlagCheckCounters.
+std::atomic<uint64_t> lookup_count{0};
+std::atomic<uint64_t> property_read_count{0};
+std::atomic<uint64_t> cache_hit_count{0};
+
+void Count(std::atomic<uint64_t>& counter) {
+  counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Returns the values of all the persist.device_config. properties, read in a
+// single pass over the property area on the first call, or null where the
+// properties can't be listed.
+const property_map* GetDeviceConfigProperties() {
+#if defined(__BIONIC__)
+  static const property_map* properties = [] {
+    property_map* values = new property_map();
+    Count(property_read_count);
+    __system_property_foreach(
+      [](const prop_info* info, void* cookie) {
+        __system_property_read_callback(
+          info,
+          [](void* cookie, const char* name, const char* value, uint32_t) {
+            if (android::base::StartsWith(name, SYSTEM_PROPERTY_PREFIX)) {
+              (*static_cast<property_map*>(cookie))[name] = value;
+            }
+          },
+          cookie);
+      },
+      values);
+    return values;
+  }();
+  return properties;
+#else
+  return nullptr;
+#endif
+}
+
+// Returns the property of the legacy flag `raw_flag_name`, either its
+// canonical name, e.g. "flagtest.android.test.myflags.test_flag", or the
+// comma-separated "flagtest, android::test::myflags, test_flag". Returns
+// nullopt if the name is invalid.
+std::optional<std::string> GetLegacyFlagProperty(const std::string& raw_flag_name) {
+  if (raw_flag_name.find(',') == std::string::npos) {
+    return SYSTEM_PROPERTY_PREFIX + raw_flag_name;
+  }
+  std::vector<std::string> flag_args = android::base::Split(raw_flag_name, ",");
+  if (flag_args.size() != 3) {
+    return std::nullopt;
+  }
+  std::string package_name = android::base::StringReplace(flag_args[1], "::", ".", true);
+  return android::base::StringPrintf(
+    SYSTEM_PROPERTY_PREFIX "%s.%s.%s",
+    android::base::Trim(flag_args[0]).c_str(),
+    android::base::Trim(package_name).c_str(),
+    android::base::Trim(flag_args[2]).c_str()
+  );
+}
+
+// Returns the value of the legacy flag `raw_flag_name`, or nullopt if the
+// name is invalid. Values are resolved once per process and raw name, and
+// looked up without copying the name, so checking a flag doesn't allocate
+// after its first check. Entries are never removed, so the returned value
+// stays valid.
+const std::optional<std::string>& GetLegacyFlagValue(std::string_view raw_flag_name) {
+  static std::mutex lock;
+  static std::map<std::string, std::optional<std::string>, std::less<>> values;
+  std::lock_guard<std::mutex> guard(lock);
+  auto cached = values.find(raw_flag_name);
+  if (cached != values.end()) {
+    Count(cache_hit_count);
+    return cached->second;
+  }
+
+  std::optional<std::string> value;
+  std::optional<std::string> property_name =
+    GetLegacyFlagProperty(std::string(raw_flag_name));
+  if (property_name) {
+    const property_map* properties = GetDeviceConfigProperties();
+    if (properties) {
+      auto property = properties->find(*property_name);
+      value = property != properties->end() ? property->second : "";
+    } else {
+      Count(property_read_count);
+      value = android::base::GetProperty(*property_name, "");
+    }
+  }
+  return values.emplace(raw_flag_name, std::move(value)).first->second;
+}
+
+// Returns whether the legacy flag `raw_flag_name` is valid and has the value
+// `expected_value`.
+bool LegacyFlagHasValue(std::string_view raw_flag_name, const char* expected_value) {
+  const std::optional<std::string>& value = GetLegacyFlagValue(raw_flag_name);
+  return value && *value == expected_value;
+}
+
+// A test registered by TEST_WITH_FLAGS or TEST_F_WITH_FLAGS.
+struct flagged_test {
+  const char* test_suite;
+  const char* test_name;
+  const std::vector<std::pair<bool, std::vector<p_flag>>>& (*flag_conditions)();
+};
+
+std::vector<flagged_test>& GetFlaggedTests() {
+  static std::vector<flagged_test> flagged_tests;
+  return flagged_tests;
+}
+
+// Lists the tests left out by ApplyFlagConditionFilter after the results of
+// the tests which ran.
+class FlagFilterReporter : public ::testing::EmptyTestEventListener {
+  public:
+    explicit FlagFilterReporter(std::vector<std::string> skipped_tests)
+      : skipped_tests_(std::move(skipped_tests)) {}
+
+    void OnTestProgramEnd(const ::testing::UnitTest&) override {
+      printf("[  SKIPPED ] %zu %s not meeting feature flag conditions, listed below:\n",
+             skipped_tests_.size(), skipped_tests_.size() == 1 ? "test" : "tests");
+      for (const std::string& skipped_test : skipped_tests_) {
+        printf("[  SKIPPED ] %s\n", skipped_test.c_str());
+      }
+      fflush(stdout);
+    }
+
+  private:
+    const std::vector<std::string> skipped_tests_;
+};
+
+}  // namespace
+
+std::string DescribeFlagsNotMetRequirements(
+  const std::vector<std::pair<bool, std::string>>& unsatisfied_flags) {
+  std::ostringstream description;
+  for (const std::pair<bool, std::string>& flag : unsatisfied_flags) {
+    description << " flag(" << flag.second << ")=" << (flag.first ? "true":"false");
+  }
+  return description.str();
+}
+
+bool RegisterFlagConditions(
+  const char* test_suite, const char* test_name,
+  const std::vector<std::pair<bool, std::vector<p_flag>>>& (*flag_conditions)()) {
+  GetFlaggedTests().push_back({test_suite, test_name, flag_conditions});
+  return true;
+}
+
+std::string FlagConditionFilter(const std::string& filter,
+                                std::vector<std::string>* skipped_tests) {
+  std::string negative_filter;
+  for (const flagged_test& test : GetFlaggedTests()) {
+    std::vector<std::pair<bool, std::string>> unsatisfied_flags =
+      GetFlagsNotMetRequirements(test.flag_conditions());
+    if (unsatisfied_flags.empty()) {
+      continue;
+    }
+    std::string full_name = std::string(test.test_suite) + "." + test.test_name;
+    negative_filter += (negative_filter.empty() ? "" : ":") + full_name;
+    skipped_tests->push_back(full_name + ":" + DescribeFlagsNotMetRequirements(unsatisfied_flags));
+  }
+  if (negative_filter.empty()) {
+    return filter;
+  }
+
+  // Everything after the first '-' of a filter is negative.
+  std::string result = filter.empty() ? "*" : filter;
+  result += (result.find('-') == std::string::npos ? "-" : ":") + negative_filter;
+  return result;
+}
+
+size_t ApplyFlagConditionFilter() {
+  std::vector<std::string> skipped_tests;
+  std::string filter = FlagConditionFilter(GTEST_FLAG_GET(filter), &skipped_tests);
+  if (skipped_tests.empty()) {
+    return 0;
+  }
+  GTEST_FLAG_SET(filter, filter);
+  ::testing::UnitTest::GetInstance()->listeners().Append(
+    new FlagFilterReporter(skipped_tests));
+  return skipped_tests.size();
+}
+
 std::vector<std::pair<bool, std::string>> GetFlagsNotMetRequirements(
-  const std::vector<std::pair<bool, std::vector<p_flag>>> flag_conditions) {
+  const std::vector<std::pair<bool, std::vector<p_flag>>>& flag_conditions) {
   std::vector<std::pair<bool, std::string>> unsatisfied_flags;
-  for (const std::pair<bool, std::vector<p_flag>> flag_condition : flag_conditions) {
+  for (const std::pair<bool, std::vector<p_flag>>& flag_condition : flag_conditions) {
     bool expected_condition = flag_condition.first;
-    for (const p_flag feature_flag : flag_condition.second) {
+    for (const p_flag& feature_flag : flag_condition.second) {
       if (!CheckFlagCondition(expected_condition, feature_flag)) {
         // Records the feature flag if it doesn't meet the expected condition.
         unsatisfied_flags.push_back({expected_condition, feature_flag.second});
@@ -44,25 +242,62 @@ std::vector<std::pair<bool, std::string>> GetFlagsNotMetRequirements(
   return unsatisfied_flags;
 }
 
-bool CheckFlagCondition(bool expected_condition, const p_flag feature_flag) {
+std::vector<flag_descriptor> GetFlagDescriptors(
+  const std::vector<std::pair<bool, std::vector<p_flag>>>& flag_conditions) {
+  std::vector<flag_descriptor> descriptors;
+  for (const std::pair<bool, std::vector<p_flag>>& flag_condition : flag_conditions) {
+    for (const p_flag& feature_flag : flag_condition.second) {
+      bool (*const* aconfig_flag)() = feature_flag.first.target<bool (*)()>();
+      if (feature_flag.first && !aconfig_flag) {
+        // Not a plain function, so it can't be described.
+        return {};
+      }
+      descriptors.push_back({
+        flag_condition.first,
+        aconfig_flag ? *aconfig_flag : nullptr,
+        feature_flag.second.c_str()
+      });
+    }
+  }
+  return descriptors;
+}
+
+const flag_descriptor* FindFlagNotMetRequirement(const flag_descriptor* flags, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (!CheckFlagCondition(flags[i])) {
+      return &flags[i];
+    }
+  }
+  return nullptr;
+}
+
+flag_check_counters GetFlagCheckCounters() {
+  return {
+    lookup_count.load(std::memory_order_relaxed),
+    property_read_count.load(std::memory_order_relaxed),
+    cache_hit_count.load(std::memory_order_relaxed)
+  };
+}
+
+bool CheckFlagCondition(const flag_descriptor& feature_flag) {
+  Count(lookup_count);
+  // Checks the aconfig flag.
+  if (feature_flag.aconfig_flag) {
+    return feature_flag.aconfig_flag() == feature_flag.expected_condition;
+  }
+  // Checks the legacy flag.
+  return LegacyFlagHasValue(
+    feature_flag.name, feature_flag.expected_condition ? "true":"false");
+}
+
+bool CheckFlagCondition(bool expected_condition, const p_flag& feature_flag) {
+  Count(lookup_count);
   // Checks the aconfig flag.
   if (feature_flag.first) {
     return feature_flag.first() == expected_condition;
   }
   // Checks the legacy flag.
-  std::vector<std::string> flag_args = android::base::Split(feature_flag.second, ",");
-  if (flag_args.size() != 3) {
-    return false;
-  }
-  std::string package_name = android::base::StringReplace(flag_args[1], "::", ".", true);
-  std::string full_flag_name = android::base::StringPrintf(
-    "%s.%s.%s",
-    android::base::Trim(flag_args[0]).c_str(),
-    android::base::Trim(package_name).c_str(),
-    android::base::Trim(flag_args[2]).c_str()
-  );
-  return android::base::GetProperty(SYSTEM_PROPERTY_PREFIX + full_flag_name, "") ==
-    (expected_condition ? "true":"false");
+  return LegacyFlagHasValue(feature_flag.second, expected_condition ? "true":"false");
 }
 
 }  // namespace android::test::flag
\ No newline at end of file
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+
+#include <benchmark/benchmark.h>
+#include <flag_checker.h>
+
+#include "android_test_myflags.h"
+
+using android::test::flag::CheckFlagCondition;
+using android::test::flag::flag_check_counters;
+using android::test::flag::flag_descriptor;
+using android::test::flag::GetFlagCheckCounters;
+
+// Reports the flag check counters per iteration of the benchmark.
+class CounterScope {
+  public:
+    explicit CounterScope(benchmark::State& state)
+      : state_(state), start_(GetFlagCheckCounters()) {}
+
+    ~CounterScope() {
+      flag_check_counters end = GetFlagCheckCounters();
+      state_.counters["lookups"] = benchmark::Counter(
+        end.lookups - start_.lookups, benchmark::Counter::kAvgIterations);
+      state_.counters["property_reads"] = benchmark::Counter(
+        end.property_reads - start_.property_reads, benchmark::Counter::kAvgIterations);
+      state_.counters["cache_hits"] = benchmark::Counter(
+        end.cache_hits - start_.cache_hits, benchmark::Counter::kAvgIterations);
+    }
+
+  private:
+    benchmark::State& state_;
+    const flag_check_counters start_;
+};
+
+static void BM_AconfigFlag(benchmark::State& state) {
+  const p_flag feature_flag = {
+    android::test::myflags::test_flag_true, "android::test::myflags, test_flag_true"};
+  CounterScope counters(state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(CheckFlagCondition(true, feature_flag));
+  }
+}
+BENCHMARK(BM_AconfigFlag);
+
+static void BM_AconfigFlagDescriptor(benchmark::State& state) {
+  static const flag_descriptor feature_flag = {
+    true, android::test::myflags::test_flag_true, "android::test::myflags, test_flag_true"};
+  CounterScope counters(state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(CheckFlagCondition(feature_flag));
+  }
+}
+BENCHMARK(BM_AconfigFlagDescriptor);
+
+// Checks a legacy flag never checked before in each iteration, so every
+// check parses the name and looks it up in the snapshot of the properties.
+static void BM_LegacyFlagCold(benchmark::State& state) {
+  static int next_flag = 0;
+  CounterScope counters(state);
+  for (auto _ : state) {
+    state.PauseTiming();
+    const p_flag feature_flag = {
+      nullptr, "flagtest, android::test::myflags, cold_flag_" + std::to_string(next_flag++)};
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(CheckFlagCondition(true, feature_flag));
+  }
+}
+BENCHMARK(BM_LegacyFlagCold);
+
+static void BM_LegacyFlagWarm(benchmark::State& state) {
+  const p_flag feature_flag = {nullptr, "flagtest, android::test::myflags, test_flag_true"};
+  CheckFlagCondition(true, feature_flag);
+  CounterScope counters(state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(CheckFlagCondition(true, feature_flag));
+  }
+}
+BENCHMARK(BM_LegacyFlagWarm);
+
+static void BM_LegacyFlagDescriptorWarm(benchmark::State& state) {
+  static const flag_descriptor feature_flag = {
+    true, nullptr, "flagtest.android.test.myflags.test_flag_true"};
+  CheckFlagCondition(feature_flag);
+  CounterScope counters(state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(CheckFlagCondition(feature_flag));
+  }
+}
+BENCHMARK(BM_LegacyFlagDescriptorWarm);
+
+BENCHMARK_MAIN();
@@ -18,14 +18,30 @@
 #include <functional>
 
 #include <flag_checker.h>
+#include <flag_macros.h>
 #include <gtest/gtest.h>
 
 #include "android_test_myflags.h"
 
 
+using android::test::flag::FlagConditionFilter;
+using android::test::flag::CanonicalFlagName;
 using android::test::flag::CheckFlagCondition;
+using android::test::flag::FindFlagNotMetRequirement;
+using android::test::flag::flag_descriptor;
+using android::test::flag::GetFlagDescriptors;
 using android::test::flag::GetFlagsNotMetRequirements;
 
+static_assert(
+  CanonicalFlagName("flagtest", "android::test::myflags", "test_flag").view() ==
+    "flagtest.android.test.myflags.test_flag");
+static_assert(CanonicalFlagName("flagtest", "android::test::myflags", "test_flag").valid);
+static_assert(!CanonicalFlagName("", "android::test::myflags", "test_flag").valid);
+static_assert(!CanonicalFlagName("flagtest", "android:test", "test_flag").valid);
+static_assert(!CanonicalFlagName("flagtest", "::android::test", "test_flag").valid);
+static_assert(!CanonicalFlagName("flagtest", "android::test::", "test_flag").valid);
+static_assert(!CanonicalFlagName("flagtest", "android::test", "1flag").valid);
+
 class CheckFlagConditionTest : public ::testing::Test {};
 
 
@@ -65,6 +81,52 @@ TEST_F(CheckFlagConditionTest, lagency_flag_meet_false_condition) {
   );
 }
 
+TEST_F(CheckFlagConditionTest, lagency_flag_repeated_lookup) {
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(
+      CheckFlagCondition(
+        true,
+        {nullptr, "flagtest, android::test::myflags, test_flag_true"}
+      )
+    );
+    ASSERT_FALSE(
+      CheckFlagCondition(
+        false,
+        {nullptr, "flagtest, android::test::myflags, test_flag_true"}
+      )
+    );
+    ASSERT_FALSE(
+      CheckFlagCondition(
+        true,
+        {nullptr, "flagtest, android::test::myflags"}
+      )
+    );
+  }
+}
+
+TEST_F(CheckFlagConditionTest, lagency_flag_canonical_name) {
+  p_flag feature_flag = LEGACY_FLAG(flagtest, android::test::myflags, test_flag_true);
+  ASSERT_EQ(feature_flag.second, "flagtest.android.test.myflags.test_flag_true");
+  ASSERT_TRUE(
+    CheckFlagCondition(
+      true,
+      LEGACY_FLAG(flagtest, android::test::myflags, test_flag_true)
+    )
+  );
+  ASSERT_TRUE(
+    CheckFlagCondition(
+      false,
+      LEGACY_FLAG(flagtest, android::test::myflags, test_flag_false)
+    )
+  );
+  ASSERT_FALSE(
+    CheckFlagCondition(
+      true,
+      LEGACY_FLAG(flagtest, android::test::myflags, test_flag)
+    )
+  );
+}
+
 TEST_F(CheckFlagConditionTest, aconfig_flag_not_meet_condition) {
   ASSERT_FALSE(
     CheckFlagCondition(
@@ -162,3 +224,91 @@ TEST_F(GetFlagsNotMetReqTest, flag_not_meet_condition) {
     "flagtest, android::test::myflags, test_flag_false"
   );
 }
+
+class FindFlagNotMetReqTest : public ::testing::Test {};
+
+TEST_F(FindFlagNotMetReqTest, flag_meet_condition) {
+  static const flag_descriptor flags[] = {
+    {true, android::test::myflags::test_flag_true, "android::test::myflags, test_flag_true"},
+    {false, nullptr, "flagtest.android.test.myflags.test_flag_false"},
+  };
+  ASSERT_EQ(FindFlagNotMetRequirement(flags, 2), nullptr);
+  ASSERT_EQ(FindFlagNotMetRequirement(flags, 0), nullptr);
+}
+
+TEST_F(FindFlagNotMetReqTest, flag_not_meet_condition) {
+  static const flag_descriptor flags[] = {
+    {false, android::test::myflags::test_flag_true, "android::test::myflags, test_flag_true"},
+    {true, nullptr, "flagtest.android.test.myflags.test_flag_true"},
+    {true, nullptr, "flagtest, android::test::myflags, test_flag_false"},
+  };
+  const flag_descriptor* unsatisfied_flag = FindFlagNotMetRequirement(flags, 3);
+  ASSERT_EQ(unsatisfied_flag, &flags[0]);
+  unsatisfied_flag = FindFlagNotMetRequirement(unsatisfied_flag + 1, flags + 3 - (unsatisfied_flag + 1));
+  ASSERT_EQ(unsatisfied_flag, &flags[2]);
+}
+
+TEST_F(FindFlagNotMetReqTest, descriptors_of_flag_conditions) {
+  std::vector<std::pair<bool, std::vector<p_flag>>> flag_conditions = {
+    {
+      true, {
+        {
+          android::test::myflags::test_flag_true,
+          "android::test::myflags, test_flag_true"
+        }
+      }
+    },
+    {
+      true, {
+        {
+          nullptr,
+          "flagtest, android::test::myflags, test_flag_false"
+        }
+      }
+    },
+  };
+  std::vector<flag_descriptor> descriptors = GetFlagDescriptors(flag_conditions);
+  ASSERT_EQ(descriptors.size(), 2);
+  ASSERT_TRUE(descriptors[0].expected_condition);
+  ASSERT_EQ(descriptors[0].aconfig_flag, android::test::myflags::test_flag_true);
+  ASSERT_EQ(descriptors[1].aconfig_flag, nullptr);
+  ASSERT_EQ(descriptors[1].name, flag_conditions[1].second[0].second.c_str());
+  ASSERT_EQ(FindFlagNotMetRequirement(descriptors.data(), descriptors.size()), &descriptors[1]);
+}
+
+TEST_WITH_FLAGS(
+  ApplyFlagConditionFilterTest,
+  meet_condition,
+  REQUIRES_FLAGS_ENABLED(ACONFIG_FLAG(android::test::myflags, test_flag_true))
+) {}
+
+TEST_WITH_FLAGS(
+  ApplyFlagConditionFilterTest,
+  not_meet_condition,
+  REQUIRES_FLAGS_ENABLED(LEGACY_FLAG(flagtest, android::test::myflags, test_flag_false))
+) {
+  FAIL();
+}
+
+TEST(ApplyFlagConditionFilterTest, filter_tests_not_meet_condition) {
+  std::vector<std::string> skipped_tests;
+  EXPECT_EQ(
+    FlagConditionFilter("Some*-Other.*", &skipped_tests),
+    "Some*-Other.*:ApplyFlagConditionFilterTest.not_meet_condition"
+  );
+  ASSERT_EQ(skipped_tests.size(), 1);
+  EXPECT_EQ(
+    skipped_tests[0],
+    "ApplyFlagConditionFilterTest.not_meet_condition:"
+    " flag(flagtest.android.test.myflags.test_flag_false)=true"
+  );
+}
+
+TEST(ApplyFlagConditionFilterTest, filter_tests_not_meet_condition_without_filter) {
+  std::vector<std::string> skipped_tests;
+  EXPECT_EQ(
+    FlagConditionFilter("", &skipped_tests),
+    "*-ApplyFlagConditionFilterTest.not_meet_condition"
+  );
+  EXPECT_EQ(skipped_tests.size(), 1);
+}
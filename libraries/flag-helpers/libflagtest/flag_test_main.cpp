@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <flag_checker.h>
+#include <gtest/gtest.h>
+
+// A replacement for gtest_main which leaves out the tests that don't meet
+// their feature flag conditions before any of them runs.
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  android::test::flag::ApplyFlagConditionFilter();
+  return RUN_ALL_TESTS();
+}
@@ -16,10 +16,14 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <vector>
 #include <utility>
 #include <functional>
 #include <string>
+#include <string_view>
 
 // The pair describes a feature flag by an aconfig function and a raw
 // flag name. For a legacy feature flag, the function pointer is null.
@@ -27,16 +31,140 @@ typedef std::pair<std::function<bool()>, std::string> p_flag;
 
 namespace android::test::flag {
 
+// The canonical name of a legacy feature flag, "namespace.package.flag",
+// built at compile time by CanonicalFlagName. `valid` is false if a part
+// of the name is empty or isn't a C++ identifier, or a namespace name for
+// the package.
+template <size_t N>
+struct CanonicalName {
+  char chars[N] = {};
+  size_t length = 0;
+  bool valid = true;
+
+  constexpr std::string_view view() const { return {chars, length}; }
+};
+
+// Returns the canonical name of the legacy flag with the given namespace,
+// package (with cpp namespace format) and name, e.g.
+// "cts.android.cts.test.flag_rw" for ("cts", "android::cts::test", "flag_rw").
+template <size_t A, size_t B, size_t C>
+constexpr CanonicalName<A + B + C> CanonicalFlagName(
+    const char (&name_space)[A], const char (&package)[B], const char (&flag)[C]) {
+  CanonicalName<A + B + C> name;
+  const char* parts[] = {name_space, package, flag};
+  const size_t lengths[] = {A - 1, B - 1, C - 1};
+  for (size_t part = 0; part < 3; part++) {
+    if (part > 0) {
+      name.chars[name.length++] = '.';
+    }
+    bool start_of_identifier = true;
+    for (size_t i = 0; i < lengths[part]; i++) {
+      char c = parts[part][i];
+      if (part == 1 && c == ':' && i + 1 < lengths[part] && parts[part][i + 1] == ':' &&
+          !start_of_identifier) {
+        name.chars[name.length++] = '.';
+        start_of_identifier = true;
+        i++;
+        continue;
+      }
+      bool letter = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+      bool digit = c >= '0' && c <= '9';
+      if (!letter && !(digit && !start_of_identifier)) {
+        name.valid = false;
+      }
+      name.chars[name.length++] = c;
+      start_of_identifier = false;
+    }
+    if (start_of_identifier) {
+      name.valid = false;
+    }
+  }
+  return name;
+}
+
+// Describes a feature flag and its expected condition without owning any
+// memory. For a legacy feature flag, `aconfig_flag` is null and `name` is
+// the canonical or raw name of the flag. `name` must outlive every check of
+// the flag.
+struct flag_descriptor {
+  bool expected_condition;
+  bool (*aconfig_flag)();
+  const char* name;
+};
+
 // Returns a group of flags that don't meet expected conditions. Each
 // element in the returned group contains an expected condition and a
 // feature flag represented by a string. The input parameter `flag_conditions`
 // is a group of pairs, with each pair containing the expected condition
 // and a group of feature flags.
 std::vector<std::pair<bool, std::string>> GetFlagsNotMetRequirements(
-    const std::vector<std::pair<bool, std::vector<p_flag>>> flag_conditions);
+    const std::vector<std::pair<bool, std::vector<p_flag>>>& flag_conditions);
+
+// Returns the first of the `count` flags starting at `flags` that doesn't
+// meet its expected condition, or null if all of them do. Calling it again
+// from the flag after the returned one finds the next. Once each legacy
+// flag has been checked, this doesn't allocate.
+const flag_descriptor* FindFlagNotMetRequirement(const flag_descriptor* flags, size_t count);
+
+// Returns the descriptors of the flags of `flag_conditions`, which must
+// outlive them, or an empty group if an aconfig flag isn't a plain
+// function.
+std::vector<flag_descriptor> GetFlagDescriptors(
+    const std::vector<std::pair<bool, std::vector<p_flag>>>& flag_conditions);
 
 // Returns true if the value of `feature_flag` meets `expected_condition`,
-// false when the condition doesn't meet.
-bool CheckFlagCondition(bool expected_condition, const p_flag feature_flag);
+// false when the condition doesn't meet. A legacy flag is named either by
+// its canonical name, as LEGACY_FLAG does, or by its comma-separated
+// namespace, package and name. The values of legacy flags are
+// read once per process, from a snapshot of the persist.device_config.
+// properties taken on the first lookup, so changes made while the test
+// runs are not seen.
+bool CheckFlagCondition(bool expected_condition, const p_flag& feature_flag);
+
+// Returns true if the value of `feature_flag` meets its expected condition.
+bool CheckFlagCondition(const flag_descriptor& feature_flag);
+
+// Counts the work of the flag checks of the process, to measure their
+// cost in suites with many flagged tests.
+struct flag_check_counters {
+  // Calls to CheckFlagCondition, including those of the other functions.
+  uint64_t lookups;
+  // Properties read for legacy flags. The snapshot of all the
+  // persist.device_config. properties counts as one read.
+  uint64_t property_reads;
+  // Legacy flag checks answered by the values cached by earlier checks.
+  uint64_t cache_hits;
+};
+
+// Returns the counters of the flag checks since the process started.
+flag_check_counters GetFlagCheckCounters();
+
+// Returns the flags of GetFlagsNotMetRequirements as listed in skip
+// messages, e.g. " flag(cts.android.cts.test.flag_rw)=true".
+std::string DescribeFlagsNotMetRequirements(
+    const std::vector<std::pair<bool, std::string>>& unsatisfied_flags);
+
+// Registers the flag conditions of the test `test_name` of `test_suite`.
+// TEST_WITH_FLAGS and TEST_F_WITH_FLAGS call this while the tests are
+// registered. Always returns true.
+bool RegisterFlagConditions(
+    const char* test_suite, const char* test_name,
+    const std::vector<std::pair<bool, std::vector<p_flag>>>& (*flag_conditions)());
+
+// Returns the gtest filter `filter` with the registered tests which don't meet
+// their flag conditions left out, and appends those tests, with the flags they
+// don't meet, to `skipped_tests`. Returns `filter` unchanged if every test
+// meets its conditions.
+std::string FlagConditionFilter(const std::string& filter,
+                                std::vector<std::string>* skipped_tests);
+
+// Checks the flag conditions of every registered test once, with
+// FlagConditionFilter, and leaves out
+// the tests which don't meet them with a negative --gtest_filter, so their
+// fixtures are never built. A listener reports the tests left out in one
+// batch at the end of the run. Must be called after InitGoogleTest and
+// before RUN_ALL_TESTS, as libflagtest_main does. Returns the number of
+// tests left out.
+size_t ApplyFlagConditionFilter();
 
 }  // namespace android::test::flag
\ No newline at end of file
@@ -17,7 +17,6 @@
 #pragma once
 
 #include <utility>
-#include <sstream>
 #include <string>
 #include <vector>
 
@@ -33,34 +32,50 @@
 
 // Defines a class inherit from the original test fixture.
 //
-// The class is defined for each test case. The class constructor calls
-// SkipIfFlagRequirementsNotMet to decide whether the test should be
-// skipped.
+// The class is defined for each test case. The class constructor checks
+// the flag conditions to decide whether the test should be skipped. The
+// conditions and their descriptors are built once per test case, so
+// checking met conditions doesn't allocate. The conditions are also
+// registered for ApplyFlagConditionFilter.
 
 #define _FLAG_GTEST_CLASS(test_fixture, test_name, parent_class, flags...)   \
   class _FLAG_GTEST_CLASS_NAME(test_fixture, test_name)                      \
                             : public parent_class {                          \
     public:                                                                  \
+      static const std::vector<std::pair<bool, std::vector<p_flag>>>&        \
+      FlagConditions() {                                                     \
+        static const std::vector<std::pair<bool, std::vector<p_flag>>>       \
+          flag_conditions = {flags};                                         \
+        return flag_conditions;                                              \
+      }                                                                      \
+                                                                             \
       void SkipTest(                                                         \
-        std::vector<std::pair<bool, std::string>> unsatisfied_flags) {       \
-        std::ostringstream skip_message;                                     \
-        for (const std::pair<bool, std::string> flag : unsatisfied_flags) {  \
-          skip_message << " flag("                                           \
-              << flag.second << ")="                                         \
-              << (flag.first ? "true":"false");                              \
-        }                                                                    \
+        const std::vector<std::pair<bool, std::string>>& unsatisfied_flags) {\
         GTEST_SKIP() << "Skipping test: not meet feature flag conditions:"   \
-          << skip_message.str();                                             \
+          << android::test::flag::DescribeFlagsNotMetRequirements(           \
+            unsatisfied_flags);                                              \
       }                                                                      \
                                                                              \
       _FLAG_GTEST_CLASS_NAME(test_fixture, test_name)() {                    \
-        std::vector<std::pair<bool, std::string>> unsatisfied_flags =        \
-          android::test::flag::GetFlagsNotMetRequirements({flags});          \
-        if (unsatisfied_flags.size() != 0) {                                 \
-          SkipTest(unsatisfied_flags);                                       \
+        static const std::vector<android::test::flag::flag_descriptor>       \
+          flag_descriptors =                                                 \
+            android::test::flag::GetFlagDescriptors(FlagConditions());       \
+        bool met = flag_descriptors.empty()                                  \
+          ? android::test::flag::GetFlagsNotMetRequirements(                 \
+              FlagConditions()).empty()                                      \
+          : !android::test::flag::FindFlagNotMetRequirement(                 \
+              flag_descriptors.data(), flag_descriptors.size());             \
+        if (!met) {                                                          \
+          SkipTest(android::test::flag::GetFlagsNotMetRequirements(          \
+            FlagConditions()));                                              \
         }                                                                    \
       }                                                                      \
-  };
+  };                                                                         \
+  [[maybe_unused]] static const bool                                         \
+    test_fixture##_##test_name##_FLAG_registered =                           \
+      android::test::flag::RegisterFlagConditions(                           \
+        #test_fixture, #test_name,                                           \
+        &_FLAG_GTEST_CLASS_NAME(test_fixture, test_name)::FlagConditions);
 
 // Defines an aconfig feature flag.
 //
@@ -83,11 +98,23 @@
 // flag. The third parameter is the name of the feature flag.
 //
 // For example: LEGACY_FLAG(cts, android::cts::test, flag_rw)
+//
+// The flag is named by its canonical "namespace.package.flag" name, here
+// "cts.android.cts.test.flag_rw", which is built at compile time. A part
+// which isn't a valid identifier fails the build.
 
 #if !TEST_WITH_FLAGS_DONT_DEFINE
-#define LEGACY_FLAG(namespace, package, flag)                               \
+#define LEGACY_FLAG(flag_namespace, flag_package, flag_name)                \
   std::make_pair<std::function<bool()>, std::string>(                       \
-    nullptr, _FLAG_STRINGFY(namespace, package, flag))
+    nullptr, [] {                                                           \
+      static constexpr auto name =                                          \
+        android::test::flag::CanonicalFlagName(                             \
+          _FLAG_STRINGFY(flag_namespace), _FLAG_STRINGFY(flag_package),     \
+          _FLAG_STRINGFY(flag_name));                                       \
+      static_assert(name.valid, "Invalid legacy flag: "                     \
+        _FLAG_STRINGFY(flag_namespace, flag_package, flag_name));           \
+      return std::string(name.view());                                      \
+    }())
 #endif
 
 // Defines a set of feature flags that must meet "enabled" condition.
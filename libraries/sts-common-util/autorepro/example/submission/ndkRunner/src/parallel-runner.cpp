@@ -0,0 +1,418 @@
+// Runs many native PoCs in parallel and streams back their combined results,
+// so a host test pushes and runs them with a single command.
+//
+//   parallel-runner [-j JOBS] [-w WORK_DIR] [-k] MANIFEST
+//
+// Each non-empty line of MANIFEST which doesn't start with '#' is one PoC:
+//
+//   NAME TIMEOUT_SECONDS FIXTURES BINARY [ARGS...]
+//
+// FIXTURES is a comma-separated list of files copied into the private working
+// directory of the PoC, or "-" for none. Each PoC runs in its own process
+// group with that directory as its working directory, and is killed once it
+// runs for longer than its timeout. The group is killed once the PoC exits,
+// and the runner stops reading output left open by processes which escaped
+// it at the timeout of the PoC.
+//
+// The output of every PoC is written to stdout as "NAME| LINE" as it arrives,
+// and each PoC ends with a line of the form
+//
+//   RESULT NAME STATUS CODE DURATION_MS
+//
+// where STATUS is SUCCESS, FAILURE or VULNERABLE for the exit codes of the
+// protocol of native-sample.cpp, CRASH with the signal as CODE, or TIMEOUT.
+// The runner exits with EXIT_VULNERABLE if any PoC did, EXIT_FAILURE if any
+// failed, crashed or timed out, and EXIT_SUCCESS otherwise.
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+#define EXIT_VULNERABLE 113
+
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+// How often the runner looks for PoCs which exited on kernels without pidfds,
+// as their output may be kept open by processes they started.
+static constexpr std::chrono::milliseconds kReapInterval(100);
+
+struct Poc {
+    std::string name;
+    std::chrono::seconds timeout;
+    std::vector<std::string> fixtures;
+    std::vector<std::string> command;
+};
+
+struct Job {
+    const Poc *poc;
+    pid_t pid = -1;
+    int outputFd = -1;
+    // A pidfd of the PoC, readable once it exits, if the kernel has them.
+    int exitFd = -1;
+    std::string workDir;
+    std::string partialLine;
+    Clock::time_point start;
+    Clock::time_point end;
+    // The PoC was reaped, with its wait status in status.
+    bool exited = false;
+    int status = 0;
+    bool timedOut = false;
+};
+
+static bool parseManifest(const char *path, std::vector<Poc> *pocs) {
+    std::ifstream manifest(path);
+    if (!manifest.is_open()) {
+        std::cout << "could not open manifest " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(manifest, line); number++) {
+        std::istringstream words(line);
+        std::string name;
+        if (!(words >> name) || name[0] == '#') {
+            continue;
+        }
+        Poc poc;
+        poc.name = name;
+        long timeout;
+        std::string fixtures;
+        if (!(words >> timeout >> fixtures) || timeout <= 0) {
+            std::cout << path << ":" << number << ": expected NAME TIMEOUT FIXTURES BINARY"
+                      << std::endl;
+            return false;
+        }
+        poc.timeout = std::chrono::seconds(timeout);
+        if (fixtures != "-") {
+            std::istringstream list(fixtures);
+            std::string fixture;
+            while (std::getline(list, fixture, ',')) {
+                poc.fixtures.push_back(fixture);
+            }
+        }
+        std::string word;
+        while (words >> word) {
+            poc.command.push_back(word);
+        }
+        if (poc.command.empty()) {
+            std::cout << path << ":" << number << ": missing the binary of " << name
+                      << std::endl;
+            return false;
+        }
+        pocs->push_back(poc);
+    }
+    return true;
+}
+
+static std::string absolutePath(const std::string &path) {
+    char resolved[PATH_MAX];
+    return realpath(path.c_str(), resolved) ? resolved : path;
+}
+
+static std::string baseName(const std::string &path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static bool copyFile(const std::string &from, const std::string &to) {
+    std::ifstream in(from, std::ios::binary);
+    std::ofstream out(to, std::ios::binary);
+    if (!in.is_open() || !out.is_open()) {
+        return false;
+    }
+    out << in.rdbuf();
+    return static_cast<bool>(out);
+}
+
+static void removeTree(const std::string &path) {
+    nftw(
+            path.c_str(),
+            [](const char *file, const struct stat *, int, struct FTW *) {
+                remove(file);
+                return 0;
+            },
+            16, FTW_DEPTH | FTW_PHYS);
+}
+
+static void printLine(const Job &job, const std::string &line) {
+    std::cout << job.poc->name << "| " << line << "\n";
+}
+
+// Starts the PoC of job in a new working directory under workRoot, with its
+// output going to a pipe.
+static bool startJob(Job *job, const std::string &workRoot) {
+    std::string dirTemplate = workRoot + "/" + job->poc->name + ".XXXXXX";
+    if (!mkdtemp(dirTemplate.data())) {
+        printLine(*job, std::string("could not create working directory: ") + strerror(errno));
+        return false;
+    }
+    job->workDir = dirTemplate;
+    for (const std::string &fixture : job->poc->fixtures) {
+        if (!copyFile(fixture, job->workDir + "/" + baseName(fixture))) {
+            printLine(*job, "could not copy fixture " + fixture);
+            return false;
+        }
+    }
+
+    // The binary and its arguments are relative to the runner, not to the
+    // working directory of the PoC.
+    std::string binary = absolutePath(job->poc->command[0]);
+    std::vector<char *> argv;
+    for (const std::string &arg : job->poc->command) {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv[0] = binary.data();
+    argv.push_back(nullptr);
+
+    int pipeFds[2];
+    if (pipe2(pipeFds, O_CLOEXEC) != 0) {
+        printLine(*job, std::string("could not create pipe: ") + strerror(errno));
+        return false;
+    }
+    job->start = Clock::now();
+    job->pid = fork();
+    if (job->pid == 0) {
+        setpgid(0, 0);
+        dup2(pipeFds[1], STDOUT_FILENO);
+        dup2(pipeFds[1], STDERR_FILENO);
+        if (chdir(job->workDir.c_str()) != 0) {
+            _exit(EXIT_FAILURE);
+        }
+        execv(argv[0], argv.data());
+        dprintf(STDOUT_FILENO, "could not run %s: %s\n", argv[0], strerror(errno));
+        _exit(EXIT_FAILURE);
+    }
+    close(pipeFds[1]);
+    if (job->pid < 0) {
+        close(pipeFds[0]);
+        printLine(*job, std::string("could not fork: ") + strerror(errno));
+        return false;
+    }
+    // Avoid racing the child for its own process group.
+    setpgid(job->pid, job->pid);
+    job->outputFd = pipeFds[0];
+    job->exitFd = static_cast<int>(syscall(__NR_pidfd_open, job->pid, 0));
+    return true;
+}
+
+// Writes what is left of the last line of job and stops reading its output.
+static void closeOutput(Job *job) {
+    if (!job->partialLine.empty()) {
+        printLine(*job, job->partialLine);
+        job->partialLine.clear();
+    }
+    close(job->outputFd);
+    job->outputFd = -1;
+}
+
+// Writes the complete lines read from the output of job, and closes it once
+// the PoC and every process it started closed it.
+static void readOutput(Job *job) {
+    char buffer[4096];
+    ssize_t size = read(job->outputFd, buffer, sizeof(buffer));
+    if (size < 0 && errno == EINTR) {
+        return;
+    }
+    if (size <= 0) {
+        closeOutput(job);
+        return;
+    }
+    job->partialLine.append(buffer, size);
+    size_t newline;
+    while ((newline = job->partialLine.find('\n')) != std::string::npos) {
+        printLine(*job, job->partialLine.substr(0, newline));
+        job->partialLine.erase(0, newline + 1);
+    }
+}
+
+// Reaps the PoC of job if it exited, or blocks until it does if block is set.
+static void reapJob(Job *job, bool block) {
+    pid_t pid;
+    while ((pid = waitpid(job->pid, &job->status, block ? 0 : WNOHANG)) < 0 && errno == EINTR) {
+    }
+    if (pid != job->pid) {
+        return;
+    }
+    job->exited = true;
+    job->end = Clock::now();
+    if (job->exitFd >= 0) {
+        close(job->exitFd);
+        job->exitFd = -1;
+    }
+    // Don't leave daemons of the PoC behind, they would also keep its output
+    // open. The group outlives the PoC as long as they run, so its ID isn't
+    // reused.
+    kill(-job->pid, SIGKILL);
+}
+
+// Reports the result of the PoC of job, which was reaped unless it failed to
+// start. Returns the exit code the runner should report for it.
+static int finishJob(Job *job, bool keepWorkDirs) {
+    int status = job->status;
+    int resultCode = EXIT_FAILURE;
+    std::string result = "FAILURE";
+    int code = EXIT_FAILURE;
+    if (job->pid > 0) {
+        if (job->timedOut) {
+            result = "TIMEOUT";
+            code = 0;
+        } else if (WIFSIGNALED(status)) {
+            result = "CRASH";
+            code = WTERMSIG(status);
+        } else {
+            code = WEXITSTATUS(status);
+            if (code == EXIT_SUCCESS) {
+                result = "SUCCESS";
+                resultCode = EXIT_SUCCESS;
+            } else if (code == EXIT_VULNERABLE) {
+                result = "VULNERABLE";
+                resultCode = EXIT_VULNERABLE;
+            }
+        }
+    }
+    if (job->outputFd >= 0) {
+        closeOutput(job);
+    }
+    long durationMs = job->pid > 0 ? std::chrono::duration_cast<std::chrono::milliseconds>(
+                                             job->end - job->start)
+                                             .count()
+                                   : 0;
+    std::cout << "RESULT " << job->poc->name << " " << result << " " << code << " "
+              << durationMs << std::endl;
+    if (!keepWorkDirs && !job->workDir.empty()) {
+        removeTree(job->workDir);
+    }
+    return resultCode;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned jobCount = std::max(1u, std::thread::hardware_concurrency());
+    std::string workRoot = ".";
+    bool keepWorkDirs = false;
+    int option;
+    while ((option = getopt(argc, argv, "j:w:k")) != -1) {
+        switch (option) {
+            case 'j':
+                jobCount = std::max(1, atoi(optarg));
+                break;
+            case 'w':
+                workRoot = optarg;
+                break;
+            case 'k':
+                keepWorkDirs = true;
+                break;
+            default:
+                std::cout << "usage: " << argv[0] << " [-j JOBS] [-w WORK_DIR] [-k] MANIFEST"
+                          << std::endl;
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind + 1 != argc) {
+        std::cout << "usage: " << argv[0] << " [-j JOBS] [-w WORK_DIR] [-k] MANIFEST"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::vector<Poc> pocs;
+    if (!parseManifest(argv[optind], &pocs)) {
+        return EXIT_FAILURE;
+    }
+    workRoot = absolutePath(workRoot);
+
+    bool vulnerable = false;
+    bool failed = false;
+    auto report = [&](int resultCode) {
+        vulnerable |= resultCode == EXIT_VULNERABLE;
+        failed |= resultCode == EXIT_FAILURE;
+    };
+
+    std::vector<Job> running;
+    size_t next = 0;
+    while (next < pocs.size() || !running.empty()) {
+        while (next < pocs.size() && running.size() < jobCount) {
+            Job job;
+            job.poc = &pocs[next++];
+            if (startJob(&job, workRoot)) {
+                running.push_back(job);
+            } else {
+                report(finishJob(&job, keepWorkDirs));
+            }
+        }
+
+        // Wait for output or exits until the earliest timeout of the running
+        // PoCs. The output and pidfds already closed are -1, which poll()
+        // ignores.
+        Clock::time_point now = Clock::now();
+        Clock::duration wait = std::chrono::hours(1);
+        std::vector<struct pollfd> fds;
+        for (const Job &job : running) {
+            wait = std::min(wait, job.start + job.poc->timeout - now);
+            if (!job.exited && job.exitFd < 0) {
+                wait = std::min<Clock::duration>(wait, kReapInterval);
+            }
+            fds.push_back({job.outputFd, POLLIN, 0});
+            fds.push_back({job.exitFd, POLLIN, 0});
+        }
+        int timeoutMs = static_cast<int>(std::max<long>(
+                0, std::chrono::duration_cast<std::chrono::milliseconds>(wait).count() + 1));
+        if (poll(fds.data(), fds.size(), timeoutMs) < 0 && errno != EINTR) {
+            std::cout << "poll failed: " << strerror(errno) << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        now = Clock::now();
+        std::vector<Job> stillRunning;
+        for (size_t i = 0; i < running.size(); i++) {
+            Job &job = running[i];
+            if (fds[2 * i].revents != 0) {
+                readOutput(&job);
+            }
+            if (!job.exited) {
+                reapJob(&job, false);
+            }
+            // A PoC is done once it exited and its output was closed. Past its
+            // timeout, a PoC which still runs timed out, while one which exited
+            // is reported as it exited, without waiting any longer for the
+            // processes it started to close its output.
+            if (!(job.exited && job.outputFd < 0) && now >= job.start + job.poc->timeout) {
+                if (!job.exited) {
+                    job.timedOut = true;
+                    kill(-job.pid, SIGKILL);
+                    reapJob(&job, true);
+                }
+                if (job.outputFd >= 0) {
+                    closeOutput(&job);
+                }
+            }
+            if (job.exited && job.outputFd < 0) {
+                report(finishJob(&job, keepWorkDirs));
+            } else {
+                stillRunning.push_back(job);
+            }
+        }
+        running.swap(stillRunning);
+    }
+
+    std::cout << "SUMMARY " << pocs.size() << " PoCs, "
+              << (vulnerable ? "vulnerable" : failed ? "failed" : "not vulnerable") << std::endl;
+    return vulnerable ? EXIT_VULNERABLE : failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
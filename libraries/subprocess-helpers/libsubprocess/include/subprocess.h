@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace android::test::subprocess {
+
+// Where the standard error of a subprocess goes.
+enum class ErrorOutput {
+  // Kept in SubprocessResult::error_output.
+  kCapture,
+  // Written to the same pipe as the standard output, so lines of both are
+  // seen in the order they were written.
+  kMerge,
+  // Left as the standard error of the caller.
+  kInherit,
+};
+
+struct SubprocessOptions {
+  // How long the subprocess may run, or zero for no limit. A subprocess
+  // which runs for longer is sent SIGTERM, and SIGKILL kill_grace_period
+  // later.
+  std::chrono::milliseconds timeout{0};
+  std::chrono::milliseconds kill_grace_period{5000};
+
+  // How many bytes of each output are kept in SubprocessResult, from the end.
+  // The lines passed to on_line are not limited by it.
+  size_t max_output_size = 64 * 1024;
+
+  ErrorOutput error_output = ErrorOutput::kCapture;
+
+  // Written to the standard input of the subprocess through a pipe, which is
+  // closed once all of it is written. The standard input is /dev/null if it
+  // is empty. Must stay valid until RunSubprocess returns.
+  std::string_view input;
+
+  // Runs the subprocess in a process group of its own, so the processes it
+  // starts are signalled with it on a timeout.
+  bool new_process_group = true;
+
+  // Called with each line of the standard output as it arrives, newline
+  // included. The last line is passed without a newline if it has none.
+  // Returns true if the line shows progress, which restarts the timeout.
+  std::function<bool(std::string_view line)> on_line;
+};
+
+struct SubprocessResult {
+  enum class Status {
+    kExited,
+    kSignaled,
+    kTimedOut,
+    // The subprocess could not be started, see `error`.
+    kNotStarted,
+  };
+
+  Status status = Status::kNotStarted;
+  // The exit code if kExited, the signal if kSignaled.
+  int code = 0;
+  // The ends of the standard output and error, up to max_output_size bytes.
+  std::string output;
+  std::string error_output;
+  // Whether the start of output or error_output had to be dropped.
+  bool output_truncated = false;
+  // Why the subprocess could not be started.
+  std::string error;
+
+  // The resources used by the subprocess, and its waited-for children.
+  struct rusage usage = {};
+  std::chrono::microseconds wall_time{0};
+
+  bool Succeeded() const { return status == Status::kExited && code == 0; }
+};
+
+// Runs args[0], which must be a path, with the arguments args[1...]. Blocks
+// until the subprocess exits or times out, while its input is written as it
+// is read and its outputs are drained as they are written, so it never blocks
+// on a full pipe.
+//
+// The subprocess is watched through a pidfd where the kernel supports them,
+// so waiting for it to exit takes no polling.
+SubprocessResult RunSubprocess(const std::vector<std::string>& args,
+                               const SubprocessOptions& options = {});
+
+// Counters of the subprocesses run in this process, e.g. for benchmarks.
+struct SubprocessCounters {
+  uint64_t started;
+  uint64_t timed_out;
+  // Started without a pidfd, because the kernel doesn't support them.
+  uint64_t without_pidfd;
+};
+
+SubprocessCounters GetSubprocessCounters();
+
+}  // namespace android::test::subprocess
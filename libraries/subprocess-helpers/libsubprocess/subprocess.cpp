@@ -0,0 +1,413 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "subprocess.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <optional>
+
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif
+
+extern char** environ;
+
+namespace android::test::subprocess {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// How often a subprocess started without a pidfd is checked for an exit.
+constexpr std::chrono::milliseconds kExitPollInterval(50);
+// How much of an output is read at once before the timeout and the exit are
+// checked again, so a subprocess writing faster than on_line takes its lines
+// can't keep the caller reading.
+constexpr size_t kDrainBudget = 64 * 1024;
+
+std::atomic<uint64_t> started_count{0};
+std::atomic<uint64_t> timed_out_count{0};
+std::atomic<uint64_t> without_pidfd_count{0};
+
+// Closes the file descriptor it holds when it goes out of scope.
+class Fd {
+ public:
+  Fd() = default;
+  explicit Fd(int fd) : fd_(fd) {}
+  Fd(const Fd&) = delete;
+  Fd& operator=(const Fd&) = delete;
+  ~Fd() { Reset(); }
+
+  int Get() const { return fd_; }
+  void Reset(int fd = -1) {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+    fd_ = fd;
+  }
+
+ private:
+  int fd_ = -1;
+};
+
+// Creates a pipe whose end used by the caller, the read end for outputs and
+// the write end for inputs, is non-blocking.
+bool MakePipe(Fd* read_end, Fd* write_end, bool for_input = false) {
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    return false;
+  }
+  read_end->Reset(fds[0]);
+  write_end->Reset(fds[1]);
+  return fcntl(for_input ? fds[1] : fds[0], F_SETFL, O_NONBLOCK) == 0;
+}
+
+// The end of an output, up to max_size bytes.
+class OutputTail {
+ public:
+  OutputTail(std::string* output, size_t max_size, bool* truncated)
+      : output_(output), max_size_(max_size), truncated_(truncated) {}
+
+  void Append(const char* data, size_t size) {
+    output_->append(data, size);
+    // Trimming only once the buffer is twice the limit keeps appends cheap.
+    if (output_->size() > 2 * max_size_) {
+      Trim();
+    }
+  }
+
+  void Trim() {
+    if (output_->size() > max_size_) {
+      output_->erase(0, output_->size() - max_size_);
+      *truncated_ = true;
+    }
+  }
+
+ private:
+  std::string* output_;
+  size_t max_size_;
+  bool* truncated_;
+};
+
+// Passes the complete lines of the standard output to on_line.
+class LineSplitter {
+ public:
+  explicit LineSplitter(const std::function<bool(std::string_view)>& on_line)
+      : on_line_(on_line) {}
+
+  // Returns true if a line showed progress.
+  bool Append(const char* data, size_t size) {
+    if (!on_line_) {
+      return false;
+    }
+    pending_.append(data, size);
+    bool progress = false;
+    size_t start = 0;
+    size_t newline;
+    while ((newline = pending_.find('\n', start)) != std::string::npos) {
+      progress |= on_line_(std::string_view(pending_).substr(start, newline + 1 - start));
+      start = newline + 1;
+    }
+    pending_.erase(0, start);
+    return progress;
+  }
+
+  void Finish() {
+    if (on_line_ && !pending_.empty()) {
+      on_line_(pending_);
+      pending_.clear();
+    }
+  }
+
+ private:
+  const std::function<bool(std::string_view)>& on_line_;
+  std::string pending_;
+};
+
+// Reads what is available on fd, up to kDrainBudget bytes. Returns false once
+// it is closed.
+template <typename OnData>
+bool Drain(int fd, OnData on_data) {
+  char buffer[16 * 1024];
+  size_t drained = 0;
+  while (drained < kDrainBudget) {
+    ssize_t size = read(fd, buffer, sizeof(buffer));
+    if (size > 0) {
+      on_data(buffer, static_cast<size_t>(size));
+      drained += size;
+      continue;
+    }
+    if (size < 0 && errno == EINTR) {
+      continue;
+    }
+    return size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+  }
+  return true;
+}
+
+// Writes as much of input from offset as fd takes. Returns false once all of
+// it is written, or the subprocess closed its standard input.
+bool Feed(int fd, std::string_view input, size_t* offset) {
+  // Writing to a pipe the subprocess closed raises SIGPIPE, which would kill
+  // the caller. The signal is blocked during the writes, and consumed if they
+  // raised it.
+  sigset_t pipe_signal, previous_mask, pending;
+  sigemptyset(&pipe_signal);
+  sigaddset(&pipe_signal, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipe_signal, &previous_mask);
+  sigpending(&pending);
+  bool was_pending = sigismember(&pending, SIGPIPE);
+
+  bool open = true;
+  while (*offset < input.size()) {
+    ssize_t size = write(fd, input.data() + *offset, input.size() - *offset);
+    if (size > 0) {
+      *offset += size;
+      continue;
+    }
+    if (size < 0 && errno == EINTR) {
+      continue;
+    }
+    open = size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    if (size < 0 && errno == EPIPE && !was_pending) {
+      struct timespec no_wait = {};
+      sigtimedwait(&pipe_signal, nullptr, &no_wait);
+    }
+    break;
+  }
+  pthread_sigmask(SIG_SETMASK, &previous_mask, nullptr);
+  return open && *offset < input.size();
+}
+
+bool Spawn(const std::vector<std::string>& args, const SubprocessOptions& options,
+           int input_fd, int output_fd, int error_fd, pid_t* pid, std::string* error) {
+  std::vector<char*> argv;
+  for (const std::string& arg : args) {
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if (input_fd >= 0) {
+    posix_spawn_file_actions_adddup2(&actions, input_fd, STDIN_FILENO);
+  } else {
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+  }
+  posix_spawn_file_actions_adddup2(&actions, output_fd, STDOUT_FILENO);
+  if (options.error_output == ErrorOutput::kCapture) {
+    posix_spawn_file_actions_adddup2(&actions, error_fd, STDERR_FILENO);
+  } else if (options.error_output == ErrorOutput::kMerge) {
+    posix_spawn_file_actions_adddup2(&actions, output_fd, STDERR_FILENO);
+  }
+
+  // The caller may block signals, e.g. for a signalfd, which the subprocess
+  // should not inherit.
+  posix_spawnattr_t attributes;
+  posix_spawnattr_init(&attributes);
+  short flags = POSIX_SPAWN_SETSIGMASK;
+  sigset_t mask;
+  sigemptyset(&mask);
+  posix_spawnattr_setsigmask(&attributes, &mask);
+  if (options.new_process_group) {
+    flags |= POSIX_SPAWN_SETPGROUP;
+    posix_spawnattr_setpgroup(&attributes, 0);
+  }
+  posix_spawnattr_setflags(&attributes, flags);
+
+  int result = posix_spawn(pid, argv[0], &actions, &attributes, argv.data(), environ);
+  posix_spawnattr_destroy(&attributes);
+  posix_spawn_file_actions_destroy(&actions);
+  if (result != 0) {
+    *error = "Could not run " + args[0] + ": " + strerror(result);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+SubprocessResult RunSubprocess(const std::vector<std::string>& args,
+                               const SubprocessOptions& options) {
+  SubprocessResult result;
+  if (args.empty()) {
+    result.error = "No command to run";
+    return result;
+  }
+
+  Fd input_read, input_write, output_read, output_write, error_read, error_write;
+  bool capture_errors = options.error_output == ErrorOutput::kCapture;
+  if ((!options.input.empty() && !MakePipe(&input_read, &input_write, /*for_input=*/true)) ||
+      !MakePipe(&output_read, &output_write) ||
+      (capture_errors && !MakePipe(&error_read, &error_write))) {
+    result.error = std::string("Could not create a pipe: ") + strerror(errno);
+    return result;
+  }
+
+  Clock::time_point start = Clock::now();
+  pid_t pid;
+  if (!Spawn(args, options, input_read.Get(), output_write.Get(), error_write.Get(), &pid,
+             &result.error)) {
+    return result;
+  }
+  input_read.Reset();
+  output_write.Reset();
+  error_write.Reset();
+  started_count.fetch_add(1, std::memory_order_relaxed);
+
+  // Until the subprocess is reaped its pid can't be reused, so opening the
+  // pidfd after the spawn is not racy.
+  Fd pidfd(static_cast<int>(syscall(__NR_pidfd_open, pid, 0)));
+  if (pidfd.Get() < 0) {
+    without_pidfd_count.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  OutputTail output(&result.output, options.max_output_size, &result.output_truncated);
+  OutputTail error_output(&result.error_output, options.max_output_size,
+                          &result.output_truncated);
+  LineSplitter lines(options.on_line);
+
+  pid_t signal_target = options.new_process_group ? -pid : pid;
+  std::optional<Clock::time_point> deadline;
+  if (options.timeout.count() > 0) {
+    deadline = start + options.timeout;
+  }
+  bool timed_out = false;
+  bool killed = false;
+  bool exited = false;
+  int status = 0;
+  size_t input_offset = 0;
+
+  while (!exited || output_read.Get() >= 0 || error_read.Get() >= 0) {
+    Clock::time_point now = Clock::now();
+    if (deadline.has_value() && now >= deadline.value()) {
+      if (exited) {
+        // Something the subprocess started still holds its outputs open.
+        break;
+      }
+      if (!timed_out) {
+        timed_out = true;
+        timed_out_count.fetch_add(1, std::memory_order_relaxed);
+        kill(signal_target, SIGTERM);
+        deadline = now + options.kill_grace_period;
+      } else if (!killed) {
+        killed = true;
+        kill(signal_target, SIGKILL);
+        // A process killed with SIGKILL exits, without the need for a
+        // deadline.
+        deadline.reset();
+      }
+    }
+
+    struct pollfd fds[4];
+    nfds_t count = 0;
+    auto add = [&](int fd, short events) {
+      if (fd >= 0) {
+        fds[count++] = {fd, events, 0};
+      }
+    };
+    add(input_write.Get(), POLLOUT);
+    add(output_read.Get(), POLLIN);
+    add(error_read.Get(), POLLIN);
+    if (!exited) {
+      add(pidfd.Get(), POLLIN);
+    }
+
+    int timeout = -1;
+    if (deadline.has_value()) {
+      auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline.value() - now);
+      timeout = static_cast<int>(std::max<int64_t>(0, remaining.count()));
+    }
+    if (!exited && pidfd.Get() < 0) {
+      timeout = timeout < 0 ? kExitPollInterval.count()
+                            : std::min<int>(timeout, kExitPollInterval.count());
+    }
+    if (count > 0) {
+      if (poll(fds, count, timeout) < 0 && errno != EINTR) {
+        break;
+      }
+    } else if (timeout > 0) {
+      usleep(timeout * 1000);
+    }
+
+    if (input_write.Get() >= 0 && !Feed(input_write.Get(), options.input, &input_offset)) {
+      input_write.Reset();
+    }
+    if (output_read.Get() >= 0 && !Drain(output_read.Get(), [&](const char* data, size_t size) {
+          output.Append(data, size);
+          if (lines.Append(data, size) && deadline.has_value() && !timed_out && !exited) {
+            deadline = Clock::now() + options.timeout;
+          }
+        })) {
+      output_read.Reset();
+    }
+    if (error_read.Get() >= 0 && !Drain(error_read.Get(), [&](const char* data, size_t size) {
+          error_output.Append(data, size);
+        })) {
+      error_read.Reset();
+    }
+
+    if (!exited && wait4(pid, &status, WNOHANG, &result.usage) == pid) {
+      exited = true;
+      // Bound how long the outputs are drained, if they are held open by
+      // processes which outlive the subprocess.
+      Clock::time_point drain_deadline = Clock::now() + options.kill_grace_period;
+      if (!deadline.has_value() || drain_deadline < deadline.value()) {
+        deadline = drain_deadline;
+      }
+    }
+  }
+
+  if (!exited) {
+    kill(signal_target, SIGKILL);
+    while (wait4(pid, &status, 0, &result.usage) < 0 && errno == EINTR) {
+    }
+  }
+  lines.Finish();
+  output.Trim();
+  error_output.Trim();
+  result.wall_time = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start);
+
+  if (timed_out) {
+    result.status = SubprocessResult::Status::kTimedOut;
+  } else if (WIFSIGNALED(status)) {
+    result.status = SubprocessResult::Status::kSignaled;
+    result.code = WTERMSIG(status);
+  } else {
+    result.status = SubprocessResult::Status::kExited;
+    result.code = WEXITSTATUS(status);
+  }
+  return result;
+}
+
+SubprocessCounters GetSubprocessCounters() {
+  return {started_count.load(std::memory_order_relaxed),
+          timed_out_count.load(std::memory_order_relaxed),
+          without_pidfd_count.load(std::memory_order_relaxed)};
+}
+
+}  // namespace android::test::subprocess
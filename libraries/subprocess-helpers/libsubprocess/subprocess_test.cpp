@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "subprocess.h"
+
+#include <gtest/gtest.h>
+#include <signal.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using android::test::subprocess::ErrorOutput;
+using android::test::subprocess::GetSubprocessCounters;
+using android::test::subprocess::RunSubprocess;
+using android::test::subprocess::SubprocessOptions;
+using android::test::subprocess::SubprocessResult;
+
+namespace {
+
+#if defined(__ANDROID__)
+constexpr char kShell[] = "/system/bin/sh";
+constexpr char kCat[] = "/system/bin/cat";
+#else
+constexpr char kShell[] = "/bin/sh";
+constexpr char kCat[] = "/bin/cat";
+#endif
+
+SubprocessResult RunShell(const std::string& script, const SubprocessOptions& options = {}) {
+  return RunSubprocess({kShell, "-c", script}, options);
+}
+
+}  // namespace
+
+TEST(RunSubprocessTest, captures_outputs_and_exit_code) {
+  SubprocessResult result = RunShell("echo out; echo err >&2; exit 3");
+  EXPECT_EQ(SubprocessResult::Status::kExited, result.status);
+  EXPECT_EQ(3, result.code);
+  EXPECT_FALSE(result.Succeeded());
+  EXPECT_EQ("out\n", result.output);
+  EXPECT_EQ("err\n", result.error_output);
+  EXPECT_GT(result.wall_time.count(), 0);
+}
+
+TEST(RunSubprocessTest, merges_error_output) {
+  SubprocessOptions options;
+  options.error_output = ErrorOutput::kMerge;
+  SubprocessResult result = RunShell("echo out; echo err >&2", options);
+  EXPECT_TRUE(result.Succeeded());
+  EXPECT_EQ("out\nerr\n", result.output);
+  EXPECT_EQ("", result.error_output);
+}
+
+TEST(RunSubprocessTest, reports_signals) {
+  SubprocessResult result = RunShell("kill -SEGV $$");
+  EXPECT_EQ(SubprocessResult::Status::kSignaled, result.status);
+  EXPECT_EQ(SIGSEGV, result.code);
+}
+
+TEST(RunSubprocessTest, reports_binaries_which_do_not_start) {
+  uint64_t started = GetSubprocessCounters().started;
+  SubprocessResult result = RunSubprocess({"/nonexistent/binary"});
+  // Whether posix_spawn reports exec failures depends on the libc.
+  if (result.status == SubprocessResult::Status::kNotStarted) {
+    EXPECT_NE(std::string::npos, result.error.find("/nonexistent/binary"));
+    EXPECT_EQ(started, GetSubprocessCounters().started);
+  } else {
+    EXPECT_EQ(127, result.code);
+  }
+  EXPECT_EQ(SubprocessResult::Status::kNotStarted, RunSubprocess({}).status);
+}
+
+TEST(RunSubprocessTest, keeps_the_end_of_long_outputs) {
+  SubprocessOptions options;
+  options.max_output_size = 10;
+  SubprocessResult result = RunShell("i=0; while [ $i -lt 1000 ]; do echo $i; i=$((i+1)); done",
+                                     options);
+  EXPECT_TRUE(result.Succeeded());
+  EXPECT_TRUE(result.output_truncated);
+  EXPECT_EQ("7\n998\n999\n", result.output);
+}
+
+TEST(RunSubprocessTest, passes_lines_as_they_arrive) {
+  std::vector<std::string> lines;
+  SubprocessOptions options;
+  options.on_line = [&](std::string_view line) {
+    lines.emplace_back(line);
+    return false;
+  };
+  SubprocessResult result = RunShell("echo a; echo b; printf c", options);
+  EXPECT_TRUE(result.Succeeded());
+  EXPECT_EQ((std::vector<std::string>{"a\n", "b\n", "c"}), lines);
+}
+
+TEST(RunSubprocessTest, stops_subprocesses_which_time_out) {
+  uint64_t timed_out = GetSubprocessCounters().timed_out;
+  SubprocessOptions options;
+  options.timeout = std::chrono::milliseconds(200);
+  SubprocessResult result = RunShell("echo started; sleep 30", options);
+  EXPECT_EQ(SubprocessResult::Status::kTimedOut, result.status);
+  EXPECT_EQ("started\n", result.output);
+  EXPECT_LT(result.wall_time, std::chrono::seconds(5));
+  EXPECT_EQ(timed_out + 1, GetSubprocessCounters().timed_out);
+}
+
+TEST(RunSubprocessTest, kills_subprocesses_which_ignore_termination) {
+  SubprocessOptions options;
+  options.timeout = std::chrono::milliseconds(100);
+  options.kill_grace_period = std::chrono::milliseconds(100);
+  SubprocessResult result = RunShell("trap '' TERM; echo ready; while :; do :; done", options);
+  EXPECT_EQ(SubprocessResult::Status::kTimedOut, result.status);
+  EXPECT_LT(result.wall_time, std::chrono::seconds(5));
+  // The busy loop used CPU time, which was measured.
+  EXPECT_GT(result.usage.ru_utime.tv_sec * 1000000 + result.usage.ru_utime.tv_usec, 0);
+}
+
+TEST(RunSubprocessTest, restarts_the_timeout_on_progress) {
+  SubprocessOptions options;
+  options.timeout = std::chrono::milliseconds(300);
+  options.on_line = [](std::string_view line) { return line == "progress\n"; };
+  SubprocessResult result =
+      RunShell("for i in 1 2 3 4; do sleep 0.2; echo progress; done", options);
+  EXPECT_TRUE(result.Succeeded());
+}
+
+TEST(RunSubprocessTest, stops_chatty_subprocesses_with_slow_on_line) {
+  SubprocessOptions options;
+  options.timeout = std::chrono::milliseconds(500);
+  options.kill_grace_period = std::chrono::milliseconds(100);
+  options.on_line = [](std::string_view) {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+    return false;
+  };
+  // Lines of 1KB, so the callback falls behind without the pipe holding many
+  // of them.
+  SubprocessResult result =
+      RunShell("line=$(printf %01000d 0); while :; do echo $line; done", options);
+  EXPECT_EQ(SubprocessResult::Status::kTimedOut, result.status);
+  EXPECT_LT(result.wall_time, std::chrono::seconds(5));
+}
+
+TEST(RunSubprocessTest, does_not_wait_for_children_holding_outputs) {
+  SubprocessOptions options;
+  options.kill_grace_period = std::chrono::milliseconds(200);
+  options.new_process_group = false;
+  SubprocessResult result = RunShell("sleep 30 & echo done", options);
+  EXPECT_TRUE(result.Succeeded());
+  EXPECT_EQ("done\n", result.output);
+  EXPECT_LT(result.wall_time, std::chrono::seconds(5));
+}
+
+TEST(RunSubprocessTest, writes_input) {
+  // More than a pipe holds, so the input is written while the output is read.
+  std::string input(1024 * 1024, 'x');
+  SubprocessOptions options;
+  options.input = input;
+  options.max_output_size = input.size();
+  SubprocessResult result = RunSubprocess({kCat}, options);
+  EXPECT_TRUE(result.Succeeded());
+  EXPECT_EQ(input, result.output);
+}
+
+TEST(RunSubprocessTest, survives_subprocesses_which_close_their_input) {
+  std::string input(1024 * 1024, 'x');
+  SubprocessOptions options;
+  options.input = input;
+  SubprocessResult result = RunShell("exec 0<&-; echo closed", options);
+  EXPECT_TRUE(result.Succeeded());
+  EXPECT_EQ("closed\n", result.output);
+}
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "coverage_incremental_flush.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The parts of the clang profile runtime used here. They are weak so that
+// builds without coverage still link, and only have no counters to flush.
+extern "C" {
+char* __llvm_profile_begin_counters(void) __attribute__((weak));
+char* __llvm_profile_end_counters(void) __attribute__((weak));
+const char* __llvm_profile_begin_names(void) __attribute__((weak));
+const char* __llvm_profile_end_names(void) __attribute__((weak));
+void __llvm_profile_set_filename(const char* name) __attribute__((weak));
+int __llvm_profile_write_file(void) __attribute__((weak));
+}
+
+namespace android::coverage {
+namespace {
+
+constexpr char kMirrorMagic[8] = {'C', 'O', 'V', 'M', 'I', 'R', 'R', '0'};
+constexpr uint32_t kMirrorVersion = 1;
+// Counters are compared and copied a cache line at a time.
+constexpr size_t kLineSize = 64;
+// How many times WriteProfileFromMirror tries to copy the counters of a
+// mirror between two flushes.
+constexpr int kMaxCopyAttempts = 100;
+
+// The start of a mirror file, followed by the counters at the next cache line.
+struct MirrorHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  // The size of the counter section, in bytes.
+  uint64_t counters_size;
+  // The hash of the function names of the binary, which identifies the layout
+  // of its counters.
+  uint64_t names_hash;
+  // Odd while a flush is copying counters.
+  uint64_t generation;
+  uint64_t flushes;
+};
+static_assert(sizeof(MirrorHeader) <= kLineSize);
+
+struct Counters {
+  char* begin;
+  size_t size;
+};
+
+bool GetCounters(Counters* counters) {
+  if (!__llvm_profile_begin_counters || !__llvm_profile_end_counters) {
+    return false;
+  }
+  counters->begin = __llvm_profile_begin_counters();
+  counters->size = __llvm_profile_end_counters() - counters->begin;
+  return counters->size > 0;
+}
+
+uint64_t HashNames() {
+  uint64_t hash = 14695981039346656037ull;
+  if (__llvm_profile_begin_names && __llvm_profile_end_names) {
+    for (const char* c = __llvm_profile_begin_names(); c < __llvm_profile_end_names(); c++) {
+      hash = (hash ^ static_cast<uint8_t>(*c)) * 1099511628211ull;
+    }
+  }
+  return hash;
+}
+
+bool MatchesBinary(const MirrorHeader& header, const Counters& counters, uint64_t names_hash) {
+  return memcmp(header.magic, kMirrorMagic, sizeof(kMirrorMagic)) == 0 &&
+         header.version == kMirrorVersion && header.counters_size == counters.size &&
+         header.names_hash == names_hash;
+}
+
+// The state of the flushes, guarded by lock.
+std::mutex lock;
+Counters counters;
+MirrorHeader* mirror = nullptr;
+size_t mirror_size = 0;
+int wake_fd = -1;
+int flush_signal = 0;
+struct sigaction previous_action;
+std::atomic<bool> stopping{false};
+std::thread flush_thread;
+
+char* MirrorCounters() {
+  return reinterpret_cast<char*>(mirror) + kLineSize;
+}
+
+size_t FlushLocked() {
+  if (!mirror) {
+    return 0;
+  }
+  __atomic_fetch_add(&mirror->generation, 1, __ATOMIC_RELEASE);
+  // Keeps the copies below from becoming visible before the odd generation.
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  char* copy = MirrorCounters();
+  size_t copied = 0;
+  for (size_t offset = 0; offset < counters.size; offset += kLineSize) {
+    size_t length = std::min(kLineSize, counters.size - offset);
+    if (memcmp(copy + offset, counters.begin + offset, length) != 0) {
+      memcpy(copy + offset, counters.begin + offset, length);
+      copied++;
+    }
+  }
+  __atomic_fetch_add(&mirror->generation, 1, __ATOMIC_RELEASE);
+  mirror->flushes++;
+  return copied;
+}
+
+void WakeFlushThread() {
+  uint64_t one = 1;
+  // Only async-signal-safe calls, since it also runs in the signal handler.
+  (void)!write(wake_fd, &one, sizeof(one));
+}
+
+void HandleFlushSignal(int) {
+  int saved_errno = errno;
+  WakeFlushThread();
+  errno = saved_errno;
+}
+
+void RunFlushThread(std::chrono::milliseconds interval) {
+  int timeout = interval.count() > 0 ? static_cast<int>(interval.count()) : -1;
+  while (!stopping.load()) {
+    struct pollfd fd = {.fd = wake_fd, .events = POLLIN};
+    if (poll(&fd, 1, timeout) > 0) {
+      uint64_t count;
+      (void)!read(wake_fd, &count, sizeof(count));
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    FlushLocked();
+  }
+}
+
+// Creates the mirror of |counters| at |path|. A mirror left there by an
+// earlier run is moved to <path>.previous, so its counts are not lost.
+MirrorHeader* MapMirror(const std::string& path, size_t* size) {
+  rename(path.c_str(), (path + ".previous").c_str());
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return nullptr;
+  }
+  *size = kLineSize + counters.size;
+  if (ftruncate(fd, *size) != 0) {
+    close(fd);
+    return nullptr;
+  }
+  void* address = mmap(nullptr, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (address == MAP_FAILED) {
+    return nullptr;
+  }
+  MirrorHeader* header = static_cast<MirrorHeader*>(address);
+  memcpy(header->magic, kMirrorMagic, sizeof(kMirrorMagic));
+  header->version = kMirrorVersion;
+  header->counters_size = counters.size;
+  header->names_hash = HashNames();
+  return header;
+}
+
+}  // namespace
+
+bool StartIncrementalFlush(const IncrementalFlushOptions& options) {
+  std::lock_guard<std::mutex> guard(lock);
+  if (mirror || !GetCounters(&counters)) {
+    return false;
+  }
+  MirrorHeader* header = MapMirror(options.path, &mirror_size);
+  if (!header) {
+    return false;
+  }
+  wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wake_fd < 0) {
+    munmap(header, mirror_size);
+    return false;
+  }
+  mirror = header;
+  FlushLocked();
+
+  flush_signal = options.signal;
+  if (flush_signal != 0) {
+    struct sigaction action = {};
+    action.sa_handler = HandleFlushSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(flush_signal, &action, &previous_action);
+  }
+  stopping = false;
+  flush_thread = std::thread(RunFlushThread, options.interval);
+  return true;
+}
+
+size_t FlushCoverageDeltas() {
+  std::lock_guard<std::mutex> guard(lock);
+  return FlushLocked();
+}
+
+uint64_t IncrementalFlushCount() {
+  std::lock_guard<std::mutex> guard(lock);
+  return mirror ? mirror->flushes : 0;
+}
+
+void StopIncrementalFlush() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!mirror) {
+      return;
+    }
+    if (flush_signal != 0) {
+      sigaction(flush_signal, &previous_action, nullptr);
+      flush_signal = 0;
+    }
+  }
+  stopping = true;
+  WakeFlushThread();
+  flush_thread.join();
+
+  std::lock_guard<std::mutex> guard(lock);
+  FlushLocked();
+  munmap(mirror, mirror_size);
+  mirror = nullptr;
+  close(wake_fd);
+  wake_fd = -1;
+}
+
+bool WriteProfileFromMirror(const std::string& mirror_path, const std::string& profile_path) {
+  Counters live;
+  if (!GetCounters(&live) || !__llvm_profile_set_filename || !__llvm_profile_write_file) {
+    return false;
+  }
+  int fd = open(mirror_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  size_t size = kLineSize + live.size;
+  struct stat st;
+  void* address = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == size) {
+    address = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (address == MAP_FAILED) {
+    return false;
+  }
+  const MirrorHeader* header = static_cast<const MirrorHeader*>(address);
+  bool written = false;
+  if (MatchesBinary(*header, live, HashNames())) {
+    // Copy the counters between flushes of a process still writing them. A
+    // flush which never completes, because its process died, leaves at most
+    // one torn cache line.
+    std::vector<char> saved(live.begin, live.begin + live.size);
+    const char* copy = static_cast<const char*>(address) + kLineSize;
+    for (int attempt = 0; attempt < kMaxCopyAttempts; attempt++) {
+      uint64_t generation = __atomic_load_n(&header->generation, __ATOMIC_ACQUIRE);
+      memcpy(live.begin, copy, live.size);
+      // Keeps the copy from being read after the generation is checked again.
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if ((generation & 1) == 0 &&
+          generation == __atomic_load_n(&header->generation, __ATOMIC_ACQUIRE)) {
+        break;
+      }
+      usleep(1000);
+    }
+    __llvm_profile_set_filename(profile_path.c_str());
+    written = __llvm_profile_write_file() == 0;
+    memcpy(live.begin, saved.data(), live.size);
+  }
+  munmap(address, size);
+  return written;
+}
+
+}  // namespace android::coverage
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <string>
+
+namespace android::coverage {
+
+// Where and when StartIncrementalFlush copies the coverage counters.
+struct IncrementalFlushOptions {
+  // The mirror file the counters are copied to. A mirror left there by an
+  // earlier run is moved to <path>.previous, for WriteProfileFromMirror.
+  std::string path;
+  // How often to flush, or zero to only flush on |signal|.
+  std::chrono::milliseconds interval{0};
+  // A signal which triggers a flush, e.g. SIGRTMIN + 6, or zero for none.
+  int signal = 0;
+};
+
+// Keeps a mirror of the clang coverage counters of the process in a memory
+// mapped file. A flush only copies the cache lines of counters which changed
+// since the previous one, and makes no system calls: the kernel writes the
+// dirty pages back, so steady-state flushes of a long-running service cost a
+// scan of its counters. The regular profile is still written at exit.
+//
+// Returns false if the process is not built with coverage, the mirror can't
+// be set up, or flushing already started.
+bool StartIncrementalFlush(const IncrementalFlushOptions& options);
+
+// Flushes the counters which changed to the mirror now. Returns the number of
+// cache lines copied.
+size_t FlushCoverageDeltas();
+
+// Returns how many flushes the mirror got since StartIncrementalFlush, or zero
+// if flushing is stopped.
+uint64_t IncrementalFlushCount();
+
+// Flushes once more and stops flushing. The mirror stays on disk.
+void StopIncrementalFlush();
+
+// Writes the mirror at |mirror_path|, left by a run of the same binary, as a
+// regular .profraw at |profile_path|. The counters of the process are
+// replaced while the profile is written, so call it before other threads run
+// instrumented code. This also sets the profile file name of the process.
+bool WriteProfileFromMirror(const std::string& mirror_path, const std::string& profile_path);
+
+}  // namespace android::coverage
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "coverage_incremental_flush.h"
+
+using android::coverage::FlushCoverageDeltas;
+using android::coverage::IncrementalFlushCount;
+using android::coverage::IncrementalFlushOptions;
+using android::coverage::StartIncrementalFlush;
+using android::coverage::StopIncrementalFlush;
+using android::coverage::WriteProfileFromMirror;
+
+__attribute__((noinline)) int covered_later(int value) {
+  return value + 1;
+}
+
+TEST(coverage_incremental_flush, flush_deltas) {
+  std::string mirror_path = testing::TempDir() + "coverage_incremental_flush.mirror";
+  unlink(mirror_path.c_str());
+  if (!StartIncrementalFlush({.path = mirror_path})) {
+    GTEST_SKIP() << "Not built with coverage.";
+  }
+
+  struct stat st;
+  ASSERT_EQ(stat(mirror_path.c_str(), &st), 0);
+  EXPECT_GT(st.st_size, 0);
+
+  FlushCoverageDeltas();
+  EXPECT_EQ(covered_later(1), 2);
+  EXPECT_GT(FlushCoverageDeltas(), 0u);
+  StopIncrementalFlush();
+
+  std::string profile_path = testing::TempDir() + "coverage_incremental_flush.profraw";
+  unlink(profile_path.c_str());
+  ASSERT_TRUE(WriteProfileFromMirror(mirror_path, profile_path));
+  ASSERT_EQ(stat(profile_path.c_str(), &st), 0);
+  EXPECT_GT(st.st_size, 0);
+}
+
+TEST(coverage_incremental_flush, flush_on_signal) {
+  std::string mirror_path = testing::TempDir() + "coverage_incremental_flush_signal.mirror";
+  if (!StartIncrementalFlush({.path = mirror_path, .signal = SIGRTMIN + 6})) {
+    GTEST_SKIP() << "Not built with coverage.";
+  }
+  uint64_t flushes = IncrementalFlushCount();
+  ASSERT_EQ(raise(SIGRTMIN + 6), 0);
+  // The flush thread flushes once it wakes up.
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (IncrementalFlushCount() == flushes && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_GT(IncrementalFlushCount(), flushes);
+  StopIncrementalFlush();
+}
+
+TEST(coverage_incremental_flush, write_profile_from_missing_mirror) {
+  ASSERT_FALSE(WriteProfileFromMirror("/nonexistent/mirror", testing::TempDir() + "missing.profraw"));
+}
@@ -19,19 +19,34 @@
 #include <gtest/gtest.h>
 
 #include "android-base/logging.h"
+#include <array>
 #include <cstdlib>
+#include <span>
 #include <string>
+#include <string_view>
 
 namespace igt {
 
 // Holds the IGT subtests details as outlined in go/igt-al
 struct IgtSubtestParams {
-  std::string name;
+  std::string_view name;
   std::string_view desc;
   // Describe the reason we care about running this test.
   std::string_view rationale;
 };
 
+// A GTest name built at compile time, e.g. "CrtcId" for "crtc-id".
+struct GTestName {
+  static constexpr size_t kMaxLength = 128;
+
+  std::array<char, kMaxLength> chars{};
+  size_t length = 0;
+  // Whether the name had to be cut to kMaxLength.
+  bool truncated = false;
+
+  constexpr std::string_view view() const { return {chars.data(), length}; }
+};
+
 class IgtTestHelper {
 public:
   // A helper function used by `INSTANTIATE_TEST_SUITE_P` from `GTest` to return
@@ -39,17 +54,98 @@ public:
   static std::string
   generateGTestName(const ::testing::TestParamInfo<IgtSubtestParams> &info);
 
+  // Turns a dashed subtest name into a PascalCase GTest name in a single pass.
+  // The %s and %d of subtest name patterns are dropped, since they are not
+  // valid in GTest names.
+  static constexpr GTestName mangleGTestName(std::string_view name) {
+    GTestName mangled;
+    bool startOfWord = true;
+    for (size_t i = 0; i < name.size(); i++) {
+      if (name[i] == '%' && i + 1 < name.size() &&
+          (name[i + 1] == 's' || name[i + 1] == 'd')) {
+        i++;
+        continue;
+      }
+      if (name[i] == '-') {
+        startOfWord = true;
+        continue;
+      }
+      if (mangled.length == GTestName::kMaxLength) {
+        mangled.truncated = true;
+        break;
+      }
+      char c = name[i];
+      if (startOfWord && c >= 'a' && c <= 'z') {
+        c = static_cast<char>(c - 'a' + 'A');
+      }
+      startOfWord = false;
+      mangled.chars[mangled.length++] = c;
+    }
+    return mangled;
+  }
+
+  // Whether the GTest names of |subtests| are complete and unique, for suites
+  // to check with a static_assert.
+  static constexpr bool
+  hasValidGTestNames(std::span<const IgtSubtestParams> subtests) {
+    for (size_t i = 0; i < subtests.size(); i++) {
+      GTestName name = mangleGTestName(subtests[i].name);
+      if (name.length == 0 || name.truncated) {
+        return false;
+      }
+      for (size_t j = 0; j < i; j++) {
+        if (mangleGTestName(subtests[j].name).view() == name.view()) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
 protected:
   IgtTestHelper(const std::string test_name)
-      : test_name_("/data/igt_tests/x86_64/" + test_name + "64") {
+      : test_name_(resolveBinaryPath(test_name)) {
     DCHECK(test_name.length());
   }
 
+  // Each of these also reports the numbers with a unit the binary prints, e.g.
+  // vblank wait times or bandwidths, as properties of the test and in
+  // $IGT_METRICS_DIR/<binary>/<subtest>.json, /data/igt_tests/metrics by
+  // default, so regressions show up as trends and not only as failures.
   void runSubTest(const IgtSubtestParams &subtest);
+  // Runs the binary once for all of |subtests| the first time it is called and
+  // reports the result of |subtest| from that run, so suites with many
+  // subtests only start the binary and set up the device once. The binary is
+  // only started again after a subtest crashes or hangs, to resume with the
+  // subtests after it. A filtered run batches the subtests it selected.
+  //
+  // Both record the subtests that pass in /data/igt_tests/results, per kernel,
+  // vendor build and binary. If debug.igt.result_cache_hours is set, subtests
+  // that passed in the same configuration within that many hours are reported
+  // as passed without running, so retries only run what failed or changed.
+  void runSubTest(const IgtSubtestParams &subtest,
+                  std::span<const IgtSubtestParams> subtests);
   void runTest(const std::string &desc, const std::string &rationale);
 
+  // Makes runSubTest run the binary with --debug and record the CRCs and flip
+  // completions it logs per frame. They are written as a binary trace to
+  // <subtest>.frames next to the metrics, and summarized in the metrics as the
+  // frame count, missed frames and the mean, jitter and maximum of the frame
+  // interval, to benchmark frame pacing.
+  void traceFrames() { trace_frames_ = true; }
+
 private:
+  // Returns the path of the IGT binary for the running ABI, e.g.
+  // /data/igt_tests/arm64/kms_vblank64. The binary is looked up in
+  // $IGT_BINARY_DIR, next to the test binary, then in the directory of the ABI
+  // under /data/igt_tests. Lookups are cached per binary.
+  static std::string resolveBinaryPath(const std::string &test_name);
+
+  // The file name of the binary, e.g. kms_vblank64.
+  std::string binaryName() const;
+
   const std::string test_name_ = "";
+  bool trace_frames_ = false;
 };
 
 } // namespace igt
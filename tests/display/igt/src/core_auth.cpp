@@ -29,7 +29,7 @@ public:
   CoreAuthTests() : IgtTestHelper("core_auth") {}
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     {.name = "getclient-simple",
      .desc = "Check drm client is always authenticated",
      .rationale = "ensuring that auth works correctly is probably P0 from a "
@@ -45,7 +45,9 @@ IgtSubtestParams subtests[] = {
                   "security perspective"},
 };
 
-TEST_P(CoreAuthTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(CoreAuthTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(CoreAuthTests, CoreAuthTests,
                          ::testing::ValuesIn(subtests),
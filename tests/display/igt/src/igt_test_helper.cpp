@@ -17,63 +17,786 @@
 #include "include/igt_test_helper.h"
 
 #include <android-base/logging.h>
+#include <android-base/properties.h>
+#include <fnmatch.h>
 #include <gtest/gtest.h>
+#include <subprocess.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
 
+#include <algorithm>
 #include <array>
+#include <cctype>
+#include <charconv>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <set>
 #include <sstream>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 namespace igt {
 namespace {
-enum class TestResult { kPass, kFail, kSkip, kUnknown };
-
-std::optional<std::string> runCommand(const std::string &cmd) {
-  // Gtest runs from root /, so the command should start from there.
-  std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(cmd.c_str(), "r"),
-                                                pclose);
-  if (!pipe) {
-    ADD_FAILURE() << "popen() failed! Could not find or run the binary.";
+namespace subprocess = android::test::subprocess;
+
+enum class TestResult { kPass, kFail, kSkip, kTimeout, kUnknown };
+
+// How much of a log is kept for failure messages. Verbose runs write megabytes,
+// of which only the end is useful to explain a failure.
+constexpr size_t kMaxLogTailSize = 64 * 1024;
+
+// The last lines of a log, up to kMaxLogTailSize bytes.
+class LogTail {
+public:
+  void append(std::string_view line) {
+    lines_.emplace_back(line);
+    size_ += line.size();
+    while (size_ > kMaxLogTailSize && lines_.size() > 1) {
+      size_ -= lines_.front().size();
+      lines_.pop_front();
+    }
+  }
+
+  void clear() {
+    lines_.clear();
+    size_ = 0;
+  }
+
+  std::string str() const {
+    std::string log;
+    log.reserve(size_);
+    for (const std::string &line : lines_) {
+      log += line;
+    }
+    return log;
+  }
+
+private:
+  std::deque<std::string> lines_;
+  size_t size_ = 0;
+};
+
+// Where the wall-clock time of a GTest suite went, for the timing report
+// written once every suite of the process ran.
+struct SuiteTiming {
+  // The file name of the IGT binary of the suite.
+  std::string binary;
+  // Time spent listing the subtests of the binary, and running it.
+  std::chrono::nanoseconds listing{};
+  std::chrono::nanoseconds running{};
+  // How often the binary was started to run subtests: more than once after a
+  // crash or hang, and once per device on machines with several.
+  int starts = 0;
+  // Subtests reported, and how many of them were cached passes.
+  int subtests = 0;
+  int cached = 0;
+
+  std::chrono::nanoseconds total() const { return listing + running; }
+};
+
+// The timings of the suites run so far, by suite name. Updated from the
+// threads of the per-device runs too, so guarded by timingsMutex.
+std::mutex timingsMutex;
+std::map<std::string, SuiteTiming> timings;
+
+// Calls |update| with the timing of the running suite, if any.
+void updateTiming(const std::function<void(SuiteTiming &)> &update) {
+  const ::testing::TestSuite *suite =
+      ::testing::UnitTest::GetInstance()->current_test_suite();
+  if (suite == nullptr) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(timingsMutex);
+  update(timings[suite->name()]);
+}
+
+// Adds the time until it goes out of scope to |field| of the running suite.
+class SuiteTimer {
+public:
+  SuiteTimer(std::string binary, std::chrono::nanoseconds SuiteTiming::*field)
+      : binary_(std::move(binary)), field_(field),
+        start_(std::chrono::steady_clock::now()) {}
+
+  ~SuiteTimer() {
+    auto elapsed = std::chrono::steady_clock::now() - start_;
+    updateTiming([&](SuiteTiming &timing) {
+      timing.binary = std::filesystem::path(binary_).filename();
+      timing.*field_ += elapsed;
+    });
+  }
+
+private:
+  const std::string binary_;
+  std::chrono::nanoseconds SuiteTiming::*const field_;
+  const std::chrono::steady_clock::time_point start_;
+};
+
+// How long a subtest, or a binary without subtests, may run before it is
+// considered hung, e.g. on a vblank wait or a GPU hang.
+constexpr std::chrono::minutes kSubtestTimeout(5);
+// How long a hung binary is given to exit after SIGTERM before it is killed.
+constexpr std::chrono::seconds kKillGracePeriod(5);
+
+constexpr std::string_view kStartingSubtest = "Starting subtest: ";
+constexpr std::string_view kStartingDynamicSubtest =
+    "Starting dynamic subtest: ";
+
+enum class RunStatus { kExited, kTimedOut, kNotStarted };
+
+// Why binaries could not be started, by path, for the subtests of a suite
+// whose batched run failed to start after its first subtest reported it.
+// Written from the threads of the per-device runs too.
+std::mutex launchErrorsMutex;
+std::map<std::string, std::string> launchErrors;
+
+std::string launchError(const std::string &binary) {
+  std::lock_guard<std::mutex> lock(launchErrorsMutex);
+  auto found = launchErrors.find(binary);
+  return found != launchErrors.end() ? found->second : "unknown error";
+}
+
+// Runs |args| and calls |onLine| with each line of its standard output as it
+// arrives, newline included. A binary which goes kSubtestTimeout without
+// finishing a subtest is killed along with its children. The resources the
+// binary used are stored in |usage| if it is not null.
+RunStatus streamCommand(const std::vector<std::string> &args,
+                        const std::function<void(std::string_view)> &onLine,
+                        struct rusage *usage = nullptr) {
+  subprocess::SubprocessOptions options;
+  options.timeout = kSubtestTimeout;
+  options.kill_grace_period = kKillGracePeriod;
+  options.error_output = subprocess::ErrorOutput::kInherit;
+  // The lines are kept by the callers, as much of them as they need.
+  options.max_output_size = 0;
+  options.on_line = [&](std::string_view line) {
+    onLine(line);
+    // The deadline is per subtest, and per dynamic subtest of a subtest.
+    return line.starts_with(kStartingSubtest) ||
+           line.starts_with(kStartingDynamicSubtest);
+  };
+  subprocess::SubprocessResult result =
+      subprocess::RunSubprocess(args, options);
+  if (usage != nullptr) {
+    *usage = result.usage;
+  }
+  switch (result.status) {
+  case subprocess::SubprocessResult::Status::kNotStarted: {
+    std::lock_guard<std::mutex> lock(launchErrorsMutex);
+    launchErrors[args[0]] = result.error;
+    ADD_FAILURE() << "Could not find or run the binary " << args[0] << ": "
+                  << result.error;
+    return RunStatus::kNotStarted;
+  }
+  case subprocess::SubprocessResult::Status::kTimedOut:
+    return RunStatus::kTimedOut;
+  default:
+    return RunStatus::kExited;
+  }
+}
+
+// A measurement IGT printed, e.g. the "16666.667us" of
+// "Time to wait for 60/60 vblanks: 16666.667us".
+struct Metric {
+  std::string name;
+  double value;
+  std::string unit;
+};
+
+// Where metric sidecars are written unless IGT_METRICS_DIR is set.
+constexpr char kDefaultMetricsDirectory[] = "/data/igt_tests/metrics";
+
+// The units a number must have to be taken as a metric, so plain counts and
+// identifiers in the log are left out.
+constexpr std::array<std::pair<std::string_view, std::string_view>, 12> kUnits =
+    {{{"µs", "us"},
+      {"us", "us"},
+      {"ns", "ns"},
+      {"ms", "ms"},
+      {"s", "s"},
+      {"Hz", "hz"},
+      {"fps", "fps"},
+      {"KB/s", "kb_per_s"},
+      {"MB/s", "mb_per_s"},
+      {"GB/s", "gb_per_s"},
+      {"Mbps", "mbps"},
+      {"%", "percent"}}};
+
+// Parses a "<label>: <number><unit>" line into a metric named after the label
+// and unit, e.g. time_to_wait_for_60_60_vblanks_us.
+std::optional<Metric> parseMetricLine(std::string_view line) {
+  size_t colon = line.rfind(": ");
+  if (colon == std::string_view::npos || colon == 0) {
+    return std::nullopt;
+  }
+  std::string_view label = line.substr(0, colon);
+  std::string_view rest = line.substr(colon + 2);
+  while (!rest.empty() && isspace(rest.front())) {
+    rest.remove_prefix(1);
+  }
+  while (!rest.empty() && isspace(rest.back())) {
+    rest.remove_suffix(1);
+  }
+
+  std::string number(rest);
+  char *end;
+  double value = strtod(number.c_str(), &end);
+  if (end == number.c_str()) {
+    return std::nullopt;
+  }
+  std::string_view unit = rest.substr(end - number.c_str());
+  while (!unit.empty() && isspace(unit.front())) {
+    unit.remove_prefix(1);
+  }
+  auto known = std::find_if(kUnits.begin(), kUnits.end(),
+                            [&](const auto &u) { return u.first == unit; });
+  if (known == kUnits.end()) {
     return std::nullopt;
   }
 
-  std::array<char, 128> buffer;
-  std::string result;
-  while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) {
-    result += buffer.data();
+  // Strip the "(binary:pid) LEVEL: " prefix of IGT log lines.
+  size_t previous = label.rfind(": ");
+  if (previous != std::string_view::npos) {
+    label.remove_prefix(previous + 2);
   }
-  return result;
+  std::string name;
+  for (char c : label) {
+    if (isalnum(static_cast<unsigned char>(c))) {
+      name += static_cast<char>(tolower(c));
+    } else if (!name.empty() && name.back() != '_') {
+      name += '_';
+    }
+  }
+  if (name.empty()) {
+    return std::nullopt;
+  }
+  if (name.back() != '_') {
+    name += '_';
+  }
+  name += known->second;
+  return Metric{std::move(name), value, std::string(known->second)};
 }
 
-TestResult getSubtestTestResultFromLog(const std::string &log,
-                                       const std::string &subTestName) {
-  if (log.find("Subtest " + subTestName + ": FAIL") != std::string::npos) {
-    return TestResult::kFail;
-  } else if (log.find("Subtest " + subTestName + ": SKIP") !=
-             std::string::npos) {
-    return TestResult::kSkip;
-  } else if (log.find("Subtest " + subTestName + ": SUCCESS") !=
-             std::string::npos) {
+// Returns the directory the sidecars of |binary| are written to, creating it.
+std::filesystem::path metricsDirectory(const std::string &binary) {
+  const char *directory = getenv("IGT_METRICS_DIR");
+  std::filesystem::path path =
+      std::filesystem::path(directory != nullptr ? directory
+                                                 : kDefaultMetricsDirectory) /
+      binary;
+  std::error_code error;
+  std::filesystem::create_directories(path, error);
+  return path;
+}
+
+// Reports the metrics of a subtest as properties of the current test, and
+// writes them to <directory>/<binary>/<subtest>.json for tradefed to collect.
+// Metrics reported more than once get a numbered suffix.
+void reportMetrics(const std::string &binary, const std::string &subtest,
+                   const std::vector<Metric> &metrics) {
+  if (metrics.empty()) {
+    return;
+  }
+  std::map<std::string, int> seen;
+  std::stringstream json;
+  json.precision(10);
+  json << "{\"binary\":\"" << binary << "\",\"subtest\":\"" << subtest
+       << "\",\"metrics\":{";
+  const char *separator = "";
+  for (const Metric &metric : metrics) {
+    int count = ++seen[metric.name];
+    std::string name =
+        count == 1 ? metric.name : metric.name + "_" + std::to_string(count);
+    ::testing::Test::RecordProperty(name, std::to_string(metric.value));
+    json << separator << "\"" << name << "\":" << metric.value;
+    separator = ",";
+  }
+  json << "}}" << std::endl;
+
+  std::ofstream file(metricsDirectory(binary) / (subtest + ".json"));
+  file << json.str();
+}
+
+// The CPU time and peak memory of a binary, to tell a slow binary from one
+// waiting on the display.
+std::vector<Metric> usageMetrics(const struct rusage &usage) {
+  auto ms = [](const struct timeval &time) {
+    return time.tv_sec * 1000.0 + time.tv_usec / 1000.0;
+  };
+  return {{"cpu_user_time_ms", ms(usage.ru_utime), "ms"},
+          {"cpu_system_time_ms", ms(usage.ru_stime), "ms"},
+          {"max_rss_kb", static_cast<double>(usage.ru_maxrss), "kb"}};
+}
+
+// Returns the result that wins when a log reports both |a| and |b|.
+TestResult combineResults(TestResult a, TestResult b) {
+  for (TestResult result : {TestResult::kTimeout, TestResult::kFail,
+                            TestResult::kSkip, TestResult::kPass}) {
+    if (a == result || b == result) {
+      return result;
+    }
+  }
+  return TestResult::kUnknown;
+}
+
+// Returns the result of a subtest which got |a| on some devices and |b| on
+// others. Unlike in a single log, a pass beats a skip: a subtest often needs
+// hardware only some devices have, and it was still tested on the others.
+TestResult combineDeviceResults(TestResult a, TestResult b) {
+  if ((a == TestResult::kPass && b == TestResult::kSkip) ||
+      (a == TestResult::kSkip && b == TestResult::kPass)) {
     return TestResult::kPass;
-  } else {
-    return TestResult::kUnknown;
   }
+  return combineResults(a, b);
 }
 
-TestResult getTestResultFromLog(std::string &log) {
-  std::for_each(log.begin(), log.end(), [](char &c) { c = ::tolower(c); });
+// Parses a "Subtest <name>: <result>" line into the name and result.
+std::optional<std::pair<std::string_view, TestResult>>
+parseSubtestResultLine(std::string_view line) {
+  constexpr std::string_view kSubtest = "Subtest ";
+  size_t colon = line.find(": ");
+  if (!line.starts_with(kSubtest) || colon == std::string_view::npos) {
+    return std::nullopt;
+  }
 
-  if (log.find("fail") != std::string::npos) {
+  std::string_view name = line.substr(kSubtest.size(), colon - kSubtest.size());
+  std::string_view result = line.substr(colon + 2);
+  if (result.starts_with("FAIL") || result.starts_with("CRASH")) {
+    return std::make_pair(name, TestResult::kFail);
+  } else if (result.starts_with("TIMEOUT")) {
+    return std::make_pair(name, TestResult::kTimeout);
+  } else if (result.starts_with("SKIP")) {
+    return std::make_pair(name, TestResult::kSkip);
+  } else if (result.starts_with("SUCCESS")) {
+    return std::make_pair(name, TestResult::kPass);
+  }
+  return std::nullopt;
+}
+
+bool containsIgnoringCase(std::string_view text, std::string_view word) {
+  return std::search(text.begin(), text.end(), word.begin(), word.end(),
+                     [](char a, char b) {
+                       return ::tolower(a) == ::tolower(b);
+                     }) != text.end();
+}
+
+// The directory the binaries of the running ABI are pushed to, and the suffix
+// data_bins gives them.
+#if defined(__aarch64__)
+constexpr char kAbiDirectory[] = "arm64";
+#elif defined(__arm__)
+constexpr char kAbiDirectory[] = "arm";
+#elif defined(__x86_64__)
+constexpr char kAbiDirectory[] = "x86_64";
+#elif defined(__i386__)
+constexpr char kAbiDirectory[] = "x86";
+#elif defined(__riscv)
+constexpr char kAbiDirectory[] = "riscv64";
+#else
+#error "unsupported ABI"
+#endif
+constexpr const char *kBinarySuffix = sizeof(void *) == 8 ? "64" : "32";
+
+// Returns the DRM devices of the system, e.g. /dev/dri/card0.
+std::vector<std::string> listDrmDevices() {
+  std::vector<std::string> devices;
+  std::error_code error;
+  for (const auto &entry :
+       std::filesystem::directory_iterator("/dev/dri", error)) {
+    if (entry.path().filename().string().starts_with("card")) {
+      devices.push_back(entry.path().string());
+    }
+  }
+  std::sort(devices.begin(), devices.end());
+  return devices;
+}
+
+// Classifies the output of a binary run without subtests: any mention of a
+// failure wins over a skip, which wins over a success.
+TestResult getTestResultFromLine(std::string_view line) {
+  if (containsIgnoringCase(line, "fail")) {
     return TestResult::kFail;
-  } else if (log.find("skip") != std::string::npos) {
+  } else if (containsIgnoringCase(line, "skip")) {
     return TestResult::kSkip;
-  } else if (log.find("success") != std::string::npos) {
+  } else if (containsIgnoringCase(line, "success")) {
     return TestResult::kPass;
+  }
+  return TestResult::kUnknown;
+}
+
+// What a frame event of the debug output of a binary reports on.
+enum class FrameEventKind : uint8_t { kCrc = 1, kFlip = 2 };
+
+// A CRC or flip completion IGT logged for a frame, e.g.
+// "CRC: pipe A, frame 1234: 0x1c642e5e 0x0b5b0ae3 0x0d98d45b" or
+// "flip done: pipe A, seq 1234, ts 512.016683".
+struct FrameEvent {
+  FrameEventKind kind;
+  // The pipe the event is on, offset by kMaxPipes per device of merged runs.
+  uint8_t stream;
+  // Whether |timestampNs| is when the line was read because IGT did not print
+  // a timestamp, which adds the buffering of the output to the intervals.
+  bool receiveTime;
+  uint32_t frame;
+  uint64_t timestampNs;
+  // The FNV-1a hash of the CRC values, 0 for flips.
+  uint32_t crc;
+};
+
+constexpr size_t kMaxPipes = 8;
+
+// Returns where |word| first is in |text| from |from| on, ignoring case.
+size_t findIgnoringCase(std::string_view text, std::string_view word,
+                        size_t from = 0) {
+  if (from > text.size()) {
+    return std::string_view::npos;
+  }
+  auto found = std::search(text.begin() + from, text.end(), word.begin(),
+                           word.end(), [](char a, char b) {
+                             return ::tolower(a) == ::tolower(b);
+                           });
+  return found == text.end() ? std::string_view::npos
+                             : static_cast<size_t>(found - text.begin());
+}
+
+// Returns the position right after the separators following the first
+// occurrence of the word |key| in |line| which is followed by a digit, e.g.
+// right before the 42 of "frame 42" or "frame=42".
+std::optional<size_t> findValueOf(std::string_view line, std::string_view key) {
+  for (size_t at = findIgnoringCase(line, key); at != std::string_view::npos;
+       at = findIgnoringCase(line, key, at + 1)) {
+    if (at > 0 && isalnum(line[at - 1])) {
+      continue;
+    }
+    size_t value = at + key.size();
+    while (value < line.size() && strchr(" =:#", line[value]) != nullptr) {
+      value++;
+    }
+    if (value > at + key.size() && value < line.size() &&
+        isdigit(line[value])) {
+      return value;
+    }
+  }
+  return std::nullopt;
+}
+
+// Parses the frame event of a debug line of a binary, or returns nullopt if
+// it is not one. Events are timestamped with the "ts" IGT prints, in seconds,
+// or else with |receivedAt|.
+std::optional<FrameEvent>
+parseFrameEvent(std::string_view line,
+                std::chrono::steady_clock::time_point receivedAt) {
+  FrameEvent event = {};
+  if (containsIgnoringCase(line, "crc")) {
+    event.kind = FrameEventKind::kCrc;
+  } else if (containsIgnoringCase(line, "flip") ||
+             containsIgnoringCase(line, "vblank")) {
+    event.kind = FrameEventKind::kFlip;
+  } else {
+    return std::nullopt;
+  }
+
+  std::optional<size_t> frame;
+  for (std::string_view key : {"frame", "sequence", "seq"}) {
+    frame = findValueOf(line, key);
+    if (frame.has_value()) {
+      break;
+    }
+  }
+  if (!frame.has_value()) {
+    return std::nullopt;
+  }
+  const char *end = line.data() + line.size();
+  auto [frameEnd, error] =
+      std::from_chars(line.data() + frame.value(), end, event.frame);
+  if (error != std::errc()) {
+    return std::nullopt;
+  }
+
+  size_t pipe = findIgnoringCase(line, "pipe ");
+  if (pipe != std::string_view::npos && pipe + 5 < line.size()) {
+    char name = static_cast<char>(::toupper(line[pipe + 5]));
+    if (name >= 'A' && name < 'A' + static_cast<int>(kMaxPipes)) {
+      event.stream = static_cast<uint8_t>(name - 'A');
+    } else if (name >= '0' && name < '0' + static_cast<int>(kMaxPipes)) {
+      event.stream = static_cast<uint8_t>(name - '0');
+    }
+  }
+
+  std::optional<size_t> timestamp = findValueOf(line, "ts");
+  uint64_t seconds = 0;
+  const char *secondsEnd = nullptr;
+  if (timestamp.has_value()) {
+    auto parsed =
+        std::from_chars(line.data() + timestamp.value(), end, seconds);
+    secondsEnd = parsed.ec == std::errc() ? parsed.ptr : nullptr;
+  }
+  if (secondsEnd != nullptr) {
+    uint64_t nanoseconds = 0;
+    uint64_t scale = 1000000000;
+    if (secondsEnd < end && *secondsEnd == '.') {
+      for (const char *digit = secondsEnd + 1;
+           digit < end && isdigit(*digit) && scale > 1; digit++) {
+        scale /= 10;
+        nanoseconds += static_cast<uint64_t>(*digit - '0') * scale;
+      }
+    }
+    event.timestampNs = seconds * 1000000000 + nanoseconds;
   } else {
-    return TestResult::kUnknown;
+    event.receiveTime = true;
+    event.timestampNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            receivedAt.time_since_epoch())
+                            .count();
   }
+
+  if (event.kind == FrameEventKind::kCrc) {
+    // The CRC values follow the frame number.
+    uint32_t hash = 2166136261u;
+    std::string_view values = line.substr(frameEnd - line.data());
+    while (!values.empty() && isspace(values.back())) {
+      values.remove_suffix(1);
+    }
+    for (char c : values) {
+      hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    event.crc = hash;
+  }
+  return event;
+}
+
+// Returns the frame count, missed frames and frame interval statistics of the
+// CRCs and flips of |events|, per pipe. Frames skipped between two events of a
+// pipe count as missed, and the jitter is the standard deviation of the time
+// between events of consecutive frames from the mean of their pipe.
+std::vector<Metric> frameStatistics(const std::vector<FrameEvent> &events) {
+  std::vector<Metric> metrics;
+  for (auto [kind, label] :
+       {std::pair(FrameEventKind::kCrc, std::string("crc")),
+        std::pair(FrameEventKind::kFlip, std::string("flip"))}) {
+    std::map<std::pair<uint8_t, bool>, const FrameEvent *> last;
+    std::map<std::pair<uint8_t, bool>, std::vector<double>> intervals;
+    size_t count = 0;
+    uint64_t missed = 0;
+    for (const FrameEvent &event : events) {
+      if (event.kind != kind) {
+        continue;
+      }
+      count++;
+      auto key = std::pair(event.stream, event.receiveTime);
+      auto previous = last.find(key);
+      // Frames going back are a new capture, e.g. after a modeset.
+      if (previous != last.end() && event.frame > previous->second->frame) {
+        uint32_t gap = event.frame - previous->second->frame;
+        missed += gap - 1;
+        if (gap == 1 && event.timestampNs >= previous->second->timestampNs) {
+          intervals[key].push_back(
+              (event.timestampNs - previous->second->timestampNs) / 1000.0);
+        }
+      }
+      last[key] = &event;
+    }
+    if (count == 0) {
+      continue;
+    }
+    metrics.push_back({label + "_frames", static_cast<double>(count), ""});
+    metrics.push_back(
+        {label + "_missed_frames", static_cast<double>(missed), ""});
+
+    size_t total = 0;
+    double sum = 0;
+    double squares = 0;
+    double longest = 0;
+    for (const auto &[key, values] : intervals) {
+      double mean = 0;
+      for (double value : values) {
+        mean += value / values.size();
+      }
+      for (double value : values) {
+        squares += (value - mean) * (value - mean);
+        sum += value;
+        longest = std::max(longest, value);
+      }
+      total += values.size();
+    }
+    if (total > 0) {
+      metrics.push_back({label + "_frame_interval_us", sum / total, "us"});
+      metrics.push_back(
+          {label + "_frame_jitter_us", std::sqrt(squares / total), "us"});
+      metrics.push_back({label + "_frame_interval_max_us", longest, "us"});
+    }
+  }
+  return metrics;
+}
+
+// The version of the frame trace format written by writeFrameTrace.
+constexpr uint32_t kFrameTraceVersion = 1;
+
+// Writes |events| to <directory>/<binary>/<subtest>.frames. The trace is the
+// "IGTF" magic, the format version and the event count as uint32s, then 18
+// bytes per event: the kind, with 0x80 set for receive timestamps, the stream,
+// the frame as a uint32, the timestamp in nanoseconds as a uint64 and the CRC
+// hash as a uint32, all in the byte order of the device.
+void writeFrameTrace(const std::string &binary, const std::string &subtest,
+                     const std::vector<FrameEvent> &events) {
+  if (events.empty()) {
+    return;
+  }
+  std::string trace = "IGTF";
+  auto put = [&trace](auto value) {
+    trace.append(reinterpret_cast<const char *>(&value), sizeof(value));
+  };
+  put(kFrameTraceVersion);
+  put(static_cast<uint32_t>(events.size()));
+  for (const FrameEvent &event : events) {
+    put(static_cast<uint8_t>(static_cast<uint8_t>(event.kind) |
+                             (event.receiveTime ? 0x80 : 0)));
+    put(event.stream);
+    put(event.frame);
+    put(event.timestampNs);
+    put(event.crc);
+  }
+  std::ofstream file(metricsDirectory(binary) / (subtest + ".frames"),
+                     std::ios::binary);
+  file.write(trace.data(), static_cast<std::streamsize>(trace.size()));
+}
+
+// The result and log of one subtest of a batched run.
+struct BatchedSubtestResult {
+  TestResult result;
+  std::string log;
+  std::vector<Metric> metrics;
+  // The frame events of the subtest, if its frames were traced.
+  std::vector<FrameEvent> frames;
+};
+
+using BatchedResults = std::map<std::string, BatchedSubtestResult, std::less<>>;
+
+std::string joinNames(const std::vector<std::string> &names) {
+  std::string joined;
+  for (const std::string &name : names) {
+    joined += (joined.empty() ? "" : ",") + name;
+  }
+  return joined;
+}
+
+// Runs |args| over the subtests |names| and splits its output into the logs of
+// the subtests it reports on, from their "Starting subtest" line to their
+// result line. Output outside of any subtest is added to the log of every
+// subtest.
+//
+// The binary is only started again if it exits or hangs in the middle of a
+// subtest, which is then reported as failed or timed out with the output it
+// wrote until then. The run resumes with the subtests it had not got to, so
+// the cost of starting the binary, probing the connectors and the first
+// modeset is paid once per crash rather than once per subtest.
+//
+// With |traceFrames|, the binary runs with --debug and the CRCs and flips it
+// logs are kept as the frame events of the subtests.
+std::optional<BatchedResults>
+runBatchedCommand(const std::vector<std::string> &args,
+                  std::vector<std::string> names, bool traceFrames = false) {
+  BatchedResults results;
+  bool started = false;
+  while (!names.empty()) {
+    BatchedResults runResults;
+    LogTail sharedLog;
+    LogTail currentLog;
+    std::vector<Metric> currentMetrics;
+    std::vector<FrameEvent> currentFrames;
+    std::optional<std::string> current;
+    std::vector<std::string> runArgs = args;
+    if (traceFrames) {
+      runArgs.push_back("--debug");
+    }
+    runArgs.push_back("--run-subtest");
+    runArgs.push_back(joinNames(names));
+    updateTiming([](SuiteTiming &timing) { timing.starts++; });
+    RunStatus status = streamCommand(runArgs, [&](std::string_view line) {
+      if (line.starts_with(kStartingSubtest)) {
+        std::string_view name = line.substr(kStartingSubtest.size());
+        while (!name.empty() && isspace(name.back())) {
+          name.remove_suffix(1);
+        }
+        current = name;
+        currentLog.clear();
+        currentMetrics.clear();
+        currentFrames.clear();
+      }
+      if (current.has_value()) {
+        currentLog.append(line);
+        auto metric = parseMetricLine(line);
+        if (metric.has_value()) {
+          currentMetrics.push_back(std::move(metric.value()));
+        }
+        auto frame = traceFrames ? parseFrameEvent(
+                                       line, std::chrono::steady_clock::now())
+                                 : std::nullopt;
+        if (frame.has_value()) {
+          currentFrames.push_back(frame.value());
+        }
+      } else {
+        sharedLog.append(line);
+      }
+
+      auto subtestResult = parseSubtestResultLine(line);
+      if (subtestResult.has_value()) {
+        auto [name, result] = subtestResult.value();
+        if (current == name) {
+          runResults[std::string(name)] = {result, currentLog.str(),
+                                           std::move(currentMetrics),
+                                           std::move(currentFrames)};
+        } else {
+          runResults[std::string(name)] = {result, std::string(line), {}, {}};
+        }
+        current.reset();
+      }
+    });
+    if (status == RunStatus::kNotStarted) {
+      return started ? std::optional(results) : std::nullopt;
+    }
+    started = true;
+    if (current.has_value()) {
+      if (status == RunStatus::kTimedOut) {
+        runResults[current.value()] = {TestResult::kTimeout, currentLog.str(),
+                                       std::move(currentMetrics),
+                                       std::move(currentFrames)};
+      } else {
+        currentLog.append("The binary exited during the subtest.\n");
+        runResults[current.value()] = {TestResult::kFail, currentLog.str(),
+                                       std::move(currentMetrics),
+                                       std::move(currentFrames)};
+      }
+    }
+
+    std::string shared = sharedLog.str();
+    for (auto &[name, subtestResult] : runResults) {
+      subtestResult.log = shared + subtestResult.log;
+    }
+    results.merge(runResults);
+
+    // Subtests the binary finished without reporting on do not exist in it,
+    // running it again would not help.
+    if (!current.has_value()) {
+      break;
+    }
+    std::erase_if(names, [&](const std::string &name) {
+      return results.find(name) != results.end();
+    });
+  }
+  return results;
 }
 
 std::string generateFailureLog(const std::string &log,
@@ -102,6 +825,11 @@ void presentTestResult(TestResult result, const std::string &log,
   case TestResult::kSkip:
     GTEST_SKIP() << log;
     break;
+  case TestResult::kTimeout:
+    ADD_FAILURE() << "Timed out after " << kSubtestTimeout.count()
+                  << " minutes, the test may be hung.\n"
+                  << generateFailureLog(log, desc, rationale);
+    break;
   case TestResult::kUnknown:
     ADD_FAILURE() << "Could not determine test result.\n" << log;
     break;
@@ -110,61 +838,717 @@ void presentTestResult(TestResult result, const std::string &log,
     break;
   }
 }
+
+// Runs runBatchedCommand on every DRM device at once, one IGT process per
+// device. The subtests of a process run one after the other, so the device is
+// the unit of exclusion: IGT does not list which pipes and connectors a subtest
+// uses, but subtests on different devices never compete for them. A subtest
+// fails if it fails on any device, is skipped only if every device skipped it,
+// and passes otherwise. It is left out if no device reported on it.
+//
+// A device which did not report on a subtest another device reported on runs
+// it again on its own, and the subtest fails if the device still does not
+// report on it.
+std::optional<BatchedResults>
+runBatchedOnEachDevice(const std::vector<std::string> &args,
+                       const std::vector<std::string> &names,
+                       bool traceFrames) {
+  std::vector<std::string> devices = listDrmDevices();
+  if (devices.size() <= 1) {
+    return runBatchedCommand(args, names, traceFrames);
+  }
+
+  std::vector<std::vector<std::string>> deviceArgs;
+  std::vector<std::future<std::optional<BatchedResults>>> runs;
+  for (const std::string &device : devices) {
+    deviceArgs.push_back(args);
+    deviceArgs.back().push_back("--device");
+    deviceArgs.back().push_back("drm:" + device);
+    runs.push_back(std::async(std::launch::async, runBatchedCommand,
+                              deviceArgs.back(), names, traceFrames));
+  }
+  std::vector<std::optional<BatchedResults>> deviceResults;
+  for (auto &run : runs) {
+    deviceResults.push_back(run.get());
+    if (!deviceResults.back().has_value()) {
+      return std::nullopt;
+    }
+  }
+
+  std::set<std::string> reported;
+  for (const std::optional<BatchedResults> &deviceResult : deviceResults) {
+    for (const auto &[name, result] : deviceResult.value()) {
+      reported.insert(name);
+    }
+  }
+  std::vector<std::future<std::optional<BatchedResults>>> reruns(
+      devices.size());
+  for (size_t i = 0; i < devices.size(); i++) {
+    std::vector<std::string> missing;
+    for (const std::string &name : reported) {
+      if (!deviceResults[i]->contains(name)) {
+        missing.push_back(name);
+      }
+    }
+    if (!missing.empty()) {
+      reruns[i] = std::async(std::launch::async, runBatchedCommand,
+                             deviceArgs[i], missing, traceFrames);
+    }
+  }
+  for (size_t i = 0; i < devices.size(); i++) {
+    if (!reruns[i].valid()) {
+      continue;
+    }
+    std::optional<BatchedResults> rerun = reruns[i].get();
+    if (rerun.has_value()) {
+      deviceResults[i]->merge(rerun.value());
+    }
+  }
+
+  BatchedResults results;
+  for (const std::string &name : reported) {
+    BatchedSubtestResult merged = {TestResult::kUnknown, "", {}, {}};
+    for (size_t i = 0; i < devices.size(); i++) {
+      auto found = deviceResults[i]->find(name);
+      if (found == deviceResults[i]->end()) {
+        merged.result = combineDeviceResults(merged.result, TestResult::kFail);
+        merged.log += "Not reported on " + devices[i] + ".\n";
+        continue;
+      }
+      merged.result =
+          combineDeviceResults(merged.result, found->second.result);
+      merged.log += "On " + devices[i] + ":\n" + found->second.log;
+      std::string device = std::filesystem::path(devices[i]).filename();
+      for (const Metric &metric : found->second.metrics) {
+        merged.metrics.push_back(
+            {device + "_" + metric.name, metric.value, metric.unit});
+      }
+      for (FrameEvent frame : found->second.frames) {
+        frame.stream = static_cast<uint8_t>(i * kMaxPipes + frame.stream);
+        merged.frames.push_back(frame);
+      }
+    }
+    results[name] = std::move(merged);
+  }
+  return results;
+}
+
+// Where the subtest lists of binaries are cached.
+constexpr char kManifestDirectory[] = "/data/igt_tests/manifests";
+
+// Returns the FNV-1a hash of the contents of |path|.
+std::optional<uint64_t> hashFile(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return std::nullopt;
+  }
+  uint64_t hash = 14695981039346656037ull;
+  std::array<char, 64 * 1024> buffer;
+  while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0) {
+    for (std::streamsize i = 0; i < file.gcount(); i++) {
+      hash = (hash ^ static_cast<uint8_t>(buffer[i])) * 1099511628211ull;
+    }
+  }
+  return hash;
+}
+
+// Returns the subtests |binary| lists with --list-subtests. The list is kept
+// in a manifest named after the binary and the hash of its contents, so it is
+// only queried again when the binary changes.
+std::optional<std::vector<std::string>>
+listSubtests(const std::string &binary) {
+  static std::map<std::string, std::optional<std::vector<std::string>>> lists;
+  auto found = lists.find(binary);
+  if (found != lists.end()) {
+    return found->second;
+  }
+
+  std::optional<uint64_t> hash = hashFile(binary);
+  std::filesystem::path manifest;
+  if (hash.has_value()) {
+    std::stringstream name;
+    name << std::filesystem::path(binary).filename().string() << "-"
+         << std::hex << hash.value() << ".txt";
+    manifest = std::filesystem::path(kManifestDirectory) / name.str();
+  }
+
+  std::vector<std::string> subtests;
+  std::ifstream cached(manifest);
+  if (!manifest.empty() && cached) {
+    std::string line;
+    while (std::getline(cached, line)) {
+      subtests.push_back(line);
+    }
+    return lists.emplace(binary, subtests).first->second;
+  }
+
+  SuiteTimer timer(binary, &SuiteTiming::listing);
+  RunStatus status = streamCommand(
+      {binary, "--list-subtests"}, [&](std::string_view line) {
+        while (!line.empty() && isspace(line.back())) {
+          line.remove_suffix(1);
+        }
+        if (!line.empty()) {
+          subtests.emplace_back(line);
+        }
+      });
+  if (status != RunStatus::kExited) {
+    return lists.emplace(binary, std::nullopt).first->second;
+  }
+
+  if (!manifest.empty()) {
+    std::error_code error;
+    std::filesystem::create_directories(kManifestDirectory, error);
+    std::filesystem::path temporary = manifest;
+    temporary += ".tmp";
+    std::ofstream file(temporary);
+    for (const std::string &subtest : subtests) {
+      file << subtest << "\n";
+    }
+    file.close();
+    if (file) {
+      std::filesystem::rename(temporary, manifest, error);
+    }
+  }
+  return lists.emplace(binary, subtests).first->second;
+}
+
+// Where the subtests that passed are cached per binary and configuration.
+constexpr char kResultCacheDirectory[] = "/data/igt_tests/results";
+
+// How many hours a pass is reused for, if set. Results are cached either way,
+// so the first retry after setting it can already skip subtests.
+constexpr char kResultCacheHoursProperty[] = "debug.igt.result_cache_hours";
+
+// The subtests of a binary that passed, with when they last did, in seconds
+// since the epoch.
+struct ResultCache {
+  std::filesystem::path path;
+  std::map<std::string, int64_t, std::less<>> passes;
+};
+
+// Returns the cache of the passes of |binary| in the running configuration: the
+// kernel, the vendor build with its GPU firmware, and the contents of the
+// binary. Its file is named after the binary and the hash of all of these, so
+// a pass never stands for another configuration. Returns nullptr if the binary
+// can not be hashed.
+ResultCache *resultCache(const std::string &binary) {
+  static std::map<std::string, std::optional<ResultCache>> caches;
+  auto found = caches.find(binary);
+  if (found != caches.end()) {
+    return found->second.has_value() ? &found->second.value() : nullptr;
+  }
+
+  std::optional<uint64_t> binaryHash = hashFile(binary);
+  if (!binaryHash.has_value()) {
+    caches.emplace(binary, std::nullopt);
+    return nullptr;
+  }
+  std::string configuration = std::to_string(binaryHash.value());
+  struct utsname kernel;
+  if (uname(&kernel) == 0) {
+    configuration += std::string("\n") + kernel.release + "\n" + kernel.version;
+  }
+  configuration +=
+      "\n" + android::base::GetProperty("ro.vendor.build.fingerprint", "");
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : configuration) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+  }
+
+  std::stringstream name;
+  name << std::filesystem::path(binary).filename().string() << "-" << std::hex
+       << hash << ".txt";
+  ResultCache cache = {std::filesystem::path(kResultCacheDirectory) /
+                           name.str(),
+                       {}};
+  std::ifstream file(cache.path);
+  std::string subtest;
+  int64_t passedAt;
+  while (file >> subtest >> passedAt) {
+    cache.passes[subtest] = passedAt;
+  }
+  return &caches.emplace(binary, std::move(cache)).first->second.value();
+}
+
+int64_t secondsSinceEpoch() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// Whether |subtest| of |binary| passed in the running configuration within the
+// hours of kResultCacheHoursProperty, and does not need to run again.
+bool passedRecently(const std::string &binary, std::string_view subtest) {
+  static const int64_t hours = android::base::GetIntProperty<int64_t>(
+      kResultCacheHoursProperty, 0, 0);
+  if (hours == 0) {
+    return false;
+  }
+  ResultCache *cache = resultCache(binary);
+  if (cache == nullptr) {
+    return false;
+  }
+  auto found = cache->passes.find(subtest);
+  return found != cache->passes.end() &&
+         secondsSinceEpoch() - found->second < hours * 3600;
+}
+
+// Whether all of the concrete subtests |names| passed recently.
+bool passedRecently(const std::string &binary,
+                    const std::vector<std::string> &names) {
+  return std::all_of(names.begin(), names.end(), [&](const std::string &name) {
+    return passedRecently(binary, name);
+  });
+}
+
+// Caches the subtests of |results| that passed and forgets the others, so only
+// the subtests which failed or changed since their last pass run again.
+void recordResults(const std::string &binary, const BatchedResults &results) {
+  ResultCache *cache = resultCache(binary);
+  if (cache == nullptr || results.empty()) {
+    return;
+  }
+  int64_t now = secondsSinceEpoch();
+  for (const auto &[name, result] : results) {
+    if (result.result == TestResult::kPass) {
+      cache->passes[name] = now;
+    } else {
+      cache->passes.erase(name);
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::create_directories(kResultCacheDirectory, error);
+  std::filesystem::path temporary = cache->path;
+  temporary += ".tmp";
+  std::ofstream file(temporary);
+  for (const auto &[name, passedAt] : cache->passes) {
+    file << name << " " << passedAt << "\n";
+  }
+  file.close();
+  if (file) {
+    std::filesystem::rename(temporary, cache->path, error);
+  }
+}
+
+// Reports |subtest| as passed without running it, since all of |names| passed
+// recently in the same configuration.
+void presentCachedPass(const IgtSubtestParams &subtest,
+                       const std::vector<std::string> &names) {
+  ::testing::Test::RecordProperty("cached_result", "pass");
+  updateTiming([](SuiteTiming &timing) {
+    timing.subtests++;
+    timing.cached++;
+  });
+  LOG(INFO) << subtest.name << " passed within the last "
+            << android::base::GetProperty(kResultCacheHoursProperty, "")
+            << " hours, not running " << joinNames(names);
+  SUCCEED();
+}
+
+// Returns the concrete subtests of |binary| that |name| stands for. Names like
+// "ctm-%s" are printf patterns of IGT's own subtest names, which are matched as
+// globs against the subtests the binary lists. Other names stand for
+// themselves, as do patterns when the binary can not list its subtests.
+std::vector<std::string> expandSubtestName(const std::string &binary,
+                                           std::string_view name) {
+  if (name.find('%') == std::string_view::npos) {
+    return {std::string(name)};
+  }
+  std::optional<std::vector<std::string>> subtests = listSubtests(binary);
+  if (!subtests.has_value()) {
+    return {std::string(name)};
+  }
+
+  std::string glob;
+  for (size_t i = 0; i < name.size(); i++) {
+    if (name[i] != '%') {
+      glob += name[i];
+      continue;
+    }
+    // Skip the flags, width and length of the conversion.
+    while (i + 1 < name.size() && !isalpha(name[i + 1])) {
+      i++;
+    }
+    while (i + 1 < name.size() && strchr("hlzjt", name[i + 1]) != nullptr) {
+      i++;
+    }
+    i++;
+    glob += '*';
+  }
+
+  std::vector<std::string> names;
+  for (const std::string &subtest : subtests.value()) {
+    if (fnmatch(glob.c_str(), subtest.c_str(), 0) == 0) {
+      names.push_back(subtest);
+    }
+  }
+  return names;
+}
+
+// The composer services which hold the DRM master while they run. The test
+// config stops them before a module.
+constexpr std::array<const char *, 3> kComposerServices = {
+    "vendor.hwcomposer-2-4", "vendor.hwcomposer-3",
+    "vendor.qti.hardware.display.composer"};
+
+// Makes sure no composer holds the display before the first IGT run of the
+// binary, e.g. when a display session shared with the previous modules outlived
+// its grace period. Only the composers found running are stopped, instead of
+// restarting the whole display stack.
+void ensureDisplayReleased() {
+  static bool checked = false;
+  if (checked) {
+    return;
+  }
+  checked = true;
+
+  for (const char *service : kComposerServices) {
+    std::string state = android::base::GetProperty(
+        std::string("init.svc.") + service, "");
+    if (state != "running" && state != "restarting") {
+      continue;
+    }
+    LOG(WARNING) << service << " is " << state << ", stopping it";
+    android::base::SetProperty("ctl.stop", service);
+    if (!android::base::WaitForProperty(std::string("init.svc.") + service,
+                                        "stopped", std::chrono::seconds(5))) {
+      ADD_FAILURE() << "Could not stop " << service
+                    << ", IGT can not become DRM master.";
+    }
+  }
+}
+
+// Presents the result of |subtest| from the results of the concrete subtests
+// it stands for. It fails if any of them failed or did not report a result,
+// and is skipped only if all of them were. The frame events of each are written
+// as its trace, and summarized in its metrics.
+void presentSubtestResults(const std::string &binary,
+                           const IgtSubtestParams &subtest,
+                           const std::vector<std::string> &names,
+                           const BatchedResults &results) {
+  bool timedOut = false;
+  bool failed = false;
+  bool missing = false;
+  bool passed = false;
+  std::string log;
+  std::vector<Metric> metrics;
+  for (const std::string &name : names) {
+    auto found = results.find(name);
+    if (found == results.end()) {
+      missing = true;
+      log += "No result for subtest " + name + "\n";
+      continue;
+    }
+    const BatchedSubtestResult &result = found->second;
+    timedOut |= result.result == TestResult::kTimeout;
+    failed |= result.result == TestResult::kFail;
+    missing |= result.result == TestResult::kUnknown;
+    passed |= result.result == TestResult::kPass;
+    log += result.log;
+    std::string prefix;
+    if (names.size() > 1) {
+      // Prefix the metrics of a pattern with the subtest they come from.
+      prefix = name + "_";
+      std::replace(prefix.begin(), prefix.end(), '-', '_');
+    }
+    for (const Metric &metric : result.metrics) {
+      metrics.push_back({prefix + metric.name, metric.value, metric.unit});
+    }
+    for (const Metric &metric : frameStatistics(result.frames)) {
+      metrics.push_back({prefix + metric.name, metric.value, metric.unit});
+    }
+    writeFrameTrace(binary, name, result.frames);
+  }
+
+  TestResult result = timedOut  ? TestResult::kTimeout
+                      : failed  ? TestResult::kFail
+                      : missing ? TestResult::kUnknown
+                      : passed  ? TestResult::kPass
+                                : TestResult::kSkip;
+  reportMetrics(binary, std::string(subtest.name), metrics);
+  updateTiming([](SuiteTiming &timing) { timing.subtests++; });
+  presentTestResult(result, log, subtest.desc, subtest.rationale);
+}
+
+// Logs where the wall-clock time of the process went once every suite ran,
+// slowest suite first, and writes it to <metrics>/timing/<module>.json for
+// tradefed to collect. Besides listing and running the IGT binaries, a suite
+// spends its time on parsing results and writing sidecars, reported as
+// other_ms. A module linking many suites thus shows which of them dominate
+// the postsubmit run.
+class TimingReport : public ::testing::Environment {
+public:
+  void SetUp() override { start_ = std::chrono::steady_clock::now(); }
+
+  void TearDown() override {
+    const ::testing::UnitTest *unitTest = ::testing::UnitTest::GetInstance();
+    std::vector<std::pair<const ::testing::TestSuite *, SuiteTiming>> suites;
+    {
+      std::lock_guard<std::mutex> lock(timingsMutex);
+      for (int i = 0; i < unitTest->total_test_suite_count(); i++) {
+        const ::testing::TestSuite *suite = unitTest->GetTestSuite(i);
+        auto found = timings.find(suite->name());
+        if (found != timings.end()) {
+          suites.emplace_back(suite, found->second);
+        }
+      }
+    }
+    if (suites.empty()) {
+      return;
+    }
+    std::sort(suites.begin(), suites.end(), [](const auto &a, const auto &b) {
+      return a.first->elapsed_time() > b.first->elapsed_time();
+    });
+
+    auto ms = [](std::chrono::nanoseconds duration) {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(duration)
+          .count();
+    };
+    std::error_code error;
+    std::string module =
+        std::filesystem::read_symlink("/proc/self/exe", error).filename();
+    // The UnitTest only knows its elapsed time once the environments are
+    // torn down.
+    int64_t total = ms(std::chrono::steady_clock::now() - start_);
+    std::stringstream json;
+    json << "{\"module\":\"" << module << "\",\"total_ms\":" << total
+         << ",\"suites\":[";
+    LOG(INFO) << module << " ran " << suites.size() << " IGT suites in "
+              << total << " ms";
+    const char *separator = "";
+    for (const auto &[suite, timing] : suites) {
+      int64_t other = std::max<int64_t>(
+          0, suite->elapsed_time() - ms(timing.total()));
+      LOG(INFO) << "  " << suite->name() << " (" << timing.binary
+                << "): " << suite->elapsed_time() << " ms, running "
+                << ms(timing.running) << " ms in " << timing.starts
+                << " starts, listing " << ms(timing.listing) << " ms, other "
+                << other << " ms, " << timing.subtests << " subtests, "
+                << timing.cached << " cached";
+      json << separator << "{\"suite\":\"" << suite->name()
+           << "\",\"binary\":\"" << timing.binary
+           << "\",\"total_ms\":" << suite->elapsed_time()
+           << ",\"running_ms\":" << ms(timing.running)
+           << ",\"listing_ms\":" << ms(timing.listing)
+           << ",\"other_ms\":" << other << ",\"starts\":" << timing.starts
+           << ",\"subtests\":" << timing.subtests
+           << ",\"cached\":" << timing.cached << "}";
+      separator = ",";
+    }
+    json << "]}" << std::endl;
+
+    std::ofstream file(metricsDirectory("timing") / (module + ".json"));
+    file << json.str();
+  }
+
+private:
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Every suite binary links this file, so the report is registered for all of
+// them before main() runs.
+[[maybe_unused]] ::testing::Environment *const kTimingReport =
+    ::testing::AddGlobalTestEnvironment(new TimingReport);
+
 } // namespace
 
 // static
 std::string IgtTestHelper::generateGTestName(
     const ::testing::TestParamInfo<IgtSubtestParams> &info) {
-  std::string dashedName(info.param.name);
+  return std::string(mangleGTestName(info.param.name).view());
+}
 
-  // Many subtest names include %s and %d which are not valid GTest names.
-  size_t pos = dashedName.find("%s");
-  while (pos != std::string::npos) {
-    dashedName.erase(pos, 2);
-    pos = dashedName.find("%s", pos);
+// static
+std::string IgtTestHelper::resolveBinaryPath(const std::string &test_name) {
+  static std::map<std::string, std::string> resolved;
+  auto found = resolved.find(test_name);
+  if (found != resolved.end()) {
+    return found->second;
   }
-  pos = dashedName.find("%d");
-  while (pos != std::string::npos) {
-    dashedName.erase(pos, 2);
-    pos = dashedName.find("%d", pos);
+
+  std::vector<std::filesystem::path> directories;
+  if (const char *directory = getenv("IGT_BINARY_DIR")) {
+    directories.push_back(directory);
   }
+  std::error_code error;
+  std::filesystem::path self =
+      std::filesystem::read_symlink("/proc/self/exe", error);
+  if (!error) {
+    directories.push_back(self.parent_path());
+  }
+  directories.push_back(std::filesystem::path("/data/igt_tests") /
+                        kAbiDirectory);
 
-  // convert test-name to PascalCase
-  std::stringstream ss(dashedName);
-  std::string word;
-  std::string pascalCaseName;
-  while (std::getline(ss, word, '-')) {
-    if (!word.empty()) {
-      // Capitalize the first letter
-      word[0] = std::toupper(word[0]);
-      pascalCaseName += word;
+  std::string binary = test_name + kBinarySuffix;
+  // Without a match, failures name the expected location.
+  std::string path = directories.back() / binary;
+  for (const std::filesystem::path &directory : directories) {
+    if (std::filesystem::exists(directory / binary, error)) {
+      path = directory / binary;
+      break;
     }
   }
+  return resolved.emplace(test_name, path).first->second;
+}
 
-  return pascalCaseName;
+std::string IgtTestHelper::binaryName() const {
+  return std::filesystem::path(test_name_).filename();
 }
 
 void IgtTestHelper::runSubTest(const IgtSubtestParams &subtest) {
   CHECK(test_name_.size());
-  std::optional<std::string> log =
-      runCommand(test_name_ + " --run-subtest " + subtest.name);
-  if (!log.has_value())
+  ensureDisplayReleased();
+  std::vector<std::string> names = expandSubtestName(test_name_, subtest.name);
+  if (names.empty()) {
+    ADD_FAILURE() << "No subtest of " << test_name_ << " matches "
+                  << subtest.name;
+    return;
+  }
+
+  if (passedRecently(test_name_, names)) {
+    presentCachedPass(subtest, names);
+    return;
+  }
+
+  std::optional<BatchedResults> results;
+  {
+    SuiteTimer timer(test_name_, &SuiteTiming::running);
+    results = runBatchedCommand({test_name_}, names, trace_frames_);
+  }
+  if (!results.has_value())
+    return;
+
+  recordResults(test_name_, results.value());
+  presentSubtestResults(binaryName(), subtest, names, results.value());
+}
+
+void IgtTestHelper::runSubTest(const IgtSubtestParams &subtest,
+                               std::span<const IgtSubtestParams> subtests) {
+  CHECK(test_name_.size());
+  ensureDisplayReleased();
+
+  // The tests of a suite with a single TEST_P are its subtests in order, so a
+  // filtered run, e.g. a retry of the failed subtests, batches the subtests it
+  // selected.
+  const ::testing::TestSuite *suite =
+      ::testing::UnitTest::GetInstance()->current_test_suite();
+  if (suite == nullptr ||
+      static_cast<size_t>(suite->total_test_count()) != subtests.size()) {
+    runSubTest(subtest);
     return;
+  }
+
+  std::vector<std::string> names = expandSubtestName(test_name_, subtest.name);
+  if (names.empty()) {
+    ADD_FAILURE() << "No subtest of " << test_name_ << " matches "
+                  << subtest.name;
+    return;
+  }
+  if (passedRecently(test_name_, names)) {
+    presentCachedPass(subtest, names);
+    return;
+  }
+
+  // The results of every batched run, by binary.
+  static std::map<std::string, std::optional<BatchedResults>> batchedRuns;
+  auto run = batchedRuns.find(test_name_);
+  const bool startsBatch = run == batchedRuns.end();
+  if (startsBatch) {
+    std::vector<std::string> allNames;
+    for (size_t i = 0; i < subtests.size(); i++) {
+      if (!suite->GetTestInfo(static_cast<int>(i))->should_run()) {
+        continue;
+      }
+      std::vector<std::string> subtestNames =
+          expandSubtestName(test_name_, subtests[i].name);
+      if (passedRecently(test_name_, subtestNames)) {
+        continue;
+      }
+      for (std::string &name : subtestNames) {
+        if (std::find(allNames.begin(), allNames.end(), name) ==
+            allNames.end()) {
+          allNames.push_back(std::move(name));
+        }
+      }
+    }
+    SuiteTimer timer(test_name_, &SuiteTiming::running);
+    run = batchedRuns
+              .emplace(test_name_,
+                       runBatchedOnEachDevice({test_name_}, allNames,
+                                              trace_frames_))
+              .first;
+  }
+  if (!run->second.has_value()) {
+    // The subtest which started the batch already failed with the reason the
+    // binary did not start, the later ones fail with the same.
+    if (!startsBatch) {
+      ADD_FAILURE() << "Could not find or run the binary " << test_name_
+                    << ": " << launchError(test_name_);
+    }
+    return;
+  }
 
-  TestResult result = getSubtestTestResultFromLog(log.value(), subtest.name);
-  presentTestResult(result, log.value(), subtest.desc, subtest.rationale);
+  BatchedResults results;
+  std::vector<std::string> missing;
+  for (const std::string &name : names) {
+    auto found = run->second->find(name);
+    if (found != run->second->end()) {
+      results.insert(*found);
+    } else {
+      missing.push_back(name);
+    }
+  }
+  if (!missing.empty()) {
+    // The batch may have stopped early, e.g. if the binary crashed.
+    SuiteTimer timer(test_name_, &SuiteTiming::running);
+    std::optional<BatchedResults> rerun =
+        runBatchedOnEachDevice({test_name_}, missing, trace_frames_);
+    if (rerun.has_value()) {
+      results.merge(rerun.value());
+    }
+  }
+  recordResults(test_name_, results);
+  presentSubtestResults(binaryName(), subtest, names, results);
 }
 
 void IgtTestHelper::runTest(const std::string &desc,
                             const std::string &rationale) {
   CHECK(test_name_.size());
+  ensureDisplayReleased();
 
-  std::optional<std::string> log = runCommand(test_name_);
-  if (!log.has_value())
+  LogTail log;
+  std::vector<Metric> metrics;
+  TestResult result = TestResult::kUnknown;
+  struct rusage usage = {};
+  RunStatus status;
+  {
+    SuiteTimer timer(test_name_, &SuiteTiming::running);
+    updateTiming([](SuiteTiming &timing) { timing.starts++; });
+    status = streamCommand(
+        {test_name_},
+        [&](std::string_view line) {
+          log.append(line);
+          auto metric = parseMetricLine(line);
+          if (metric.has_value()) {
+            metrics.push_back(std::move(metric.value()));
+          }
+          result = combineResults(result, getTestResultFromLine(line));
+        },
+        &usage);
+  }
+  if (status == RunStatus::kNotStarted)
     return;
+  if (status == RunStatus::kTimedOut)
+    result = TestResult::kTimeout;
+  for (Metric &metric : usageMetrics(usage)) {
+    metrics.push_back(std::move(metric));
+  }
 
-  TestResult result = getTestResultFromLog(log.value());
-  presentTestResult(result, log.value(), desc, rationale);
+  reportMetrics(binaryName(), binaryName(), metrics);
+  updateTiming([](SuiteTiming &timing) { timing.subtests++; });
+  presentTestResult(result, log.str(), desc, rationale);
 }
 
 } // namespace igt
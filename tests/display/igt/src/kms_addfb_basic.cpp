@@ -38,14 +38,16 @@ public:
   KmsAddfbBasicTests() : IgtTestHelper("kms_addfb_basic") {}
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Low Level Validation Tests
     {.name = "basic",
      .desc = "Check if addfb2 call works with given handle",
      .rationale = "fundamentral fb mgmt"},
 };
 
-TEST_P(KmsAddfbBasicTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsAddfbBasicTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsAddfbBasicTests, KmsAddfbBasicTests,
                          ::testing::ValuesIn(subtests),
@@ -38,7 +38,7 @@ public:
   KmsAtomicTests() : IgtTestHelper("kms_atomic") {}
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Low Level Validation Tests
     {.name = "atomic-invalid-params",
      .desc = "Test abuse the atomic ioctl directly in order to test "
@@ -67,7 +67,9 @@ IgtSubtestParams subtests[] = {
      .rationale = "important for ensuring that the planes are displayed in the "
                   "correct order"}};
 
-TEST_P(KmsAtomicTests, Run) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsAtomicTests, Run) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsAtomic, KmsAtomicTests,
                          ::testing::ValuesIn(subtests));
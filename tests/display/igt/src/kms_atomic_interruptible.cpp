@@ -38,7 +38,7 @@ public:
   KmsAtomicInterruptibleTests() : IgtTestHelper("kms_atomic_interruptible") {}
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Full System Tests
     {.name = "atomic-setmode",
      .desc = "Validate atomic modeset by interruption",
@@ -52,7 +52,9 @@ IgtSubtestParams subtests[] = {
                   "otherwise it's not"},
 };
 
-TEST_P(KmsAtomicInterruptibleTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsAtomicInterruptibleTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsAtomicInterruptibleTests,
                          KmsAtomicInterruptibleTests,
@@ -46,7 +46,7 @@ constexpr std::string_view kRationale =
     "leading to slowdowns or an inability to drive the display at its native "
     "resolution";
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Fundamental Validation tests.
     {.name = "linear-tiling-%d-displays-%s",
      .desc = kDescription,
@@ -57,7 +57,9 @@ IgtSubtestParams subtests[] = {
 
 };
 
-TEST_P(KmsBwTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsBwTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsBwTests, KmsBwTests, ::testing::ValuesIn(subtests),
                          IgtTestHelper::generateGTestName);
@@ -38,7 +38,7 @@ public:
   KmsColorTests() : IgtTestHelper("kms_color") {}
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Fundamental Validation tests.
     {.name = "deep-color",
      .desc = "Verify that deep color works correctly",
@@ -59,7 +59,9 @@ IgtSubtestParams subtests[] = {
 
 };
 
-TEST_P(KmsColorTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsColorTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsColorTests, KmsColorTests,
                          ::testing::ValuesIn(subtests),
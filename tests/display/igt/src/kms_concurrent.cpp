@@ -36,7 +36,7 @@ public:
   KmsConcurrentTests() : IgtTestHelper("kms_concurrent") {}
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Full System Tests
     {.name = "multi-plane-atomic-lowres",
      .desc = "Test atomic mode setting concurrently with multiple planes and "
@@ -44,7 +44,9 @@ IgtSubtestParams subtests[] = {
      .rationale = "concurrent operations"},
 };
 
-TEST_P(KmsConcurrentTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsConcurrentTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsConcurrentTests, KmsConcurrentTests,
                          ::testing::ValuesIn(subtests),
@@ -39,7 +39,7 @@ public:
   KmsContentProtectionTests() : IgtTestHelper("kms_content_protection") {}
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Fundamental Validation tests.
     {.name = "lic-type-0",
      .desc = "Test for the integrity of link for type-0 content",
@@ -48,7 +48,9 @@ IgtSubtestParams subtests[] = {
      .desc = "Test for the integrity of link for type-1 content",
      .rationale = "it's a hardware feature"}};
 
-TEST_P(KmsContentProtectionTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsContentProtectionTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsContentProtectionTests, KmsContentProtectionTests,
                          ::testing::ValuesIn(subtests),
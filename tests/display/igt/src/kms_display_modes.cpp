@@ -37,7 +37,7 @@ public:
   KmsDisplayModesTests() : IgtTestHelper("kms_display_modes") {}
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Fundamental Validation tests.
     {.name = "extended-mode-basic",
      .desc = "Test for validating display extended mode with a pair of "
@@ -45,7 +45,9 @@ IgtSubtestParams subtests[] = {
      .rationale = "common use case"},
 };
 
-TEST_P(KmsDisplayModesTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsDisplayModesTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsDisplayModesTests, KmsDisplayModesTests,
                          ::testing::ValuesIn(subtests),
@@ -38,7 +38,7 @@ public:
   KmsHdmiInjectTests() : IgtTestHelper("kms_hdmi_inject") {}
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Full System Tests
     {.name = "inject-4k",
      .desc = "Make sure that 4K modes exposed by DRM match the forced EDID and "
@@ -46,7 +46,9 @@ IgtSubtestParams subtests[] = {
      .rationale = "EDID is solid"},
 };
 
-TEST_P(KmsHdmiInjectTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsHdmiInjectTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsHdmiInjectTests, KmsHdmiInjectTests,
                          ::testing::ValuesIn(subtests),
@@ -37,7 +37,7 @@ public:
   KmsHdrTests() : IgtTestHelper("kms_hdr") {}
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Fundamental Validation tests.
     {.name = "bpc-switch",
      .desc = "Tests switching between different display output bpc modes",
@@ -51,7 +51,9 @@ IgtSubtestParams subtests[] = {
 
 };
 
-TEST_P(KmsHdrTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsHdrTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsHdrTests, KmsHdrTests,
                          ::testing::ValuesIn(subtests),
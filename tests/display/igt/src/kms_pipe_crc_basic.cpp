@@ -35,10 +35,12 @@ namespace {
 class KmsPipeCrcBasicTests : public ::testing::TestWithParam<IgtSubtestParams>,
                              public IgtTestHelper {
 public:
-  KmsPipeCrcBasicTests() : IgtTestHelper("kms_pipe_crc_basic") {}
+  KmsPipeCrcBasicTests() : IgtTestHelper("kms_pipe_crc_basic") {
+    traceFrames();
+  }
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Fundamental Validation tests.
     {.name = "read-crc",
      .desc = "Test for pipe CRC reads",
@@ -57,7 +59,9 @@ IgtSubtestParams subtests[] = {
      .rationale = "verify that the display is outputting the correct pixels."},
 };
 
-TEST_P(KmsPipeCrcBasicTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsPipeCrcBasicTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsPipeCrcBasicTests, KmsPipeCrcBasicTests,
                          ::testing::ValuesIn(subtests),
@@ -37,7 +37,7 @@ public:
   KmsPlaneTests() : IgtTestHelper("kms_plane") {}
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Fundamental Validation tests.
     {.name = "planar-pixel-format-settings",
      .desc = "verify planar settings for pixel format are handled correctly",
@@ -54,7 +54,9 @@ IgtSubtestParams subtests[] = {
                   "incorrect layering of elements on the screen"},
 };
 
-TEST_P(KmsPlaneTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsPlaneTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsPlaneTests, KmsPlaneTests,
                          ::testing::ValuesIn(subtests),
@@ -38,7 +38,7 @@ public:
   KmsPlaneCursorTests() : IgtTestHelper("kms_plane_cursor") {}
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Low Level Validation Tests
     {.name = "primary",
      .desc = "Tests atomic cursor positioning on primary plane",
@@ -46,7 +46,9 @@ IgtSubtestParams subtests[] = {
                   "accurately, impacting user interaction."},
 };
 
-TEST_P(KmsPlaneCursorTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsPlaneCursorTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsPlaneCursorTests, KmsPlaneCursorTests,
                          ::testing::ValuesIn(subtests),
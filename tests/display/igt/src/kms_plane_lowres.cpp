@@ -46,7 +46,7 @@ constexpr std::string_view kRationale =
     "revealing issues with memory management or the interaction between "
     "scaling and tiling";
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Fundamental Validation tests.
     {.name = "tiling-none", .desc = kDescription, .rationale = kRationale},
     {.name = "tiling-x", .desc = kDescription, .rationale = kRationale},
@@ -55,7 +55,9 @@ IgtSubtestParams subtests[] = {
 
 };
 
-TEST_P(KmsPlaneLowresTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsPlaneLowresTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsPlaneLowresTests, KmsPlaneLowresTests,
                          ::testing::ValuesIn(subtests),
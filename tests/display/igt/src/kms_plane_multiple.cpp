@@ -43,7 +43,7 @@ constexpr std::string_view kDescription =
 constexpr std::string_view kRationale =
     "fundamental KMS display functionalities";
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Fundamental Validation tests.
     {.name = "tiling-x", .desc = kDescription, .rationale = kRationale},
     {.name = "tiling-y", .desc = kDescription, .rationale = kRationale},
@@ -51,7 +51,9 @@ IgtSubtestParams subtests[] = {
 
 };
 
-TEST_P(KmsPlaneMultipleTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsPlaneMultipleTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsPlaneMultipleTests, KmsPlaneMultipleTests,
                          ::testing::ValuesIn(subtests),
@@ -38,7 +38,7 @@ public:
   KmsPlaneScalingTests() : IgtTestHelper("kms_plane_scaling") {}
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Fundamental Validation tests.
     {.name = "plane-scaler-unity-scaling-with-rotation",
      .desc = "Tests scaling with rotation, unity scaling",
@@ -66,7 +66,9 @@ IgtSubtestParams subtests[] = {
          "artifacts or a black screen"},
 };
 
-TEST_P(KmsPlaneScalingTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsPlaneScalingTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsPlaneScalingTests, KmsPlaneScalingTests,
                          ::testing::ValuesIn(subtests),
@@ -38,7 +38,7 @@ public:
   KmsPropBlobTests() : IgtTestHelper("kms_prop_blob") {}
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Full System Tests
     {.name = "blob-prop-core",
      .desc = "Tests error handling when invalid property IDs are passed.",
@@ -51,7 +51,9 @@ IgtSubtestParams subtests[] = {
      .rationale = "DRM property blob functionality"},
 };
 
-TEST_P(KmsPropBlobTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsPropBlobTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsPropBlobTests, KmsPropBlobTests,
                          ::testing::ValuesIn(subtests),
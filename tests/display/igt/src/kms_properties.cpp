@@ -38,7 +38,7 @@ public:
   KmsPropertiesTests() : IgtTestHelper("kms_properties") {}
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Fundamental Validation tests.
     {.name = "get_properties-sanity-atomic",
      .desc = "Test validates the properties of all planes, crtc and connectors "
@@ -57,7 +57,9 @@ IgtSubtestParams subtests[] = {
      .rationale = "basic prop functionality for connectors"},
 };
 
-TEST_P(KmsPropertiesTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsPropertiesTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsPropertiesTests, KmsPropertiesTests,
                          ::testing::ValuesIn(subtests),
@@ -35,10 +35,12 @@ namespace {
 class KmsRotationCrcTests : public ::testing::TestWithParam<IgtSubtestParams>,
                             public IgtTestHelper {
 public:
-  KmsRotationCrcTests() : IgtTestHelper("kms_rotation_crc") {}
+  KmsRotationCrcTests() : IgtTestHelper("kms_rotation_crc") {
+    traceFrames();
+  }
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     {.name = "%s-rotation-180",
      .desc = "Rotation test with 180 degree for (primary/sprite/cursor) planes",
      .rationale = "plane rotation"},
@@ -63,7 +65,9 @@ IgtSubtestParams subtests[] = {
      .rationale = "plane rotation"},
 };
 
-TEST_P(KmsRotationCrcTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsRotationCrcTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsRotationCrcTests, KmsRotationCrcTests,
                          ::testing::ValuesIn(subtests),
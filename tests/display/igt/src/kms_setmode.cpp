@@ -38,14 +38,16 @@ public:
   KmsSetmodeTests() : IgtTestHelper("kms_setmode") {}
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     {.name = "basic",
      .desc = "Tests the vblank timing by iterating through all valid "
              "crtc/connector combinations",
      .rationale = "basic functionality"},
 };
 
-TEST_P(KmsSetmodeTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsSetmodeTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsSetmodeTests, KmsSetmodeTests,
                          ::testing::ValuesIn(subtests),
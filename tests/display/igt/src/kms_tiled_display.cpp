@@ -37,7 +37,7 @@ public:
   KmsTiledDisplayTests() : IgtTestHelper("kms_tiled_display") {}
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Fundamental Validation tests.
     {.name = "basic-test-pattern",
      .desc = "Make sure the Tiled CRTCs are synchronized and we get page flips "
@@ -45,7 +45,9 @@ IgtSubtestParams subtests[] = {
      .rationale = "Failure could lead to tearing or other visual artifacts"},
 };
 
-TEST_P(KmsTiledDisplayTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsTiledDisplayTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsTiledDisplayTests, KmsTiledDisplayTests,
                          ::testing::ValuesIn(subtests),
@@ -37,7 +37,7 @@ public:
   KmsVblankTests() : IgtTestHelper("kms_vblank") {}
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     // Fundamental Validation tests.
     {.name = "crtc-id",
      .desc = "Check the vblank and flip events works with given crtc id",
@@ -68,7 +68,9 @@ IgtSubtestParams subtests[] = {
      .rationale = "checks for timing issues"},
 };
 
-TEST_P(KmsVblankTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsVblankTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsVblankTests, KmsVblankTests,
                          ::testing::ValuesIn(subtests),
@@ -38,7 +38,7 @@ public:
   KmsVrrTests() : IgtTestHelper("kms_vrr") {}
 };
 
-IgtSubtestParams subtests[] = {
+constexpr IgtSubtestParams subtests[] = {
     {.name = "flipline",
      .desc = "Make sure that flips happen at flipline decision boundary",
      .rationale = "smoother visual experience, especially in games and video"},
@@ -48,7 +48,9 @@ IgtSubtestParams subtests[] = {
      .rationale = "ensures that the feature works correctly"},
 };
 
-TEST_P(KmsVrrTests, RunSubTests) { runSubTest(GetParam()); }
+static_assert(IgtTestHelper::hasValidGTestNames(subtests));
+
+TEST_P(KmsVrrTests, RunSubTests) { runSubTest(GetParam(), subtests); }
 
 INSTANTIATE_TEST_SUITE_P(KmsVrrTests, KmsVrrTests,
                          ::testing::ValuesIn(subtests),
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Channel.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace android::automotive::proxy {
+
+// How many fills the capacity is reconsidered after.
+static constexpr unsigned kAdaptWindow = 16;
+
+Channel::Channel(ForwardingEngine engine, size_t capacity, size_t maxCapacity,
+                 DirectionMetrics* metrics)
+    : mCapacity(capacity), mMetrics(metrics) {
+    if (engine == ForwardingEngine::SPLICE && pipe2(mPipe, O_CLOEXEC | O_NONBLOCK) == 0) {
+        // The kernel rounds the pipe size up to whole pages.
+        fcntl(mPipe[1], F_SETPIPE_SZ, static_cast<int>(capacity));
+        int pipeSize = fcntl(mPipe[1], F_GETPIPE_SZ);
+        if (pipeSize > 0) {
+            mCapacity = pipeSize;
+        }
+    } else {
+        mPipe[0] = mPipe[1] = -1;
+        mBuffer = std::make_unique<char[]>(mCapacity);
+    }
+    mMinCapacity = mCapacity;
+    mMaxCapacity = std::max(mCapacity, maxCapacity);
+    mTargetCapacity = mCapacity;
+}
+
+Channel::~Channel() {
+    if (isSplicing()) {
+        close(mPipe[0]);
+        close(mPipe[1]);
+    }
+}
+
+bool Channel::switchToCopy() {
+    mBuffer = std::make_unique<char[]>(mCapacity);
+    // Move whatever is still in the pipe into the ring buffer. It always fits
+    // as the ring buffer has the capacity of the pipe.
+    for (size_t copied = 0; copied < mPending;) {
+        ssize_t readBytes = read(mPipe[0], mBuffer.get() + copied, mPending - copied);
+        if (readBytes <= 0) {
+            return false;
+        }
+        copied += readBytes;
+    }
+    close(mPipe[0]);
+    close(mPipe[1]);
+    mPipe[0] = mPipe[1] = -1;
+    mPipeFull = false;
+    mHead = 0;
+    return true;
+}
+
+void Channel::observeFill(size_t readBytes, size_t space) {
+    if (mMinCapacity == mMaxCapacity) {
+        return;
+    }
+    mFills++;
+    if (readBytes == space) {
+        mFullFills++;
+    }
+    mPeakPending = std::max(mPeakPending, mPending);
+    if (mFills < kAdaptWindow) {
+        return;
+    }
+
+    if (mFullFills * 2 >= mFills) {
+        // The source had more to give than fit most of the time.
+        mTargetCapacity = std::min(mCapacity * 2, mMaxCapacity);
+    } else if (mPeakPending <= mCapacity / 4) {
+        mTargetCapacity = std::max(mCapacity / 2, mMinCapacity);
+    }
+    mFills = 0;
+    mFullFills = 0;
+    mPeakPending = 0;
+}
+
+void Channel::resize() {
+    if (mTargetCapacity == mCapacity || mPending > 0) {
+        return;
+    }
+    if (isSplicing()) {
+        // Growing may exceed what an unprivileged process may allocate for
+        // pipes, in which case the pipe keeps its size.
+        fcntl(mPipe[1], F_SETPIPE_SZ, static_cast<int>(mTargetCapacity));
+        int pipeSize = fcntl(mPipe[1], F_GETPIPE_SZ);
+        if (pipeSize > 0) {
+            mCapacity = pipeSize;
+        }
+        mPipeFull = false;
+    } else {
+        mBuffer = std::make_unique<char[]>(mTargetCapacity);
+        mCapacity = mTargetCapacity;
+        mHead = 0;
+    }
+    mTargetCapacity = mCapacity;
+}
+
+IoStatus Channel::fill(int src_fd, size_t maxBytes) {
+    resize();
+    if (!canFill()) {
+        return IoStatus::AGAIN;
+    }
+
+    size_t space = mCapacity - mPending;
+    // Reads cut short by maxBytes don't count as filling the buffer, so they
+    // don't grow it.
+    size_t wanted = std::min(space, maxBytes);
+    ssize_t readBytes;
+    if (isSplicing()) {
+        readBytes = splice(src_fd, nullptr, mPipe[1], nullptr, wanted,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (readBytes < 0 && errno == EINVAL) {
+            if (!switchToCopy()) {
+                return IoStatus::ERROR;
+            }
+            return fill(src_fd, maxBytes);
+        }
+        if (readBytes < 0 && errno == EAGAIN && mPending > 0) {
+            // Either the socket is drained or the pipe ran out of pages.
+            // Reading resumes after the next flush either way.
+            mPipeFull = true;
+        }
+    } else {
+        size_t tail = (mHead + mPending) % mCapacity;
+        size_t first = std::min(wanted, mCapacity - tail);
+        iovec iov[2] = {{mBuffer.get() + tail, first}, {mBuffer.get(), wanted - first}};
+        readBytes = readv(src_fd, iov, wanted > first ? 2 : 1);
+    }
+
+    if (readBytes == 0) {
+        return IoStatus::END;
+    }
+    if (readBytes < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? IoStatus::AGAIN
+                                                                          : IoStatus::ERROR;
+    }
+    if (mPending == 0 && mMetrics != nullptr) {
+        mFilledAt = std::chrono::steady_clock::now();
+    }
+    mPending += readBytes;
+    observeFill(readBytes, space);
+    return IoStatus::OK;
+}
+
+IoStatus Channel::flush(int dst_fd) {
+    if (mPending == 0) {
+        return IoStatus::AGAIN;
+    }
+
+    ssize_t writtenBytes;
+    if (isSplicing()) {
+        writtenBytes = splice(mPipe[0], nullptr, dst_fd, nullptr, mPending,
+                              SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (writtenBytes < 0 && errno == EINVAL) {
+            if (!switchToCopy()) {
+                return IoStatus::ERROR;
+            }
+            return flush(dst_fd);
+        }
+    } else {
+        size_t first = std::min(mPending, mCapacity - mHead);
+        iovec iov[2] = {{mBuffer.get() + mHead, first}, {mBuffer.get(), mPending - first}};
+        writtenBytes = writev(dst_fd, iov, mPending > first ? 2 : 1);
+    }
+
+    if (writtenBytes < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? IoStatus::AGAIN
+                                                                          : IoStatus::ERROR;
+    }
+    mPending -= writtenBytes;
+    mHead = mPending == 0 ? 0 : (mHead + writtenBytes) % mCapacity;
+    if (writtenBytes > 0) {
+        mPipeFull = false;
+        if (mMetrics != nullptr) {
+            // Measured from the oldest byte that was pending, so this is an
+            // upper bound for the bytes just written.
+            auto now = std::chrono::steady_clock::now();
+            mMetrics->bytes.fetch_add(writtenBytes, std::memory_order_relaxed);
+            mMetrics->chunkLatency.record(now - mFilledAt);
+            mFilledAt = now;
+        }
+    }
+    return IoStatus::OK;
+}
+
+}  // namespace android::automotive::proxy
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <memory>
+
+#include "Forwarder.h"
+#include "Metrics.h"
+
+namespace android::automotive::proxy {
+
+enum class IoStatus {
+    // Some bytes were moved.
+    OK,
+    // The socket (or the buffer) is not ready, try again on the next
+    // readiness notification.
+    AGAIN,
+    // The source socket reached end of stream.
+    END,
+    // The socket failed; the connection must be closed.
+    ERROR,
+};
+
+// One direction of a connection between two non-blocking sockets. Bytes read
+// from the source socket are held until the destination socket accepts them,
+// so a slow destination pauses reading from the source instead of losing
+// data or blocking the event loop.
+//
+// With the splice engine the buffer is a pipe; otherwise it is a ring buffer
+// in user space. A channel switches to the ring buffer if the kernel refuses
+// to splice either socket.
+//
+// The capacity follows the traffic: a channel whose reads keep filling it
+// doubles up to maxCapacity, one which stays mostly empty halves back down to
+// its initial capacity. Resizing only happens while the buffer is empty.
+class Channel {
+  public:
+    // Bytes delivered by flush() are accounted to metrics, if given.
+    Channel(ForwardingEngine engine, size_t capacity, size_t maxCapacity,
+            DirectionMetrics* metrics = nullptr);
+    ~Channel();
+
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+
+    // Reads up to maxBytes from src_fd into the free space of the buffer.
+    IoStatus fill(int src_fd, size_t maxBytes = SIZE_MAX);
+
+    // Writes buffered bytes to dst_fd.
+    IoStatus flush(int dst_fd);
+
+    size_t pending() const { return mPending; }
+    size_t capacity() const { return mCapacity; }
+    bool canFill() const { return mPending < mCapacity && !mPipeFull; }
+
+  private:
+    bool isSplicing() const { return mPipe[0] >= 0; }
+    bool switchToCopy();
+    void observeFill(size_t readBytes, size_t space);
+    void resize();
+
+    int mPipe[2] = {-1, -1};
+    // Set when the pipe refused more bytes before mCapacity was reached (a
+    // pipe counts pages, not bytes). Cleared once the pipe is drained a bit.
+    bool mPipeFull = false;
+    std::unique_ptr<char[]> mBuffer;
+    size_t mCapacity;
+    size_t mMinCapacity;
+    size_t mMaxCapacity;
+    // Fills since the capacity was last reconsidered, how many of them took
+    // all the space offered, and the most bytes pending meanwhile.
+    unsigned mFills = 0;
+    unsigned mFullFills = 0;
+    size_t mPeakPending = 0;
+    // The capacity to switch to once the buffer is empty.
+    size_t mTargetCapacity;
+    size_t mHead = 0;
+    size_t mPending = 0;
+    DirectionMetrics* mMetrics;
+    // When the oldest buffered byte was read. Only meaningful with bytes
+    // pending.
+    std::chrono::steady_clock::time_point mFilledAt;
+};
+
+}  // namespace android::automotive::proxy
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ConfigWatcher.h"
+
+#include <errno.h>
+#include <iostream>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <map>
+#include <utility>
+
+namespace android::automotive::proxy {
+
+using proxyconfig::ServiceConfig;
+using proxyconfig::VmConfig;
+
+using ServiceKey = std::pair<unsigned, unsigned>;
+
+// The services of vmConfigs with the VM they belong to.
+static std::map<ServiceKey, std::pair<const VmConfig*, const ServiceConfig*>> servicesByKey(
+        const std::vector<VmConfig>& vmConfigs) {
+    std::map<ServiceKey, std::pair<const VmConfig*, const ServiceConfig*>> services;
+    for (const auto& vmConfig : vmConfigs) {
+        for (const auto& service : vmConfig.services) {
+            services.emplace(ServiceKey(vmConfig.cid, service.port),
+                             std::pair(&vmConfig, &service));
+        }
+    }
+    return services;
+}
+
+ConfigWatcher::ConfigWatcher(std::vector<VmConfig> current, ServiceCallback onAdded,
+                             ServiceCallback onRemoved)
+    : mCurrent(std::move(current)),
+      mOnAdded(std::move(onAdded)),
+      mOnRemoved(std::move(onRemoved)) {}
+
+ConfigWatcher::~ConfigWatcher() {
+    if (mThread.joinable()) {
+        uint64_t one = 1;
+        write(mStopFd, &one, sizeof(one));
+        mThread.join();
+    }
+    if (mInotifyFd >= 0) {
+        close(mInotifyFd);
+    }
+    if (mStopFd >= 0) {
+        close(mStopFd);
+    }
+}
+
+bool ConfigWatcher::start() {
+    std::string path(proxyconfig::getProxyConfigFile());
+    size_t slash = path.rfind('/');
+    mDirectory = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+    mFileName = slash == std::string::npos ? path : path.substr(slash + 1);
+
+    mInotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    mStopFd = eventfd(0, EFD_CLOEXEC);
+    if (mInotifyFd < 0 || mStopFd < 0) {
+        std::cerr << "Failed to set up config watcher, ERROR = " << strerror(errno) << std::endl;
+        return false;
+    }
+    // The directory is watched rather than the file, as editors and package
+    // updates replace the file instead of writing to it.
+    if (inotify_add_watch(mInotifyFd, mDirectory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        std::cerr << "Failed to watch " << mDirectory << ", ERROR = " << strerror(errno)
+                  << std::endl;
+        return false;
+    }
+    mThread = std::thread(&ConfigWatcher::watch, this);
+    return true;
+}
+
+void ConfigWatcher::watch() {
+    alignas(inotify_event) char buffer[4096];
+    pollfd fds[] = {{mInotifyFd, POLLIN, 0}, {mStopFd, POLLIN, 0}};
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "ERROR in poll!. Error = " << strerror(errno) << std::endl;
+            return;
+        }
+        if (fds[1].revents & POLLIN) {
+            return;
+        }
+
+        bool changed = false;
+        ssize_t length;
+        while ((length = read(mInotifyFd, buffer, sizeof(buffer))) > 0) {
+            for (char* next = buffer; next < buffer + length;) {
+                auto* event = reinterpret_cast<inotify_event*>(next);
+                if (event->len > 0 && mFileName == event->name) {
+                    changed = true;
+                }
+                next += sizeof(inotify_event) + event->len;
+            }
+        }
+        if (changed) {
+            reload();
+        }
+    }
+}
+
+void ConfigWatcher::reload() {
+    proxyconfig::ProxyConfigResult result = proxyconfig::readProxyConfigFile();
+    if (!result.ok()) {
+        std::cerr << "Ignoring invalid proxy config " << proxyconfig::getProxyConfigFile()
+                  << std::endl;
+        for (const auto& error : result.errors) {
+            std::cerr << "  " << error.toString() << std::endl;
+        }
+        return;
+    }
+    auto& vmConfigs = result.vmConfigs;
+
+    auto before = servicesByKey(mCurrent);
+    auto after = servicesByKey(vmConfigs);
+    // Removed services release their ports before added ones bind theirs.
+    for (const auto& [key, entry] : before) {
+        const auto& [vmConfig, service] = entry;
+        if (after.find(key) == after.end()) {
+            std::cerr << "Removing service " << service->name << " of CID " << key.first
+                      << std::endl;
+            mOnRemoved(*vmConfig, *service);
+        }
+    }
+    for (const auto& [key, entry] : after) {
+        const auto& [vmConfig, service] = entry;
+        auto previous = before.find(key);
+        if (previous == before.end()) {
+            std::cerr << "Adding service " << service->name << " of CID " << key.first
+                      << std::endl;
+            mOnAdded(*vmConfig, *service);
+        } else if (!(*previous->second.second == *service)) {
+            std::cerr << "Changes to service " << service->name << " of CID " << key.first
+                      << " take effect after a restart" << std::endl;
+        }
+    }
+    mCurrent = std::move(vmConfigs);
+}
+
+}  // namespace android::automotive::proxy
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ProxyConfig.h"
+
+namespace android::automotive::proxy {
+
+// Watches the proxy config file with inotify and reports which services were
+// added to or removed from it, so routes can change without a restart.
+// Services are identified by the CID of their VM and their port; other
+// changes to a service are only picked up by a restart.
+class ConfigWatcher {
+  public:
+    using ServiceCallback = std::function<void(const proxyconfig::VmConfig& vmConfig,
+                                               const proxyconfig::ServiceConfig& service)>;
+
+    // current is the config the proxy runs with. The callbacks run on the
+    // watcher's thread. A reload reports every removed service before the
+    // added ones, and onRemoved must only return once the listening sockets
+    // of the service are closed, so an added service can bind the ports a
+    // removed one used.
+    ConfigWatcher(std::vector<proxyconfig::VmConfig> current, ServiceCallback onAdded,
+                  ServiceCallback onRemoved);
+    ~ConfigWatcher();
+
+    ConfigWatcher(const ConfigWatcher&) = delete;
+    ConfigWatcher& operator=(const ConfigWatcher&) = delete;
+
+    // Starts watching the file set with proxyconfig::setProxyConfigFile().
+    bool start();
+
+  private:
+    void watch();
+    void reload();
+
+    std::vector<proxyconfig::VmConfig> mCurrent;
+    ServiceCallback mOnAdded;
+    ServiceCallback mOnRemoved;
+    std::string mDirectory;
+    std::string mFileName;
+    int mInotifyFd = -1;
+    int mStopFd = -1;
+    std::thread mThread;
+};
+
+}  // namespace android::automotive::proxy
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ConnectionLimiter.h"
+
+namespace android::automotive::proxy {
+
+ConnectionLimiter::ConnectionLimiter(unsigned limit, ConnectionLimiter* parent)
+    : mLimit(limit), mParent(parent) {}
+
+bool ConnectionLimiter::tryAcquire() {
+    unsigned active = mActive.load(std::memory_order_relaxed);
+    do {
+        if (mLimit != 0 && active >= mLimit) {
+            return false;
+        }
+    } while (!mActive.compare_exchange_weak(active, active + 1, std::memory_order_relaxed));
+
+    if (mParent != nullptr && !mParent->tryAcquire()) {
+        decrement();
+        return false;
+    }
+    return true;
+}
+
+void ConnectionLimiter::release() {
+    decrement();
+    if (mParent != nullptr) {
+        mParent->release();
+    }
+}
+
+void ConnectionLimiter::decrement() {
+    if (mActive.fetch_sub(1, std::memory_order_relaxed) == 1) {
+        // Taking the lock orders this with a waiter between its check and its
+        // wait, so the wakeup is not lost.
+        std::lock_guard<std::mutex> lock(mIdleLock);
+        mIdle.notify_all();
+    }
+}
+
+bool ConnectionLimiter::waitUntilIdle(std::chrono::steady_clock::time_point deadline) const {
+    std::unique_lock<std::mutex> lock(mIdleLock);
+    return mIdle.wait_until(lock, deadline, [this]() { return active() == 0; });
+}
+
+}  // namespace android::automotive::proxy
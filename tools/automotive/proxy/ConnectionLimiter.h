@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace android::automotive::proxy {
+
+// Bounds the number of connections forwarded at once. A limiter may be nested
+// in a parent, e.g. a per-service limit in the proxy-wide one; a connection is
+// only admitted when every level has room for it. Thread safe.
+class ConnectionLimiter {
+  public:
+    // A limit of zero admits any number of connections.
+    explicit ConnectionLimiter(unsigned limit, ConnectionLimiter* parent = nullptr);
+
+    ConnectionLimiter(const ConnectionLimiter&) = delete;
+    ConnectionLimiter& operator=(const ConnectionLimiter&) = delete;
+
+    // Reserves room for one connection. Returns false if this limiter or its
+    // parent is full, in which case the client should be turned away.
+    bool tryAcquire();
+
+    // Gives back the room reserved by a successful tryAcquire().
+    void release();
+
+    unsigned active() const { return mActive.load(std::memory_order_relaxed); }
+
+    // Waits until no connection is active or until deadline. Returns whether
+    // none is.
+    bool waitUntilIdle(std::chrono::steady_clock::time_point deadline) const;
+
+  private:
+    // Takes back one connection, waking waitUntilIdle() if it was the last.
+    void decrement();
+
+    const unsigned mLimit;
+    ConnectionLimiter* const mParent;
+    std::atomic<unsigned> mActive{0};
+    // Only taken when the last connection goes away and by waitUntilIdle(), so
+    // admitting and releasing clients stays lock-free otherwise.
+    mutable std::mutex mIdleLock;
+    mutable std::condition_variable mIdle;
+};
+
+}  // namespace android::automotive::proxy
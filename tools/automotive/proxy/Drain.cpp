@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Drain.h"
+
+#include <errno.h>
+#include <iostream>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+
+#include "Log.h"
+
+namespace android::automotive::proxy {
+
+static int sDrainFd = -1;
+static std::chrono::seconds sDrainTimeout{0};
+static std::atomic<bool> sDraining{false};
+
+static void onTerminate(int /* signal */) {
+    sDraining.store(true, std::memory_order_relaxed);
+    uint64_t one = 1;
+    // Only async-signal-safe calls here; the loops take it from the eventfd.
+    write(sDrainFd, &one, sizeof(one));
+}
+
+static void awaitDrain(const ConnectionLimiter* connections, std::chrono::seconds timeout) {
+    pollfd drain{sDrainFd, POLLIN, 0};
+    while (poll(&drain, 1, -1) < 0 && errno == EINTR) {
+    }
+
+    std::cerr << "Draining " << connections->active() << " connections" << std::endl;
+    if (!connections->waitUntilIdle(std::chrono::steady_clock::now() + timeout)) {
+        std::cerr << "Drain timed out, dropping " << connections->active() << " connections"
+                  << std::endl;
+    }
+
+    // The loops are still running, so leave without running static
+    // destructors under their feet.
+    flushLog();
+    std::cout.flush();
+    std::cerr.flush();
+    _exit(0);
+}
+
+bool installDrainHandler(const ConnectionLimiter& connections, std::chrono::seconds timeout) {
+    sDrainTimeout = timeout;
+    sDrainFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (sDrainFd < 0) {
+        std::cerr << "Failed to create drain eventfd, ERROR = " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct sigaction action {};
+    action.sa_handler = onTerminate;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGTERM, &action, nullptr) != 0) {
+        std::cerr << "Failed to install SIGTERM handler, ERROR = " << strerror(errno)
+                  << std::endl;
+        return false;
+    }
+
+    std::thread(awaitDrain, &connections, timeout).detach();
+    return true;
+}
+
+int drainEventFd() {
+    return sDrainFd;
+}
+
+std::chrono::seconds drainTimeout() {
+    return sDrainTimeout;
+}
+
+bool isDraining() {
+    return sDraining.load(std::memory_order_relaxed);
+}
+
+}  // namespace android::automotive::proxy
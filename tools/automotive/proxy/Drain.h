@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+
+#include "ConnectionLimiter.h"
+
+namespace android::automotive::proxy {
+
+// Graceful shutdown. SIGTERM starts a drain: the proxy stops accepting
+// clients, lets the connections it is forwarding finish, and exits once they
+// have or once the drain timeout expired.
+
+// Installs the SIGTERM handler, and a thread which ends the process when
+// connections has nothing left to forward after a drain started.
+bool installDrainHandler(const ConnectionLimiter& connections, std::chrono::seconds timeout);
+
+// An eventfd which becomes readable, and stays readable, once a drain started,
+// so every loop can poll it without consuming it. -1 before
+// installDrainHandler().
+int drainEventFd();
+
+// The timeout given to installDrainHandler(), which also bounds how long a
+// removed route waits for its connections.
+std::chrono::seconds drainTimeout();
+
+bool isDraining();
+
+}  // namespace android::automotive::proxy
@@ -0,0 +1,682 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "EventLoop.h"
+
+#include <errno.h>
+#include <algorithm>
+#include <initializer_list>
+#include <iostream>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <linux/vm_sockets.h>
+
+#include "Channel.h"
+#include "Drain.h"
+#include "Log.h"
+#include "SocketUtils.h"
+
+namespace android::automotive::proxy {
+
+static constexpr int kMaxEvents = 64;
+static constexpr int kMaxAcceptBatch = 64;
+// How often connections are checked against their route's idle timeout.
+static constexpr auto kIdleCheckInterval = std::chrono::seconds(1);
+// Bytes a connection of weight one may read per socket and wakeup. A loop
+// handles every ready socket once per wakeup, and level-triggered epoll
+// reports the sockets which still have data after those which didn't get a
+// turn, so a bulk transfer only delays the other connections by its quantum.
+static constexpr size_t kFairQuantum = 64 * 1024;
+
+// A client socket paired with its socket to the forwarding address. Both
+// sockets are non-blocking and every direction is buffered separately, so a
+// slow reader on one side only pauses reading from the other side.
+class Connection {
+  public:
+    // The client must have been admitted by the route's limiter, which the
+    // connection releases when it is destroyed.
+    Connection(EventLoop& loop, int clientFd, std::shared_ptr<const Route> route)
+        : mLoop(loop),
+          mRoute(std::move(route)),
+          mMetrics(*mRoute->metrics),
+          mLastActive(std::chrono::steady_clock::now()),
+          mQuantum(kFairQuantum * mRoute->weight),
+          mUpstream(loop.engine(), mRoute->buffers.bufferSize, mRoute->buffers.maxBufferSize,
+                    &mMetrics.toServer),
+          mDownstream(loop.engine(), mRoute->buffers.bufferSize, mRoute->buffers.maxBufferSize,
+                      &mMetrics.toClient),
+          mClient(*this, clientFd, mUpstream, mDownstream),
+          mServer(*this, -1, mDownstream, mUpstream) {
+        mMetrics.activeConnections.fetch_add(1, std::memory_order_relaxed);
+        setSocketBufferSizes(clientFd, mRoute->buffers);
+    }
+
+    ~Connection() {
+        mMetrics.activeConnections.fetch_sub(1, std::memory_order_relaxed);
+        mRoute->limiter->release();
+        for (Endpoint* endpoint : {&mClient, &mServer}) {
+            if (endpoint->fd < 0) {
+                continue;
+            }
+            if (endpoint->registered) {
+                mLoop.remove(endpoint->fd);
+            }
+            closeFileDescriptor(endpoint->fd);
+        }
+    }
+
+    // Starts a non-blocking connect to the forwarding address, unless the
+    // route's pool has an established connection ready. Bytes are only
+    // forwarded once the connect has completed.
+    bool start() {
+        UpstreamPool* pool = mRoute->pool.get();
+        if (pool != nullptr && (mServer.fd = pool->take()) >= 0) {
+            setSocketBufferSizes(mServer.fd, mRoute->buffers);
+            mMetrics.pooledConnections.fetch_add(1, std::memory_order_relaxed);
+            mConnectTimer.record(mMetrics.connectLatency);
+            mConnecting = false;
+            updateInterest();
+            return !mClosed;
+        }
+
+        mServer.fd = socket(AF_VSOCK, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (mServer.fd < 0) {
+            logMessage(LOG_SITE(), logFields(errno), "Failed to create forwarding VSOCK socket");
+            return false;
+        }
+        setSocketBufferSizes(mServer.fd, mRoute->buffers);
+
+        sockaddr_vm fwd_addr{};
+        fwd_addr.svm_family = AF_VSOCK;
+        fwd_addr.svm_cid = mRoute->fwdCid;
+        fwd_addr.svm_port = mRoute->fwdPort;
+
+        if (connect(mServer.fd, reinterpret_cast<sockaddr*>(&fwd_addr), sizeof(fwd_addr)) < 0 &&
+            errno != EINPROGRESS) {
+            logMessage(LOG_SITE(), logFields(errno),
+                       "Failed to connect to forwarding vsock socket");
+            mMetrics.connectErrors.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        mServer.registered = mLoop.add(mServer.fd, EPOLLOUT, &mServer);
+        mServer.interest = EPOLLOUT;
+        return mServer.registered;
+    }
+
+    // Hands the connection back to the loop for destruction. Events already
+    // fetched for either socket are ignored from here on.
+    void close() {
+        if (!mClosed) {
+            mClosed = true;
+            mLoop.release(this);
+        }
+    }
+
+    // Closes the connection if neither socket had an event for longer than
+    // the route's idle timeout.
+    void closeIfIdle(std::chrono::steady_clock::time_point now) {
+        if (mRoute->idleTimeout.count() > 0 && now - mLastActive >= mRoute->idleTimeout) {
+            mMetrics.idleTimeouts.fetch_add(1, std::memory_order_relaxed);
+            close();
+        }
+    }
+
+    // Reads again from the sockets throttled by the route's rate limiter.
+    void resume() {
+        mResumeScheduled = false;
+        mClient.throttled = false;
+        mServer.throttled = false;
+        updateInterest();
+    }
+
+  private:
+    // One of the two sockets of the connection, with the channel it fills
+    // and the channel it drains.
+    struct Endpoint : public EventHandler {
+        Endpoint(Connection& connection, int fd, Channel& in, Channel& out)
+            : connection(connection), fd(fd), in(in), out(out) {}
+
+        void handleEvents(uint32_t events) override { connection.handleEvents(*this, events); }
+
+        Connection& connection;
+        int fd;
+        Channel& in;
+        Channel& out;
+        uint32_t interest = 0;
+        bool registered = false;
+        // End of stream was read; nothing more will be read from fd.
+        bool readClosed = false;
+        // fd was shut down for writing, or its peer can no longer receive.
+        bool writeClosed = false;
+        // Both directions of fd are shut down. epoll reports this regardless
+        // of interest, so fd is unregistered while it has nothing to do.
+        bool hungUp = false;
+        // Not read from until the route's rate limiter has bytes again.
+        bool throttled = false;
+    };
+
+    Endpoint& peerOf(Endpoint& endpoint) { return &endpoint == &mClient ? mServer : mClient; }
+
+    void handleEvents(Endpoint& endpoint, uint32_t events) {
+        if (mClosed) {
+            return;
+        }
+        mLastActive = std::chrono::steady_clock::now();
+        if (mConnecting) {
+            finishConnect(events);
+            return;
+        }
+        if (events & EPOLLERR) {
+            close();
+            return;
+        }
+        if (events & EPOLLHUP) {
+            endpoint.hungUp = true;
+        }
+        if (events & (EPOLLIN | EPOLLHUP)) {
+            readFrom(endpoint);
+        }
+        if ((events & EPOLLOUT) && !mClosed) {
+            writeTo(endpoint);
+        }
+        updateInterest();
+    }
+
+    // Reads what fits from src, up to the connection's quantum and what the
+    // route's rate limit allows, and immediately tries to pass it on, which
+    // saves a round trip through epoll whenever the peer can take it.
+    void readFrom(Endpoint& src) {
+        if (src.readClosed) {
+            return;
+        }
+        size_t budget = mQuantum;
+        size_t granted = 0;
+        // epoll keeps reporting a socket which hung up, so its last bytes are
+        // read regardless of the limit.
+        RateLimiter* rateLimiter = src.hungUp ? nullptr : mRoute->rateLimiter.get();
+        if (rateLimiter != nullptr && src.in.canFill()) {
+            granted = budget = rateLimiter->acquire(
+                std::min(budget, src.in.capacity() - src.in.pending()));
+            if (granted == 0) {
+                throttle(src, rateLimiter->delay());
+                writeTo(peerOf(src));
+                return;
+            }
+        }
+        size_t pendingBefore = src.in.pending();
+        IoStatus status = src.in.fill(src.fd, budget);
+        if (granted > 0) {
+            rateLimiter->refund(granted - std::min(granted, src.in.pending() - pendingBefore));
+        }
+        switch (status) {
+            case IoStatus::OK:
+            case IoStatus::AGAIN:
+                break;
+            case IoStatus::END:
+                src.readClosed = true;
+                break;
+            case IoStatus::ERROR:
+                close();
+                return;
+        }
+        writeTo(peerOf(src));
+    }
+
+    void writeTo(Endpoint& dst) {
+        if (dst.writeClosed) {
+            return;
+        }
+        Endpoint& src = peerOf(dst);
+        if (dst.out.pending() > 0 && dst.out.flush(dst.fd) == IoStatus::ERROR) {
+            // The destination is gone. Whatever is still buffered for it is
+            // dropped and nothing more is read for it.
+            dst.writeClosed = true;
+            src.readClosed = true;
+            return;
+        }
+        // Forward a half close once everything read before it was delivered.
+        if (src.readClosed && dst.out.pending() == 0) {
+            shutdown(dst.fd, SHUT_WR);
+            dst.writeClosed = true;
+        }
+    }
+
+    void updateInterest() {
+        if (mClosed) {
+            return;
+        }
+        if (mClient.writeClosed && mServer.writeClosed) {
+            close();
+            return;
+        }
+        for (Endpoint* endpoint : {&mClient, &mServer}) {
+            uint32_t events = 0;
+            if (!endpoint->readClosed && !endpoint->throttled && endpoint->in.canFill()) {
+                events |= EPOLLIN;
+            }
+            if (!endpoint->writeClosed && endpoint->out.pending() > 0) {
+                events |= EPOLLOUT;
+            }
+
+            bool ok = true;
+            if (events == 0 && endpoint->hungUp) {
+                if (endpoint->registered) {
+                    mLoop.remove(endpoint->fd);
+                    endpoint->registered = false;
+                }
+            } else if (!endpoint->registered) {
+                ok = endpoint->registered = mLoop.add(endpoint->fd, events, endpoint);
+            } else if (events != endpoint->interest) {
+                ok = mLoop.modify(endpoint->fd, events, endpoint);
+            }
+            if (!ok) {
+                close();
+                return;
+            }
+            endpoint->interest = events;
+        }
+    }
+
+    void throttle(Endpoint& endpoint, std::chrono::steady_clock::duration delay) {
+        mMetrics.throttledReads.fetch_add(1, std::memory_order_relaxed);
+        endpoint.throttled = true;
+        if (!mResumeScheduled) {
+            mResumeScheduled = true;
+            mLoop.resumeLater(this, std::chrono::steady_clock::now() + delay);
+        }
+    }
+
+    LogFields logFields(int error) const {
+        return {.service = mRoute->serviceName.c_str(), .cid = mRoute->fwdCid, .error = error};
+    }
+
+    void finishConnect(uint32_t events) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (!(events & EPOLLOUT) ||
+            getsockopt(mServer.fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0 || error != 0) {
+            logMessage(LOG_SITE(), logFields(error ? error : errno),
+                       "Failed to connect to forwarding vsock socket");
+            mMetrics.connectErrors.fetch_add(1, std::memory_order_relaxed);
+            close();
+            return;
+        }
+
+        mConnectTimer.record(mMetrics.connectLatency);
+        mConnecting = false;
+        updateInterest();
+    }
+
+    EventLoop& mLoop;
+    const std::shared_ptr<const Route> mRoute;
+    ServiceMetrics& mMetrics;
+    std::chrono::steady_clock::time_point mLastActive;
+    // Most bytes read from either socket per wakeup.
+    const size_t mQuantum;
+    LatencyTimer mConnectTimer;
+    bool mConnecting = true;
+    bool mClosed = false;
+    bool mResumeScheduled = false;
+    Channel mUpstream;
+    Channel mDownstream;
+    Endpoint mClient;
+    Endpoint mServer;
+};
+
+// Accepts clients of a Route from one of its sockets on behalf of one
+// EventLoop.
+class Listener : public EventHandler {
+  public:
+    Listener(EventLoop& loop, std::shared_ptr<const Route> route, int listenFd)
+        : mLoop(loop), mRoute(std::move(route)), mListenFd(listenFd) {}
+
+    int listenFd() const { return mListenFd; }
+    const std::shared_ptr<const Route>& route() const { return mRoute; }
+
+    // Drains up to kMaxAcceptBatch clients from the backlog per wakeup and
+    // spreads them across the loops.
+    void handleEvents(uint32_t /* events */) override {
+        for (int i = 0; i < kMaxAcceptBatch; i++) {
+            int client_sock =
+                accept4(mListenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client_sock < 0) {
+                // Every loop may be woken for the shared listening socket;
+                // finding the backlog already drained is expected.
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    logMessage(LOG_SITE(),
+                               {.service = mRoute->serviceName.c_str(), .error = errno},
+                               "Failed to accept connection");
+                    mRoute->metrics->acceptErrors.fetch_add(1, std::memory_order_relaxed);
+                }
+                return;
+            }
+            mRoute->metrics->acceptedConnections.fetch_add(1, std::memory_order_relaxed);
+            if (!mRoute->limiter->tryAcquire()) {
+                // Shed the load rather than queueing clients without bound.
+                mRoute->metrics->rejectedConnections.fetch_add(1, std::memory_order_relaxed);
+                closeFileDescriptor(client_sock);
+                continue;
+            }
+            if (mRoute->mux != nullptr) {
+                mRoute->mux->addClient(client_sock);
+                continue;
+            }
+            mLoop.dispatch(client_sock, mRoute);
+        }
+    }
+
+  private:
+    EventLoop& mLoop;
+    const std::shared_ptr<const Route> mRoute;
+    const int mListenFd;
+};
+
+// Wakes a loop up when other loops posted clients to it.
+class Inbox : public EventHandler {
+  public:
+    explicit Inbox(EventLoop& loop) : mLoop(loop) {}
+
+    ~Inbox() {
+        if (mFd >= 0) {
+            ::close(mFd);
+        }
+    }
+
+    bool init() {
+        mFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        return mFd >= 0 && mLoop.add(mFd, EPOLLIN, this);
+    }
+
+    void notify() {
+        uint64_t one = 1;
+        write(mFd, &one, sizeof(one));
+    }
+
+    void handleEvents(uint32_t /* events */) override {
+        uint64_t count;
+        read(mFd, &count, sizeof(count));
+        mLoop.drainInbox();
+    }
+
+  private:
+    EventLoop& mLoop;
+    int mFd = -1;
+};
+
+// Stops the loop from accepting clients once the proxy drains.
+class DrainWatcher : public EventHandler {
+  public:
+    explicit DrainWatcher(EventLoop& loop) : mLoop(loop) {}
+
+    void handleEvents(uint32_t /* events */) override { mLoop.stopAccepting(); }
+
+  private:
+    EventLoop& mLoop;
+};
+
+EventLoop::EventLoop(ForwardingEngine engine) : mEngine(engine) {}
+
+EventLoop::~EventLoop() {
+    mReleased.clear();
+    mReleasedListeners.clear();
+    mConnections.clear();
+    mListeners.clear();
+    mInbox.reset();
+    for (auto& [clientFd, route] : mInboxClients) {
+        closeFileDescriptor(clientFd);
+    }
+    if (mEpollFd >= 0) {
+        close(mEpollFd);
+    }
+}
+
+bool EventLoop::init() {
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (mEpollFd < 0) {
+        std::cerr << "Failed to create epoll instance, ERROR = " << strerror(errno) << std::endl;
+        return false;
+    }
+    mInbox = std::make_unique<Inbox>(*this);
+    if (!mInbox->init()) {
+        std::cerr << "Failed to set up event loop inbox, ERROR = " << strerror(errno)
+                  << std::endl;
+        return false;
+    }
+    if (drainEventFd() >= 0) {
+        mDrainWatcher = std::make_unique<DrainWatcher>(*this);
+        if (!add(drainEventFd(), EPOLLIN, mDrainWatcher.get())) {
+            return false;
+        }
+    }
+    mLastIdleCheck = std::chrono::steady_clock::now();
+    return true;
+}
+
+bool EventLoop::addRoute(std::shared_ptr<const Route> route) {
+    for (int listenFd : route->listenFds) {
+        auto listener = std::make_unique<Listener>(*this, route, listenFd);
+        if (!add(listenFd, EPOLLIN | EPOLLEXCLUSIVE, listener.get())) {
+            return false;
+        }
+        mListeners.push_back(std::move(listener));
+    }
+    return true;
+}
+
+void EventLoop::removeRoute(const std::shared_ptr<const Route>& route) {
+    auto removed = std::stable_partition(mListeners.begin(), mListeners.end(),
+                                         [&route](const auto& candidate) {
+                                             return candidate->route() != route;
+                                         });
+    for (auto listener = removed; listener != mListeners.end(); listener++) {
+        remove((*listener)->listenFd());
+        // Events for the listener may still be pending in the current batch.
+        mReleasedListeners.push_back(std::move(*listener));
+    }
+    mListeners.erase(removed, mListeners.end());
+}
+
+void EventLoop::postTask(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mInboxLock);
+        mInboxTasks.push_back(std::move(task));
+    }
+    mInbox->notify();
+}
+
+void EventLoop::setPeers(std::vector<EventLoop*> peers) {
+    mPeers = std::move(peers);
+}
+
+void EventLoop::run() {
+    epoll_event events[kMaxEvents];
+    while (true) {
+        int count = epoll_wait(mEpollFd, events, kMaxEvents, waitTimeout());
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            logMessage(LOG_SITE(), {.error = errno}, "ERROR in epoll_wait!");
+            return;
+        }
+        for (int i = 0; i < count; i++) {
+            static_cast<EventHandler*>(events[i].data.ptr)->handleEvents(events[i].events);
+        }
+        resumeThrottledConnections();
+        closeIdleConnections();
+        mReleased.clear();
+        mReleasedListeners.clear();
+    }
+}
+
+void EventLoop::stopAccepting() {
+    // The listeners are kept, as events for them may still be pending in the
+    // current batch.
+    for (const auto& listener : mListeners) {
+        remove(listener->listenFd());
+    }
+    remove(drainEventFd());
+}
+
+int EventLoop::waitTimeout() const {
+    auto timeout = std::chrono::milliseconds(kIdleCheckInterval);
+    if (!mThrottled.empty()) {
+        auto next = std::min_element(mThrottled.begin(), mThrottled.end())->first;
+        // Rounded up, so the loop doesn't wake up just before the time.
+        auto untilNext = std::chrono::ceil<std::chrono::milliseconds>(
+            next - std::chrono::steady_clock::now());
+        timeout = std::clamp(untilNext, std::chrono::milliseconds(0), timeout);
+    }
+    return timeout.count();
+}
+
+void EventLoop::resumeLater(Connection* connection, std::chrono::steady_clock::time_point when) {
+    mThrottled.emplace_back(when, connection);
+}
+
+void EventLoop::resumeThrottledConnections() {
+    if (mThrottled.empty()) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    // Resuming a connection may throttle it again, which appends to
+    // mThrottled.
+    std::vector<Connection*> due;
+    auto waiting = std::partition(mThrottled.begin(), mThrottled.end(),
+                                  [now](const auto& entry) { return entry.first <= now; });
+    for (auto entry = mThrottled.begin(); entry != waiting; entry++) {
+        due.push_back(entry->second);
+    }
+    mThrottled.erase(mThrottled.begin(), waiting);
+    for (Connection* connection : due) {
+        connection->resume();
+    }
+}
+
+void EventLoop::closeIdleConnections() {
+    auto now = std::chrono::steady_clock::now();
+    if (now - mLastIdleCheck < kIdleCheckInterval) {
+        return;
+    }
+    mLastIdleCheck = now;
+
+    // Closing a connection removes it from mConnections.
+    std::vector<Connection*> connections;
+    connections.reserve(mConnections.size());
+    for (const auto& [connection, owner] : mConnections) {
+        connections.push_back(connection);
+    }
+    for (Connection* connection : connections) {
+        connection->closeIfIdle(now);
+    }
+}
+
+void EventLoop::dispatch(int clientFd, std::shared_ptr<const Route> route) {
+    EventLoop* target = this;
+    for (EventLoop* peer : mPeers) {
+        if (peer->mLoad.load(std::memory_order_relaxed) <
+            target->mLoad.load(std::memory_order_relaxed)) {
+            target = peer;
+        }
+    }
+    target->mLoad.fetch_add(1, std::memory_order_relaxed);
+    if (target == this) {
+        startConnection(clientFd, route);
+    } else {
+        target->post(clientFd, std::move(route));
+    }
+}
+
+void EventLoop::post(int clientFd, std::shared_ptr<const Route> route) {
+    {
+        std::lock_guard<std::mutex> lock(mInboxLock);
+        mInboxClients.emplace_back(clientFd, std::move(route));
+    }
+    mInbox->notify();
+}
+
+void EventLoop::drainInbox() {
+    std::vector<std::pair<int, std::shared_ptr<const Route>>> clients;
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(mInboxLock);
+        clients.swap(mInboxClients);
+        tasks.swap(mInboxTasks);
+    }
+    for (const auto& [clientFd, route] : clients) {
+        startConnection(clientFd, route);
+    }
+    for (const auto& task : tasks) {
+        task();
+    }
+}
+
+void EventLoop::startConnection(int clientFd, const std::shared_ptr<const Route>& route) {
+    auto connection = std::make_unique<Connection>(*this, clientFd, route);
+    Connection* pending = connection.get();
+    mConnections.emplace(pending, std::move(connection));
+    if (!pending->start()) {
+        pending->close();
+    }
+}
+
+bool EventLoop::add(int fd, uint32_t events, EventHandler* handler) {
+    epoll_event event{};
+    event.events = events;
+    event.data.ptr = handler;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        logMessage(LOG_SITE(), {.error = errno}, "Failed to add fd to epoll");
+        return false;
+    }
+    return true;
+}
+
+bool EventLoop::modify(int fd, uint32_t events, EventHandler* handler) {
+    epoll_event event{};
+    event.events = events;
+    event.data.ptr = handler;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_MOD, fd, &event) != 0) {
+        logMessage(LOG_SITE(), {.error = errno}, "Failed to modify fd in epoll");
+        return false;
+    }
+    return true;
+}
+
+void EventLoop::remove(int fd) {
+    // Fails harmlessly for sockets which were never registered.
+    epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void EventLoop::release(Connection* connection) {
+    auto entry = mConnections.find(connection);
+    if (entry == mConnections.end()) {
+        return;
+    }
+    mThrottled.erase(std::remove_if(mThrottled.begin(), mThrottled.end(),
+                                    [connection](const auto& throttled) {
+                                        return throttled.second == connection;
+                                    }),
+                     mThrottled.end());
+    mReleased.push_back(std::move(entry->second));
+    mConnections.erase(entry);
+    mLoad.fetch_sub(1, std::memory_order_relaxed);
+}
+
+}  // namespace android::automotive::proxy
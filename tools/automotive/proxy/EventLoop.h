@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ConnectionLimiter.h"
+#include "Forwarder.h"
+#include "Metrics.h"
+#include "RateLimiter.h"
+#include "SocketUtils.h"
+#include "UpstreamMux.h"
+#include "UpstreamPool.h"
+
+namespace android::automotive::proxy {
+
+// Receives readiness notifications for a file descriptor registered with an
+// EventLoop.
+class EventHandler {
+  public:
+    virtual ~EventHandler() = default;
+    virtual void handleEvents(uint32_t events) = 0;
+};
+
+// The listening sockets of a service and the address its clients are
+// forwarded to. The same route is shared by every EventLoop of the proxy, and
+// kept alive by the connections it accepted after it was removed.
+struct Route {
+    std::string serviceName;
+    // The VSOCK socket, followed by those of the service's frontends.
+    std::vector<int> listenFds;
+    unsigned fwdCid;
+    unsigned fwdPort;
+    ServiceMetrics* metrics;
+    // Established connections to the forwarding address, or null.
+    std::unique_ptr<UpstreamPool> pool;
+    // Admits the clients of the service, within the proxy-wide limit.
+    std::unique_ptr<ConnectionLimiter> limiter;
+    // How long a connection may go without traffic, zero for no limit.
+    std::chrono::seconds idleTimeout;
+    BufferConfig buffers;
+    // How many quanta each connection of the service may forward per wakeup
+    // of its loop, at least one.
+    unsigned weight;
+    // Bounds the bytes the service forwards per second, or null.
+    std::unique_ptr<RateLimiter> rateLimiter;
+    // Forwards the clients of a multiplexed service instead of the loops, or
+    // null.
+    std::unique_ptr<UpstreamMux> mux;
+};
+
+class Connection;
+class DrainWatcher;
+class Inbox;
+class Listener;
+
+// A single-threaded epoll loop which owns the connections it accepts. The
+// proxy runs a fixed number of these, one per worker thread, so the thread
+// count follows the core count instead of the connection count.
+class EventLoop {
+  public:
+    explicit EventLoop(ForwardingEngine engine);
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool init();
+
+    // Starts accepting clients of route on this loop. The listening sockets
+    // are registered exclusively so only one loop is woken per incoming client.
+    bool addRoute(std::shared_ptr<const Route> route);
+
+    // Stops accepting clients of route on this loop. Connections which were
+    // already accepted are still forwarded. The caller closes the listening
+    // sockets once every loop has removed the route.
+    void removeRoute(const std::shared_ptr<const Route>& route);
+
+    // Runs task on the loop's thread, e.g. to add or remove a route while
+    // the loop runs. Thread safe.
+    void postTask(std::function<void()> task);
+
+    // The loops accepted clients are spread across, this one included. Must
+    // be set before any loop runs.
+    void setPeers(std::vector<EventLoop*> peers);
+
+    // Runs the loop on the calling thread. Only returns on a fatal error.
+    void run();
+
+    // Stops accepting clients once the proxy drains. Connections which were
+    // already accepted are still forwarded.
+    void stopAccepting();
+
+    bool add(int fd, uint32_t events, EventHandler* handler);
+    bool modify(int fd, uint32_t events, EventHandler* handler);
+    void remove(int fd);
+
+    // Hands a client accepted by this loop to the least loaded peer.
+    void dispatch(int clientFd, std::shared_ptr<const Route> route);
+
+    // Queues a client accepted by another loop. Thread safe.
+    void post(int clientFd, std::shared_ptr<const Route> route);
+
+    // Starts forwarding the clients queued with post(), and runs the tasks
+    // queued with postTask().
+    void drainInbox();
+
+    // Destroys connection once the current batch of events has been handled,
+    // so pending events for its other socket never see a dangling handler.
+    void release(Connection* connection);
+
+    // Resumes reading for a connection throttled by its route's rate limiter
+    // once when has passed.
+    void resumeLater(Connection* connection, std::chrono::steady_clock::time_point when);
+
+    ForwardingEngine engine() const { return mEngine; }
+
+  private:
+    void startConnection(int clientFd, const std::shared_ptr<const Route>& route);
+    void closeIdleConnections();
+    void resumeThrottledConnections();
+    // Until the next idle check or throttled connection is due, in ms.
+    int waitTimeout() const;
+
+    const ForwardingEngine mEngine;
+    int mEpollFd = -1;
+    std::vector<std::unique_ptr<Listener>> mListeners;
+    std::unique_ptr<DrainWatcher> mDrainWatcher;
+    std::chrono::steady_clock::time_point mLastIdleCheck;
+    std::vector<EventLoop*> mPeers;
+    // Connections owned by or on their way to this loop.
+    std::atomic<size_t> mLoad{0};
+
+    // Clients handed over by other loops, signalled through an eventfd.
+    std::unique_ptr<Inbox> mInbox;
+    std::mutex mInboxLock;
+    std::vector<std::pair<int, std::shared_ptr<const Route>>> mInboxClients;
+    std::vector<std::function<void()>> mInboxTasks;
+    std::unordered_map<Connection*, std::unique_ptr<Connection>> mConnections;
+    // Throttled connections and when they may read again.
+    std::vector<std::pair<std::chrono::steady_clock::time_point, Connection*>> mThrottled;
+    std::vector<std::unique_ptr<Connection>> mReleased;
+    std::vector<std::unique_ptr<Listener>> mReleasedListeners;
+};
+
+}  // namespace android::automotive::proxy
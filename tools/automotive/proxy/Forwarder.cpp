@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Forwarder.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "SocketUtils.h"
+
+namespace android::automotive::proxy {
+
+Forwarder::Forwarder(ForwardingEngine engine, size_t chunkSize) : mChunkSize(chunkSize) {
+    if (engine != ForwardingEngine::SPLICE) {
+        return;
+    }
+    if (pipe2(mPipe, O_CLOEXEC) != 0) {
+        // Out of file descriptors; this connection simply copies.
+        mPipe[0] = mPipe[1] = -1;
+    } else if (fcntl(mPipe[1], F_GETPIPE_SZ) < static_cast<int>(chunkSize)) {
+        // A chunk larger than the pipe would be split in several splices.
+        fcntl(mPipe[1], F_SETPIPE_SZ, static_cast<int>(chunkSize));
+    }
+}
+
+Forwarder::~Forwarder() {
+    stopSplicing();
+}
+
+void Forwarder::stopSplicing() {
+    if (mPipe[0] >= 0) {
+        close(mPipe[0]);
+        close(mPipe[1]);
+        mPipe[0] = mPipe[1] = -1;
+    }
+}
+
+bool Forwarder::transfer(int src_fd, int dst_fd, DirectionMetrics* metrics) {
+    LatencyTimer timer;
+    size_t transferred = 0;
+    if (!transferChunk(src_fd, dst_fd, &transferred)) {
+        return false;
+    }
+    if (metrics != nullptr) {
+        metrics->bytes.fetch_add(transferred, std::memory_order_relaxed);
+        timer.record(metrics->chunkLatency);
+    }
+    return true;
+}
+
+bool Forwarder::transferChunk(int src_fd, int dst_fd, size_t* transferred) {
+    if (!isSplicing()) {
+        return copyChunk(src_fd, dst_fd, transferred);
+    }
+
+    ssize_t readBytes = splice(src_fd, nullptr, mPipe[1], nullptr, mChunkSize, SPLICE_F_MOVE);
+    if (readBytes < 0 && errno == EINVAL) {
+        // The source socket does not support splice. Nothing has been
+        // consumed yet, so the copy loop takes over from here.
+        stopSplicing();
+        return copyChunk(src_fd, dst_fd, transferred);
+    }
+    if (readBytes <= 0) {
+        return false;
+    }
+    *transferred = readBytes;
+    return drainPipe(dst_fd, readBytes);
+}
+
+bool Forwarder::drainPipe(int dst_fd, size_t pending) {
+    while (pending > 0) {
+        ssize_t writtenBytes = splice(mPipe[0], nullptr, dst_fd, nullptr, pending, SPLICE_F_MOVE);
+        if (writtenBytes < 0 && errno == EINVAL) {
+            // The destination socket does not support splice. Hand the bytes
+            // already in the pipe over by copying and stop splicing.
+            bool ok = copyFromPipe(dst_fd, pending);
+            stopSplicing();
+            return ok;
+        }
+        if (writtenBytes <= 0) {
+            return false;
+        }
+        pending -= writtenBytes;
+    }
+    return true;
+}
+
+bool Forwarder::copyChunk(int src_fd, int dst_fd, size_t* transferred) {
+    if (!mBuffer) {
+        mBuffer = std::make_unique<char[]>(mChunkSize);
+    }
+    ssize_t readBytes = read(src_fd, mBuffer.get(), mChunkSize);
+    if (readBytes <= 0) {
+        return false;
+    }
+    *transferred = readBytes;
+    return writeAll(dst_fd, mBuffer.get(), readBytes);
+}
+
+bool Forwarder::copyFromPipe(int dst_fd, size_t pending) {
+    if (!mBuffer) {
+        mBuffer = std::make_unique<char[]>(mChunkSize);
+    }
+    while (pending > 0) {
+        ssize_t readBytes = read(mPipe[0], mBuffer.get(), std::min(pending, mChunkSize));
+        if (readBytes <= 0) {
+            return false;
+        }
+        pending -= readBytes;
+        if (!writeAll(dst_fd, mBuffer.get(), readBytes)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A short write is not the end of the chunk; keep writing until all of it has
+// been handed to the destination.
+bool Forwarder::writeAll(int dst_fd, const char* data, size_t size) {
+    for (size_t offset = 0; offset < size;) {
+        ssize_t writtenBytes = write(dst_fd, data + offset, size - offset);
+        if (writtenBytes < 0) {
+            return false;
+        }
+        offset += writtenBytes;
+    }
+    return true;
+}
+
+}  // namespace android::automotive::proxy
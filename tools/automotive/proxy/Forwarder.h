@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <memory>
+
+#include "Metrics.h"
+#include "SocketUtils.h"
+
+namespace android::automotive::proxy {
+
+enum class ForwardingEngine {
+    // read() into a user space buffer, then write() it out.
+    COPY,
+    // splice() through a pipe owned by the connection, so the payload never
+    // leaves the kernel.
+    SPLICE,
+};
+
+// Moves bytes between the two sockets of a connection with the requested
+// engine. The splice engine falls back to copying when the kernel refuses to
+// splice one of the sockets.
+class Forwarder {
+  public:
+    // Bytes are moved in chunks of at most chunkSize.
+    explicit Forwarder(ForwardingEngine engine, size_t chunkSize = BUFFER_SIZE);
+    ~Forwarder();
+
+    Forwarder(const Forwarder&) = delete;
+    Forwarder& operator=(const Forwarder&) = delete;
+
+    // transfers a max of chunkSize bytes between a source file descriptor
+    // and a destination file descriptor. Returns true on success, false
+    // otherwise. Moved bytes are accounted to metrics, if given.
+    bool transfer(int src_fd, int dst_fd, DirectionMetrics* metrics = nullptr);
+
+    bool isSplicing() const { return mPipe[0] >= 0; }
+
+  private:
+    bool transferChunk(int src_fd, int dst_fd, size_t* transferred);
+    bool copyChunk(int src_fd, int dst_fd, size_t* transferred);
+    bool writeAll(int dst_fd, const char* data, size_t size);
+    bool drainPipe(int dst_fd, size_t pending);
+    bool copyFromPipe(int dst_fd, size_t pending);
+    void stopSplicing();
+
+    int mPipe[2] = {-1, -1};
+    const size_t mChunkSize;
+    // Only allocated once a chunk is copied.
+    std::unique_ptr<char[]> mBuffer;
+};
+
+}  // namespace android::automotive::proxy
@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Log.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace android::automotive::proxy {
+
+// A power of two, so positions map to slots with a mask.
+static constexpr size_t kLogRingSize = 1024;
+static constexpr size_t kLogTextSize = 160;
+static constexpr size_t kLogServiceSize = 32;
+// How often the logging thread looks for messages once the ring is empty.
+static constexpr auto kLogDrainInterval = std::chrono::milliseconds(20);
+// Lines are written to stderr in batches of up to this many bytes.
+static constexpr size_t kLogBatchSize = 16 * 1024;
+
+namespace {
+
+struct Slot {
+    // The position the slot can be written at next, plus one once written:
+    // the bounded queue of Dmitry Vyukov, which needs no lock on either side.
+    std::atomic<size_t> sequence;
+    char text[kLogTextSize];
+    char service[kLogServiceSize];
+    unsigned cid;
+    int error;
+    uint32_t suppressed;
+};
+
+class Logger {
+  public:
+    Logger() {
+        for (size_t i = 0; i < kLogRingSize; i++) {
+            mSlots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        std::thread([this]() {
+            while (true) {
+                if (!drain()) {
+                    std::this_thread::sleep_for(kLogDrainInterval);
+                }
+            }
+        }).detach();
+        atexit(flushLog);
+    }
+
+    // Returns the slot to write a message to, to be handed back with
+    // publish(), or null if the ring is full.
+    Slot* claim(size_t* position) {
+        size_t pos = mHead.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = mSlots[pos & (kLogRingSize - 1)];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (mHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    *position = pos;
+                    return &slot;
+                }
+            } else if (diff < 0) {
+                mDropped.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            } else {
+                pos = mHead.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void publish(Slot* slot, size_t position) {
+        slot->sequence.store(position + 1, std::memory_order_release);
+    }
+
+    // Writes the messages queued so far to stderr. Returns false if there
+    // were none.
+    bool drain() {
+        char batch[kLogBatchSize];
+        size_t length = 0;
+        bool drained = false;
+
+        uint64_t dropped = mDropped.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            length += snprintf(batch, sizeof(batch), "Dropped %llu log messages\n",
+                               static_cast<unsigned long long>(dropped));
+        }
+
+        Slot copy;
+        while (take(&copy)) {
+            drained = true;
+            char line[kLogTextSize + kLogServiceSize + 128];
+            size_t lineLength = formatLine(copy, line, sizeof(line));
+            if (length + lineLength > sizeof(batch)) {
+                write(batch, length);
+                length = 0;
+            }
+            memcpy(batch + length, line, lineLength);
+            length += lineLength;
+        }
+        write(batch, length);
+        return drained;
+    }
+
+  private:
+    bool take(Slot* copy) {
+        size_t pos = mTail.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = mSlots[pos & (kLogRingSize - 1)];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (mTail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    memcpy(copy->text, slot.text, sizeof(slot.text));
+                    memcpy(copy->service, slot.service, sizeof(slot.service));
+                    copy->cid = slot.cid;
+                    copy->error = slot.error;
+                    copy->suppressed = slot.suppressed;
+                    slot.sequence.store(pos + kLogRingSize, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = mTail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // "text [service=NAME cid=N errno=N], ERROR = DESCRIPTION (N more suppressed)"
+    static size_t formatLine(const Slot& slot, char* line, size_t size) {
+        size_t length = 0;
+        append(line, size, &length, "%s", slot.text);
+        if (slot.service[0] != '\0' || slot.cid != 0 || slot.error != 0) {
+            const char* separator = " [";
+            if (slot.service[0] != '\0') {
+                append(line, size, &length, "%sservice=%s", separator, slot.service);
+                separator = " ";
+            }
+            if (slot.cid != 0) {
+                append(line, size, &length, "%scid=%u", separator, slot.cid);
+                separator = " ";
+            }
+            if (slot.error != 0) {
+                append(line, size, &length, "%serrno=%d", separator, slot.error);
+            }
+            append(line, size, &length, "]");
+        }
+        if (slot.error != 0) {
+            append(line, size, &length, ", ERROR = %s", strerror(slot.error));
+        }
+        if (slot.suppressed > 0) {
+            append(line, size, &length, " (%u more suppressed)", slot.suppressed);
+        }
+        // Lines which did not fit are cut off, keeping the newline.
+        line[length++] = '\n';
+        return length;
+    }
+
+    // Appends to line, leaving room for the newline.
+    __attribute__((format(printf, 4, 5))) static void append(char* line, size_t size,
+                                                              size_t* length, const char* format,
+                                                              ...) {
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(line + *length, size - 1 - *length, format, args);
+        va_end(args);
+        if (written > 0) {
+            *length = std::min(*length + written, size - 2);
+        }
+    }
+
+    static void write(const char* data, size_t length) {
+        while (length > 0) {
+            ssize_t written = ::write(STDERR_FILENO, data, length);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return;
+            }
+            data += written;
+            length -= written;
+        }
+    }
+
+    Slot mSlots[kLogRingSize];
+    alignas(64) std::atomic<size_t> mHead{0};
+    alignas(64) std::atomic<size_t> mTail{0};
+    std::atomic<uint64_t> mDropped{0};
+};
+
+// Never destroyed, as the logging thread runs until the process exits.
+Logger& logger() {
+    static Logger* sLogger = new Logger();
+    return *sLogger;
+}
+
+}  // namespace
+
+void logMessage(LogSite& site, const LogFields& fields, const char* format, ...) {
+    // Callers may look at errno after logging.
+    int savedErrno = errno;
+
+    int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+                          std::chrono::steady_clock::now().time_since_epoch())
+                          .count();
+    int64_t second = site.second.load(std::memory_order_relaxed);
+    if (second != now &&
+        site.second.compare_exchange_strong(second, now, std::memory_order_relaxed)) {
+        site.count.store(0, std::memory_order_relaxed);
+    }
+    if (site.count.fetch_add(1, std::memory_order_relaxed) >= kLogSiteBurst) {
+        site.suppressed.fetch_add(1, std::memory_order_relaxed);
+        errno = savedErrno;
+        return;
+    }
+
+    Logger& log = logger();
+    size_t position;
+    Slot* slot = log.claim(&position);
+    if (slot == nullptr) {
+        errno = savedErrno;
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vsnprintf(slot->text, sizeof(slot->text), format, args);
+    va_end(args);
+    snprintf(slot->service, sizeof(slot->service), "%s",
+             fields.service != nullptr ? fields.service : "");
+    slot->cid = fields.cid;
+    slot->error = fields.error;
+    slot->suppressed = site.suppressed.exchange(0, std::memory_order_relaxed);
+    log.publish(slot, position);
+    errno = savedErrno;
+}
+
+void flushLog() {
+    while (logger().drain()) {
+    }
+}
+
+}  // namespace android::automotive::proxy
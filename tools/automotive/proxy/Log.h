@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+namespace android::automotive::proxy {
+
+// What a message is about besides its text. Unset fields are left out of the
+// line written to stderr.
+struct LogFields {
+    const char* service = nullptr;
+    // Zero for no CID, as no VM has it.
+    unsigned cid = 0;
+    // The errno of the failure, written with its description.
+    int error = 0;
+};
+
+// The share of the log one call site gets: the sites of the data path fail
+// for every connection at once when a VM restarts, and are limited to
+// kLogSiteBurst messages a second. Messages above that are counted and the
+// count is written with the next message of the site.
+struct LogSite {
+    std::atomic<int64_t> second{0};
+    std::atomic<uint32_t> count{0};
+    std::atomic<uint32_t> suppressed{0};
+};
+
+inline constexpr uint32_t kLogSiteBurst = 10;
+
+// Queues a message for the logging thread, which writes it to stderr. Never
+// blocks and does not allocate: messages are formatted into a fixed-size slot
+// of a lock-free ring, cut off if too long, and dropped if the ring is full.
+// The errno description is looked up by the logging thread.
+void logMessage(LogSite& site, const LogFields& fields, const char* format, ...)
+        __attribute__((format(printf, 3, 4)));
+
+// Writes the queued messages on the calling thread. Called on exit, and
+// before leaving with _exit().
+void flushLog();
+
+}  // namespace android::automotive::proxy
+
+// A LogSite of its own for the call site it is expanded at, e.g.
+//   logMessage(LOG_SITE(), {.service = name, .error = errno}, "Failed to connect");
+#define LOG_SITE()                                          \
+    ([]() -> ::android::automotive::proxy::LogSite& {       \
+        static ::android::automotive::proxy::LogSite sSite; \
+        return sSite;                                       \
+    }())
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Metrics.h"
+
+#include <bit>
+
+namespace android::automotive::proxy {
+
+void LatencyHistogram::record(std::chrono::nanoseconds latency) {
+    uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    size_t bucket = std::bit_width(micros);
+    if (bucket >= kBuckets) {
+        bucket = kBuckets - 1;
+    }
+    mBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::count() const {
+    uint64_t total = 0;
+    for (const auto& bucket : mBuckets) {
+        total += bucket.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+std::chrono::microseconds LatencyHistogram::percentile(double percentile) const {
+    std::array<uint64_t, kBuckets> snapshot;
+    uint64_t total = 0;
+    for (size_t i = 0; i < kBuckets; i++) {
+        snapshot[i] = mBuckets[i].load(std::memory_order_relaxed);
+        total += snapshot[i];
+    }
+    if (total == 0) {
+        return std::chrono::microseconds(0);
+    }
+
+    uint64_t rank = static_cast<uint64_t>(total * percentile / 100.0);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; i++) {
+        seen += snapshot[i];
+        if (seen > rank || seen == total) {
+            // Bucket i holds latencies below 2^i microseconds.
+            return std::chrono::microseconds(uint64_t{1} << i);
+        }
+    }
+    return std::chrono::microseconds(uint64_t{1} << (kBuckets - 1));
+}
+
+MetricsRegistry& MetricsRegistry::get() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+ServiceMetrics* MetricsRegistry::registerService(const std::string& name, unsigned cid,
+                                                 unsigned port) {
+    std::lock_guard<std::mutex> lock(mLock);
+    for (const auto& service : mServices) {
+        if (service->name == name && service->cid == cid && service->port == port) {
+            return service.get();
+        }
+    }
+    mServices.push_back(std::make_unique<ServiceMetrics>(name, cid, port));
+    return mServices.back().get();
+}
+
+static void dumpHistogram(std::ostream& out, const char* label,
+                          const LatencyHistogram& histogram) {
+    out << " " << label << "_us(p50/p99/p999)=" << histogram.percentile(50).count() << "/"
+        << histogram.percentile(99).count() << "/" << histogram.percentile(99.9).count();
+}
+
+void MetricsRegistry::dump(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(mLock);
+    for (const auto& service : mServices) {
+        out << "service=\"" << service->name << "\" cid=" << service->cid
+            << " port=" << service->port
+            << " active=" << service->activeConnections.load(std::memory_order_relaxed)
+            << " accepted=" << service->acceptedConnections.load(std::memory_order_relaxed)
+            << " accept_errors=" << service->acceptErrors.load(std::memory_order_relaxed)
+            << " connect_errors=" << service->connectErrors.load(std::memory_order_relaxed)
+            << " pooled=" << service->pooledConnections.load(std::memory_order_relaxed)
+            << " multiplexed=" << service->multiplexedConnections.load(std::memory_order_relaxed)
+            << " rejected=" << service->rejectedConnections.load(std::memory_order_relaxed)
+            << " idle_timeouts=" << service->idleTimeouts.load(std::memory_order_relaxed)
+            << " throttled=" << service->throttledReads.load(std::memory_order_relaxed)
+            << " bytes_to_server=" << service->toServer.bytes.load(std::memory_order_relaxed)
+            << " bytes_to_client=" << service->toClient.bytes.load(std::memory_order_relaxed);
+        dumpHistogram(out, "connect", service->connectLatency);
+        dumpHistogram(out, "chunk_to_server", service->toServer.chunkLatency);
+        dumpHistogram(out, "chunk_to_client", service->toClient.chunkLatency);
+        out << std::endl;
+    }
+}
+
+}  // namespace android::automotive::proxy
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace android::automotive::proxy {
+
+// A histogram of latencies with power-of-two microsecond buckets. Recording is
+// a single relaxed atomic increment, so it is safe from any worker thread.
+class LatencyHistogram {
+  public:
+    static constexpr size_t kBuckets = 32;
+
+    void record(std::chrono::nanoseconds latency);
+
+    uint64_t count() const;
+
+    // Returns the upper bound of the bucket holding the given percentile
+    // (0 < percentile <= 100), or zero if nothing was recorded.
+    std::chrono::microseconds percentile(double percentile) const;
+
+  private:
+    std::array<std::atomic<uint64_t>, kBuckets> mBuckets{};
+};
+
+// Counters for the bytes travelling one way through the proxy.
+struct DirectionMetrics {
+    std::atomic<uint64_t> bytes{0};
+    // How long bytes were held by the proxy between being read from one
+    // socket and being fully written to the other.
+    LatencyHistogram chunkLatency;
+};
+
+// Counters for one Service of one VM. All members are updated lock-free.
+struct ServiceMetrics {
+    ServiceMetrics(std::string name, unsigned cid, unsigned port)
+        : name(std::move(name)), cid(cid), port(port) {}
+
+    const std::string name;
+    const unsigned cid;
+    const unsigned port;
+
+    std::atomic<int64_t> activeConnections{0};
+    std::atomic<uint64_t> acceptedConnections{0};
+    std::atomic<uint64_t> acceptErrors{0};
+    std::atomic<uint64_t> connectErrors{0};
+    // Connections forwarded over an already established UpstreamPool socket.
+    std::atomic<uint64_t> pooledConnections{0};
+    // Connections forwarded as a stream over the links of an UpstreamMux.
+    std::atomic<uint64_t> multiplexedConnections{0};
+    // Clients closed right after accept because the proxy was at capacity.
+    std::atomic<uint64_t> rejectedConnections{0};
+    // Connections closed after going without traffic for the idle timeout.
+    std::atomic<uint64_t> idleTimeouts{0};
+    // Reads put off because the service used up its rate limit.
+    std::atomic<uint64_t> throttledReads{0};
+    // Time to establish the connection to the forwarding CID.
+    LatencyHistogram connectLatency;
+    DirectionMetrics toServer;
+    DirectionMetrics toClient;
+};
+
+// The metrics of every route of the proxy. Services are registered while
+// routes are set up; the returned ServiceMetrics lives as long as the
+// registry. A service registered again, e.g. when a config reload adds it
+// back, keeps counting where it left off.
+class MetricsRegistry {
+  public:
+    static MetricsRegistry& get();
+
+    ServiceMetrics* registerService(const std::string& name, unsigned cid, unsigned port);
+
+    // Writes one line per service.
+    void dump(std::ostream& out) const;
+
+  private:
+    mutable std::mutex mLock;
+    std::vector<std::unique_ptr<ServiceMetrics>> mServices;
+};
+
+// Measures the time between construction and record().
+class LatencyTimer {
+  public:
+    LatencyTimer() : mStart(std::chrono::steady_clock::now()) {}
+
+    void record(LatencyHistogram& histogram) const {
+        histogram.record(std::chrono::steady_clock::now() - mStart);
+    }
+
+  private:
+    std::chrono::steady_clock::time_point mStart;
+};
+
+}  // namespace android::automotive::proxy
@@ -0,0 +1,727 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Multiplexer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+#include "SocketUtils.h"
+
+namespace android::automotive::proxy {
+
+static constexpr int kMaxEvents = 64;
+static constexpr size_t kLinkReadSize = 64 * 1024;
+// Bytes queued for a link above which its streams stop being read, and below
+// which they are read again.
+static constexpr size_t kLinkHighWater = 256 * 1024;
+static constexpr size_t kLinkLowWater = 64 * 1024;
+// Bytes of a stream written out before they are credited to the peer, so
+// WINDOW frames stay rare.
+static constexpr uint32_t kCreditThreshold = kMuxStreamWindow / 4;
+static constexpr auto kIdleCheckInterval = std::chrono::seconds(1);
+
+static bool isTransient(int error) {
+    return error == EAGAIN || error == EWOULDBLOCK || error == EINTR;
+}
+
+struct Multiplexer::Handler {
+    virtual ~Handler() = default;
+    virtual void handleEvents(uint32_t events) = 0;
+};
+
+// Runs a callback for the events of a socket the multiplexer doesn't forward.
+struct Multiplexer::Callback : public Handler {
+    explicit Callback(std::function<void(uint32_t)> callback) : callback(std::move(callback)) {}
+
+    void handleEvents(uint32_t events) override { callback(events); }
+
+    std::function<void(uint32_t)> callback;
+};
+
+// One connection to the other end, and the streams it carries.
+struct Multiplexer::Link : public Handler {
+    Link(Multiplexer& mux, int fd, bool connecting) : mux(mux), fd(fd), connecting(connecting) {}
+
+    void handleEvents(uint32_t events) override { mux.handleLinkEvents(*this, events); }
+
+    size_t queued() const { return out.size() - outHead; }
+
+    Multiplexer& mux;
+    const int fd;
+    bool connecting;
+    // The HELLO of the other end arrived.
+    bool greeted = false;
+    bool closed = false;
+    // Too much is queued for the link; its streams aren't read meanwhile.
+    bool blocked = false;
+    uint32_t interest = 0;
+    uint32_t nextStreamId = 1;
+    // Frames not written yet, from outHead on, and the start of a frame not
+    // fully read yet.
+    std::string out;
+    size_t outHead = 0;
+    std::string in;
+    std::unordered_map<uint32_t, std::unique_ptr<Stream>> streams;
+};
+
+// A local socket forwarded over a link.
+struct Multiplexer::Stream : public Handler {
+    Stream(Multiplexer& mux, Link& link, uint32_t id, int fd, bool connecting)
+        : mux(mux),
+          link(link),
+          id(id),
+          fd(fd),
+          connecting(connecting),
+          lastActive(std::chrono::steady_clock::now()) {}
+
+    void handleEvents(uint32_t events) override { mux.handleStreamEvents(*this, events); }
+
+    size_t pending() const { return toLocal.size() - toLocalHead; }
+
+    Multiplexer& mux;
+    Link& link;
+    const uint32_t id;
+    const int fd;
+    bool connecting;
+    // End of stream was read from fd, and FIN sent.
+    bool readClosed = false;
+    // The other end sent FIN.
+    bool peerFinished = false;
+    // fd was shut down for writing after everything before FIN was written.
+    bool writeClosed = false;
+    // Both directions of fd are shut down. epoll reports this regardless of
+    // interest, so fd is unregistered while it has nothing to do.
+    bool hungUp = false;
+    bool registered = false;
+    bool closed = false;
+    uint32_t interest = 0;
+    // Bytes which may be sent before the other end credits more.
+    uint32_t sendWindow = kMuxStreamWindow;
+    // Bytes written to fd which were not credited to the other end yet.
+    uint32_t uncredited = 0;
+    // Bytes from the other end not written to fd yet, from toLocalHead on.
+    std::string toLocal;
+    size_t toLocalHead = 0;
+    std::chrono::steady_clock::time_point lastActive;
+};
+
+Multiplexer::Multiplexer(ServiceMetrics* metrics, std::chrono::seconds idleTimeout)
+    : mMetrics(metrics), mIdleTimeout(idleTimeout) {}
+
+Multiplexer::~Multiplexer() {
+    stop();
+    mHandlers.clear();
+    if (mWakeFd >= 0) {
+        close(mWakeFd);
+    }
+    if (mEpollFd >= 0) {
+        close(mEpollFd);
+    }
+}
+
+bool Multiplexer::start() {
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (mEpollFd < 0) {
+        std::cerr << "Failed to create epoll instance, ERROR = " << strerror(errno) << std::endl;
+        return false;
+    }
+    mWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mWakeFd < 0) {
+        std::cerr << "Failed to create multiplexer eventfd, ERROR = " << strerror(errno)
+                  << std::endl;
+        return false;
+    }
+    auto wakeHandler = std::make_unique<Callback>([this](uint32_t /* events */) {
+        uint64_t count;
+        read(mWakeFd, &count, sizeof(count));
+        if (!mStopping) {
+            handleWake();
+        }
+    });
+    if (!control(EPOLL_CTL_ADD, mWakeFd, EPOLLIN, wakeHandler.get())) {
+        return false;
+    }
+    mHandlers.push_back(std::move(wakeHandler));
+    if (!setUp()) {
+        return false;
+    }
+    mLastIdleCheck = std::chrono::steady_clock::now();
+    mThread = std::thread(&Multiplexer::run, this);
+    return true;
+}
+
+void Multiplexer::wait() {
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+void Multiplexer::stop() {
+    if (mThread.joinable()) {
+        mStopping = true;
+        wake();
+        mThread.join();
+    }
+    while (!mLinks.empty()) {
+        closeLink(*mLinks.front());
+    }
+    mReleasedStreams.clear();
+    mReleasedLinks.clear();
+}
+
+void Multiplexer::wake() {
+    uint64_t one = 1;
+    write(mWakeFd, &one, sizeof(one));
+}
+
+bool Multiplexer::watch(int fd) {
+    auto handler = std::make_unique<Callback>(
+        [this, fd](uint32_t /* events */) { handleReady(fd); });
+    if (!control(EPOLL_CTL_ADD, fd, EPOLLIN, handler.get())) {
+        return false;
+    }
+    mHandlers.push_back(std::move(handler));
+    return true;
+}
+
+void Multiplexer::run() {
+    epoll_event events[kMaxEvents];
+    int timeout = mIdleTimeout.count() > 0
+                      ? std::chrono::milliseconds(kIdleCheckInterval).count()
+                      : -1;
+    while (!mStopping) {
+        int count = epoll_wait(mEpollFd, events, kMaxEvents, timeout);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            logMessage(LOG_SITE(), logFields(errno), "ERROR in epoll_wait!");
+            return;
+        }
+        for (int i = 0; i < count && !mStopping; i++) {
+            static_cast<Handler*>(events[i].data.ptr)->handleEvents(events[i].events);
+        }
+        if (mIdleTimeout.count() > 0) {
+            closeIdleStreams();
+        }
+        mReleasedStreams.clear();
+        mReleasedLinks.clear();
+    }
+}
+
+Multiplexer::Link* Multiplexer::addLink(int fd, bool connecting) {
+    auto link = std::make_unique<Link>(*this, fd, connecting);
+    if (!control(EPOLL_CTL_ADD, fd, EPOLLIN | EPOLLOUT, link.get())) {
+        closeFileDescriptor(fd);
+        return nullptr;
+    }
+    link->interest = EPOLLIN | EPOLLOUT;
+    uint32_t version = kMuxVersion;
+    queueFrame(*link, MuxFrameType::HELLO, 0, &version, sizeof(version));
+    Link* added = link.get();
+    mLinks.push_back(std::move(link));
+    flushLink(*added);
+    return added->closed ? nullptr : added;
+}
+
+Multiplexer::Link* Multiplexer::leastLoadedLink() const {
+    auto least = std::min_element(mLinks.begin(), mLinks.end(), [](const auto& a, const auto& b) {
+        return a->streams.size() < b->streams.size();
+    });
+    return least == mLinks.end() ? nullptr : least->get();
+}
+
+void Multiplexer::openStream(Link& link, int fd) {
+    // Stream 0 is the link itself, and the IDs of streams still open after
+    // the counter wrapped around are skipped.
+    uint32_t id;
+    do {
+        id = link.nextStreamId++;
+    } while (id == 0 || link.streams.find(id) != link.streams.end());
+    // Queued first, so a stream which fails right away is reset after it
+    // was opened.
+    queueFrame(link, MuxFrameType::OPEN, id);
+    addStream(link, id, fd, false);
+    flushLink(link);
+}
+
+void Multiplexer::handleLinkEvents(Link& link, uint32_t events) {
+    if (link.closed) {
+        return;
+    }
+    if (link.connecting) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (!(events & EPOLLOUT) || getsockopt(link.fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0 ||
+            error != 0) {
+            logMessage(LOG_SITE(), logFields(error ? error : errno),
+                       "Failed to connect multiplexed link");
+            if (mMetrics != nullptr) {
+                mMetrics->connectErrors.fetch_add(1, std::memory_order_relaxed);
+            }
+            closeLink(link);
+            return;
+        }
+        link.connecting = false;
+    }
+    if ((events & EPOLLERR) || ((events & (EPOLLIN | EPOLLHUP)) && !readLink(link))) {
+        closeLink(link);
+        return;
+    }
+    flushLink(link);
+}
+
+// Reads what the link has and handles every complete frame in it.
+bool Multiplexer::readLink(Link& link) {
+    size_t start = link.in.size();
+    link.in.resize(start + kLinkReadSize);
+    ssize_t readBytes = read(link.fd, link.in.data() + start, kLinkReadSize);
+    if (readBytes <= 0) {
+        link.in.resize(start);
+        return readBytes < 0 && isTransient(errno);
+    }
+    link.in.resize(start + readBytes);
+
+    size_t offset = 0;
+    while (link.in.size() - offset >= sizeof(MuxFrameHeader)) {
+        MuxFrameHeader header;
+        memcpy(&header, link.in.data() + offset, sizeof(header));
+        if (header.length > kMuxMaxPayload) {
+            logMessage(LOG_SITE(), logFields(), "Multiplexed link sent a frame of %u bytes",
+                       header.length);
+            return false;
+        }
+        if (link.in.size() - offset - sizeof(header) < header.length) {
+            break;
+        }
+        if (!handleFrame(link, header, link.in.data() + offset + sizeof(header))) {
+            return false;
+        }
+        offset += sizeof(header) + header.length;
+    }
+    link.in.erase(0, offset);
+    return true;
+}
+
+// Returns false if the other end broke the protocol, which closes the link.
+bool Multiplexer::handleFrame(Link& link, const MuxFrameHeader& header, const char* payload) {
+    MuxFrameType type = static_cast<MuxFrameType>(header.type);
+    uint32_t value = 0;
+    if (type == MuxFrameType::HELLO || type == MuxFrameType::WINDOW) {
+        if (header.length != sizeof(value)) {
+            logMessage(LOG_SITE(), logFields(), "Multiplexed link sent a malformed frame");
+            return false;
+        }
+        memcpy(&value, payload, sizeof(value));
+    }
+    if (!link.greeted) {
+        if (type != MuxFrameType::HELLO || value != kMuxVersion) {
+            logMessage(LOG_SITE(), logFields(), "Multiplexed link does not speak version %u",
+                       kMuxVersion);
+            return false;
+        }
+        link.greeted = true;
+        return true;
+    }
+
+    auto entry = link.streams.find(header.stream);
+    // Frames for streams closed meanwhile, e.g. because both ends reset them
+    // at once, are dropped.
+    Stream* stream = entry == link.streams.end() ? nullptr : entry->second.get();
+    switch (type) {
+        case MuxFrameType::HELLO:
+            return false;
+        case MuxFrameType::OPEN: {
+            if (header.stream == 0 || stream != nullptr) {
+                return false;
+            }
+            int fd = acceptStream();
+            if (fd < 0) {
+                queueFrame(link, MuxFrameType::RESET, header.stream);
+            } else {
+                addStream(link, header.stream, fd, true);
+            }
+            return true;
+        }
+        case MuxFrameType::DATA:
+            if (stream == nullptr || stream->peerFinished) {
+                return true;
+            }
+            if (stream->pending() + stream->uncredited + header.length > kMuxStreamWindow) {
+                logMessage(LOG_SITE(), logFields(), "Multiplexed stream overran its window");
+                resetStream(*stream);
+                return true;
+            }
+            stream->toLocal.append(payload, header.length);
+            stream->lastActive = std::chrono::steady_clock::now();
+            writeStream(*stream);
+            return true;
+        case MuxFrameType::FIN:
+            if (stream != nullptr) {
+                stream->peerFinished = true;
+                writeStream(*stream);
+            }
+            return true;
+        case MuxFrameType::RESET:
+            if (stream != nullptr) {
+                closeStream(*stream);
+            }
+            return true;
+        case MuxFrameType::WINDOW:
+            if (stream != nullptr) {
+                stream->sendWindow = static_cast<uint32_t>(
+                    std::min<uint64_t>(kMuxStreamWindow, uint64_t{stream->sendWindow} + value));
+                updateStream(*stream);
+            }
+            return true;
+    }
+    // Unknown frames are skipped.
+    return true;
+}
+
+void Multiplexer::queueFrame(Link& link, MuxFrameType type, uint32_t stream, const void* payload,
+                             size_t length) {
+    MuxFrameHeader header{stream, static_cast<uint16_t>(length), static_cast<uint8_t>(type), 0};
+    link.out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (length > 0) {
+        link.out.append(static_cast<const char*>(payload), length);
+    }
+}
+
+// Writes what the link takes of the queued frames.
+void Multiplexer::flushLink(Link& link) {
+    if (link.closed) {
+        return;
+    }
+    while (!link.connecting && link.queued() > 0) {
+        ssize_t writtenBytes =
+            send(link.fd, link.out.data() + link.outHead, link.queued(), MSG_NOSIGNAL);
+        if (writtenBytes < 0) {
+            if (isTransient(errno)) {
+                break;
+            }
+            closeLink(link);
+            return;
+        }
+        link.outHead += writtenBytes;
+    }
+    if (link.queued() == 0) {
+        link.out.clear();
+        link.outHead = 0;
+    } else if (link.outHead > link.out.size() / 2) {
+        link.out.erase(0, link.outHead);
+        link.outHead = 0;
+    }
+    updateLink(link);
+}
+
+void Multiplexer::updateLink(Link& link) {
+    uint32_t events = EPOLLIN;
+    if (link.connecting || link.queued() > 0) {
+        events |= EPOLLOUT;
+    }
+    if (events != link.interest) {
+        if (!control(EPOLL_CTL_MOD, link.fd, events, &link)) {
+            closeLink(link);
+            return;
+        }
+        link.interest = events;
+    }
+
+    bool blocked = link.blocked ? link.queued() > kLinkLowWater : link.queued() >= kLinkHighWater;
+    if (blocked != link.blocked) {
+        link.blocked = blocked;
+        // Updating a stream may close it.
+        std::vector<Stream*> streams;
+        for (const auto& [id, stream] : link.streams) {
+            streams.push_back(stream.get());
+        }
+        for (Stream* stream : streams) {
+            updateStream(*stream);
+        }
+    }
+}
+
+// Closes the link and every stream it carried, without telling the other
+// end, which can't be reached any more.
+void Multiplexer::closeLink(Link& link) {
+    if (link.closed) {
+        return;
+    }
+    link.closed = true;
+    while (!link.streams.empty()) {
+        closeStream(*link.streams.begin()->second);
+    }
+    control(EPOLL_CTL_DEL, link.fd, 0, nullptr);
+    closeFileDescriptor(link.fd);
+    auto entry = std::find_if(mLinks.begin(), mLinks.end(),
+                              [&link](const auto& candidate) { return candidate.get() == &link; });
+    if (entry != mLinks.end()) {
+        mReleasedLinks.push_back(std::move(*entry));
+        mLinks.erase(entry);
+    }
+}
+
+Multiplexer::Stream* Multiplexer::addStream(Link& link, uint32_t id, int fd, bool connecting) {
+    auto [entry, inserted] = link.streams.try_emplace(id);
+    if (!inserted) {
+        // Callers pick IDs which are not in use, but the stream using it
+        // must not be reset for it.
+        logMessage(LOG_SITE(), logFields(), "Multiplexed stream %u is already open", id);
+        closeFileDescriptor(fd);
+        streamClosed();
+        return nullptr;
+    }
+    entry->second = std::make_unique<Stream>(*this, link, id, fd, connecting);
+    Stream* added = entry->second.get();
+    updateStream(*added);
+    return added->closed ? nullptr : added;
+}
+
+// Passes what fits into the stream's window on to the link.
+void Multiplexer::readStream(Stream& stream) {
+    Link& link = stream.link;
+    size_t wanted = std::min<size_t>(stream.sendWindow, kMuxMaxPayload);
+    if (stream.readClosed || stream.connecting || wanted == 0 || link.blocked) {
+        return;
+    }
+    // Read right behind the header of the frame which will carry the bytes.
+    size_t start = link.out.size();
+    link.out.resize(start + sizeof(MuxFrameHeader) + wanted);
+    ssize_t readBytes = read(stream.fd, link.out.data() + start + sizeof(MuxFrameHeader), wanted);
+    if (readBytes <= 0) {
+        link.out.resize(start);
+        if (readBytes == 0) {
+            stream.readClosed = true;
+            queueFrame(link, MuxFrameType::FIN, stream.id);
+        } else if (!isTransient(errno)) {
+            resetStream(stream);
+        }
+        return;
+    }
+    MuxFrameHeader header{stream.id, static_cast<uint16_t>(readBytes),
+                          static_cast<uint8_t>(MuxFrameType::DATA), 0};
+    memcpy(link.out.data() + start, &header, sizeof(header));
+    link.out.resize(start + sizeof(header) + readBytes);
+    stream.sendWindow -= readBytes;
+    stream.lastActive = std::chrono::steady_clock::now();
+    if (mMetrics != nullptr) {
+        mMetrics->toServer.bytes.fetch_add(readBytes, std::memory_order_relaxed);
+    }
+}
+
+// Writes what fd takes of the bytes from the other end, and credits them.
+void Multiplexer::writeStream(Stream& stream) {
+    if (stream.connecting || stream.closed) {
+        return;
+    }
+    while (!stream.writeClosed && stream.pending() > 0) {
+        ssize_t writtenBytes = send(stream.fd, stream.toLocal.data() + stream.toLocalHead,
+                                    stream.pending(), MSG_NOSIGNAL);
+        if (writtenBytes < 0) {
+            if (isTransient(errno)) {
+                break;
+            }
+            // The bytes can't be delivered any more.
+            resetStream(stream);
+            return;
+        }
+        stream.toLocalHead += writtenBytes;
+        stream.uncredited += writtenBytes;
+        stream.lastActive = std::chrono::steady_clock::now();
+        if (mMetrics != nullptr) {
+            mMetrics->toClient.bytes.fetch_add(writtenBytes, std::memory_order_relaxed);
+        }
+    }
+    if (stream.pending() == 0) {
+        stream.toLocal.clear();
+        stream.toLocalHead = 0;
+    }
+    if (stream.uncredited >= kCreditThreshold && !stream.peerFinished) {
+        queueFrame(stream.link, MuxFrameType::WINDOW, stream.id, &stream.uncredited,
+                   sizeof(stream.uncredited));
+        stream.uncredited = 0;
+    }
+    // Forward a half close once everything sent before it was written.
+    if (stream.peerFinished && stream.pending() == 0 && !stream.writeClosed) {
+        shutdown(stream.fd, SHUT_WR);
+        stream.writeClosed = true;
+    }
+    updateStream(stream);
+}
+
+void Multiplexer::handleStreamEvents(Stream& stream, uint32_t events) {
+    if (stream.closed) {
+        return;
+    }
+    Link& link = stream.link;
+    if (stream.connecting) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (!(events & EPOLLOUT) ||
+            getsockopt(stream.fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0 || error != 0) {
+            logMessage(LOG_SITE(), logFields(error ? error : errno),
+                       "Failed to connect multiplexed stream");
+            resetStream(stream);
+            flushLink(link);
+            return;
+        }
+        stream.connecting = false;
+        // Whatever arrived while connecting.
+        writeStream(stream);
+    } else if (events & EPOLLERR) {
+        resetStream(stream);
+        flushLink(link);
+        return;
+    } else {
+        if (events & EPOLLHUP) {
+            stream.hungUp = true;
+        }
+        if (events & (EPOLLIN | EPOLLHUP)) {
+            readStream(stream);
+        }
+        if (events & EPOLLOUT) {
+            writeStream(stream);
+        }
+        updateStream(stream);
+    }
+    flushLink(link);
+}
+
+void Multiplexer::updateStream(Stream& stream) {
+    if (stream.closed) {
+        return;
+    }
+    if (stream.readClosed && stream.writeClosed) {
+        closeStream(stream);
+        return;
+    }
+    uint32_t events = 0;
+    if (stream.connecting) {
+        events = EPOLLOUT;
+    } else {
+        if (!stream.readClosed && stream.sendWindow > 0 && !stream.link.blocked) {
+            events |= EPOLLIN;
+        }
+        if (!stream.writeClosed && stream.pending() > 0) {
+            events |= EPOLLOUT;
+        }
+    }
+
+    bool ok = true;
+    if (events == 0 && stream.hungUp) {
+        if (stream.registered) {
+            control(EPOLL_CTL_DEL, stream.fd, 0, nullptr);
+            stream.registered = false;
+        }
+    } else if (!stream.registered) {
+        ok = stream.registered = control(EPOLL_CTL_ADD, stream.fd, events, &stream);
+    } else if (events != stream.interest) {
+        ok = control(EPOLL_CTL_MOD, stream.fd, events, &stream);
+    }
+    if (!ok) {
+        resetStream(stream);
+        return;
+    }
+    stream.interest = events;
+}
+
+void Multiplexer::resetStream(Stream& stream) {
+    if (!stream.closed) {
+        queueFrame(stream.link, MuxFrameType::RESET, stream.id);
+        closeStream(stream);
+    }
+}
+
+void Multiplexer::closeStream(Stream& stream) {
+    if (stream.closed) {
+        return;
+    }
+    stream.closed = true;
+    if (stream.registered) {
+        control(EPOLL_CTL_DEL, stream.fd, 0, nullptr);
+    }
+    closeFileDescriptor(stream.fd);
+    streamClosed();
+    // Events for the stream may still be pending in the current batch.
+    auto entry = stream.link.streams.find(stream.id);
+    mReleasedStreams.push_back(std::move(entry->second));
+    stream.link.streams.erase(entry);
+}
+
+void Multiplexer::closeIdleStreams() {
+    auto now = std::chrono::steady_clock::now();
+    if (now - mLastIdleCheck < kIdleCheckInterval) {
+        return;
+    }
+    mLastIdleCheck = now;
+
+    std::vector<Link*> links;
+    for (const auto& link : mLinks) {
+        links.push_back(link.get());
+    }
+    for (Link* link : links) {
+        std::vector<Stream*> idle;
+        for (const auto& [id, stream] : link->streams) {
+            if (now - stream->lastActive >= mIdleTimeout) {
+                idle.push_back(stream.get());
+            }
+        }
+        for (Stream* stream : idle) {
+            if (mMetrics != nullptr) {
+                mMetrics->idleTimeouts.fetch_add(1, std::memory_order_relaxed);
+            }
+            resetStream(*stream);
+        }
+        if (!idle.empty()) {
+            flushLink(*link);
+        }
+    }
+}
+
+bool Multiplexer::control(int op, int fd, uint32_t events, void* handler) {
+    epoll_event event{};
+    event.events = events;
+    event.data.ptr = handler;
+    if (epoll_ctl(mEpollFd, op, fd, &event) != 0) {
+        // Removing fails harmlessly for sockets which were never registered.
+        if (op != EPOLL_CTL_DEL) {
+            logMessage(LOG_SITE(), logFields(errno), "Failed to update multiplexer epoll");
+        }
+        return false;
+    }
+    return true;
+}
+
+LogFields Multiplexer::logFields(int error) const {
+    if (mMetrics == nullptr) {
+        return {.error = error};
+    }
+    return {.service = mMetrics->name.c_str(), .cid = mMetrics->cid, .error = error};
+}
+
+}  // namespace android::automotive::proxy
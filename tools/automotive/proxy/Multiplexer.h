@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Log.h"
+#include "Metrics.h"
+#include "MuxProtocol.h"
+
+namespace android::automotive::proxy {
+
+// Forwards streams between local sockets and the links they are multiplexed
+// over, on an epoll loop of its own. This is the part shared by both ends of
+// a link; UpstreamMux opens links and streams for the proxy's clients, and
+// the demux in the VM accepts them.
+//
+// Every socket is non-blocking. A link whose peer falls behind pauses reading
+// from its streams instead of buffering without bound.
+class Multiplexer {
+  public:
+    virtual ~Multiplexer();
+
+    Multiplexer(const Multiplexer&) = delete;
+    Multiplexer& operator=(const Multiplexer&) = delete;
+
+    // Sets the multiplexer up and starts its thread.
+    bool start();
+
+    // Blocks until the thread returns, which it only does on a fatal error or
+    // after stop().
+    void wait();
+
+  protected:
+    struct Link;
+    struct Stream;
+
+    // Bytes and idle timeouts are accounted to metrics, if given. Streams
+    // without traffic for idleTimeout are reset, unless it is zero.
+    Multiplexer(ServiceMetrics* metrics, std::chrono::seconds idleTimeout);
+
+    // Stops the thread and closes every link. Subclasses call it from their
+    // destructor, so streamClosed() still reaches them.
+    void stop();
+
+    // Called by start() before the thread runs, e.g. to watch a listening
+    // socket.
+    virtual bool setUp() { return true; }
+    // Called on the thread after wake() was called.
+    virtual void handleWake() {}
+    // Called on the thread when a socket given to watch() is readable.
+    virtual void handleReady(int /* fd */) {}
+    // Returns the socket a stream the peer opened is forwarded to, which may
+    // still be connecting, or -1 to refuse the stream.
+    virtual int acceptStream() { return -1; }
+    // Called once for every stream which was added, when it is closed.
+    virtual void streamClosed() {}
+
+    // Makes the thread call handleWake(). Thread safe.
+    void wake();
+    bool watch(int fd);
+
+    // Adds a link over fd, which is still connecting if connecting is set.
+    // Takes fd, and returns null on failure.
+    Link* addLink(int fd, bool connecting);
+    // The link carrying the fewest streams, or null if there is none.
+    Link* leastLoadedLink() const;
+    size_t linkCount() const { return mLinks.size(); }
+    // Opens a new stream to the peer of link, forwarding fd. Takes fd, and
+    // calls streamClosed() once the stream closes, even if it fails to open.
+    void openStream(Link& link, int fd);
+
+  private:
+    struct Handler;
+    struct Callback;
+
+    void run();
+    void handleLinkEvents(Link& link, uint32_t events);
+    void handleStreamEvents(Stream& stream, uint32_t events);
+    bool readLink(Link& link);
+    bool handleFrame(Link& link, const MuxFrameHeader& header, const char* payload);
+    void queueFrame(Link& link, MuxFrameType type, uint32_t stream, const void* payload = nullptr,
+                    size_t length = 0);
+    void flushLink(Link& link);
+    void closeLink(Link& link);
+    Stream* addStream(Link& link, uint32_t id, int fd, bool connecting);
+    void readStream(Stream& stream);
+    void writeStream(Stream& stream);
+    void updateStream(Stream& stream);
+    void updateLink(Link& link);
+    void resetStream(Stream& stream);
+    void closeStream(Stream& stream);
+    void closeIdleStreams();
+    bool control(int op, int fd, uint32_t events, void* handler);
+    // The service of the multiplexer for log messages, if it has metrics.
+    LogFields logFields(int error = 0) const;
+
+    ServiceMetrics* const mMetrics;
+    const std::chrono::seconds mIdleTimeout;
+    int mEpollFd = -1;
+    int mWakeFd = -1;
+    std::atomic<bool> mStopping{false};
+    std::vector<std::unique_ptr<Handler>> mHandlers;
+    std::vector<std::unique_ptr<Link>> mLinks;
+    // Closed during the current batch of events, which may still refer to
+    // them.
+    std::vector<std::unique_ptr<Link>> mReleasedLinks;
+    std::vector<std::unique_ptr<Stream>> mReleasedStreams;
+    std::chrono::steady_clock::time_point mLastIdleCheck;
+    std::thread mThread;
+};
+
+}  // namespace android::automotive::proxy
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The framing of multiplexed services, spoken between the proxy and
+// automotive_vsock_demux in the VM. A link is one VSOCK connection carrying
+// any number of streams, each the bytes of one client connection. All fields
+// are little-endian.
+//
+// Both ends start a link with HELLO, and the proxy opens a stream with OPEN.
+// Either end then sends DATA for the stream, and FIN once it will send no
+// more, so a stream ends once both ends sent FIN. RESET drops a stream at
+// once, e.g. when the VM's service refused it.
+//
+// Every stream is flow controlled on its own: an end sends no more than
+// kMuxStreamWindow bytes the other end hasn't credited with WINDOW yet, so a
+// client which stops reading never holds up the other streams of its link.
+namespace android::automotive::proxy {
+
+enum class MuxFrameType : uint8_t {
+    // Stream 0, with the uint32_t kMuxVersion of the sender.
+    HELLO = 1,
+    OPEN = 2,
+    DATA = 3,
+    FIN = 4,
+    RESET = 5,
+    // A uint32_t count of bytes of the stream the receiver may send on top.
+    WINDOW = 6,
+};
+
+struct MuxFrameHeader {
+    uint32_t stream;
+    // Bytes of payload following the header.
+    uint16_t length;
+    uint8_t type;
+    uint8_t reserved;
+};
+static_assert(sizeof(MuxFrameHeader) == 8);
+
+// Bumped whenever the framing changes; links to an end of another version are
+// closed after HELLO.
+constexpr uint32_t kMuxVersion = 1;
+constexpr size_t kMuxMaxPayload = 16 * 1024;
+constexpr uint32_t kMuxStreamWindow = 256 * 1024;
+
+}  // namespace android::automotive::proxy
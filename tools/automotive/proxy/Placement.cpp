@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Placement.h"
+
+#include <errno.h>
+#include <iostream>
+#include <fstream>
+#include <sched.h>
+#include <string.h>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <linux/mempolicy.h>
+
+namespace android::automotive::proxy {
+
+// The most NUMA nodes a memory policy of the proxy can name.
+static constexpr unsigned kMaxNumaNodes = 1024;
+static constexpr unsigned kBitsPerWord = 8 * sizeof(unsigned long);
+
+// Parses a sysfs CPU list such as "0-3,8-11".
+static std::vector<unsigned> readCpuList(const std::string& path) {
+    std::vector<unsigned> cpus;
+    std::ifstream file(path);
+    std::string range;
+    while (std::getline(file, range, ',')) {
+        unsigned first;
+        unsigned last;
+        int fields = sscanf(range.c_str(), "%u-%u", &first, &last);
+        if (fields < 1) {
+            continue;
+        }
+        if (fields == 1) {
+            last = first;
+        }
+        for (unsigned cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+Placement placementOf(const proxyconfig::VmConfig& vmConfig) {
+    Placement placement{vmConfig.cpus, vmConfig.numaNode};
+    if (placement.cpus.empty() && placement.numaNode) {
+        placement.cpus = readCpuList("/sys/devices/system/node/node" +
+                                     std::to_string(*placement.numaNode) + "/cpulist");
+        if (placement.cpus.empty()) {
+            std::cerr << "Failed to read the CPUs of NUMA node " << *placement.numaNode
+                      << std::endl;
+        }
+    }
+    return placement;
+}
+
+static bool setPreferredNode(std::optional<unsigned> numaNode) {
+    long ret;
+    if (numaNode) {
+        unsigned long nodes[kMaxNumaNodes / kBitsPerWord] = {};
+        nodes[*numaNode / kBitsPerWord] |= 1UL << (*numaNode % kBitsPerWord);
+        // The kernel reads one bit less than maxnode says.
+        ret = syscall(__NR_set_mempolicy, MPOL_PREFERRED, nodes, kMaxNumaNodes + 1);
+    } else {
+        ret = syscall(__NR_set_mempolicy, MPOL_DEFAULT, nullptr, 0);
+    }
+    if (ret < 0) {
+        std::cerr << "Failed to set the memory policy, ERROR = " << strerror(errno)
+                  << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool applyPlacement(const Placement& placement) {
+    bool applied = true;
+    if (!placement.cpus.empty()) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (unsigned cpu : placement.cpus) {
+            if (cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &cpus);
+            }
+        }
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+            std::cerr << "Failed to set the CPU affinity, ERROR = " << strerror(errno)
+                      << std::endl;
+            applied = false;
+        }
+    }
+    if (placement.numaNode && !setPreferredNode(placement.numaNode)) {
+        applied = false;
+    }
+    return applied;
+}
+
+ScopedMemoryPolicy::ScopedMemoryPolicy(std::optional<unsigned> numaNode) {
+    if (numaNode) {
+        mApplied = setPreferredNode(numaNode);
+    }
+}
+
+ScopedMemoryPolicy::~ScopedMemoryPolicy() {
+    if (mApplied) {
+        setPreferredNode(std::nullopt);
+    }
+}
+
+}  // namespace android::automotive::proxy
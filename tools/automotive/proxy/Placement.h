@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include "ProxyConfig.h"
+
+namespace android::automotive::proxy {
+
+// Where the threads forwarding the connections of a VM run, and which NUMA
+// node their memory comes from. An empty placement leaves both to the kernel.
+struct Placement {
+    std::vector<unsigned> cpus;
+    std::optional<unsigned> numaNode;
+
+    bool empty() const { return cpus.empty() && !numaNode; }
+    bool operator==(const Placement&) const = default;
+};
+
+// The placement the config of a VM asks for. A NUMA node without CPUs stands
+// for the CPUs of the node.
+Placement placementOf(const proxyconfig::VmConfig& vmConfig);
+
+// Pins the calling thread to the CPUs of placement and makes it prefer memory
+// of its NUMA node. Threads it creates afterwards inherit both.
+bool applyPlacement(const Placement& placement);
+
+// Makes the calling thread prefer memory of a NUMA node while in scope, e.g.
+// while allocating the buffers of a loop which will run on the node.
+class ScopedMemoryPolicy {
+  public:
+    explicit ScopedMemoryPolicy(std::optional<unsigned> numaNode);
+    ~ScopedMemoryPolicy();
+
+    ScopedMemoryPolicy(const ScopedMemoryPolicy&) = delete;
+    ScopedMemoryPolicy& operator=(const ScopedMemoryPolicy&) = delete;
+
+  private:
+    bool mApplied = false;
+};
+
+}  // namespace android::automotive::proxy
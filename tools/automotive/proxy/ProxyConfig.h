@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// The whole proxy config, as the proxy and its tools read it. Unlike
+// <libProxyConfig/libProxyConfig.h>, which other vendor modules build
+// against, this is private to tools/automotive/proxy and may change with the
+// proxy.
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <libProxyConfig/libProxyConfig.h>
+
+namespace android::automotive::proxyconfig {
+
+// A socket on the host clients of a service may connect to besides the VSOCK
+// port, so host tools need no relay of their own.
+struct Frontend {
+    enum class Type { UNIX, TCP };
+
+    Type type;
+    // The path of a Unix domain socket ("unix"), created when the proxy
+    // starts. A leading '@' stands for the abstract namespace.
+    std::string path;
+    // A TCP port on the loopback interface ("tcp").
+    unsigned port = 0;
+
+    bool operator==(const Frontend&) const = default;
+};
+
+struct ServiceConfig {
+    std::string name;
+    unsigned port;
+    // Number of idle connections to the VM the proxy keeps established for
+    // this service ("poolSize"), so clients do not wait for a handshake.
+    unsigned poolSize = 0;
+    // Length of the queue of clients waiting to be accepted ("backlog"), or
+    // zero for the proxy's default.
+    unsigned backlog = 0;
+    // Most clients forwarded at once ("maxConnections"), zero for no limit
+    // beyond the proxy-wide one. Clients above it are closed after accept.
+    unsigned maxConnections = 0;
+    // Seconds a connection may go without traffic in either direction before
+    // the proxy closes it ("idleTimeoutSeconds"), zero to never time out.
+    unsigned idleTimeoutSeconds = 0;
+    // Bytes buffered per direction of a connection ("bufferSize"), zero for
+    // the proxy's default.
+    unsigned bufferSize = 0;
+    // Up to how many bytes the proxy may grow the buffers of a connection
+    // which keeps them full ("maxBufferSize"), zero to stay at bufferSize.
+    unsigned maxBufferSize = 0;
+    // SO_SNDBUF and SO_RCVBUF of both sockets of a connection
+    // ("sendBufferSize", "receiveBufferSize"), zero for the kernel's default.
+    unsigned sendBufferSize = 0;
+    unsigned receiveBufferSize = 0;
+    // Hint for interactive services ("lowLatency"): small buffers which are
+    // never grown, so bytes are passed on as soon as they arrive.
+    bool lowLatency = false;
+    // Share of a forwarding thread each connection of this service gets when
+    // connections compete for it ("weight"), relative to the other services.
+    // Zero counts as one.
+    unsigned weight = 0;
+    // Bytes per second the connections of this service may forward together,
+    // in both directions ("rateLimitBytesPerSecond"), zero for no limit. Up
+    // to "rateLimitBurstBytes" may be forwarded at once after a quiet spell,
+    // zero for a second's worth.
+    unsigned rateLimitBytesPerSecond = 0;
+    unsigned rateLimitBurstBytes = 0;
+    // Carries the clients of this service as streams over this many shared
+    // connections to automotive_vsock_demux in the VM
+    // ("multiplexConnections"), instead of a connection per client. Zero
+    // connects every client on its own, and poolSize is ignored otherwise.
+    unsigned multiplexConnections = 0;
+    // The port the demux listens on in the VM ("multiplexPort"), zero for
+    // port.
+    unsigned multiplexPort = 0;
+    // Further sockets forwarded like the VSOCK port ("frontends"), each an
+    // object with either "unix" or "tcp".
+    std::vector<Frontend> frontends;
+
+    bool operator==(const ServiceConfig&) const = default;
+};
+
+struct VmConfig {
+    unsigned cid;
+    std::vector<ServiceConfig> services;
+    // CPUs the proxy forwards the VM's connections on ("cpus"), empty for
+    // any CPU.
+    std::vector<unsigned> cpus;
+    // NUMA node the VM is pinned to ("numaNode"). The proxy then prefers
+    // memory of that node for the VM's connections, and runs them on the
+    // node's CPUs unless cpus is set.
+    std::optional<unsigned> numaNode;
+};
+
+// A problem found in a config file, at a 1-based line and column, or at 0:0
+// for problems with the file as a whole.
+struct ProxyConfigError {
+    unsigned line;
+    unsigned column;
+    std::string message;
+
+    // "line:column: message"
+    std::string toString() const;
+};
+
+// The configs read from a config file, or the errors which kept it from being
+// read.
+struct ProxyConfigResult {
+    std::vector<VmConfig> vmConfigs;
+    std::vector<ProxyConfigError> errors;
+
+    bool ok() const { return errors.empty(); }
+};
+
+std::string_view getProxyConfigFile();
+// The binary config compiled from configFile at build time: its path with a
+// ".bin" extension instead of ".json".
+std::string getBinaryProxyConfigFile(std::string_view configFile);
+// Parses and validates the text of a config file in a single pass, without
+// building a JSON tree. Besides JSON syntax and member types, it checks that
+// CIDs and ports are usable, that no CID is listed twice, that no port is used
+// twice and that service names are unique within a VM. Unknown members are
+// ignored.
+ProxyConfigResult parseVmProxyConfigs(std::string_view json);
+// Reads the JSON config file with parseVmProxyConfigs().
+ProxyConfigResult readProxyConfigFile();
+// Reads the binary config when it is there and not older than the JSON, so no
+// JSON is parsed, and the JSON with readProxyConfigFile() otherwise.
+ProxyConfigResult loadProxyConfigFile();
+
+}  // namespace android::automotive::proxyconfig
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compiles a proxy_config.json into the binary form libProxyConfig reads at
+// runtime, see ProxyConfigFormat.h.
+
+#include <errno.h>
+#include <iostream>
+#include <fstream>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "ProxyConfig.h"
+#include "ProxyConfigFormat.h"
+
+using namespace android::automotive::proxyconfig;
+
+static bool writeBinaryConfig(const std::vector<VmConfig>& vmConfigs,
+                              const char* path) {
+    BinaryHeader header{};
+    memcpy(header.magic, kBinaryMagic, sizeof(kBinaryMagic));
+    header.version = kBinaryVersion;
+    header.vmCount = vmConfigs.size();
+
+    std::vector<BinaryVm> vms;
+    std::vector<BinaryService> services;
+    std::vector<uint32_t> cpus;
+    std::vector<BinaryFrontend> frontends;
+    std::string names;
+    for (const auto& vmConfig: vmConfigs) {
+        vms.push_back(BinaryVm{vmConfig.cid, static_cast<uint32_t>(vmConfig.services.size()),
+                               static_cast<uint32_t>(vmConfig.cpus.size()),
+                               vmConfig.numaNode.value_or(kBinaryNoNumaNode)});
+        cpus.insert(cpus.end(), vmConfig.cpus.begin(), vmConfig.cpus.end());
+        for (const auto& service: vmConfig.services) {
+            BinaryService entry{};
+            entry.nameOffset = names.size();
+            entry.nameLength = service.name.size();
+            entry.port = service.port;
+            entry.poolSize = service.poolSize;
+            entry.backlog = service.backlog;
+            entry.maxConnections = service.maxConnections;
+            entry.idleTimeoutSeconds = service.idleTimeoutSeconds;
+            entry.bufferSize = service.bufferSize;
+            entry.maxBufferSize = service.maxBufferSize;
+            entry.sendBufferSize = service.sendBufferSize;
+            entry.receiveBufferSize = service.receiveBufferSize;
+            entry.flags = service.lowLatency ? kBinaryLowLatency : 0;
+            entry.frontendCount = service.frontends.size();
+            entry.weight = service.weight;
+            entry.rateLimitBytesPerSecond = service.rateLimitBytesPerSecond;
+            entry.rateLimitBurstBytes = service.rateLimitBurstBytes;
+            entry.multiplexConnections = service.multiplexConnections;
+            entry.multiplexPort = service.multiplexPort;
+            services.push_back(entry);
+            names += service.name;
+            for (const auto& frontend: service.frontends) {
+                frontends.push_back(BinaryFrontend{
+                    frontend.type == Frontend::Type::TCP ? kBinaryTcpFrontend
+                                                         : kBinaryUnixFrontend,
+                    frontend.port, static_cast<uint32_t>(names.size()),
+                    static_cast<uint32_t>(frontend.path.size())});
+                names += frontend.path;
+            }
+        }
+    }
+    header.serviceCount = services.size();
+    header.cpuCount = cpus.size();
+    header.frontendCount = frontends.size();
+    header.namesSize = names.size();
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(vms.data()), vms.size() * sizeof(BinaryVm));
+    file.write(reinterpret_cast<const char*>(services.data()),
+               services.size() * sizeof(BinaryService));
+    file.write(reinterpret_cast<const char*>(cpus.data()), cpus.size() * sizeof(uint32_t));
+    file.write(reinterpret_cast<const char*>(frontends.data()),
+               frontends.size() * sizeof(BinaryFrontend));
+    file.write(names.data(), names.size());
+    file.close();
+    return !file.fail();
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " proxy_config.json proxy_config.bin" << std::endl;
+        return 1;
+    }
+
+    setProxyConfigFile(argv[1]);
+    ProxyConfigResult result = readProxyConfigFile();
+    if (!result.ok()) {
+        for (const auto& error : result.errors) {
+            std::cerr << argv[1] << ":" << error.toString() << std::endl;
+        }
+        return 1;
+    }
+    if (!writeBinaryConfig(result.vmConfigs, argv[2])) {
+        std::cerr << "Failed to write " << argv[2] << ", ERROR = " << strerror(errno)
+                  << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Reading the config file, in either its JSON or its binary form.
+
+#include "ProxyConfig.h"
+
+#include <string.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <iterator>
+
+#include "ProxyConfigFormat.h"
+
+namespace android::automotive::proxyconfig {
+
+static std::string_view proxyConfig =
+    "/etc/automotive/proxy_config.json";
+
+void setProxyConfigFile(std::string_view configFile) {
+    proxyConfig = configFile;
+}
+
+std::string_view getProxyConfigFile() {
+    return proxyConfig;
+}
+
+std::string getBinaryProxyConfigFile(std::string_view configFile) {
+    std::string path(configFile);
+    constexpr std::string_view kJsonExtension = ".json";
+    if (path.size() >= kJsonExtension.size() &&
+        path.compare(path.size() - kJsonExtension.size(), kJsonExtension.size(),
+                     kJsonExtension) == 0) {
+        path.resize(path.size() - kJsonExtension.size());
+    }
+    return path + ".bin";
+}
+
+static bool isNewer(const timespec& lhs, const timespec& rhs) {
+    return lhs.tv_sec > rhs.tv_sec || (lhs.tv_sec == rhs.tv_sec && lhs.tv_nsec > rhs.tv_nsec);
+}
+
+// Decodes the size bytes of a binary config, or returns nullopt if they are
+// not a complete config of kBinaryVersion.
+static std::optional<std::vector<VmConfig>> decodeBinaryConfig(const char* data, size_t size) {
+    BinaryHeader header;
+    if (size < sizeof(header)) {
+        return std::nullopt;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, kBinaryMagic, sizeof(kBinaryMagic)) != 0 ||
+        header.version != kBinaryVersion) {
+        return std::nullopt;
+    }
+    uint64_t vmsOffset = sizeof(header);
+    uint64_t servicesOffset = vmsOffset + uint64_t{header.vmCount} * sizeof(BinaryVm);
+    uint64_t cpusOffset =
+        servicesOffset + uint64_t{header.serviceCount} * sizeof(BinaryService);
+    uint64_t frontendsOffset = cpusOffset + uint64_t{header.cpuCount} * sizeof(uint32_t);
+    uint64_t namesOffset =
+        frontendsOffset + uint64_t{header.frontendCount} * sizeof(BinaryFrontend);
+    if (namesOffset + header.namesSize != size) {
+        return std::nullopt;
+    }
+
+    std::vector<VmConfig> vmConfigs(header.vmCount);
+    uint32_t serviceIndex = 0;
+    uint32_t cpuIndex = 0;
+    uint32_t frontendIndex = 0;
+    for (uint32_t i = 0; i < header.vmCount; i++) {
+        BinaryVm vm;
+        memcpy(&vm, data + vmsOffset + i * sizeof(vm), sizeof(vm));
+        if (vm.serviceCount > header.serviceCount - serviceIndex ||
+            vm.cpuCount > header.cpuCount - cpuIndex) {
+            return std::nullopt;
+        }
+        vmConfigs[i].cid = vm.cid;
+        vmConfigs[i].cpus.resize(vm.cpuCount);
+        for (unsigned& cpu : vmConfigs[i].cpus) {
+            uint32_t entry;
+            memcpy(&entry, data + cpusOffset + cpuIndex++ * sizeof(entry), sizeof(entry));
+            cpu = entry;
+        }
+        if (vm.numaNode != kBinaryNoNumaNode) {
+            vmConfigs[i].numaNode = vm.numaNode;
+        }
+        vmConfigs[i].services.resize(vm.serviceCount);
+        for (ServiceConfig& service : vmConfigs[i].services) {
+            BinaryService entry;
+            memcpy(&entry, data + servicesOffset + serviceIndex++ * sizeof(entry),
+                   sizeof(entry));
+            if (uint64_t{entry.nameOffset} + entry.nameLength > header.namesSize) {
+                return std::nullopt;
+            }
+            service.name.assign(data + namesOffset + entry.nameOffset, entry.nameLength);
+            service.port = entry.port;
+            service.poolSize = entry.poolSize;
+            service.backlog = entry.backlog;
+            service.maxConnections = entry.maxConnections;
+            service.idleTimeoutSeconds = entry.idleTimeoutSeconds;
+            service.bufferSize = entry.bufferSize;
+            service.maxBufferSize = entry.maxBufferSize;
+            service.sendBufferSize = entry.sendBufferSize;
+            service.receiveBufferSize = entry.receiveBufferSize;
+            service.lowLatency = (entry.flags & kBinaryLowLatency) != 0;
+            service.weight = entry.weight;
+            service.rateLimitBytesPerSecond = entry.rateLimitBytesPerSecond;
+            service.rateLimitBurstBytes = entry.rateLimitBurstBytes;
+            service.multiplexConnections = entry.multiplexConnections;
+            service.multiplexPort = entry.multiplexPort;
+            if (entry.frontendCount > header.frontendCount - frontendIndex) {
+                return std::nullopt;
+            }
+            service.frontends.resize(entry.frontendCount);
+            for (Frontend& frontend : service.frontends) {
+                BinaryFrontend binaryFrontend;
+                memcpy(&binaryFrontend,
+                       data + frontendsOffset + frontendIndex++ * sizeof(binaryFrontend),
+                       sizeof(binaryFrontend));
+                if (uint64_t{binaryFrontend.pathOffset} + binaryFrontend.pathLength >
+                    header.namesSize) {
+                    return std::nullopt;
+                }
+                frontend.type = binaryFrontend.type == kBinaryTcpFrontend ? Frontend::Type::TCP
+                                                                          : Frontend::Type::UNIX;
+                frontend.port = binaryFrontend.port;
+                frontend.path.assign(data + namesOffset + binaryFrontend.pathOffset,
+                                     binaryFrontend.pathLength);
+            }
+        }
+    }
+    if (serviceIndex != header.serviceCount || cpuIndex != header.cpuCount ||
+        frontendIndex != header.frontendCount) {
+        return std::nullopt;
+    }
+    return vmConfigs;
+}
+
+// Reads the binary config next to the JSON one, unless it is missing, invalid
+// or older than the JSON, e.g. because the JSON was edited on the device.
+static std::optional<std::vector<VmConfig>> loadBinaryConfig() {
+    std::string path = getBinaryProxyConfigFile(proxyConfig);
+    std::ifstream file(path, std::ios::binary);
+    struct stat binaryStat;
+    struct stat jsonStat;
+    if (!file || stat(path.c_str(), &binaryStat) < 0 ||
+        (stat(std::string(proxyConfig).c_str(), &jsonStat) == 0 &&
+         isNewer(jsonStat.st_mtim, binaryStat.st_mtim))) {
+        return std::nullopt;
+    }
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return decodeBinaryConfig(data.data(), data.size());
+}
+
+ProxyConfigResult readProxyConfigFile() {
+    std::ifstream file(std::string(proxyConfig).c_str(), std::ios::binary);
+    if (!file) {
+        return ProxyConfigResult{{}, {{0, 0, "cannot open " + std::string(proxyConfig)}}};
+    }
+    std::string json((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return parseVmProxyConfigs(json);
+}
+
+ProxyConfigResult loadProxyConfigFile() {
+    if (auto vmConfigs = loadBinaryConfig()) {
+        return ProxyConfigResult{std::move(*vmConfigs), {}};
+    }
+    return readProxyConfigFile();
+}
+
+}  // namespace android::automotive::proxyconfig
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// The binary form of proxy_config.json, written at build time by
+// automotive_proxy_config_compiler and read by libProxyConfig. The compiler
+// already validated the config, so loading it takes a single bounds-checked
+// pass over fixed-size records instead of parsing and validating the JSON at
+// every start. All fields are little-endian. The file is laid out as:
+//
+//   BinaryHeader
+//   BinaryVm[vmCount]
+//   BinaryService[serviceCount], the services of each VM in turn
+//   uint32_t[cpuCount], the CPUs of each VM in turn
+//   BinaryFrontend[frontendCount], the frontends of each service in turn
+//   the names of the services and the paths of the frontends, not
+//   NUL-terminated
+namespace android::automotive::proxyconfig {
+
+constexpr char kBinaryMagic[4] = {'P', 'X', 'C', 'F'};
+// Bumped whenever the layout below changes; files of another version are
+// ignored in favour of the JSON.
+constexpr uint32_t kBinaryVersion = 5;
+
+struct BinaryHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t vmCount;
+    uint32_t serviceCount;
+    uint32_t cpuCount;
+    uint32_t frontendCount;
+    uint32_t namesSize;
+};
+
+constexpr uint32_t kBinaryNoNumaNode = UINT32_MAX;
+
+struct BinaryVm {
+    uint32_t cid;
+    uint32_t serviceCount;
+    uint32_t cpuCount;
+    // kBinaryNoNumaNode if the VM has none.
+    uint32_t numaNode;
+};
+
+constexpr uint32_t kBinaryLowLatency = 1 << 0;
+
+struct BinaryService {
+    // Relative to the start of the names.
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t port;
+    uint32_t poolSize;
+    uint32_t backlog;
+    uint32_t maxConnections;
+    uint32_t idleTimeoutSeconds;
+    uint32_t bufferSize;
+    uint32_t maxBufferSize;
+    uint32_t sendBufferSize;
+    uint32_t receiveBufferSize;
+    uint32_t flags;
+    uint32_t frontendCount;
+    uint32_t weight;
+    uint32_t rateLimitBytesPerSecond;
+    uint32_t rateLimitBurstBytes;
+    uint32_t multiplexConnections;
+    uint32_t multiplexPort;
+};
+
+constexpr uint32_t kBinaryUnixFrontend = 0;
+constexpr uint32_t kBinaryTcpFrontend = 1;
+
+struct BinaryFrontend {
+    uint32_t type;
+    uint32_t port;
+    // Relative to the start of the names.
+    uint32_t pathOffset;
+    uint32_t pathLength;
+};
+
+}  // namespace android::automotive::proxyconfig
@@ -0,0 +1,637 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A single-pass parser for proxy_config.json. It fills VmConfig and
+// ServiceConfig as it reads, without building a JSON tree first, and validates
+// the config on the way.
+
+#include "ProxyConfig.h"
+
+#include <stdint.h>
+
+#include <linux/vm_sockets.h>
+
+#include <map>
+#include <set>
+#include <utility>
+
+namespace android::automotive::proxyconfig {
+
+namespace {
+
+// Deeper values are only ever seen in members the parser does not know, and
+// are rejected rather than risking the stack.
+constexpr int kMaxDepth = 64;
+// The most CPUs and NUMA nodes a cpu_set_t and a node mask of the proxy fit.
+constexpr unsigned kMaxCpus = 1024;
+constexpr unsigned kMaxNumaNodes = 1024;
+// sizeof(sockaddr_un::sun_path).
+constexpr size_t kMaxUnixPathLength = 108;
+
+class Parser {
+  public:
+    explicit Parser(std::string_view text) : mText(text) {}
+
+    ProxyConfigResult parse() {
+        skipWhitespace();
+        parseConfig();
+        if (!mFailed) {
+            skipWhitespace();
+            if (mOffset < mText.size()) {
+                syntaxError("unexpected data after the config");
+            }
+        }
+        if (!mResult.errors.empty()) {
+            mResult.vmConfigs.clear();
+        }
+        return std::move(mResult);
+    }
+
+  private:
+    // Syntax errors stop the parser, other errors are collected until the
+    // end of the file.
+    void error(size_t offset, std::string message) {
+        ProxyConfigError error{1, 1, std::move(message)};
+        for (size_t i = 0; i < offset && i < mText.size(); i++) {
+            if (mText[i] == '\n') {
+                error.line++;
+                error.column = 1;
+            } else {
+                error.column++;
+            }
+        }
+        mResult.errors.push_back(std::move(error));
+    }
+
+    bool syntaxError(std::string message) {
+        error(mOffset, std::move(message));
+        mFailed = true;
+        return false;
+    }
+
+    void skipWhitespace() {
+        while (mOffset < mText.size() && (mText[mOffset] == ' ' || mText[mOffset] == '\t' ||
+                                          mText[mOffset] == '\n' || mText[mOffset] == '\r')) {
+            mOffset++;
+        }
+    }
+
+    char peek() const { return mOffset < mText.size() ? mText[mOffset] : '\0'; }
+
+    bool consume(char expected) {
+        skipWhitespace();
+        if (peek() != expected) {
+            return syntaxError(std::string("expected '") + expected + "'");
+        }
+        mOffset++;
+        skipWhitespace();
+        return true;
+    }
+
+    bool consumeLiteral(std::string_view literal) {
+        if (mText.substr(mOffset, literal.size()) != literal) {
+            return syntaxError("invalid literal");
+        }
+        mOffset += literal.size();
+        return true;
+    }
+
+    static int hexValue(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    bool parseHex4(uint32_t* value) {
+        *value = 0;
+        for (int i = 0; i < 4; i++) {
+            int digit = hexValue(peek());
+            if (digit < 0) {
+                return syntaxError("invalid \\u escape");
+            }
+            *value = *value << 4 | digit;
+            mOffset++;
+        }
+        return true;
+    }
+
+    static void appendUtf8(std::string* out, uint32_t codePoint) {
+        if (codePoint < 0x80) {
+            *out += static_cast<char>(codePoint);
+        } else if (codePoint < 0x800) {
+            *out += static_cast<char>(0xc0 | codePoint >> 6);
+            *out += static_cast<char>(0x80 | (codePoint & 0x3f));
+        } else if (codePoint < 0x10000) {
+            *out += static_cast<char>(0xe0 | codePoint >> 12);
+            *out += static_cast<char>(0x80 | (codePoint >> 6 & 0x3f));
+            *out += static_cast<char>(0x80 | (codePoint & 0x3f));
+        } else {
+            *out += static_cast<char>(0xf0 | codePoint >> 18);
+            *out += static_cast<char>(0x80 | (codePoint >> 12 & 0x3f));
+            *out += static_cast<char>(0x80 | (codePoint >> 6 & 0x3f));
+            *out += static_cast<char>(0x80 | (codePoint & 0x3f));
+        }
+    }
+
+    // Parses a string at the current position into out, if not null.
+    bool parseString(std::string* out) {
+        if (peek() != '"') {
+            return syntaxError("expected a string");
+        }
+        mOffset++;
+        while (true) {
+            if (mOffset >= mText.size()) {
+                return syntaxError("unterminated string");
+            }
+            char c = mText[mOffset++];
+            if (c == '"') {
+                return true;
+            }
+            if (static_cast<unsigned char>(c) < 0x20) {
+                mOffset--;
+                return syntaxError("control character in string");
+            }
+            if (c != '\\') {
+                if (out != nullptr) *out += c;
+                continue;
+            }
+            char escape = peek();
+            mOffset++;
+            char decoded;
+            switch (escape) {
+                case '"': decoded = '"'; break;
+                case '\\': decoded = '\\'; break;
+                case '/': decoded = '/'; break;
+                case 'b': decoded = '\b'; break;
+                case 'f': decoded = '\f'; break;
+                case 'n': decoded = '\n'; break;
+                case 'r': decoded = '\r'; break;
+                case 't': decoded = '\t'; break;
+                case 'u': {
+                    uint32_t codePoint;
+                    if (!parseHex4(&codePoint)) {
+                        return false;
+                    }
+                    if (codePoint >= 0xd800 && codePoint < 0xdc00) {
+                        if (mText.substr(mOffset, 2) != "\\u") {
+                            return syntaxError("invalid surrogate pair");
+                        }
+                        mOffset += 2;
+                        uint32_t low;
+                        if (!parseHex4(&low)) {
+                            return false;
+                        }
+                        if (low < 0xdc00 || low >= 0xe000) {
+                            return syntaxError("invalid surrogate pair");
+                        }
+                        codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+                    } else if (codePoint >= 0xdc00 && codePoint < 0xe000) {
+                        return syntaxError("invalid surrogate pair");
+                    }
+                    if (out != nullptr) appendUtf8(out, codePoint);
+                    continue;
+                }
+                default:
+                    mOffset--;
+                    return syntaxError("invalid escape in string");
+            }
+            if (out != nullptr) *out += decoded;
+        }
+    }
+
+    // Consumes a number, setting out to its value when it is an integer
+    // which fits. Returns false on a syntax error only.
+    bool parseNumber(bool* isUnsigned, uint64_t* out) {
+        *isUnsigned = peek() != '-';
+        if (peek() == '-') {
+            mOffset++;
+        }
+        if (peek() < '0' || peek() > '9') {
+            return syntaxError("invalid number");
+        }
+        *out = 0;
+        bool overflow = false;
+        if (peek() == '0') {
+            mOffset++;
+        } else {
+            while (peek() >= '0' && peek() <= '9') {
+                if (*out > (UINT64_MAX - 9) / 10) {
+                    overflow = true;
+                } else {
+                    *out = *out * 10 + (peek() - '0');
+                }
+                mOffset++;
+            }
+        }
+        if (peek() == '.') {
+            *isUnsigned = false;
+            mOffset++;
+            if (peek() < '0' || peek() > '9') {
+                return syntaxError("invalid number");
+            }
+            while (peek() >= '0' && peek() <= '9') mOffset++;
+        }
+        if (peek() == 'e' || peek() == 'E') {
+            *isUnsigned = false;
+            mOffset++;
+            if (peek() == '+' || peek() == '-') mOffset++;
+            if (peek() < '0' || peek() > '9') {
+                return syntaxError("invalid number");
+            }
+            while (peek() >= '0' && peek() <= '9') mOffset++;
+        }
+        if (overflow) {
+            *out = UINT64_MAX;
+        }
+        return true;
+    }
+
+    bool skipValue(int depth) {
+        if (depth > kMaxDepth) {
+            return syntaxError("values nested too deeply");
+        }
+        switch (peek()) {
+            case '{':
+                return parseObject([this, depth](const std::string&, size_t) {
+                    return skipValue(depth + 1);
+                });
+            case '[':
+                return parseArray([this, depth](size_t) { return skipValue(depth + 1); });
+            case '"':
+                return parseString(nullptr);
+            case 't':
+                return consumeLiteral("true");
+            case 'f':
+                return consumeLiteral("false");
+            case 'n':
+                return consumeLiteral("null");
+            default: {
+                bool isUnsigned;
+                uint64_t value;
+                return parseNumber(&isUnsigned, &value);
+            }
+        }
+    }
+
+    // Calls onMember(name, offset) with the position at each member's value,
+    // which onMember must consume. Reports members given twice.
+    template <typename OnMember>
+    bool parseObject(OnMember onMember) {
+        if (!consume('{')) {
+            return false;
+        }
+        std::set<std::string> seen;
+        if (peek() == '}') {
+            mOffset++;
+            return true;
+        }
+        while (true) {
+            size_t offset = mOffset;
+            std::string name;
+            if (!parseString(&name) || !consume(':')) {
+                return false;
+            }
+            if (!seen.insert(name).second) {
+                error(offset, "duplicate member \"" + name + "\"");
+            }
+            if (!onMember(name, offset)) {
+                return false;
+            }
+            skipWhitespace();
+            if (peek() == '}') {
+                mOffset++;
+                return true;
+            }
+            if (!consume(',')) {
+                return false;
+            }
+        }
+    }
+
+    // Calls onElement(offset) with the position at each element.
+    template <typename OnElement>
+    bool parseArray(OnElement onElement) {
+        if (!consume('[')) {
+            return false;
+        }
+        if (peek() == ']') {
+            mOffset++;
+            return true;
+        }
+        while (true) {
+            if (!onElement(mOffset)) {
+                return false;
+            }
+            skipWhitespace();
+            if (peek() == ']') {
+                mOffset++;
+                return true;
+            }
+            if (!consume(',')) {
+                return false;
+            }
+        }
+    }
+
+    bool parseUnsigned(const std::string& name, unsigned* out) {
+        size_t offset = mOffset;
+        char c = peek();
+        if (c != '-' && (c < '0' || c > '9')) {
+            error(offset, "\"" + name + "\" must be an unsigned integer");
+            return skipValue(0);
+        }
+        bool isUnsigned;
+        uint64_t value;
+        if (!parseNumber(&isUnsigned, &value)) {
+            return false;
+        }
+        if (!isUnsigned) {
+            error(offset, "\"" + name + "\" must be an unsigned integer");
+        } else if (value > UINT32_MAX) {
+            error(offset, "\"" + name + "\" is out of range");
+        } else {
+            *out = value;
+        }
+        return true;
+    }
+
+    bool parseBool(const std::string& name, bool* out) {
+        if (peek() == 't') {
+            *out = true;
+            return consumeLiteral("true");
+        }
+        if (peek() == 'f') {
+            *out = false;
+            return consumeLiteral("false");
+        }
+        error(mOffset, "\"" + name + "\" must be a boolean");
+        return skipValue(0);
+    }
+
+    bool parseName(const std::string& name, std::string* out) {
+        if (peek() != '"') {
+            error(mOffset, "\"" + name + "\" must be a string");
+            return skipValue(0);
+        }
+        return parseString(out);
+    }
+
+    bool parseFrontend(size_t offset, ServiceConfig* service) {
+        if (peek() != '{') {
+            error(offset, "a frontend must be an object");
+            return skipValue(0);
+        }
+        Frontend frontend{};
+        int types = 0;
+        bool parsed = parseObject([&](const std::string& name, size_t) {
+            if (name == "unix") {
+                types++;
+                frontend.type = Frontend::Type::UNIX;
+                return parseName(name, &frontend.path);
+            }
+            if (name == "tcp") {
+                types++;
+                frontend.type = Frontend::Type::TCP;
+                return parseUnsigned(name, &frontend.port);
+            }
+            return skipValue(1);
+        });
+        if (!parsed) {
+            return false;
+        }
+
+        if (types != 1) {
+            error(offset, "a frontend needs either \"unix\" or \"tcp\"");
+        } else if (frontend.type == Frontend::Type::UNIX) {
+            // The path has to fit sockaddr_un::sun_path with its terminator.
+            if (frontend.path.empty() || frontend.path == "@" ||
+                frontend.path.size() >= kMaxUnixPathLength) {
+                error(offset, "invalid Unix socket path \"" + frontend.path + "\"");
+            } else if (!mUnixPaths.insert(frontend.path).second) {
+                error(offset, "Unix socket path \"" + frontend.path + "\" is used twice");
+            }
+        } else if (frontend.port == 0 || frontend.port > UINT16_MAX) {
+            error(offset, "invalid TCP port " + std::to_string(frontend.port));
+        } else if (!mTcpPorts.insert(frontend.port).second) {
+            error(offset, "TCP port " + std::to_string(frontend.port) + " is used twice");
+        }
+        service->frontends.push_back(std::move(frontend));
+        return true;
+    }
+
+    bool parseService(size_t offset, VmConfig* vmConfig,
+                      std::set<std::string>* names) {
+        if (peek() != '{') {
+            error(offset, "a service must be an object");
+            return skipValue(0);
+        }
+        ServiceConfig service;
+        bool hasName = false;
+        bool nameIsInvalid = false;
+        bool hasPort = false;
+        bool portIsInvalid = false;
+        size_t portOffset = offset;
+        bool parsed = parseObject([&](const std::string& name, size_t) {
+            if (name == "name") {
+                hasName = true;
+                nameIsInvalid = peek() != '"';
+                return parseName(name, &service.name);
+            }
+            if (name == "port") {
+                hasPort = true;
+                portOffset = mOffset;
+                size_t errorCount = mResult.errors.size();
+                bool parsedPort = parseUnsigned(name, &service.port);
+                portIsInvalid = mResult.errors.size() != errorCount;
+                return parsedPort;
+            }
+            if (name == "lowLatency") {
+                return parseBool(name, &service.lowLatency);
+            }
+            if (name == "frontends") {
+                if (peek() != '[') {
+                    error(mOffset, "\"frontends\" must be an array");
+                    return skipValue(0);
+                }
+                return parseArray([&](size_t frontendOffset) {
+                    return parseFrontend(frontendOffset, &service);
+                });
+            }
+            for (auto [member, field] : {
+                     std::pair{"poolSize", &service.poolSize},
+                     std::pair{"backlog", &service.backlog},
+                     std::pair{"maxConnections", &service.maxConnections},
+                     std::pair{"idleTimeoutSeconds", &service.idleTimeoutSeconds},
+                     std::pair{"bufferSize", &service.bufferSize},
+                     std::pair{"maxBufferSize", &service.maxBufferSize},
+                     std::pair{"sendBufferSize", &service.sendBufferSize},
+                     std::pair{"receiveBufferSize", &service.receiveBufferSize},
+                     std::pair{"weight", &service.weight},
+                     std::pair{"rateLimitBytesPerSecond", &service.rateLimitBytesPerSecond},
+                     std::pair{"rateLimitBurstBytes", &service.rateLimitBurstBytes},
+                     std::pair{"multiplexConnections", &service.multiplexConnections},
+                     std::pair{"multiplexPort", &service.multiplexPort},
+                 }) {
+                if (name == member) {
+                    return parseUnsigned(name, field);
+                }
+            }
+            // Unknown members are skipped, so older builds read newer configs.
+            return skipValue(1);
+        });
+        if (!parsed) {
+            return false;
+        }
+
+        if (!hasName) {
+            error(offset, "a service needs a \"name\"");
+        } else if (service.name.empty()) {
+            // Also the case for a name which is not a string, already reported.
+            if (!nameIsInvalid) {
+                error(offset, "\"name\" must not be empty");
+            }
+        } else if (!names->insert(service.name).second) {
+            error(offset, "duplicate service name \"" + service.name + "\" in CID " +
+                              std::to_string(vmConfig->cid));
+        }
+        if (!hasPort) {
+            error(offset, "a service needs a \"port\"");
+        } else if (portIsInvalid) {
+            // Already reported.
+        } else if (service.port == 0 || service.port == VMADDR_PORT_ANY) {
+            error(portOffset, "invalid port " + std::to_string(service.port));
+        } else if (auto [entry, added] = mPorts.emplace(service.port, service.name); !added) {
+            // Every service is listened for on the same host CID.
+            error(portOffset, "port " + std::to_string(service.port) + " of \"" + service.name +
+                                  "\" is already used by \"" + entry->second + "\"");
+        }
+        vmConfig->services.push_back(std::move(service));
+        return true;
+    }
+
+    bool parseVm(size_t offset) {
+        if (peek() != '{') {
+            error(offset, "a VM must be an object");
+            return skipValue(0);
+        }
+        VmConfig vmConfig{};
+        bool hasCid = false;
+        bool hasServices = false;
+        bool cidIsInvalid = false;
+        size_t cidOffset = offset;
+        std::set<std::string> names;
+        bool parsed = parseObject([&](const std::string& name, size_t) {
+            if (name == "CID") {
+                hasCid = true;
+                cidOffset = mOffset;
+                size_t errorCount = mResult.errors.size();
+                bool parsedCid = parseUnsigned(name, &vmConfig.cid);
+                cidIsInvalid = mResult.errors.size() != errorCount;
+                return parsedCid;
+            }
+            if (name == "Services") {
+                hasServices = true;
+                if (peek() != '[') {
+                    error(mOffset, "\"Services\" must be an array");
+                    return skipValue(0);
+                }
+                return parseArray([&](size_t serviceOffset) {
+                    return parseService(serviceOffset, &vmConfig, &names);
+                });
+            }
+            if (name == "cpus") {
+                if (peek() != '[') {
+                    error(mOffset, "\"cpus\" must be an array");
+                    return skipValue(0);
+                }
+                return parseArray([&](size_t cpuOffset) {
+                    unsigned cpu = 0;
+                    if (!parseUnsigned(name, &cpu)) {
+                        return false;
+                    }
+                    if (cpu >= kMaxCpus) {
+                        error(cpuOffset, "invalid CPU " + std::to_string(cpu));
+                    } else {
+                        vmConfig.cpus.push_back(cpu);
+                    }
+                    return true;
+                });
+            }
+            if (name == "numaNode") {
+                size_t nodeOffset = mOffset;
+                unsigned node = 0;
+                if (!parseUnsigned(name, &node)) {
+                    return false;
+                }
+                if (node >= kMaxNumaNodes) {
+                    error(nodeOffset, "invalid NUMA node " + std::to_string(node));
+                } else {
+                    vmConfig.numaNode = node;
+                }
+                return true;
+            }
+            return skipValue(1);
+        });
+        if (!parsed) {
+            return false;
+        }
+
+        if (!hasCid) {
+            error(offset, "a VM needs a \"CID\"");
+        } else if (cidIsInvalid) {
+            // Already reported.
+        } else if (vmConfig.cid == VMADDR_CID_HOST || vmConfig.cid == VMADDR_CID_ANY) {
+            error(cidOffset, "invalid CID " + std::to_string(vmConfig.cid));
+        } else if (!mCids.insert(vmConfig.cid).second) {
+            error(cidOffset, "duplicate CID " + std::to_string(vmConfig.cid));
+        }
+        if (!hasServices) {
+            error(offset, "a VM needs \"Services\"");
+        }
+        mResult.vmConfigs.push_back(std::move(vmConfig));
+        return true;
+    }
+
+    void parseConfig() {
+        if (peek() != '[') {
+            syntaxError("the config must be an array of VMs");
+            return;
+        }
+        parseArray([this](size_t offset) { return parseVm(offset); });
+    }
+
+    const std::string_view mText;
+    size_t mOffset = 0;
+    bool mFailed = false;
+    ProxyConfigResult mResult;
+    std::set<unsigned> mCids;
+    std::map<unsigned, std::string> mPorts;
+    std::set<std::string> mUnixPaths;
+    std::set<unsigned> mTcpPorts;
+};
+
+}  // namespace
+
+std::string ProxyConfigError::toString() const {
+    return std::to_string(line) + ":" + std::to_string(column) + ": " + message;
+}
+
+ProxyConfigResult parseVmProxyConfigs(std::string_view json) {
+    return Parser(json).parse();
+}
+
+}  // namespace android::automotive::proxyconfig
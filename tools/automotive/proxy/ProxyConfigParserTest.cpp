@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "ProxyConfig.h"
+
+namespace android::automotive::proxyconfig {
+namespace {
+
+// The errors of config as "line:column: message".
+std::vector<std::string> errorsOf(std::string_view config) {
+    ProxyConfigResult result = parseVmProxyConfigs(config);
+    std::vector<std::string> errors;
+    for (const ProxyConfigError& error : result.errors) {
+        errors.push_back(error.toString());
+    }
+    EXPECT_EQ(result.ok(), errors.empty());
+    if (!result.ok()) {
+        EXPECT_TRUE(result.vmConfigs.empty());
+    }
+    return errors;
+}
+
+// A config with a VM of CID 3 whose only service has the given members.
+std::string withService(const std::string& members) {
+    return R"([{"CID": 3, "Services": [{"name": "a", "port": 1000, )" + members + "}]}]";
+}
+
+// A config with a VM of CID 3 and the given members, with a single service.
+std::string withVm(const std::string& members) {
+    return R"([{"CID": 3, "Services": [{"name": "a", "port": 1000}], )" + members + "}]";
+}
+
+TEST(ProxyConfigParserTest, ParsesServices) {
+    ProxyConfigResult result = parseVmProxyConfigs(R"([
+  {
+    "CID": 3,
+    "cpus": [0, 2],
+    "numaNode": 1,
+    "Services": [
+      {"name": "rpc", "port": 2345, "poolSize": 4, "lowLatency": true,
+       "frontends": [{"unix": "@rpc"}, {"tcp": 8080}], "unknown": {"a": [1, null]}}
+    ]
+  },
+  {"CID": 4, "Services": []}
+])");
+    ASSERT_TRUE(result.ok());
+    ASSERT_EQ(result.vmConfigs.size(), 2u);
+    const VmConfig& vm = result.vmConfigs[0];
+    EXPECT_EQ(vm.cid, 3u);
+    EXPECT_EQ(vm.cpus, (std::vector<unsigned>{0, 2}));
+    EXPECT_EQ(vm.numaNode, 1u);
+    ASSERT_EQ(vm.services.size(), 1u);
+    const ServiceConfig& service = vm.services[0];
+    EXPECT_EQ(service.name, "rpc");
+    EXPECT_EQ(service.port, 2345u);
+    EXPECT_EQ(service.poolSize, 4u);
+    EXPECT_TRUE(service.lowLatency);
+    EXPECT_EQ(service.frontends,
+              (std::vector<Frontend>{{Frontend::Type::UNIX, "@rpc", 0},
+                                     {Frontend::Type::TCP, "", 8080}}));
+    EXPECT_EQ(result.vmConfigs[1].cid, 4u);
+    EXPECT_FALSE(result.vmConfigs[1].numaNode.has_value());
+}
+
+TEST(ProxyConfigParserTest, ReportsSyntaxErrorsWithLineAndColumn) {
+    EXPECT_EQ(errorsOf("[\n  {\"CID\" 3}\n]"), std::vector<std::string>{"2:10: expected ':'"});
+    EXPECT_EQ(errorsOf("[{\"CID\": 3,\n\n   \"Services\": [], \"x\": tru}]"),
+              std::vector<std::string>{"3:25: invalid literal"});
+    EXPECT_EQ(errorsOf("[{\"CID\": 3, \"x\": \"3"),
+              std::vector<std::string>{"1:20: unterminated string"});
+    EXPECT_EQ(errorsOf("[] []"), std::vector<std::string>{"1:4: unexpected data after the config"});
+    EXPECT_EQ(errorsOf("{}"), std::vector<std::string>{"1:1: the config must be an array of VMs"});
+    EXPECT_EQ(errorsOf("[{\"x\": 1.}]"), std::vector<std::string>{"1:10: invalid number"});
+    // Errors found before a syntax error are kept.
+    EXPECT_EQ(errorsOf("[{\"CID\": 2, \"Services\": []}, {\"x\": -}]"),
+              (std::vector<std::string>{"1:10: invalid CID 2", "1:37: invalid number"}));
+}
+
+TEST(ProxyConfigParserTest, RejectsDeeplyNestedValues) {
+    std::string nested = std::string(100, '[') + std::string(100, ']');
+    std::vector<std::string> errors = errorsOf(withService(R"("unknown": )" + nested));
+    ASSERT_EQ(errors.size(), 1u);
+    EXPECT_NE(errors[0].find("values nested too deeply"), std::string::npos);
+}
+
+TEST(ProxyConfigParserTest, ReportsDuplicateNamesAndPorts) {
+    EXPECT_EQ(errorsOf(R"([{"CID": 3, "Services": [
+                          {"name": "a", "port": 1000},
+                          {"name": "a", "port": 1001}]}])"),
+              std::vector<std::string>{"3:27: duplicate service name \"a\" in CID 3"});
+    // Services are all listened for on the host, so ports are unique across
+    // VMs, unlike names.
+    EXPECT_EQ(errorsOf(R"([{"CID": 3, "Services": [{"name": "a", "port": 1000}]},
+                          {"CID": 4, "Services": [{"name": "a", "port": 1000}]}])"),
+              std::vector<std::string>{
+                      "2:73: port 1000 of \"a\" is already used by \"a\""});
+    EXPECT_EQ(errorsOf(R"([{"CID": 3, "Services": []}, {"CID": 3, "Services": []}])"),
+              std::vector<std::string>{"1:38: duplicate CID 3"});
+    EXPECT_EQ(errorsOf(R"([{"CID": 3, "CID": 4, "Services": []}])"),
+              std::vector<std::string>{"1:13: duplicate member \"CID\""});
+}
+
+TEST(ProxyConfigParserTest, ChecksCidsAndPorts) {
+    EXPECT_EQ(errorsOf(R"([{"CID": 2, "Services": []}])"),
+              std::vector<std::string>{"1:10: invalid CID 2"});
+    EXPECT_EQ(errorsOf(R"([{"CID": 4294967295, "Services": []}])"),
+              std::vector<std::string>{"1:10: invalid CID 4294967295"});
+    EXPECT_EQ(errorsOf(R"([{"CID": 4294967296, "Services": []}])"),
+              std::vector<std::string>{"1:10: \"CID\" is out of range"});
+    EXPECT_EQ(errorsOf(R"([{"CID": -3, "Services": []}])"),
+              std::vector<std::string>{"1:10: \"CID\" must be an unsigned integer"});
+    EXPECT_EQ(errorsOf(R"([{"CID": 3, "Services": [{"name": "a", "port": 0}]}])"),
+              std::vector<std::string>{"1:48: invalid port 0"});
+    EXPECT_EQ(errorsOf(R"([{"CID": 3, "Services": [{"name": "a", "port": 4294967295}]}])"),
+              std::vector<std::string>{"1:48: invalid port 4294967295"});
+    EXPECT_EQ(errorsOf(R"([{"CID": 3, "Services": [{"name": "a", "port": 1.5}]}])"),
+              std::vector<std::string>{"1:48: \"port\" must be an unsigned integer"});
+    EXPECT_EQ(errorsOf(R"([{"Services": [{"name": "a"}]}])"),
+              (std::vector<std::string>{"1:16: a service needs a \"port\"",
+                                        "1:2: a VM needs a \"CID\""}));
+}
+
+TEST(ProxyConfigParserTest, ChecksFrontends) {
+    EXPECT_EQ(errorsOf(withService(R"("frontends": [{"unix": "@"}])")),
+              std::vector<std::string>{"1:68: invalid Unix socket path \"@\""});
+    EXPECT_EQ(errorsOf(withService(R"("frontends": [{"unix": ")" + std::string(108, 'x') +
+                                   R"("}])")),
+              std::vector<std::string>{"1:68: invalid Unix socket path \"" +
+                                       std::string(108, 'x') + "\""});
+    EXPECT_EQ(errorsOf(withService(R"("frontends": [{"tcp": 65536}])")),
+              std::vector<std::string>{"1:68: invalid TCP port 65536"});
+    EXPECT_EQ(errorsOf(withService(R"("frontends": [{"tcp": 80, "unix": "/a"}])")),
+              std::vector<std::string>{"1:68: a frontend needs either \"unix\" or \"tcp\""});
+    EXPECT_EQ(errorsOf(withService(R"("frontends": [{"tcp": 80}, {"tcp": 80}])")),
+              std::vector<std::string>{"1:81: TCP port 80 is used twice"});
+    EXPECT_EQ(errorsOf(withService(R"("frontends": [{"unix": "/a"}, {"unix": "/a"}])")),
+              std::vector<std::string>{"1:84: Unix socket path \"/a\" is used twice"});
+    EXPECT_EQ(errorsOf(withService(R"("frontends": ["/a"])")),
+              std::vector<std::string>{"1:68: a frontend must be an object"});
+    EXPECT_EQ(errorsOf(withService(R"("frontends": {})")),
+              std::vector<std::string>{"1:67: \"frontends\" must be an array"});
+}
+
+TEST(ProxyConfigParserTest, ChecksCpusAndNumaNode) {
+    EXPECT_EQ(errorsOf(withVm(R"("cpus": [0, 1024])")),
+              std::vector<std::string>{"1:68: invalid CPU 1024"});
+    EXPECT_EQ(errorsOf(withVm(R"("cpus": 0)")),
+              std::vector<std::string>{"1:64: \"cpus\" must be an array"});
+    EXPECT_EQ(errorsOf(withVm(R"("cpus": [-1])")),
+              std::vector<std::string>{"1:65: \"cpus\" must be an unsigned integer"});
+    EXPECT_EQ(errorsOf(withVm(R"("numaNode": 1024)")),
+              std::vector<std::string>{"1:68: invalid NUMA node 1024"});
+    EXPECT_EQ(errorsOf(withVm(R"("numaNode": true)")),
+              std::vector<std::string>{"1:68: \"numaNode\" must be an unsigned integer"});
+}
+
+TEST(ProxyConfigParserTest, DecodesStringEscapes) {
+    ProxyConfigResult result = parseVmProxyConfigs(
+            R"([{"CID": 3, "Services": [{"name": "\"\\\/\b\f\n\r\tAé€😀", "port": 1}]}])");
+    ASSERT_TRUE(result.ok());
+    EXPECT_EQ(result.vmConfigs[0].services[0].name,
+              "\"\\/\b\f\n\r\tA\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80");
+}
+
+TEST(ProxyConfigParserTest, RejectsInvalidEscapes) {
+    auto nameError = [](const std::string& name) {
+        std::vector<std::string> errors =
+                errorsOf(R"([{"CID": 3, "Services": [{"name": ")" + name + R"(", "port": 1}]}])");
+        return errors.size() == 1 ? errors[0] : "";
+    };
+    EXPECT_EQ(nameError(R"(\x)"), "1:37: invalid escape in string");
+    EXPECT_EQ(nameError(R"(\u12)"), "1:40: invalid \\u escape");
+    // A high surrogate needs a low one right after it, and a low one can't
+    // come first.
+    EXPECT_EQ(nameError(R"(\ud83d)"), "1:42: invalid surrogate pair");
+    EXPECT_EQ(nameError(R"(\ud83dA)"), "1:42: invalid surrogate pair");
+    EXPECT_EQ(nameError(R"(\ud83d\u0041)"), "1:48: invalid surrogate pair");
+    EXPECT_EQ(nameError(R"(\ude00)"), "1:42: invalid surrogate pair");
+    EXPECT_EQ(nameError("a\tb"), "1:37: control character in string");
+}
+
+TEST(ProxyConfigParserTest, ParsesTheShippedConfig) {
+    std::string json;
+    ASSERT_TRUE(android::base::ReadFileToString(
+            android::base::GetExecutableDirectory() + "/proxy_config.json", &json));
+    ProxyConfigResult result = parseVmProxyConfigs(json);
+    for (const ProxyConfigError& error : result.errors) {
+        ADD_FAILURE() << error.toString();
+    }
+    EXPECT_FALSE(result.vmConfigs.empty());
+}
+
+}  // namespace
+}  // namespace android::automotive::proxyconfig
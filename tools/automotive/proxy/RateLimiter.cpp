@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RateLimiter.h"
+
+#include <algorithm>
+
+namespace android::automotive::proxy {
+
+// The smallest grant worth a read, unless the burst is smaller.
+static constexpr double kMinGrantBytes = 4096;
+
+RateLimiter::RateLimiter(size_t bytesPerSecond, size_t burstBytes)
+    : mBytesPerSecond(static_cast<double>(bytesPerSecond)),
+      mBurstBytes(static_cast<double>(burstBytes > 0 ? burstBytes : bytesPerSecond)),
+      mMinBytes(std::min(kMinGrantBytes, mBurstBytes)),
+      mTokens(mBurstBytes),
+      mRefilledAt(std::chrono::steady_clock::now()) {}
+
+void RateLimiter::refillLocked(std::chrono::steady_clock::time_point now) {
+    std::chrono::duration<double> elapsed = now - mRefilledAt;
+    mTokens = std::min(mBurstBytes, mTokens + elapsed.count() * mBytesPerSecond);
+    mRefilledAt = now;
+}
+
+size_t RateLimiter::acquire(size_t wanted) {
+    std::lock_guard<std::mutex> lock(mLock);
+    refillLocked(std::chrono::steady_clock::now());
+    if (mTokens < std::min(mMinBytes, static_cast<double>(wanted))) {
+        return 0;
+    }
+    size_t granted = std::min(wanted, static_cast<size_t>(mTokens));
+    mTokens -= granted;
+    return granted;
+}
+
+void RateLimiter::refund(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mTokens = std::min(mBurstBytes, mTokens + bytes);
+}
+
+std::chrono::steady_clock::duration RateLimiter::delay() {
+    std::lock_guard<std::mutex> lock(mLock);
+    refillLocked(std::chrono::steady_clock::now());
+    if (mTokens >= mMinBytes) {
+        return std::chrono::steady_clock::duration::zero();
+    }
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>((mMinBytes - mTokens) / mBytesPerSecond));
+}
+
+}  // namespace android::automotive::proxy
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <chrono>
+#include <mutex>
+
+namespace android::automotive::proxy {
+
+// A token bucket bounding the bytes the connections of a service forward per
+// second. The bucket holds up to burstBytes, so a service which was quiet may
+// forward that much at once. Shared by the connections of every loop, so
+// thread safe.
+class RateLimiter {
+  public:
+    // A burst of zero holds one second's worth of bytes.
+    RateLimiter(size_t bytesPerSecond, size_t burstBytes);
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    // Takes up to wanted bytes out of the bucket and returns how many were
+    // taken. Returns zero while the bucket holds less than a useful read, so
+    // a throttled connection isn't woken up for a handful of bytes.
+    size_t acquire(size_t wanted);
+
+    // Puts back bytes taken by acquire() which were not forwarded.
+    void refund(size_t bytes);
+
+    // How long until acquire() hands out bytes again.
+    std::chrono::steady_clock::duration delay();
+
+  private:
+    void refillLocked(std::chrono::steady_clock::time_point now);
+
+    const double mBytesPerSecond;
+    const double mBurstBytes;
+    // The bytes acquire() waits for, so slow rates still move whole reads.
+    const double mMinBytes;
+    std::mutex mLock;
+    double mTokens;
+    std::chrono::steady_clock::time_point mRefilledAt;
+};
+
+}  // namespace android::automotive::proxy
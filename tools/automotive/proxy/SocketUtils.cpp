@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SocketUtils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace android::automotive::proxy {
+
+int setupServerSocket(sockaddr_vm& addr, int flags, int backlog) {
+    int vsock_socket = socket(AF_VSOCK, SOCK_STREAM | flags, 0);
+
+    if (vsock_socket == -1) {
+        std::cerr << "Failed to create server VSOCK socket, ERROR = "
+                  << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    if (bind(vsock_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        std::cerr << "Failed to bind to server VSOCK socket, ERROR = "
+                  << strerror(errno) << std::endl;
+        close(vsock_socket);
+        return -1;
+    }
+
+    if (listen(vsock_socket, backlog > 0 ? backlog : CLIENT_QUEUE_SIZE) != 0) {
+        std::cerr << "Failed to listen on server VSOCK socket, ERROR = "
+                  << strerror(errno) << std::endl;
+        close(vsock_socket);
+        return -1;
+    }
+
+    return vsock_socket;
+}
+
+// Binds fd to addr and listens on it, or closes it on failure.
+static int bindAndListen(int fd, const sockaddr* addr, socklen_t length, int backlog,
+                         const char* kind) {
+    if (bind(fd, addr, length) != 0) {
+        std::cerr << "Failed to bind to server " << kind << " socket, ERROR = "
+                  << strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+
+    if (listen(fd, backlog > 0 ? backlog : CLIENT_QUEUE_SIZE) != 0) {
+        std::cerr << "Failed to listen on server " << kind << " socket, ERROR = "
+                  << strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int setupUnixServerSocket(const std::string& path, int flags, int backlog) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Invalid Unix socket path " << path << std::endl;
+        return -1;
+    }
+    memcpy(addr.sun_path, path.data(), path.size());
+    socklen_t length = sizeof(addr);
+    if (path[0] == '@') {
+        // Abstract names are not terminated, so the length has to be exact.
+        addr.sun_path[0] = '\0';
+        length = offsetof(sockaddr_un, sun_path) + path.size();
+    } else {
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+            unlink(path.c_str());
+        }
+    }
+
+    int unix_socket = socket(AF_UNIX, SOCK_STREAM | flags, 0);
+    if (unix_socket == -1) {
+        std::cerr << "Failed to create server Unix socket, ERROR = "
+                  << strerror(errno) << std::endl;
+        return -1;
+    }
+    return bindAndListen(unix_socket, reinterpret_cast<sockaddr*>(&addr), length, backlog,
+                         "Unix");
+}
+
+int setupTcpServerSocket(unsigned port, int flags, int backlog) {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    int tcp_socket = socket(AF_INET, SOCK_STREAM | flags, 0);
+    if (tcp_socket == -1) {
+        std::cerr << "Failed to create server TCP socket, ERROR = "
+                  << strerror(errno) << std::endl;
+        return -1;
+    }
+    int one = 1;
+    setsockopt(tcp_socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    // Inherited by the accepted sockets.
+    setsockopt(tcp_socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return bindAndListen(tcp_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr), backlog,
+                         "TCP");
+}
+
+void closeFileDescriptor(int fd) {
+    close(fd);
+    shutdown(fd, SHUT_RDWR);
+}
+
+bool setNonBlocking(int fd, bool nonBlocking) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0) {
+        return false;
+    }
+    flags = nonBlocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(fd, F_SETFL, flags) == 0;
+}
+
+void setSocketBufferSizes(int fd, const BufferConfig& config) {
+    if (config.sendBufferSize > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &config.sendBufferSize,
+                   sizeof(config.sendBufferSize));
+    }
+    if (config.receiveBufferSize > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &config.receiveBufferSize,
+                   sizeof(config.receiveBufferSize));
+        // A VSOCK socket sizes the window it advertises with its own option,
+        // capped by a maximum which has to be raised first.
+        unsigned long long size = config.receiveBufferSize;
+        setsockopt(fd, AF_VSOCK, SO_VM_SOCKETS_BUFFER_MAX_SIZE, &size, sizeof(size));
+        setsockopt(fd, AF_VSOCK, SO_VM_SOCKETS_BUFFER_SIZE, &size, sizeof(size));
+    }
+}
+
+bool transferBytes(int src_fd, int dst_fd, size_t* transferred) {
+    char buf[BUFFER_SIZE];
+    int readBytes = read(src_fd, buf, BUFFER_SIZE);
+    if (readBytes <= 0) {
+        return false;
+    }
+    // A short write is not the end of the chunk; keep writing until all of
+    // it has been handed to the destination.
+    for (int offset = 0; offset < readBytes;) {
+        int writtenBytes = write(dst_fd, buf + offset, readBytes - offset);
+        if (writtenBytes < 0) {
+            return false;
+        }
+        offset += writtenBytes;
+    }
+    if (transferred != nullptr) {
+        *transferred = readBytes;
+    }
+    return true;
+}
+
+}  // namespace android::automotive::proxy
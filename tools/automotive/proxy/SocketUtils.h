@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+#include <string>
+
+#include <linux/vm_sockets.h>
+
+namespace android::automotive::proxy {
+
+constexpr int BUFFER_SIZE = 16384;
+constexpr int CLIENT_QUEUE_SIZE = 128;
+
+// How the connections of a service are buffered.
+struct BufferConfig {
+    // Bytes held per direction of a connection. The event loops grow the
+    // buffers of a busy connection up to maxBufferSize and shrink them back.
+    size_t bufferSize = BUFFER_SIZE;
+    size_t maxBufferSize = BUFFER_SIZE;
+    // SO_SNDBUF and SO_RCVBUF of both sockets, zero for the kernel default.
+    int sendBufferSize = 0;
+    int receiveBufferSize = 0;
+};
+
+// Creates a VSOCK socket bound to addr and listening for clients. Extra socket
+// flags (e.g. SOCK_NONBLOCK) are passed through to socket(), and a backlog of
+// zero means CLIENT_QUEUE_SIZE. Returns the socket on success, -1 otherwise.
+int setupServerSocket(sockaddr_vm& addr, int flags = 0, int backlog = 0);
+
+// Like setupServerSocket(), for a Unix domain socket at path. A stale socket
+// left at path is replaced; a leading '@' stands for the abstract namespace.
+int setupUnixServerSocket(const std::string& path, int flags = 0, int backlog = 0);
+
+// Like setupServerSocket(), for a TCP port on the loopback interface. Accepted
+// sockets have Nagle's algorithm disabled, as the proxy writes whole chunks.
+int setupTcpServerSocket(unsigned port, int flags = 0, int backlog = 0);
+
+void closeFileDescriptor(int fd);
+
+bool setNonBlocking(int fd, bool nonBlocking);
+
+// Applies the socket buffer sizes of config to fd. The sizes are hints; a
+// size the kernel refuses leaves its default in place.
+void setSocketBufferSizes(int fd, const BufferConfig& config);
+
+// transfers a max of BUFFER_SIZE bytes between a source file descriptor and a
+// destination file descriptor. Returns true on success, false otherwise. The
+// number of bytes moved is stored in transferred, if given.
+bool transferBytes(int src_fd, int dst_fd, size_t* transferred = nullptr);
+
+}  // namespace android::automotive::proxy
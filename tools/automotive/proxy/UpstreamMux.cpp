@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UpstreamMux.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+
+#include <linux/vm_sockets.h>
+
+#include "Log.h"
+
+namespace android::automotive::proxy {
+
+UpstreamMux::UpstreamMux(unsigned cid, unsigned port, size_t linkCount, ServiceMetrics* metrics,
+                         ConnectionLimiter* limiter, std::chrono::seconds idleTimeout,
+                         const BufferConfig& buffers)
+    : Multiplexer(metrics, idleTimeout),
+      mCid(cid),
+      mPort(port),
+      mLinkCount(linkCount),
+      mMetrics(metrics),
+      mLimiter(limiter),
+      mBuffers(buffers) {}
+
+UpstreamMux::~UpstreamMux() {
+    stop();
+    for (int clientFd : mClients) {
+        closeFileDescriptor(clientFd);
+        mLimiter->release();
+    }
+}
+
+void UpstreamMux::addClient(int clientFd) {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mClients.push_back(clientFd);
+    }
+    wake();
+}
+
+bool UpstreamMux::setUp() {
+    connectLinks();
+    return true;
+}
+
+// Starts connecting the links which are missing. A VM which refuses them is
+// tried again with the next client.
+void UpstreamMux::connectLinks() {
+    while (linkCount() < mLinkCount) {
+        int fd = socket(AF_VSOCK, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            logMessage(LOG_SITE(),
+                       {.service = mMetrics->name.c_str(), .cid = mCid, .error = errno},
+                       "Failed to create multiplexed VSOCK socket");
+            return;
+        }
+        setSocketBufferSizes(fd, mBuffers);
+
+        sockaddr_vm fwd_addr{};
+        fwd_addr.svm_family = AF_VSOCK;
+        fwd_addr.svm_cid = mCid;
+        fwd_addr.svm_port = mPort;
+        int connected = connect(fd, reinterpret_cast<sockaddr*>(&fwd_addr), sizeof(fwd_addr));
+        if (connected < 0 && errno != EINPROGRESS) {
+            logMessage(LOG_SITE(),
+                       {.service = mMetrics->name.c_str(), .cid = mCid, .error = errno},
+                       "Failed to connect to multiplexed vsock socket");
+            mMetrics->connectErrors.fetch_add(1, std::memory_order_relaxed);
+            closeFileDescriptor(fd);
+            return;
+        }
+        if (addLink(fd, connected < 0) == nullptr) {
+            return;
+        }
+    }
+}
+
+void UpstreamMux::handleWake() {
+    std::vector<int> clients;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        clients.swap(mClients);
+    }
+    if (clients.empty()) {
+        return;
+    }
+    connectLinks();
+    for (int clientFd : clients) {
+        Link* link = leastLoadedLink();
+        if (link == nullptr || !setNonBlocking(clientFd, true)) {
+            closeFileDescriptor(clientFd);
+            mLimiter->release();
+            continue;
+        }
+        setSocketBufferSizes(clientFd, mBuffers);
+        mMetrics->activeConnections.fetch_add(1, std::memory_order_relaxed);
+        mMetrics->multiplexedConnections.fetch_add(1, std::memory_order_relaxed);
+        openStream(*link, clientFd);
+    }
+}
+
+void UpstreamMux::streamClosed() {
+    mMetrics->activeConnections.fetch_sub(1, std::memory_order_relaxed);
+    mLimiter->release();
+}
+
+}  // namespace android::automotive::proxy
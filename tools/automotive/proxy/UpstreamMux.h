@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include "ConnectionLimiter.h"
+#include "Metrics.h"
+#include "Multiplexer.h"
+#include "SocketUtils.h"
+
+namespace android::automotive::proxy {
+
+// Forwards the clients of a multiplexed service as streams over up to
+// linkCount connections to automotive_vsock_demux at cid:port, instead of a
+// connection to the VM per client. The links are established when the
+// multiplexer starts, and again for the next client when the VM closed them.
+//
+// Removing the service closes the clients still forwarded, as their links go
+// with it.
+class UpstreamMux : public Multiplexer {
+  public:
+    // Clients are admitted by limiter, which is released when their stream
+    // closes.
+    UpstreamMux(unsigned cid, unsigned port, size_t linkCount, ServiceMetrics* metrics,
+                ConnectionLimiter* limiter, std::chrono::seconds idleTimeout,
+                const BufferConfig& buffers);
+    ~UpstreamMux() override;
+
+    // Forwards clientFd, which must have been admitted by the limiter, over
+    // the least loaded link. Takes clientFd. Thread safe.
+    void addClient(int clientFd);
+
+  private:
+    bool setUp() override;
+    void handleWake() override;
+    void streamClosed() override;
+    void connectLinks();
+
+    const unsigned mCid;
+    const unsigned mPort;
+    const size_t mLinkCount;
+    ServiceMetrics* const mMetrics;
+    ConnectionLimiter* const mLimiter;
+    const BufferConfig mBuffers;
+
+    std::mutex mLock;
+    std::vector<int> mClients;
+};
+
+}  // namespace android::automotive::proxy
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UpstreamPool.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include <linux/vm_sockets.h>
+
+#include "SocketUtils.h"
+
+namespace android::automotive::proxy {
+
+// How often idle connections are checked, and how long to wait before trying
+// again when the VM refused a connection.
+static constexpr auto kMaintenanceInterval = std::chrono::seconds(1);
+
+// An idle connection is healthy unless the VM closed it or it failed. Bytes
+// the VM sent ahead of time are left for the client.
+static bool isHealthy(int fd) {
+    char byte;
+    ssize_t peeked = recv(fd, &byte, sizeof(byte), MSG_PEEK | MSG_DONTWAIT);
+    return peeked > 0 || (peeked < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+UpstreamPool::UpstreamPool(unsigned cid, unsigned port, size_t size)
+    : mCid(cid), mPort(port), mSize(size) {}
+
+UpstreamPool::~UpstreamPool() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mStopping = true;
+    }
+    mCondition.notify_all();
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+    for (int fd : mIdle) {
+        closeFileDescriptor(fd);
+    }
+}
+
+void UpstreamPool::start() {
+    mThread = std::thread(&UpstreamPool::maintain, this);
+}
+
+int UpstreamPool::take() {
+    int fd = -1;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        while (!mIdle.empty() && fd < 0) {
+            fd = mIdle.front();
+            mIdle.pop_front();
+            if (!isHealthy(fd)) {
+                closeFileDescriptor(fd);
+                fd = -1;
+            }
+        }
+    }
+    mCondition.notify_one();
+    return fd;
+}
+
+int UpstreamPool::connectUpstream() const {
+    int fd = socket(AF_VSOCK, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    sockaddr_vm fwd_addr{};
+    fwd_addr.svm_family = AF_VSOCK;
+    fwd_addr.svm_cid = mCid;
+    fwd_addr.svm_port = mPort;
+
+    if (connect(fd, reinterpret_cast<sockaddr*>(&fwd_addr), sizeof(fwd_addr)) < 0 ||
+        !setNonBlocking(fd, true)) {
+        closeFileDescriptor(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void UpstreamPool::dropUnhealthy() {
+    auto dead = std::stable_partition(mIdle.begin(), mIdle.end(), isHealthy);
+    std::for_each(dead, mIdle.end(), closeFileDescriptor);
+    mIdle.erase(dead, mIdle.end());
+}
+
+void UpstreamPool::maintain() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (!mStopping) {
+        dropUnhealthy();
+        while (mIdle.size() < mSize && !mStopping) {
+            // Connecting blocks, so do it without holding the lock.
+            lock.unlock();
+            int fd = connectUpstream();
+            lock.lock();
+            if (fd < 0) {
+                break;
+            }
+            mIdle.push_back(fd);
+        }
+        mCondition.wait_for(lock, kMaintenanceInterval);
+    }
+}
+
+}  // namespace android::automotive::proxy
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace android::automotive::proxy {
+
+// Keeps a number of idle connections to a forwarding address established, so
+// a new client can be forwarded without waiting for a VSOCK handshake.
+//
+// A background thread opens the connections, replaces the ones handed out,
+// and drops the ones the VM closed while they were idle.
+class UpstreamPool {
+  public:
+    UpstreamPool(unsigned cid, unsigned port, size_t size);
+    ~UpstreamPool();
+
+    UpstreamPool(const UpstreamPool&) = delete;
+    UpstreamPool& operator=(const UpstreamPool&) = delete;
+
+    void start();
+
+    // Returns a connected non-blocking socket, or -1 if none is ready.
+    int take();
+
+  private:
+    void maintain();
+    void dropUnhealthy();
+    int connectUpstream() const;
+
+    const unsigned mCid;
+    const unsigned mPort;
+    const size_t mSize;
+
+    std::mutex mLock;
+    std::condition_variable mCondition;
+    std::deque<int> mIdle;
+    bool mStopping = false;
+    std::thread mThread;
+};
+
+}  // namespace android::automotive::proxy
@@ -0,0 +1,553 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UringLoop.h"
+
+#include <errno.h>
+#include <iostream>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <initializer_list>
+
+#include "Drain.h"
+#include "Log.h"
+#include "SocketUtils.h"
+
+namespace android::automotive::proxy {
+
+static constexpr unsigned kRingEntries = 512;
+// How often connections are checked against their route's idle timeout.
+static constexpr auto kIdleCheckInterval = std::chrono::seconds(1);
+
+static uint64_t userData(uint32_t id, uint8_t operation) {
+    return (static_cast<uint64_t>(id) << 8) | operation;
+}
+
+bool UringLoop::isSupported() {
+    io_uring ring;
+    if (io_uring_queue_init(8, &ring, 0) != 0) {
+        return false;
+    }
+    io_uring_probe* probe = io_uring_get_probe_ring(&ring);
+    bool supported = probe != nullptr;
+    for (int operation : {IORING_OP_ACCEPT, IORING_OP_CONNECT, IORING_OP_READ_FIXED,
+                          IORING_OP_WRITE_FIXED, IORING_OP_TIMEOUT, IORING_OP_POLL_ADD,
+                          IORING_OP_ASYNC_CANCEL}) {
+        supported = supported && io_uring_opcode_supported(probe, operation);
+    }
+    if (probe != nullptr) {
+        io_uring_free_probe(probe);
+    }
+    io_uring_queue_exit(&ring);
+    return supported;
+}
+
+UringLoop::UringLoop() = default;
+
+UringLoop::~UringLoop() {
+    for (auto& connection : mConnections) {
+        if (connection.inUse) {
+            closeFileDescriptor(connection.clientFd);
+            if (connection.serverFd >= 0) {
+                closeFileDescriptor(connection.serverFd);
+            }
+        }
+    }
+    if (mRingReady) {
+        io_uring_queue_exit(&mRing);
+    }
+    if (mTaskFd >= 0) {
+        close(mTaskFd);
+    }
+}
+
+bool UringLoop::init() {
+    int ret = io_uring_queue_init(kRingEntries, &mRing, 0);
+    if (ret < 0) {
+        std::cerr << "Failed to create io_uring, ERROR = " << strerror(-ret) << std::endl;
+        return false;
+    }
+    mRingReady = true;
+
+    // Slot 2 * id holds the client socket of connection id, slot 2 * id + 1
+    // its socket to the forwarding address. Buffers are numbered the same
+    // way, upstream first.
+    std::vector<int> files(2 * kMaxConnections, -1);
+    ret = io_uring_register_files(&mRing, files.data(), files.size());
+    if (ret < 0) {
+        std::cerr << "Failed to register io_uring files, ERROR = " << strerror(-ret) << std::endl;
+        return false;
+    }
+
+    mBuffers = std::make_unique<char[]>(size_t{2} * kMaxConnections * BUFFER_SIZE);
+    std::vector<iovec> buffers(2 * kMaxConnections);
+    for (size_t i = 0; i < buffers.size(); i++) {
+        buffers[i].iov_base = mBuffers.get() + i * BUFFER_SIZE;
+        buffers[i].iov_len = BUFFER_SIZE;
+    }
+    ret = io_uring_register_buffers(&mRing, buffers.data(), buffers.size());
+    if (ret < 0) {
+        std::cerr << "Failed to register io_uring buffers, ERROR = " << strerror(-ret)
+                  << std::endl;
+        return false;
+    }
+
+    mConnections.resize(kMaxConnections);
+    for (uint32_t id = kMaxConnections; id-- > 0;) {
+        mFreeIds.push_back(id);
+    }
+
+    mTaskFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mTaskFd < 0) {
+        std::cerr << "Failed to create io_uring task eventfd, ERROR = " << strerror(errno)
+                  << std::endl;
+        return false;
+    }
+    armTasks();
+
+    mIdleCheckInterval.tv_sec = kIdleCheckInterval.count();
+    armIdleCheck();
+    if (drainEventFd() >= 0) {
+        armDrain();
+    }
+    return true;
+}
+
+bool UringLoop::addRoute(std::shared_ptr<const Route> route) {
+    for (int listenFd : route->listenFds) {
+        mRouteSockets.push_back(RouteSocket{route, listenFd});
+        armAccept(mRouteSockets.size() - 1);
+    }
+    return true;
+}
+
+void UringLoop::removeRoute(const std::shared_ptr<const Route>& route) {
+    for (uint32_t socketIndex = 0; socketIndex < mRouteSockets.size(); socketIndex++) {
+        if (mRouteSockets[socketIndex].route != route) {
+            continue;
+        }
+        io_uring_sqe* sqe = getSqe();
+        io_uring_prep_cancel64(sqe, userData(socketIndex, ACCEPT), 0);
+        io_uring_sqe_set_data64(sqe, userData(0, CANCEL));
+        mRouteSockets[socketIndex].route = nullptr;
+    }
+}
+
+void UringLoop::postTask(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mTaskLock);
+        mTasks.push_back(std::move(task));
+    }
+    uint64_t one = 1;
+    write(mTaskFd, &one, sizeof(one));
+}
+
+void UringLoop::armTasks() {
+    io_uring_sqe* sqe = getSqe();
+    io_uring_prep_poll_add(sqe, mTaskFd, POLLIN);
+    io_uring_sqe_set_data64(sqe, userData(0, TASKS));
+}
+
+void UringLoop::runTasks() {
+    uint64_t count;
+    read(mTaskFd, &count, sizeof(count));
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(mTaskLock);
+        tasks.swap(mTasks);
+    }
+    for (const auto& task : tasks) {
+        task();
+    }
+    armTasks();
+}
+
+void UringLoop::run() {
+    while (true) {
+        int ret = io_uring_submit_and_wait(&mRing, 1);
+        if (ret < 0 && ret != -EINTR) {
+            logMessage(LOG_SITE(), {.error = -ret}, "ERROR in io_uring_submit_and_wait!");
+            return;
+        }
+
+        unsigned head;
+        unsigned count = 0;
+        io_uring_cqe* cqe;
+        io_uring_for_each_cqe(&mRing, head, cqe) {
+            handleCompletion(cqe);
+            count++;
+        }
+        io_uring_cq_advance(&mRing, count);
+    }
+}
+
+io_uring_sqe* UringLoop::getSqe() {
+    io_uring_sqe* sqe = io_uring_get_sqe(&mRing);
+    if (sqe == nullptr) {
+        // The submission queue is full; hand it to the kernel to make room.
+        io_uring_submit(&mRing);
+        sqe = io_uring_get_sqe(&mRing);
+    }
+    return sqe;
+}
+
+void UringLoop::armAccept(uint32_t socketIndex) {
+    io_uring_sqe* sqe = getSqe();
+    int listenFd = mRouteSockets[socketIndex].listenFd;
+    if (mMultishotAccept) {
+        io_uring_prep_multishot_accept(sqe, listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    } else {
+        io_uring_prep_accept(sqe, listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    }
+    io_uring_sqe_set_data64(sqe, userData(socketIndex, ACCEPT));
+}
+
+void UringLoop::armIdleCheck() {
+    io_uring_sqe* sqe = getSqe();
+    io_uring_prep_timeout(sqe, &mIdleCheckInterval, 0, 0);
+    io_uring_sqe_set_data64(sqe, userData(0, IDLE_CHECK));
+}
+
+void UringLoop::armDrain() {
+    io_uring_sqe* sqe = getSqe();
+    io_uring_prep_poll_add(sqe, drainEventFd(), POLLIN);
+    io_uring_sqe_set_data64(sqe, userData(0, DRAIN));
+}
+
+// Cancels the accepts of every route. Connections which were already accepted
+// are still forwarded.
+void UringLoop::handleDrain() {
+    mDraining = true;
+    for (uint32_t socketIndex = 0; socketIndex < mRouteSockets.size(); socketIndex++) {
+        if (mRouteSockets[socketIndex].route == nullptr) {
+            continue;
+        }
+        io_uring_sqe* sqe = getSqe();
+        io_uring_prep_cancel64(sqe, userData(socketIndex, ACCEPT), 0);
+        io_uring_sqe_set_data64(sqe, userData(0, CANCEL));
+    }
+}
+
+void UringLoop::closeIdleConnections() {
+    auto now = std::chrono::steady_clock::now();
+    for (auto& connection : mConnections) {
+        if (!connection.inUse || connection.failed) {
+            continue;
+        }
+        auto idleTimeout = connection.route->idleTimeout;
+        if (idleTimeout.count() > 0 && now - connection.lastActive >= idleTimeout) {
+            connection.route->metrics->idleTimeouts.fetch_add(1, std::memory_order_relaxed);
+            fail(connection);
+        }
+    }
+}
+
+void UringLoop::handleCompletion(const io_uring_cqe* cqe) {
+    uint64_t data = io_uring_cqe_get_data64(cqe);
+    uint32_t id = data >> 8;
+    auto operation = static_cast<Operation>(data & 0xff);
+    switch (operation) {
+        case ACCEPT:
+            handleAccept(id, cqe);
+            return;
+        case IDLE_CHECK:
+            closeIdleConnections();
+            armIdleCheck();
+            return;
+        case DRAIN:
+            handleDrain();
+            return;
+        case CANCEL:
+            return;
+        case TASKS:
+            runTasks();
+            return;
+        default:
+            break;
+    }
+
+    Connection& connection = mConnections[id];
+    connection.inflight--;
+    switch (operation) {
+        case CONNECT:
+            handleConnect(connection, cqe->res);
+            break;
+        case READ_UPSTREAM:
+            handleRead(connection, connection.upstream, cqe->res);
+            break;
+        case WRITE_UPSTREAM:
+            handleWrite(connection, connection.upstream, cqe->res);
+            break;
+        case READ_DOWNSTREAM:
+            handleRead(connection, connection.downstream, cqe->res);
+            break;
+        case WRITE_DOWNSTREAM:
+            handleWrite(connection, connection.downstream, cqe->res);
+            break;
+        default:
+            break;
+    }
+    maybeRecycle(id);
+}
+
+void UringLoop::handleAccept(uint32_t socketIndex, const io_uring_cqe* cqe) {
+    std::shared_ptr<const Route> route = mRouteSockets[socketIndex].route;
+    if (route == nullptr) {
+        // The route was removed while a client was being accepted.
+        if (cqe->res >= 0) {
+            closeFileDescriptor(cqe->res);
+        }
+        return;
+    }
+    if (cqe->res >= 0) {
+        route->metrics->acceptedConnections.fetch_add(1, std::memory_order_relaxed);
+        if (route->limiter->tryAcquire()) {
+            if (route->mux != nullptr) {
+                route->mux->addClient(cqe->res);
+            } else {
+                startConnection(cqe->res, route);
+            }
+        } else {
+            // Shed the load rather than queueing clients without bound.
+            route->metrics->rejectedConnections.fetch_add(1, std::memory_order_relaxed);
+            closeFileDescriptor(cqe->res);
+        }
+    } else if (cqe->res == -EINVAL && mMultishotAccept) {
+        // Multishot accept needs Linux 5.19; re-arm a single accept per client.
+        mMultishotAccept = false;
+    } else if (cqe->res != -ECANCELED) {
+        logMessage(LOG_SITE(), {.service = route->serviceName.c_str(), .error = -cqe->res},
+                   "Failed to accept connection");
+        route->metrics->acceptErrors.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE) && !mDraining) {
+        armAccept(socketIndex);
+    }
+}
+
+void UringLoop::startConnection(int clientFd, std::shared_ptr<const Route> route) {
+    if (mFreeIds.empty()) {
+        logMessage(LOG_SITE(), {.service = route->serviceName.c_str()},
+                   "Too many connections on one io_uring loop, refusing client");
+        route->metrics->rejectedConnections.fetch_add(1, std::memory_order_relaxed);
+        route->limiter->release();
+        closeFileDescriptor(clientFd);
+        return;
+    }
+    uint32_t id = mFreeIds.back();
+    mFreeIds.pop_back();
+
+    Connection& connection = mConnections[id];
+    connection.inUse = true;
+    connection.clientFd = clientFd;
+    connection.route = std::move(route);
+    connection.acceptedAt = std::chrono::steady_clock::now();
+    connection.lastActive = connection.acceptedAt;
+    ServiceMetrics* metrics = connection.route->metrics;
+    metrics->activeConnections.fetch_add(1, std::memory_order_relaxed);
+
+    UpstreamPool* pool = connection.route->pool.get();
+    bool pooled = pool != nullptr && (connection.serverFd = pool->take()) >= 0;
+    if (!pooled) {
+        connection.serverFd = socket(AF_VSOCK, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    }
+    if (connection.serverFd < 0) {
+        logMessage(LOG_SITE(),
+                   {.service = metrics->name.c_str(), .cid = metrics->cid, .error = errno},
+                   "Failed to create forwarding VSOCK socket");
+        metrics->connectErrors.fetch_add(1, std::memory_order_relaxed);
+        fail(connection);
+        maybeRecycle(id);
+        return;
+    }
+
+    setSocketBufferSizes(connection.clientFd, connection.route->buffers);
+    setSocketBufferSizes(connection.serverFd, connection.route->buffers);
+
+    // The registered buffers cannot grow, so larger buffer sizes are capped.
+    uint32_t readSize = std::min<size_t>(connection.route->buffers.bufferSize, BUFFER_SIZE);
+    char* buffers = mBuffers.get() + size_t{2} * id * BUFFER_SIZE;
+    connection.upstream.srcSlot = 2 * id;
+    connection.upstream.dstSlot = 2 * id + 1;
+    connection.upstream.dstFd = connection.serverFd;
+    connection.upstream.bufferIndex = 2 * id;
+    connection.upstream.buffer = buffers;
+    connection.upstream.readSize = readSize;
+    connection.upstream.metrics = &metrics->toServer;
+    connection.downstream.srcSlot = 2 * id + 1;
+    connection.downstream.dstSlot = 2 * id;
+    connection.downstream.dstFd = connection.clientFd;
+    connection.downstream.bufferIndex = 2 * id + 1;
+    connection.downstream.buffer = buffers + BUFFER_SIZE;
+    connection.downstream.readSize = readSize;
+    connection.downstream.metrics = &metrics->toClient;
+
+    int fds[2] = {connection.clientFd, connection.serverFd};
+    int ret = io_uring_register_files_update(&mRing, 2 * id, fds, 2);
+    if (ret != 2) {
+        logMessage(LOG_SITE(), {.error = -ret}, "Failed to install io_uring files");
+        fail(connection);
+        maybeRecycle(id);
+        return;
+    }
+
+    if (pooled) {
+        metrics->pooledConnections.fetch_add(1, std::memory_order_relaxed);
+        handleConnect(connection, 0);
+        return;
+    }
+
+    connection.fwdAddr = {};
+    connection.fwdAddr.svm_family = AF_VSOCK;
+    connection.fwdAddr.svm_cid = connection.route->fwdCid;
+    connection.fwdAddr.svm_port = connection.route->fwdPort;
+
+    io_uring_sqe* sqe = getSqe();
+    io_uring_prep_connect(sqe, connection.upstream.dstSlot,
+                          reinterpret_cast<sockaddr*>(&connection.fwdAddr),
+                          sizeof(connection.fwdAddr));
+    sqe->flags |= IOSQE_FIXED_FILE;
+    io_uring_sqe_set_data64(sqe, userData(id, CONNECT));
+    connection.inflight++;
+}
+
+void UringLoop::handleConnect(Connection& connection, int result) {
+    ServiceMetrics* metrics = connection.route->metrics;
+    if (result < 0) {
+        logMessage(LOG_SITE(),
+                   {.service = metrics->name.c_str(), .cid = metrics->cid, .error = -result},
+                   "Failed to connect to forwarding vsock socket");
+        metrics->connectErrors.fetch_add(1, std::memory_order_relaxed);
+        fail(connection);
+        return;
+    }
+    metrics->connectLatency.record(std::chrono::steady_clock::now() - connection.acceptedAt);
+    connection.connected = true;
+
+    uint32_t id = &connection - mConnections.data();
+    submitRead(id, connection.upstream);
+    submitRead(id, connection.downstream);
+}
+
+void UringLoop::submitRead(uint32_t id, Direction& direction) {
+    Connection& connection = mConnections[id];
+    io_uring_sqe* sqe = getSqe();
+    io_uring_prep_read_fixed(sqe, direction.srcSlot, direction.buffer, direction.readSize, 0,
+                             direction.bufferIndex);
+    sqe->flags |= IOSQE_FIXED_FILE;
+    io_uring_sqe_set_data64(
+        sqe, userData(id, &direction == &connection.upstream ? READ_UPSTREAM : READ_DOWNSTREAM));
+    connection.inflight++;
+}
+
+// Writes the rest of the buffer, linked with the read that refills it. A
+// short or failed write breaks the link, which cancels the read.
+void UringLoop::submitWrite(uint32_t id, Direction& direction) {
+    Connection& connection = mConnections[id];
+    // Both requests of the link must reach the kernel in the same submission.
+    if (io_uring_sq_space_left(&mRing) < 2) {
+        io_uring_submit(&mRing);
+    }
+    io_uring_sqe* sqe = getSqe();
+    io_uring_prep_write_fixed(sqe, direction.dstSlot, direction.buffer + direction.written,
+                              direction.length - direction.written, 0, direction.bufferIndex);
+    sqe->flags |= IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+    io_uring_sqe_set_data64(
+        sqe, userData(id, &direction == &connection.upstream ? WRITE_UPSTREAM : WRITE_DOWNSTREAM));
+    connection.inflight++;
+    submitRead(id, direction);
+}
+
+void UringLoop::handleRead(Connection& connection, Direction& direction, int result) {
+    if (result == -ECANCELED || connection.failed) {
+        // Either the write linked in front of the read fell short and is
+        // being resubmitted, or the connection is going away.
+        return;
+    }
+    connection.lastActive = std::chrono::steady_clock::now();
+    if (result < 0) {
+        fail(connection);
+        return;
+    }
+    if (result == 0) {
+        // Forward the half close; the other direction keeps going.
+        direction.done = true;
+        shutdown(direction.dstFd, SHUT_WR);
+        return;
+    }
+    direction.length = result;
+    direction.written = 0;
+    direction.readAt = connection.lastActive;
+    submitWrite(&connection - mConnections.data(), direction);
+}
+
+void UringLoop::handleWrite(Connection& connection, Direction& direction, int result) {
+    if (connection.failed) {
+        return;
+    }
+    if (result <= 0) {
+        fail(connection);
+        return;
+    }
+    connection.lastActive = std::chrono::steady_clock::now();
+    direction.written += result;
+    direction.metrics->bytes.fetch_add(result, std::memory_order_relaxed);
+    if (direction.written < direction.length) {
+        submitWrite(&connection - mConnections.data(), direction);
+        return;
+    }
+    direction.metrics->chunkLatency.record(connection.lastActive - direction.readAt);
+}
+
+// Shuts both sockets down so every outstanding request completes promptly.
+void UringLoop::fail(Connection& connection) {
+    if (connection.failed) {
+        return;
+    }
+    connection.failed = true;
+    shutdown(connection.clientFd, SHUT_RDWR);
+    if (connection.serverFd >= 0) {
+        shutdown(connection.serverFd, SHUT_RDWR);
+    }
+}
+
+void UringLoop::maybeRecycle(uint32_t id) {
+    Connection& connection = mConnections[id];
+    if (!connection.inUse || connection.inflight > 0) {
+        return;
+    }
+    if (!connection.failed && !(connection.upstream.done && connection.downstream.done)) {
+        return;
+    }
+
+    int empty[2] = {-1, -1};
+    io_uring_register_files_update(&mRing, 2 * id, empty, 2);
+    closeFileDescriptor(connection.clientFd);
+    if (connection.serverFd >= 0) {
+        closeFileDescriptor(connection.serverFd);
+    }
+    connection.route->metrics->activeConnections.fetch_sub(1, std::memory_order_relaxed);
+    connection.route->limiter->release();
+    connection = Connection{};
+    mFreeIds.push_back(id);
+}
+
+}  // namespace android::automotive::proxy
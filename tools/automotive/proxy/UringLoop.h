@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <liburing.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <linux/vm_sockets.h>
+
+#include "EventLoop.h"
+
+namespace android::automotive::proxy {
+
+// An io_uring based alternative to EventLoop. Each loop owns a ring with a
+// multishot accept per route, and forwards every connection with fixed files
+// and registered buffers: a write of a received chunk is linked with the next
+// read into the same buffer, so a loaded connection costs one submission per
+// chunk instead of two syscalls per direction.
+class UringLoop {
+  public:
+    // The number of connections a loop can forward at once, which bounds the
+    // memory registered with the kernel. Clients beyond it are refused.
+    static constexpr uint32_t kMaxConnections = 256;
+
+    UringLoop();
+    ~UringLoop();
+
+    UringLoop(const UringLoop&) = delete;
+    UringLoop& operator=(const UringLoop&) = delete;
+
+    // Returns true if the running kernel provides every io_uring operation
+    // the loop relies on.
+    static bool isSupported();
+
+    bool init();
+
+    // Starts accepting clients of route on this loop.
+    bool addRoute(std::shared_ptr<const Route> route);
+
+    // Cancels the accept of route on this loop. Connections which were
+    // already accepted are still forwarded.
+    void removeRoute(const std::shared_ptr<const Route>& route);
+
+    // Runs task on the loop's thread. Thread safe.
+    void postTask(std::function<void()> task);
+
+    // Runs the loop on the calling thread. Only returns on a fatal error.
+    void run();
+
+  private:
+    enum Operation : uint8_t {
+        ACCEPT,
+        CONNECT,
+        READ_UPSTREAM,
+        WRITE_UPSTREAM,
+        READ_DOWNSTREAM,
+        WRITE_DOWNSTREAM,
+        IDLE_CHECK,
+        DRAIN,
+        CANCEL,
+        TASKS,
+    };
+
+    // Bytes travelling one way through a connection.
+    struct Direction {
+        int srcSlot;
+        int dstSlot;
+        int dstFd;
+        uint16_t bufferIndex;
+        char* buffer;
+        // How much a read may take, at most the registered buffer size.
+        uint32_t readSize;
+        uint32_t length = 0;
+        uint32_t written = 0;
+        bool done = false;
+        DirectionMetrics* metrics;
+        std::chrono::steady_clock::time_point readAt;
+    };
+
+    struct Connection {
+        bool inUse = false;
+        bool connected = false;
+        bool failed = false;
+        // Submitted operations which have not completed yet. The connection
+        // is only recycled once this drops to zero.
+        int inflight = 0;
+        int clientFd = -1;
+        int serverFd = -1;
+        sockaddr_vm fwdAddr;
+        std::shared_ptr<const Route> route;
+        std::chrono::steady_clock::time_point acceptedAt;
+        std::chrono::steady_clock::time_point lastActive;
+        Direction upstream;
+        Direction downstream;
+    };
+
+    io_uring_sqe* getSqe();
+    void armAccept(uint32_t socketIndex);
+    void armIdleCheck();
+    void armDrain();
+    void armTasks();
+    void runTasks();
+    void handleDrain();
+    void closeIdleConnections();
+    void handleCompletion(const io_uring_cqe* cqe);
+    void handleAccept(uint32_t socketIndex, const io_uring_cqe* cqe);
+    void handleConnect(Connection& connection, int result);
+    void handleRead(Connection& connection, Direction& direction, int result);
+    void handleWrite(Connection& connection, Direction& direction, int result);
+    void startConnection(int clientFd, std::shared_ptr<const Route> route);
+    void submitRead(uint32_t id, Direction& direction);
+    void submitWrite(uint32_t id, Direction& direction);
+    void fail(Connection& connection);
+    void maybeRecycle(uint32_t id);
+
+    io_uring mRing;
+    bool mRingReady = false;
+    bool mMultishotAccept = true;
+    bool mDraining = false;
+    __kernel_timespec mIdleCheckInterval{};
+    // A listening socket of a route.
+    struct RouteSocket {
+        std::shared_ptr<const Route> route;
+        int listenFd;
+    };
+
+    // Indexed by the socket index of ACCEPT requests. Removed routes leave
+    // null entries, so a late completion is never taken for another route.
+    std::vector<RouteSocket> mRouteSockets;
+    int mTaskFd = -1;
+    std::mutex mTaskLock;
+    std::vector<std::function<void()>> mTasks;
+    std::vector<Connection> mConnections;
+    std::vector<uint32_t> mFreeIds;
+    std::unique_ptr<char[]> mBuffers;
+};
+
+}  // namespace android::automotive::proxy
@@ -0,0 +1,454 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures automotive_vsock_proxy end to end. The benchmark runs an echo
+// service on a local VSOCK CID, starts the proxy in front of it once per
+// configuration, and keeps a number of connections busy sending messages
+// through the proxy and waiting for their echo.
+//
+// Example, comparing the threaded and epoll modes over 64 connections:
+//   automotive_vsock_proxy_benchmark --config="--mode=threaded" --config="--mode=epoll"
+//       --connections=64
+
+#include <errno.h>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <linux/vm_sockets.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// The proxy always listens on the host CID.
+constexpr unsigned kProxyCid = VMADDR_CID_HOST;
+constexpr auto kStartupTimeout = std::chrono::seconds(5);
+constexpr auto kStartupRetryInterval = std::chrono::milliseconds(50);
+
+const char* const kDefaultConfigs[] = {
+    "--mode=threaded --forwarding=copy",
+    "--mode=threaded --forwarding=splice",
+    "--mode=epoll --forwarding=copy",
+    "--mode=epoll --forwarding=splice",
+    "--mode=io_uring",
+};
+
+struct Options {
+    std::string proxy = "automotive_vsock_proxy";
+    std::vector<std::string> configs;
+    unsigned echoCid = VMADDR_CID_LOCAL;
+    unsigned port = 9999;
+    unsigned connections = 16;
+    size_t messageSize = 4096;
+    std::chrono::seconds duration{10};
+};
+
+struct Result {
+    uint64_t bytes = 0;
+    uint64_t messages = 0;
+    uint64_t failedConnections = 0;
+    std::chrono::duration<double> elapsed{0};
+    std::vector<std::chrono::nanoseconds> latencies;
+    double proxyCpuPercent = 0;
+};
+
+int connectVsock(unsigned cid, unsigned port) {
+    int fd = socket(AF_VSOCK, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    sockaddr_vm addr{};
+    addr.svm_family = AF_VSOCK;
+    addr.svm_cid = cid;
+    addr.svm_port = port;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool writeAll(int fd, const char* data, size_t size) {
+    for (size_t offset = 0; offset < size;) {
+        ssize_t written = write(fd, data + offset, size - offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        offset += written;
+    }
+    return true;
+}
+
+bool readAll(int fd, char* data, size_t size) {
+    for (size_t offset = 0; offset < size;) {
+        ssize_t readBytes = read(fd, data + offset, size - offset);
+        if (readBytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (readBytes <= 0) {
+            return false;
+        }
+        offset += readBytes;
+    }
+    return true;
+}
+
+// Echoes every byte back on its own thread per connection, which keeps the
+// service out of the way of the proxy being measured.
+class EchoService {
+  public:
+    bool start(unsigned cid, unsigned port) {
+        mFd = socket(AF_VSOCK, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_vm addr{};
+        addr.svm_family = AF_VSOCK;
+        addr.svm_cid = cid;
+        addr.svm_port = port;
+        if (mFd < 0 || bind(mFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            listen(mFd, SOMAXCONN) != 0) {
+            std::cerr << "Failed to set up the echo service on CID " << cid << " port " << port
+                      << ", ERROR = " << strerror(errno) << std::endl;
+            return false;
+        }
+        std::thread(&EchoService::acceptClients, this).detach();
+        return true;
+    }
+
+  private:
+    void acceptClients() {
+        while (true) {
+            int client = accept4(mFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                return;
+            }
+            std::thread(echo, client).detach();
+        }
+    }
+
+    static void echo(int fd) {
+        std::vector<char> buffer(65536);
+        while (true) {
+            ssize_t readBytes = read(fd, buffer.data(), buffer.size());
+            if (readBytes <= 0 || !writeAll(fd, buffer.data(), readBytes)) {
+                break;
+            }
+        }
+        close(fd);
+    }
+
+    int mFd = -1;
+};
+
+std::vector<std::string> splitArguments(const std::string& arguments) {
+    std::istringstream stream(arguments);
+    std::vector<std::string> split;
+    for (std::string argument; stream >> argument;) {
+        split.push_back(argument);
+    }
+    return split;
+}
+
+pid_t startProxy(const Options& options, const std::string& config,
+                 const std::string& configFile) {
+    std::vector<std::string> arguments = {options.proxy};
+    for (auto& argument : splitArguments(config)) {
+        arguments.push_back(std::move(argument));
+    }
+    arguments.push_back(configFile);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        std::vector<char*> argv;
+        for (auto& argument : arguments) {
+            argv.push_back(argument.data());
+        }
+        argv.push_back(nullptr);
+        execvp(argv[0], argv.data());
+        std::cerr << "Failed to run " << options.proxy << ", ERROR = " << strerror(errno)
+                  << std::endl;
+        _exit(127);
+    }
+    return pid;
+}
+
+void stopProxy(pid_t pid) {
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+}
+
+// Returns the CPU time used by pid so far, in clock ticks.
+long cpuTicks(pid_t pid) {
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    std::getline(stat, line);
+    // The command name may contain spaces, so fields are counted from the
+    // closing parenthesis; utime and stime are fields 14 and 15.
+    size_t end = line.rfind(')');
+    if (end == std::string::npos) {
+        return 0;
+    }
+    std::istringstream fields(line.substr(end + 2));
+    std::string field;
+    for (int i = 3; i < 14; i++) {
+        fields >> field;
+    }
+    long utime = 0;
+    long stime = 0;
+    fields >> utime >> stime;
+    return utime + stime;
+}
+
+bool waitForProxy(unsigned port) {
+    auto deadline = Clock::now() + kStartupTimeout;
+    while (Clock::now() < deadline) {
+        int fd = connectVsock(kProxyCid, port);
+        if (fd >= 0) {
+            close(fd);
+            return true;
+        }
+        std::this_thread::sleep_for(kStartupRetryInterval);
+    }
+    return false;
+}
+
+// Sends messages on one connection and waits for each echo until the
+// deadline, recording the round trip of every message.
+void driveConnection(const Options& options, Clock::time_point deadline,
+                     std::chrono::nanoseconds* latencies, size_t maxLatencies, Result* result,
+                     std::atomic<uint64_t>* recorded) {
+    int fd = connectVsock(kProxyCid, options.port);
+    if (fd < 0) {
+        result->failedConnections++;
+        return;
+    }
+    std::vector<char> message(options.messageSize, 'x');
+    std::vector<char> echo(options.messageSize);
+    while (Clock::now() < deadline) {
+        auto start = Clock::now();
+        if (!writeAll(fd, message.data(), message.size()) ||
+            !readAll(fd, echo.data(), echo.size())) {
+            result->failedConnections++;
+            break;
+        }
+        auto latency = Clock::now() - start;
+        result->messages++;
+        result->bytes += options.messageSize;
+        uint64_t index = recorded->fetch_add(1, std::memory_order_relaxed);
+        if (index < maxLatencies) {
+            latencies[index] = latency;
+        }
+    }
+    close(fd);
+}
+
+bool runConfig(const Options& options, const std::string& config,
+               const std::string& configFile, Result* result) {
+    pid_t pid = startProxy(options, config, configFile);
+    if (pid < 0 || !waitForProxy(options.port)) {
+        std::cerr << "The proxy did not start with " << config << std::endl;
+        if (pid > 0) {
+            stopProxy(pid);
+        }
+        return false;
+    }
+
+    // Enough room for a message every microsecond on every connection would
+    // be excessive; a sample of the first few million round trips suffices.
+    constexpr size_t kMaxLatencies = 4 * 1024 * 1024;
+    std::vector<std::chrono::nanoseconds> latencies(kMaxLatencies);
+    std::atomic<uint64_t> recorded{0};
+    std::vector<Result> perConnection(options.connections);
+
+    long ticksBefore = cpuTicks(pid);
+    auto start = Clock::now();
+    auto deadline = start + options.duration;
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < options.connections; i++) {
+        threads.emplace_back(driveConnection, std::cref(options), deadline, latencies.data(),
+                             kMaxLatencies, &perConnection[i], &recorded);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    result->elapsed = Clock::now() - start;
+    long ticks = cpuTicks(pid) - ticksBefore;
+    stopProxy(pid);
+
+    for (const auto& connection : perConnection) {
+        result->bytes += connection.bytes;
+        result->messages += connection.messages;
+        result->failedConnections += connection.failedConnections;
+    }
+    latencies.resize(std::min<uint64_t>(recorded.load(), kMaxLatencies));
+    std::sort(latencies.begin(), latencies.end());
+    result->latencies = std::move(latencies);
+    result->proxyCpuPercent = 100.0 * ticks / sysconf(_SC_CLK_TCK) / result->elapsed.count();
+    return true;
+}
+
+double percentileMicros(const std::vector<std::chrono::nanoseconds>& sorted, double percentile) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = std::min(sorted.size() - 1, static_cast<size_t>(sorted.size() * percentile / 100));
+    return std::chrono::duration<double, std::micro>(sorted[index]).count();
+}
+
+void printHeader() {
+    std::cout << std::left << std::setw(40) << "config" << std::right << std::setw(10) << "MB/s"
+              << std::setw(12) << "msgs/s" << std::setw(10) << "p50_us" << std::setw(10)
+              << "p99_us" << std::setw(10) << "p999_us" << std::setw(8) << "cpu%"
+              << std::setw(8) << "failed" << std::endl;
+}
+
+void printResult(const std::string& config, const Result& result) {
+    double seconds = result.elapsed.count();
+    std::cout << std::left << std::setw(40) << config << std::right << std::fixed
+              << std::setprecision(1) << std::setw(10) << result.bytes / seconds / 1e6
+              << std::setw(12) << result.messages / seconds << std::setw(10)
+              << percentileMicros(result.latencies, 50) << std::setw(10)
+              << percentileMicros(result.latencies, 99) << std::setw(10)
+              << percentileMicros(result.latencies, 99.9) << std::setw(8)
+              << result.proxyCpuPercent << std::setw(8) << result.failedConnections
+              << std::endl;
+}
+
+void usage(const char* name) {
+    std::cerr << "Usage: " << name << " [--proxy=PATH] [--config=\"PROXY ARGS\"]..."
+              << " [--connections=N] [--message_size=BYTES] [--duration=SECONDS]"
+              << " [--port=N] [--echo_cid=CID]" << std::endl
+              << "  --proxy=PATH        the automotive_vsock_proxy binary to measure"
+              << std::endl
+              << "  --config=ARGS       proxy arguments to measure, may be repeated; defaults"
+              << " to every mode and forwarding engine" << std::endl
+              << "  --connections=N     concurrent connections, defaults to 16" << std::endl
+              << "  --message_size=N    bytes per message, defaults to 4096" << std::endl
+              << "  --duration=SECONDS  measurement time per config, defaults to 10"
+              << std::endl
+              << "  --port=N            VSOCK port of the proxied service, defaults to 9999"
+              << std::endl
+              << "  --echo_cid=CID      CID the echo service binds, defaults to VMADDR_CID_LOCAL"
+              << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    static const option longOptions[] = {
+        {"proxy", required_argument, nullptr, 'p'},
+        {"config", required_argument, nullptr, 'c'},
+        {"connections", required_argument, nullptr, 'n'},
+        {"message_size", required_argument, nullptr, 's'},
+        {"duration", required_argument, nullptr, 'd'},
+        {"port", required_argument, nullptr, 'P'},
+        {"echo_cid", required_argument, nullptr, 'e'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    Options options;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:c:n:s:d:P:e:h", longOptions, nullptr)) != -1) {
+        switch (opt) {
+            case 'p':
+                options.proxy = optarg;
+                break;
+            case 'c':
+                options.configs.push_back(optarg);
+                break;
+            case 'n':
+                options.connections = atoi(optarg);
+                break;
+            case 's':
+                options.messageSize = atoi(optarg);
+                break;
+            case 'd':
+                options.duration = std::chrono::seconds(atoi(optarg));
+                break;
+            case 'P':
+                options.port = atoi(optarg);
+                break;
+            case 'e':
+                options.echoCid = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (options.configs.empty()) {
+        options.configs.assign(std::begin(kDefaultConfigs), std::end(kDefaultConfigs));
+    }
+    if (options.connections == 0 || options.messageSize == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    EchoService echo;
+    if (!echo.start(options.echoCid, options.port)) {
+        return 1;
+    }
+
+    const char* tmpDir = getenv("TMPDIR");
+    std::string configFile = std::string(tmpDir != nullptr ? tmpDir : "/tmp") +
+                             "/automotive_vsock_proxy_benchmark." + std::to_string(getpid()) +
+                             ".json";
+    {
+        std::ofstream config(configFile);
+        config << "[{\"CID\": " << options.echoCid
+               << ", \"Services\": [{\"name\": \"benchmark\", \"port\": " << options.port
+               << "}]}]" << std::endl;
+    }
+
+    std::cout << options.connections << " connections, " << options.messageSize
+              << " byte messages, " << options.duration.count() << "s per config" << std::endl;
+    printHeader();
+    int status = 0;
+    for (const auto& config : options.configs) {
+        Result result;
+        if (!runConfig(options, config, configFile, &result)) {
+            status = 1;
+            continue;
+        }
+        printResult(config, result);
+    }
+
+    unlink(configFile.c_str());
+    return status;
+}
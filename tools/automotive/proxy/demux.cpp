@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// The VM's end of a multiplexed service: accepts the links of the proxy on a
+// VSOCK port and connects every stream they carry to the service on its own,
+// so the service sees one connection per client as before.
+
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <iostream>
+#include <string>
+
+#include <linux/vm_sockets.h>
+
+#include "Multiplexer.h"
+#include "SocketUtils.h"
+
+using namespace android::automotive::proxy;
+
+namespace {
+
+// Where the streams are forwarded to in the VM.
+struct Target {
+    enum class Type { VSOCK, UNIX, TCP } type = Type::VSOCK;
+    unsigned port = 0;
+    std::string path;
+};
+
+class Demux : public Multiplexer {
+  public:
+    Demux(int listenFd, Target target)
+        : Multiplexer(nullptr, std::chrono::seconds(0)),
+          mListenFd(listenFd),
+          mTarget(std::move(target)) {}
+
+    ~Demux() override { stop(); }
+
+  private:
+    bool setUp() override { return watch(mListenFd); }
+
+    void handleReady(int /* fd */) override {
+        int linkFd = accept4(mListenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (linkFd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                std::cerr << "Failed to accept link, ERROR = " << strerror(errno) << std::endl;
+            }
+            return;
+        }
+        addLink(linkFd, false);
+    }
+
+    int acceptStream() override {
+        sockaddr_storage addr{};
+        socklen_t length = 0;
+        switch (mTarget.type) {
+            case Target::Type::VSOCK: {
+                auto* vm = reinterpret_cast<sockaddr_vm*>(&addr);
+                vm->svm_family = AF_VSOCK;
+                vm->svm_cid = VMADDR_CID_LOCAL;
+                vm->svm_port = mTarget.port;
+                length = sizeof(*vm);
+                break;
+            }
+            case Target::Type::UNIX: {
+                auto* un = reinterpret_cast<sockaddr_un*>(&addr);
+                un->sun_family = AF_UNIX;
+                memcpy(un->sun_path, mTarget.path.data(), mTarget.path.size());
+                length = sizeof(*un);
+                if (mTarget.path[0] == '@') {
+                    // Abstract names are not terminated, so the length has to
+                    // be exact.
+                    un->sun_path[0] = '\0';
+                    length = offsetof(sockaddr_un, sun_path) + mTarget.path.size();
+                }
+                break;
+            }
+            case Target::Type::TCP: {
+                auto* in = reinterpret_cast<sockaddr_in*>(&addr);
+                in->sin_family = AF_INET;
+                in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                in->sin_port = htons(mTarget.port);
+                length = sizeof(*in);
+                break;
+            }
+        }
+
+        int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            std::cerr << "Failed to create service socket, ERROR = " << strerror(errno)
+                      << std::endl;
+            return -1;
+        }
+        if (connect(fd, reinterpret_cast<sockaddr*>(&addr), length) < 0 &&
+            errno != EINPROGRESS) {
+            std::cerr << "Failed to connect to service, ERROR = " << strerror(errno)
+                      << std::endl;
+            closeFileDescriptor(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    const int mListenFd;
+    const Target mTarget;
+};
+
+void usage(const char* name) {
+    std::cerr << "Usage: " << name
+              << " --port=PORT (--vsock_port=PORT | --unix=PATH | --tcp_port=PORT)" << std::endl
+              << "  --port=PORT        VSOCK port the proxy's links are accepted on"
+              << std::endl
+              << "  --vsock_port=PORT  forward streams to this VSOCK port of the VM" << std::endl
+              << "  --unix=PATH        forward streams to this Unix domain socket, a leading"
+              << " '@' for the abstract namespace" << std::endl
+              << "  --tcp_port=PORT    forward streams to this TCP port on the loopback"
+              << " interface" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    static const option options[] = {
+        {"port", required_argument, nullptr, 'p'},
+        {"vsock_port", required_argument, nullptr, 'v'},
+        {"unix", required_argument, nullptr, 'u'},
+        {"tcp_port", required_argument, nullptr, 't'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    unsigned port = 0;
+    Target target;
+    bool hasTarget = false;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:v:u:t:h", options, nullptr)) != -1) {
+        switch (opt) {
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'v':
+                target.type = Target::Type::VSOCK;
+                target.port = atoi(optarg);
+                hasTarget = target.port > 0;
+                break;
+            case 'u':
+                target.type = Target::Type::UNIX;
+                target.path = optarg;
+                hasTarget = !target.path.empty() &&
+                            target.path.size() < sizeof(sockaddr_un::sun_path);
+                break;
+            case 't':
+                target.type = Target::Type::TCP;
+                target.port = atoi(optarg);
+                hasTarget = target.port > 0;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (port == 0 || !hasTarget) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // A peer going away must fail the write, not kill the demux.
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_vm addr{};
+    addr.svm_family = AF_VSOCK;
+    addr.svm_cid = VMADDR_CID_ANY;
+    addr.svm_port = port;
+    int listenFd = setupServerSocket(addr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (listenFd < 0) {
+        return 1;
+    }
+
+    Demux demux(listenFd, target);
+    if (!demux.start()) {
+        return 1;
+    }
+    demux.wait();
+    return 1;
+}
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#pragma once
+
 #include <optional>
 #include <string>
 #include <string_view>
@@ -32,7 +34,23 @@ struct VmProxyConfig {
 };
 
 void setProxyConfigFile(std::string_view configFile);
+// Reads the binary config when it is there and not older than the JSON, and
+// the JSON otherwise. Errors in the JSON are written to stderr, and leave no
+// configs.
 std::vector<VmProxyConfig> getAllVmProxyConfigs();
+// Like getAllVmProxyConfigs(), but returns nullopt instead of failing when the
+// config is missing or invalid, e.g. while it is being rewritten.
+std::optional<std::vector<VmProxyConfig>> loadVmProxyConfigs();
+
+// Lookups of a single service, which are lock-free and do not allocate beyond
+// the returned copy. The config file is read on first use; the services of
+// the VM which come first in it win for names or ports used more than once.
 std::optional<Service> getServiceConfig(std::string_view name);
+std::optional<Service> getServiceConfig(unsigned cid, std::string_view name);
+std::optional<Service> getServiceConfigByPort(unsigned port);
+// Makes the lookups above use the current content of the config file. Lookups
+// running concurrently see either the old or the new config. Returns false,
+// and keeps the old config, if the file cannot be loaded.
+bool reloadProxyConfig();
 
-}  // namespace android::automotive::proxyconfig
\ No newline at end of file
+}  // namespace android::automotive::proxyconfig
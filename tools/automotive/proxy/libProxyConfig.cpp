@@ -16,65 +16,146 @@
 
 #include <libProxyConfig/libProxyConfig.h>
 
-#include <json/json.h>
-
-#include <fstream>
-#include <map>
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <memory>
 #include <mutex>
+#include <unordered_map>
+
+#include "ProxyConfig.h"
 
 namespace android::automotive::proxyconfig {
 
-static std::map<std::string, Service> serviceConfigs;
-std::once_flag flag;
+namespace {
 
-static std::string_view proxyConfig =
-    "/etc/automotive/proxy_config.json";
+// Lets the indexes below be searched with a std::string_view, so a lookup
+// does not build a std::string.
+struct StringHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view value) const {
+        return std::hash<std::string_view>{}(value);
+    }
+};
 
-void setProxyConfigFile(std::string_view configFile) {
-    proxyConfig = configFile;
-}
+using NameIndex = std::unordered_map<std::string, const Service*, StringHash, std::equal_to<>>;
+
+// The services of one version of the config file, indexed for lookup. Never
+// modified once published. Where several services share a key, the first one
+// in the file wins.
+struct ServiceIndex {
+    explicit ServiceIndex(const std::vector<VmProxyConfig>& vmConfigs) {
+        size_t count = 0;
+        for (const auto& vmConfig: vmConfigs) {
+            count += vmConfig.services.size();
+        }
+        // Reserved up front, so the pointers held by the indexes stay valid.
+        services.reserve(count);
+        for (const auto& vmConfig: vmConfigs) {
+            for (const auto& service: vmConfig.services) {
+                const Service* entry = &services.emplace_back(service);
+                byName.emplace(entry->name, entry);
+                byPort.emplace(entry->port, entry);
+                byCid[vmConfig.cid].emplace(entry->name, entry);
+            }
+        }
+    }
 
-static Service readVmService(Json::Value service) {
-    Service vmService;
+    std::vector<Service> services;
+    NameIndex byName;
+    std::unordered_map<unsigned, const Service*> byPort;
+    std::unordered_map<unsigned, NameIndex> byCid;
+};
 
-    vmService.name = service["name"].asString();
-    vmService.port = service["port"].asInt();
+}  // namespace
+
+// The index lookups read. Readers only load the pointer; a reload publishes
+// a new index, and the old ones are kept in retiredIndexes until exit, since
+// a reader may still be using them. Reloads are rare, so this costs little.
+static std::atomic<const ServiceIndex*> serviceIndex{nullptr};
+static std::mutex indexLock;
+static std::vector<std::unique_ptr<const ServiceIndex>> retiredIndexes;
+std::once_flag flag;
 
-    return vmService;
+// Drops what only the proxy reads from the config.
+static std::vector<VmProxyConfig> toVmProxyConfigs(const std::vector<VmConfig>& vmConfigs) {
+    std::vector<VmProxyConfig> result;
+    result.reserve(vmConfigs.size());
+    for (const auto& vmConfig : vmConfigs) {
+        VmProxyConfig& entry = result.emplace_back();
+        entry.cid = vmConfig.cid;
+        entry.services.reserve(vmConfig.services.size());
+        for (const auto& service : vmConfig.services) {
+            entry.services.push_back(Service{service.name, service.port});
+        }
+    }
+    return result;
 }
 
 std::vector<VmProxyConfig> getAllVmProxyConfigs() {
-    std::ifstream file(std::string(proxyConfig).c_str());
-    Json::Value jsonConfig;
-    file >> jsonConfig;
-    std::vector<VmProxyConfig> vmConfigs;
-
-    for (const auto& vm: jsonConfig) {
-        VmProxyConfig vmConfig;
-        vmConfig.cid = vm["CID"].asInt();
-        for (const auto& service: vm["Services"]) {
-            vmConfig.services.push_back(readVmService(service));
-        }
-        vmConfigs.push_back(vmConfig);
+    ProxyConfigResult result = loadProxyConfigFile();
+    for (const auto& error : result.errors) {
+        std::cerr << getProxyConfigFile() << ":" << error.toString() << std::endl;
     }
-    return vmConfigs;
+    return toVmProxyConfigs(result.vmConfigs);
 }
 
-static void lazyLoadConfig() {
+std::optional<std::vector<VmProxyConfig>> loadVmProxyConfigs() {
+    ProxyConfigResult result = loadProxyConfigFile();
+    if (!result.ok()) {
+        return std::nullopt;
+    }
+    return toVmProxyConfigs(result.vmConfigs);
+}
+
+static void publishIndex(const std::vector<VmProxyConfig>& vmConfigs) {
+    auto index = std::make_unique<const ServiceIndex>(vmConfigs);
+    std::lock_guard<std::mutex> lock(indexLock);
+    serviceIndex.store(index.get(), std::memory_order_release);
+    retiredIndexes.push_back(std::move(index));
+}
+
+static const ServiceIndex& lazyLoadConfig() {
     std::call_once(flag, [](){
-        std::vector<VmProxyConfig> vmConfigs = getAllVmProxyConfigs();
-        for (const auto& vmConfig: vmConfigs) {
-            for (const auto& service: vmConfig.services) {
-                serviceConfigs.insert({service.name, service});
-            }
+        if (serviceIndex.load(std::memory_order_acquire) == nullptr) {
+            publishIndex(getAllVmProxyConfigs());
         }
     });
+    return *serviceIndex.load(std::memory_order_acquire);
+}
+
+static std::optional<Service> find(const NameIndex& index, std::string_view name) {
+    if (auto entry = index.find(name); entry != index.end()) {
+        return *entry->second;
+    }
+    return std::nullopt;
+}
+
+bool reloadProxyConfig() {
+    auto vmConfigs = loadVmProxyConfigs();
+    if (!vmConfigs) {
+        return false;
+    }
+    publishIndex(*vmConfigs);
+    return true;
 }
 
 std::optional<Service> getServiceConfig(std::string_view name) {
-    lazyLoadConfig();
-    if (auto entry = serviceConfigs.find(std::string(name)); entry != serviceConfigs.end()) {
-        return entry->second;
+    return find(lazyLoadConfig().byName, name);
+}
+
+std::optional<Service> getServiceConfig(unsigned cid, std::string_view name) {
+    const ServiceIndex& index = lazyLoadConfig();
+    if (auto vm = index.byCid.find(cid); vm != index.byCid.end()) {
+        return find(vm->second, name);
+    }
+    return std::nullopt;
+}
+
+std::optional<Service> getServiceConfigByPort(unsigned port) {
+    const ServiceIndex& index = lazyLoadConfig();
+    if (auto entry = index.byPort.find(port); entry != index.byPort.end()) {
+        return *entry->second;
     }
     return std::nullopt;
 }
@@ -14,73 +14,90 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <errno.h>
+#include <future>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <thread>
 #include <unistd.h>
 
-#include <libProxyConfig/libProxyConfig.h>
+#include "ProxyConfig.h"
 
 #include <linux/vm_sockets.h>
 
-#define MAX(x, y) (((x) > (y)) ? (x) : (y))
-#define BUFFER_SIZE 16384
-#define CLIENT_QUEUE_SIZE 128
-
-int setupServerSocket(sockaddr_vm& addr) {
-    int vsock_socket = socket(AF_VSOCK, SOCK_STREAM, 0);
+#include "ConfigWatcher.h"
+#include "ConnectionLimiter.h"
+#include "Drain.h"
+#include "EventLoop.h"
+#include "Forwarder.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "Placement.h"
+#include "RateLimiter.h"
+#include "SocketUtils.h"
+#include "UpstreamMux.h"
+#include "UpstreamPool.h"
+#include "UringLoop.h"
 
-    if (vsock_socket == -1) {
-        std::cerr << "Failed to create server VSOCK socket, ERROR = "
-                  << strerror(errno) << std::endl;
-        return -1;
-    }
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
 
-    if (bind(vsock_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
-        std::cerr << "Failed to bind to server VSOCK socket, ERROR = "
-                  << strerror(errno) << std::endl;
-        return -1;
-    }
+using namespace android::automotive::proxy;
 
-    if (listen(vsock_socket, CLIENT_QUEUE_SIZE) != 0) {
-        std::cerr << "Failed to listen on server VSOCK socket, ERROR = "
-                  << strerror(errno) << std::endl;
-        return -1;
-    }
+static ForwardingEngine sForwardingEngine = ForwardingEngine::SPLICE;
 
-    return vsock_socket;
-}
+// Connections forwarded at once across all services, unless --max_connections
+// says otherwise. Every connection costs a thread in threaded mode.
+static constexpr unsigned kDefaultMaxConnections = 1024;
+static constexpr unsigned kDefaultDrainTimeoutSeconds = 30;
+// Bytes buffered per direction for services with the lowLatency hint.
+static constexpr size_t kLowLatencyBufferSize = 4096;
+// How long removing a service on reload waits for its listening sockets to
+// close, so a service added by the same reload can bind its ports.
+static constexpr auto kListenerCloseTimeout = std::chrono::seconds(5);
 
-void closeFileDescriptor(int fd) {
-    close(fd);
-    shutdown(fd, SHUT_RDWR);
-}
+static void forwardConnection(int client_sock, int server_sock, ServiceMetrics* metrics,
+                              std::chrono::seconds idleTimeout, const BufferConfig& buffers);
 
-// transfers a max of BUFFER_SIZE bytes between a source file descriptor and a
-// destination file descriptor. Returns true on success, false otherwise
-bool transferBytes(int src_fd, int dst_fd) {
-    char buf[BUFFER_SIZE];
-    int readBytes = read(src_fd, buf, BUFFER_SIZE);
-    if (readBytes <= 0) {
-        return false;
+// Handles a client requesting to connect with the forwarding address
+void* handleConnection(int client_sock, int fwd_cid, int fwd_port, ServiceMetrics* metrics,
+                       UpstreamPool* pool, std::chrono::seconds idleTimeout,
+                       const BufferConfig& buffers) {
+    metrics->activeConnections.fetch_add(1, std::memory_order_relaxed);
+    LatencyTimer connectTimer;
+    int server_sock = pool != nullptr ? pool->take() : -1;
+    if (server_sock >= 0 && setNonBlocking(server_sock, false)) {
+        metrics->pooledConnections.fetch_add(1, std::memory_order_relaxed);
+        connectTimer.record(metrics->connectLatency);
+        forwardConnection(client_sock, server_sock, metrics, idleTimeout, buffers);
+        return nullptr;
+    }
+    if (server_sock >= 0) {
+        closeFileDescriptor(server_sock);
     }
-    int writtenBytes = write(dst_fd, buf, readBytes);
-    return writtenBytes >= 0;
-}
 
-// Handles a client requesting to connect with the forwarding address
-void* handleConnection(int client_sock, int fwd_cid, int fwd_port) {
-    int server_sock = socket(AF_VSOCK, SOCK_STREAM, 0);
+    server_sock = socket(AF_VSOCK, SOCK_STREAM, 0);
 
     if (server_sock < 0) {
-        std::cerr << "Failed to create forwarding VSOCK socket, ERROR = "
-                  <<  strerror(errno) << std::endl;
+        logMessage(LOG_SITE(),
+                   {.service = metrics->name.c_str(), .cid = metrics->cid, .error = errno},
+                   "Failed to create forwarding VSOCK socket");
         closeFileDescriptor(server_sock);
         closeFileDescriptor(client_sock);
+        metrics->connectErrors.fetch_add(1, std::memory_order_relaxed);
+        metrics->activeConnections.fetch_sub(1, std::memory_order_relaxed);
         return nullptr;
     }
 
@@ -91,13 +108,36 @@ void* handleConnection(int client_sock, int fwd_cid, int fwd_port) {
 
     if (connect(server_sock, reinterpret_cast<sockaddr*>(&fwd_addr),
               sizeof(fwd_addr)) < 0) {
-        std::cerr << "Failed to connect to forwarding vsock socket, ERROR = "
-                  <<  strerror(errno) << std::endl;
+        logMessage(LOG_SITE(),
+                   {.service = metrics->name.c_str(), .cid = metrics->cid, .error = errno},
+                   "Failed to connect to forwarding vsock socket");
         closeFileDescriptor(server_sock);
         closeFileDescriptor(client_sock);
+        metrics->connectErrors.fetch_add(1, std::memory_order_relaxed);
+        metrics->activeConnections.fetch_sub(1, std::memory_order_relaxed);
         return nullptr;
     }
+    connectTimer.record(metrics->connectLatency);
+    forwardConnection(client_sock, server_sock, metrics, idleTimeout, buffers);
+    return nullptr;
+}
+
+// Forwards bytes between a client and its connection to the forwarding
+// address until either side closes, or nothing moved for idleTimeout, then
+// closes both.
+static void forwardConnection(int client_sock, int server_sock, ServiceMetrics* metrics,
+                              std::chrono::seconds idleTimeout, const BufferConfig& buffers) {
+    setSocketBufferSizes(client_sock, buffers);
+    setSocketBufferSizes(server_sock, buffers);
+    if (idleTimeout.count() > 0) {
+        // A peer which stopped reading must not block a write forever either.
+        timeval sendTimeout{};
+        sendTimeout.tv_sec = idleTimeout.count();
+        setsockopt(client_sock, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+        setsockopt(server_sock, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+    }
 
+    Forwarder forwarder(sForwardingEngine, buffers.bufferSize);
     bool connected = true;
     while (connected) {
       fd_set file_descriptors;
@@ -105,87 +145,782 @@ void* handleConnection(int client_sock, int fwd_cid, int fwd_port) {
       FD_SET(client_sock, &file_descriptors);
       FD_SET(server_sock, &file_descriptors);
 
+      // select() may modify the timeout, so it is set up on every iteration.
+      timeval timeout{};
+      timeout.tv_sec = idleTimeout.count();
       int rv = select(MAX(client_sock, server_sock) + 1, &file_descriptors, nullptr, nullptr,
-                    nullptr);
+                    idleTimeout.count() > 0 ? &timeout : nullptr);
       if (rv == -1) {
-          std::cerr << "ERROR in Select!. Error = " << strerror(errno) << std::endl;
+          logMessage(LOG_SITE(), {.service = metrics->name.c_str(), .error = errno},
+                     "ERROR in Select!");
+          break;
+      }
+      if (rv == 0) {
+          metrics->idleTimeouts.fetch_add(1, std::memory_order_relaxed);
           break;
       }
 
       if (FD_ISSET(client_sock, &file_descriptors)) {
           // transfer bytes from client to forward address
-          connected = transferBytes(client_sock, server_sock);
+          connected = forwarder.transfer(client_sock, server_sock, &metrics->toServer);
       }
 
       if (FD_ISSET(server_sock, &file_descriptors)) {
           // transfer bytes from forward address to client
-          connected = transferBytes(server_sock, client_sock);
+          connected = forwarder.transfer(server_sock, client_sock, &metrics->toClient);
       }
     }
 
     closeFileDescriptor(client_sock);
     closeFileDescriptor(server_sock);
+    metrics->activeConnections.fetch_sub(1, std::memory_order_relaxed);
+}
 
-    return nullptr;
+// Translates the buffering hints of a service. Without any, connections are
+// buffered as they always were.
+static BufferConfig bufferConfigOf(const android::automotive::proxyconfig::ServiceConfig& service) {
+    BufferConfig config;
+    if (service.lowLatency) {
+        config.bufferSize = kLowLatencyBufferSize;
+    }
+    if (service.bufferSize > 0) {
+        config.bufferSize = service.bufferSize;
+    }
+    config.maxBufferSize = service.lowLatency
+                               ? config.bufferSize
+                               : MAX(config.bufferSize, size_t{service.maxBufferSize});
+    config.sendBufferSize = service.sendBufferSize;
+    config.receiveBufferSize = service.receiveBufferSize;
+    return config;
+}
+
+// Starts forwarding the clients of a service with multiplexConnections over
+// shared links to the VM's demux. Returns null on failure.
+static std::unique_ptr<UpstreamMux> startMux(
+        unsigned cid, const android::automotive::proxyconfig::ServiceConfig& service,
+        ServiceMetrics* metrics, ConnectionLimiter* limiter) {
+    unsigned port = service.multiplexPort > 0 ? service.multiplexPort : service.port;
+    auto mux = std::make_unique<UpstreamMux>(cid, port, service.multiplexConnections, metrics,
+                                             limiter,
+                                             std::chrono::seconds(service.idleTimeoutSeconds),
+                                             bufferConfigOf(service));
+    if (!mux->start()) {
+        std::cerr << "Failed to start multiplexer for " << service.name << std::endl;
+        return nullptr;
+    }
+    return mux;
 }
 
-void setupRoute(int cid, const android::automotive::proxyconfig::Service& service) {
+// Tells the thread of a route in threaded mode to stop accepting clients.
+struct StopSignal {
+    StopSignal() : fd(eventfd(0, EFD_CLOEXEC)) {}
+    ~StopSignal() { close(fd); }
+
+    StopSignal(const StopSignal&) = delete;
+    StopSignal& operator=(const StopSignal&) = delete;
+
+    void notify() {
+        uint64_t one = 1;
+        write(fd, &one, sizeof(one));
+    }
+
+    // Called by the route thread once its listening sockets are closed, or
+    // if it never opened them.
+    void listenersClosed() {
+        std::lock_guard<std::mutex> lock(mLock);
+        mListenersClosed = true;
+        mClosed.notify_all();
+    }
+
+    // Waits up to timeout for listenersClosed(). Returns false on timeout.
+    bool waitListenersClosed(std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mLock);
+        return mClosed.wait_for(lock, timeout, [this]() { return mListenersClosed; });
+    }
+
+    const int fd;
+
+  private:
+    std::mutex mLock;
+    std::condition_variable mClosed;
+    bool mListenersClosed = false;
+};
+
+// Creates the listening sockets of a service: its VSOCK port, followed by its
+// frontends. A frontend which cannot be set up is left out. Returns no sockets
+// if the VSOCK port cannot be set up.
+static std::vector<int> setupListenSockets(
+        const android::automotive::proxyconfig::ServiceConfig& service, int socketFlags) {
+    using android::automotive::proxyconfig::Frontend;
 
     sockaddr_vm addr{};
     addr.svm_family = AF_VSOCK;
     addr.svm_cid = 2;
     addr.svm_port = service.port;
 
+    int proxy_socket = setupServerSocket(addr, socketFlags, service.backlog);
+    if (proxy_socket == -1) {
+        std::cerr << "Failed to set up proxy server VSOCK socket for " << service.name
+                  << std::endl;
+        return {};
+    }
+    std::vector<int> listenFds = {proxy_socket};
+    for (const auto& frontend: service.frontends) {
+        int frontend_socket = frontend.type == Frontend::Type::UNIX
+                                  ? setupUnixServerSocket(frontend.path, socketFlags,
+                                                          service.backlog)
+                                  : setupTcpServerSocket(frontend.port, socketFlags,
+                                                         service.backlog);
+        if (frontend_socket == -1) {
+            std::cerr << "Failed to set up frontend "
+                      << (frontend.type == Frontend::Type::UNIX ? frontend.path
+                                                                : std::to_string(frontend.port))
+                      << " for " << service.name << std::endl;
+            continue;
+        }
+        listenFds.push_back(frontend_socket);
+    }
+    return listenFds;
+}
+
+void setupRoute(int cid, const android::automotive::proxyconfig::ServiceConfig& service,
+                ConnectionLimiter* connections, std::shared_ptr<StopSignal> stop) {
     int fwd_cid = cid;
     int fwd_port = service.port;
+    ServiceMetrics* metrics =
+        MetricsRegistry::get().registerService(service.name, fwd_cid, fwd_port);
+    // Shared with the connection threads, which may outlive the route when
+    // they don't finish within the drain timeout.
+    std::shared_ptr<UpstreamPool> pool;
+    if (service.poolSize > 0 && service.multiplexConnections == 0) {
+        pool = std::make_shared<UpstreamPool>(fwd_cid, fwd_port, service.poolSize);
+        pool->start();
+    }
+    auto limiter = std::make_shared<ConnectionLimiter>(service.maxConnections, connections);
+    std::chrono::seconds idleTimeout(service.idleTimeoutSeconds);
+    BufferConfig buffers = bufferConfigOf(service);
 
-    int proxy_socket = setupServerSocket(addr);
-
-    if (proxy_socket == -1) {
-        std::cerr << "Failed to set up proxy server VSOCK socket, ERROR = " <<
-           strerror(errno) << std::endl;
+    std::vector<int> listenFds = setupListenSockets(service, 0);
+    if (listenFds.empty()) {
+        stop->listenersClosed();
+        return;
+    }
+    // Multiplexed clients take no thread of their own. Destroyed before the
+    // limiter, to which it gives back the clients it still has.
+    std::unique_ptr<UpstreamMux> mux;
+    if (service.multiplexConnections > 0 &&
+        (mux = startMux(fwd_cid, service, metrics, limiter.get())) == nullptr) {
+        for (int listenFd: listenFds) {
+            closeFileDescriptor(listenFd);
+        }
+        stop->listenersClosed();
         return;
     }
 
-    int client_sock;
-    int len = sizeof(addr);
+    // The listening sockets, followed by the drain and stop signals.
+    std::vector<pollfd> fds;
+    for (int listenFd: listenFds) {
+        fds.push_back({listenFd, POLLIN, 0});
+    }
+    fds.push_back({drainEventFd(), POLLIN, 0});
+    fds.push_back({stop->fd, POLLIN, 0});
+    const size_t listenCount = listenFds.size();
 
     while (true) {
-        if ((client_sock = accept(proxy_socket, reinterpret_cast<sockaddr*>(&addr),
-                              reinterpret_cast<socklen_t*>(&len))) < 0) {
-            std::cerr << "Failed to accept VSOCK connection, ERROR = " <<
-               strerror(errno) << std::endl;
-            closeFileDescriptor(client_sock);
-            continue;
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            logMessage(LOG_SITE(), {.service = metrics->name.c_str(), .error = errno},
+                       "ERROR in poll!");
+            break;
+        }
+        if ((fds[listenCount].revents | fds[listenCount + 1].revents) & POLLIN) {
+            break;
         }
 
-        std::thread t(handleConnection, client_sock, fwd_cid, fwd_port);
-        t.detach();
+        for (size_t i = 0; i < listenCount; i++) {
+            if (!(fds[i].revents & POLLIN)) {
+                continue;
+            }
+            int client_sock = accept(fds[i].fd, nullptr, nullptr);
+            if (client_sock < 0) {
+                logMessage(LOG_SITE(), {.service = metrics->name.c_str(), .error = errno},
+                           "Failed to accept connection");
+                metrics->acceptErrors.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            metrics->acceptedConnections.fetch_add(1, std::memory_order_relaxed);
+            if (!limiter->tryAcquire()) {
+                // Shed the load rather than starting threads without bound.
+                metrics->rejectedConnections.fetch_add(1, std::memory_order_relaxed);
+                closeFileDescriptor(client_sock);
+                continue;
+            }
+            if (mux != nullptr) {
+                mux->addClient(client_sock);
+                continue;
+            }
+
+            std::thread t([=]() {
+                handleConnection(client_sock, fwd_cid, fwd_port, metrics, pool.get(),
+                                 idleTimeout, buffers);
+                limiter->release();
+            });
+            t.detach();
+        }
     }
 
-    closeFileDescriptor(proxy_socket);
+    for (int listenFd: listenFds) {
+        closeFileDescriptor(listenFd);
+    }
+    stop->listenersClosed();
+
+    // Draining or removed: let the connections finish, up to the drain
+    // timeout. Those of the multiplexer are dropped with it after that, while
+    // connection threads keep running on their own.
+    if (!limiter->waitUntilIdle(std::chrono::steady_clock::now() + drainTimeout())) {
+        logMessage(LOG_SITE(), {.service = metrics->name.c_str()},
+                   "%u connections still open after the drain timeout", limiter->active());
+    }
 }
 
-
 static constexpr const char *kProxyConfigFile =
     "../etc/automotive/proxy_config.json";
 
-int main(int argc, char **argv ) {
-    android::automotive::proxyconfig::setProxyConfigFile(
-        (argc >= 2)?argv[1]:kProxyConfigFile);
+static void usage(const char* name) {
+    std::cerr << "Usage: " << name << " [--mode=threaded|epoll|io_uring] [--workers=N]"
+              << " [--forwarding=splice|copy] [--stats_interval=SECONDS]"
+              << " [--max_connections=N] [--drain_timeout=SECONDS] [config_file]"
+              << std::endl
+              << "  --mode=threaded  one thread per route and per connection (default)"
+              << std::endl
+              << "  --mode=epoll     a fixed pool of epoll loops shared by all routes"
+              << std::endl
+              << "  --mode=io_uring  like epoll, with io_uring rings where the kernel has them"
+              << std::endl
+              << "  --workers=N      number of event loops, defaults to the core count"
+              << std::endl
+              << "  --forwarding=splice  move bytes through a pipe with splice() (default)"
+              << std::endl
+              << "  --forwarding=copy    read() into a buffer and write() it out"
+              << std::endl
+              << "  --stats_interval=SECONDS  print per-service metrics to stdout periodically"
+              << std::endl
+              << "  --max_connections=N  connections forwarded at once across all services,"
+              << " defaults to " << kDefaultMaxConnections << ", 0 for no limit"
+              << std::endl
+              << "  --drain_timeout=SECONDS  how long SIGTERM waits for connections to finish,"
+              << " defaults to " << kDefaultDrainTimeoutSeconds
+              << std::endl;
+}
+
+using ServiceKey = std::pair<unsigned, unsigned>;
+
+// Builds a ConfigWatcher which adds and removes the services of routes, a
+// ThreadedRoutes or RouteTable, as the config file changes. Returns null if
+// the file cannot be watched; the proxy then runs with the config it started
+// with.
+template <typename Routes>
+static std::unique_ptr<ConfigWatcher> watchConfig(
+        const std::vector<android::automotive::proxyconfig::VmConfig>& vmConfigs,
+        Routes& routes) {
+    auto watcher = std::make_unique<ConfigWatcher>(
+        vmConfigs,
+        [&routes](const android::automotive::proxyconfig::VmConfig& vmConfig,
+                  const android::automotive::proxyconfig::ServiceConfig& service) {
+            routes.add(vmConfig, service);
+        },
+        [&routes](const android::automotive::proxyconfig::VmConfig& vmConfig,
+                  const android::automotive::proxyconfig::ServiceConfig& service) {
+            routes.remove(vmConfig.cid, service);
+        });
+    if (!watcher->start()) {
+        return nullptr;
+    }
+    return watcher;
+}
+
+// The route threads of threaded mode. Each spawns a thread per accepted
+// connection, placed like the route thread.
+class ThreadedRoutes {
+  public:
+    explicit ThreadedRoutes(ConnectionLimiter* connections) : mConnections(connections) {}
 
-    auto vmConfigs = android::automotive::proxyconfig::getAllVmProxyConfigs();
+    void add(const android::automotive::proxyconfig::VmConfig& vmConfig,
+             const android::automotive::proxyconfig::ServiceConfig& service) {
+        if (isDraining()) {
+            return;
+        }
+        auto stop = std::make_shared<StopSignal>();
+        std::lock_guard<std::mutex> lock(mLock);
+        if (!mStopSignals.emplace(ServiceKey(vmConfig.cid, service.port), stop).second) {
+            return;
+        }
+        mRunning++;
+        unsigned cid = vmConfig.cid;
+        Placement placement = placementOf(vmConfig);
+        std::thread([this, cid, service, stop, placement]() {
+            if (!placement.empty()) {
+                applyPlacement(placement);
+            }
+            setupRoute(cid, service, mConnections, stop);
+            std::lock_guard<std::mutex> lock(mLock);
+            mRunning--;
+            mFinished.notify_all();
+        }).detach();
+    }
 
-    std::vector<std::thread> routeThreads;
+    // Stops accepting clients of the service, and returns once its listening
+    // sockets are closed. Its connections are forwarded until they finish.
+    void remove(unsigned cid, const android::automotive::proxyconfig::ServiceConfig& service) {
+        std::shared_ptr<StopSignal> stop;
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            auto entry = mStopSignals.find(ServiceKey(cid, service.port));
+            if (entry == mStopSignals.end()) {
+                return;
+            }
+            stop = std::move(entry->second);
+            mStopSignals.erase(entry);
+        }
+        stop->notify();
+        if (!stop->waitListenersClosed(kListenerCloseTimeout)) {
+            std::cerr << "Timed out closing the listening sockets of " << service.name
+                      << std::endl;
+        }
+    }
+
+    // Blocks until every route thread returned.
+    void wait() {
+        std::unique_lock<std::mutex> lock(mLock);
+        mFinished.wait(lock, [this]() { return mRunning == 0; });
+    }
+
+  private:
+    ConnectionLimiter* const mConnections;
+    std::mutex mLock;
+    std::condition_variable mFinished;
+    size_t mRunning = 0;
+    std::map<ServiceKey, std::shared_ptr<StopSignal>> mStopSignals;
+};
+
+// Runs one thread per route, each spawning a thread per accepted connection.
+static int runThreaded(const std::vector<android::automotive::proxyconfig::VmConfig>& vmConfigs,
+                       ConnectionLimiter* connections) {
+    ThreadedRoutes routes(connections);
     for (const auto& vmConfig: vmConfigs) {
         for (const auto& service: vmConfig.services) {
-            routeThreads.push_back(std::thread(setupRoute, vmConfig.cid, service));
+            routes.add(vmConfig, service);
+        }
+    }
+    auto watcher = watchConfig(vmConfigs, routes);
+
+    routes.wait();
+
+    return 0;
+}
+
+// Creates the listening sockets, metrics, limiter and connection pool or
+// multiplexer of a service for the event-driven modes. Returns null on
+// failure.
+static std::shared_ptr<const Route> makeRoute(
+        unsigned cid, const android::automotive::proxyconfig::ServiceConfig& service,
+        int socketFlags, ConnectionLimiter* connections) {
+    std::vector<int> listenFds = setupListenSockets(service, socketFlags);
+    if (listenFds.empty()) {
+        return nullptr;
+    }
+    ServiceMetrics* metrics =
+        MetricsRegistry::get().registerService(service.name, cid, service.port);
+    auto limiter = std::make_unique<ConnectionLimiter>(service.maxConnections, connections);
+    std::unique_ptr<UpstreamMux> mux;
+    std::unique_ptr<UpstreamPool> pool;
+    if (service.multiplexConnections > 0) {
+        mux = startMux(cid, service, metrics, limiter.get());
+        if (mux == nullptr) {
+            for (int listenFd: listenFds) {
+                closeFileDescriptor(listenFd);
+            }
+            return nullptr;
+        }
+    } else if (service.poolSize > 0) {
+        pool = std::make_unique<UpstreamPool>(cid, service.port, service.poolSize);
+        pool->start();
+    }
+    std::unique_ptr<RateLimiter> rateLimiter;
+    if (service.rateLimitBytesPerSecond > 0) {
+        rateLimiter = std::make_unique<RateLimiter>(service.rateLimitBytesPerSecond,
+                                                    service.rateLimitBurstBytes);
+    }
+    return std::make_shared<const Route>(
+        Route{service.name, std::move(listenFds), cid, service.port, metrics, std::move(pool),
+              std::move(limiter), std::chrono::seconds(service.idleTimeoutSeconds),
+              bufferConfigOf(service), MAX(service.weight, 1u), std::move(rateLimiter),
+              std::move(mux)});
+}
+
+static void closeListenSockets(const Route& route) {
+    for (int listenFd: route.listenFds) {
+        closeFileDescriptor(listenFd);
+    }
+}
+
+// A set of loops clients are spread across. VMs with a placement get a group
+// of their own, which runs on their CPUs; the other VMs share the first group.
+template <typename Loop>
+struct LoopGroup {
+    Placement placement;
+    std::vector<std::unique_ptr<Loop>> loops;
+};
+
+// Creates the loop groups for vmConfigs with makeLoop(), which returns null
+// on failure. A group has up to workers loops, no more than it has CPUs, and
+// their buffers come from the group's NUMA node.
+template <typename Loop, typename MakeLoop>
+static bool makeLoopGroups(
+        const std::vector<android::automotive::proxyconfig::VmConfig>& vmConfigs,
+        unsigned workers, MakeLoop makeLoop, std::vector<LoopGroup<Loop>>& groups) {
+    groups.push_back(LoopGroup<Loop>{});
+    for (const auto& vmConfig: vmConfigs) {
+        Placement placement = placementOf(vmConfig);
+        bool known = std::any_of(groups.begin(), groups.end(), [&placement](const auto& group) {
+            return group.placement == placement;
+        });
+        if (!known) {
+            groups.push_back(LoopGroup<Loop>{std::move(placement), {}});
+        }
+    }
+
+    for (auto& group: groups) {
+        size_t count = workers;
+        if (!group.placement.cpus.empty()) {
+            count = std::min(count, group.placement.cpus.size());
+        }
+        ScopedMemoryPolicy memoryPolicy(group.placement.numaNode);
+        for (size_t i = 0; i < count; i++) {
+            auto loop = makeLoop();
+            if (loop == nullptr) {
+                return false;
+            }
+            group.loops.push_back(std::move(loop));
+        }
+    }
+    return true;
+}
+
+// The routes of the event-driven modes. A route is shared by every loop of
+// the group of its VM. Routes added or removed while the loops run are handed
+// to each loop as a task.
+template <typename Loop>
+class RouteTable {
+  public:
+    using Loops = std::vector<std::unique_ptr<Loop>>;
+
+    RouteTable(const std::vector<LoopGroup<Loop>>& groups, int socketFlags,
+               ConnectionLimiter* connections)
+        : mGroups(groups), mSocketFlags(socketFlags), mConnections(connections) {}
+
+    ~RouteTable() {
+        for (const auto& [key, entry] : mRoutes) {
+            closeListenSockets(*entry.route);
+        }
+    }
+
+    RouteTable(const RouteTable&) = delete;
+    RouteTable& operator=(const RouteTable&) = delete;
+
+    // Adds the routes of vmConfigs to the loops, which must not run yet.
+    bool setup(const std::vector<android::automotive::proxyconfig::VmConfig>& vmConfigs) {
+        for (const auto& vmConfig: vmConfigs) {
+            const Loops& loops = loopsOf(vmConfig);
+            for (const auto& service: vmConfig.services) {
+                auto route = makeRoute(vmConfig.cid, service, mSocketFlags, mConnections);
+                if (route == nullptr) {
+                    continue;
+                }
+                mRoutes.emplace(ServiceKey(vmConfig.cid, service.port), Entry{route, &loops});
+                for (const auto& loop: loops) {
+                    if (!loop->addRoute(route)) {
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    void add(const android::automotive::proxyconfig::VmConfig& vmConfig,
+             const android::automotive::proxyconfig::ServiceConfig& service) {
+        if (isDraining()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mLock);
+        ServiceKey key(vmConfig.cid, service.port);
+        if (mRoutes.find(key) != mRoutes.end()) {
+            return;
+        }
+        auto route = makeRoute(vmConfig.cid, service, mSocketFlags, mConnections);
+        if (route == nullptr) {
+            return;
+        }
+        const Loops& loops = loopsOf(vmConfig);
+        mRoutes.emplace(key, Entry{route, &loops});
+        for (const auto& loop: loops) {
+            Loop* target = loop.get();
+            target->postTask([target, route]() {
+                if (!target->addRoute(route)) {
+                    logMessage(LOG_SITE(),
+                               {.service = route->serviceName.c_str(), .cid = route->fwdCid},
+                               "Failed to add route");
+                }
+            });
+        }
+    }
+
+    // Stops accepting clients of the service on every loop, then closes its
+    // listening sockets, and returns once they are closed. Its connections are
+    // forwarded until they finish.
+    void remove(unsigned cid, const android::automotive::proxyconfig::ServiceConfig& service) {
+        Entry removed;
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            auto entry = mRoutes.find(ServiceKey(cid, service.port));
+            if (entry == mRoutes.end()) {
+                return;
+            }
+            removed = std::move(entry->second);
+            mRoutes.erase(entry);
+        }
+        auto route = removed.route;
+        auto pending = std::make_shared<std::atomic<size_t>>(removed.loops->size());
+        auto closed = std::make_shared<std::promise<void>>();
+        std::future<void> listenersClosed = closed->get_future();
+        for (const auto& loop: *removed.loops) {
+            Loop* target = loop.get();
+            target->postTask([target, route, pending, closed]() {
+                target->removeRoute(route);
+                if (pending->fetch_sub(1) == 1) {
+                    closeListenSockets(*route);
+                    closed->set_value();
+                }
+            });
+        }
+        if (listenersClosed.wait_for(kListenerCloseTimeout) != std::future_status::ready) {
+            std::cerr << "Timed out closing the listening sockets of " << service.name
+                      << std::endl;
+        }
+    }
+
+  private:
+    struct Entry {
+        std::shared_ptr<const Route> route;
+        const Loops* loops;
+    };
+
+    // The loops of the group placed like vmConfig. VMs added by a reload with
+    // a placement no group has share the first group.
+    const Loops& loopsOf(const android::automotive::proxyconfig::VmConfig& vmConfig) const {
+        Placement placement = placementOf(vmConfig);
+        for (const auto& group: mGroups) {
+            if (group.placement == placement) {
+                return group.loops;
+            }
         }
+        return mGroups.front().loops;
     }
 
-    for(auto& t: routeThreads) {
+    const std::vector<LoopGroup<Loop>>& mGroups;
+    const int mSocketFlags;
+    ConnectionLimiter* const mConnections;
+    std::mutex mLock;
+    std::map<ServiceKey, Entry> mRoutes;
+};
+
+// Runs every loop on its own thread, placed like its group, until they all
+// return.
+template <typename Loop>
+static void runLoops(std::vector<LoopGroup<Loop>>& groups) {
+    std::vector<std::thread> workerThreads;
+    for (auto& group: groups) {
+        for (auto& loop: group.loops) {
+            workerThreads.push_back(std::thread([&group, &loop]() {
+                if (!group.placement.empty()) {
+                    applyPlacement(group.placement);
+                }
+                loop->run();
+            }));
+        }
+    }
+
+    for(auto& t: workerThreads) {
         t.join();
     }
+}
+
+// Runs a fixed number of epoll loops per group. Every loop listens on every
+// socket of its group's routes, and the loop woken for a client spreads the
+// batch it accepts across the least loaded loops of the group.
+static int runEventLoops(
+        const std::vector<android::automotive::proxyconfig::VmConfig>& vmConfigs,
+        unsigned workers, ConnectionLimiter* connections) {
+    std::vector<LoopGroup<EventLoop>> groups;
+    bool created = makeLoopGroups(vmConfigs, workers, []() {
+        auto loop = std::make_unique<EventLoop>(sForwardingEngine);
+        return loop->init() ? std::move(loop) : nullptr;
+    }, groups);
+    if (!created) {
+        return 1;
+    }
 
-    return 0;
+    for (auto& group: groups) {
+        std::vector<EventLoop*> peers;
+        for (auto& loop: group.loops) {
+            peers.push_back(loop.get());
+        }
+        for (auto& loop: group.loops) {
+            loop->setPeers(peers);
+        }
+    }
+
+    RouteTable<EventLoop> routes(groups, SOCK_NONBLOCK | SOCK_CLOEXEC, connections);
+    if (!routes.setup(vmConfigs)) {
+        return 1;
+    }
+    auto watcher = watchConfig(vmConfigs, routes);
+
+    runLoops(groups);
+
+    return 1;
+}
+
+// Runs a fixed number of io_uring loops per group, each with a multishot
+// accept on every socket of its group's routes.
+static int runUringLoops(
+        const std::vector<android::automotive::proxyconfig::VmConfig>& vmConfigs,
+        unsigned workers, ConnectionLimiter* connections) {
+    std::vector<LoopGroup<UringLoop>> groups;
+    bool created = makeLoopGroups(vmConfigs, workers, []() {
+        auto loop = std::make_unique<UringLoop>();
+        return loop->init() ? std::move(loop) : nullptr;
+    }, groups);
+    if (!created) {
+        return 1;
+    }
+
+    // io_uring waits for blocking sockets without tying up a thread.
+    RouteTable<UringLoop> routes(groups, SOCK_CLOEXEC, connections);
+    if (!routes.setup(vmConfigs)) {
+        return 1;
+    }
+    auto watcher = watchConfig(vmConfigs, routes);
+
+    runLoops(groups);
+
+    return 1;
+}
+
+int main(int argc, char **argv ) {
+    static const option options[] = {
+        {"mode", required_argument, nullptr, 'm'},
+        {"workers", required_argument, nullptr, 'w'},
+        {"forwarding", required_argument, nullptr, 'f'},
+        {"stats_interval", required_argument, nullptr, 's'},
+        {"max_connections", required_argument, nullptr, 'c'},
+        {"drain_timeout", required_argument, nullptr, 'd'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    enum class Mode { THREADED, EPOLL, IO_URING } mode = Mode::THREADED;
+    unsigned workers = std::thread::hardware_concurrency();
+    unsigned statsInterval = 0;
+    unsigned maxConnections = kDefaultMaxConnections;
+    unsigned drainTimeout = kDefaultDrainTimeoutSeconds;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "m:w:f:s:c:d:h", options, nullptr)) != -1) {
+        switch (opt) {
+            case 'm':
+                if (strcmp(optarg, "epoll") == 0) {
+                    mode = Mode::EPOLL;
+                } else if (strcmp(optarg, "io_uring") == 0) {
+                    mode = Mode::IO_URING;
+                } else if (strcmp(optarg, "threaded") == 0) {
+                    mode = Mode::THREADED;
+                } else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'w':
+                workers = atoi(optarg);
+                break;
+            case 'f':
+                if (strcmp(optarg, "splice") == 0) {
+                    sForwardingEngine = ForwardingEngine::SPLICE;
+                } else if (strcmp(optarg, "copy") == 0) {
+                    sForwardingEngine = ForwardingEngine::COPY;
+                } else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 's':
+                statsInterval = atoi(optarg);
+                break;
+            case 'c':
+                maxConnections = atoi(optarg);
+                break;
+            case 'd':
+                drainTimeout = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (workers == 0) {
+        workers = 1;
+    }
+
+    android::automotive::proxyconfig::setProxyConfigFile(
+        (optind < argc)?argv[optind]:kProxyConfigFile);
+
+    android::automotive::proxyconfig::ProxyConfigResult config =
+            android::automotive::proxyconfig::loadProxyConfigFile();
+    for (const auto& error : config.errors) {
+        std::cerr << android::automotive::proxyconfig::getProxyConfigFile() << ":"
+                  << error.toString() << std::endl;
+    }
+    auto& vmConfigs = config.vmConfigs;
+
+    if (statsInterval > 0) {
+        std::thread([statsInterval]() {
+            while (true) {
+                std::this_thread::sleep_for(std::chrono::seconds(statsInterval));
+                MetricsRegistry::get().dump(std::cout);
+            }
+        }).detach();
+    }
+
+    // A peer going away must fail the write, not kill the proxy.
+    signal(SIGPIPE, SIG_IGN);
+
+    ConnectionLimiter connections(maxConnections);
+    installDrainHandler(connections, std::chrono::seconds(drainTimeout));
+
+    if (mode == Mode::IO_URING && !UringLoop::isSupported()) {
+        std::cerr << "io_uring is not supported by this kernel, using epoll" << std::endl;
+        mode = Mode::EPOLL;
+    }
+
+    switch (mode) {
+        case Mode::IO_URING:
+            return runUringLoops(vmConfigs, workers, &connections);
+        case Mode::EPOLL:
+            return runEventLoops(vmConfigs, workers, &connections);
+        case Mode::THREADED:
+            break;
+    }
+    return runThreaded(vmConfigs, &connections);
 }
@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "./batch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "./execute.h"
+#include "./seccomp-filters.h"
+
+namespace shell_as {
+
+namespace {
+
+const char kShell[] = "/system/bin/sh";
+
+// How many bytes of the output of a command are kept until it exits, from the
+// end, so a chatty command does not grow the memory of the batch unbounded.
+constexpr size_t kMaxJobOutputSize = 64 * 1024;
+
+typedef struct Command {
+  // The line of the batch file the command was read from.
+  size_t line_number;
+  std::string command_line;
+} Command;
+
+typedef struct Job {
+  Command command;
+  pid_t process_id;
+  // The read end of the pipe the command writes its output to.
+  int output_fd;
+  // The end of the output, see kMaxJobOutputSize.
+  std::string output;
+  bool output_truncated;
+} Job;
+
+bool ReadCommands(const char* path, std::vector<Command>* commands) {
+  std::ifstream file;
+  std::istream* input = &std::cin;
+  if (strcmp(path, "-") != 0) {
+    file.open(path);
+    if (!file) {
+      std::cerr << "Unable to open batch file " << path << std::endl;
+      return false;
+    }
+    input = &file;
+  }
+
+  std::string line;
+  for (size_t line_number = 1; std::getline(*input, line); line_number++) {
+    size_t start = line.find_first_not_of(" \t");
+    if (start == std::string::npos || line[start] == '#') {
+      continue;
+    }
+    commands->push_back({line_number, line.substr(start)});
+  }
+  return true;
+}
+
+void ReportCommand(const Command& command, const std::string& result,
+                   const std::string& output) {
+  std::cout << "[" << command.line_number << "] " << result << " "
+            << command.command_line << "\n"
+            << output;
+  if (!output.empty() && output.back() != '\n') {
+    std::cout << "\n";
+  }
+  std::cout << std::flush;
+}
+
+bool StartJob(const Command& command, const SecurityContext* context,
+              const int input_fd, Job* job) {
+  int output_fds[2];
+  if (pipe2(output_fds, O_CLOEXEC) != 0) {
+    std::cerr << "Unable to create a pipe: " << strerror(errno) << std::endl;
+    return false;
+  }
+  std::string command_line = command.command_line;
+  char* const arguments[] = {const_cast<char*>(kShell),
+                             const_cast<char*>("-c"), command_line.data(),
+                             nullptr};
+  pid_t process_id;
+  bool started = StartInContext(arguments, context, input_fd, output_fds[1],
+                                output_fds[1], &process_id);
+  close(output_fds[1]);
+  if (!started) {
+    close(output_fds[0]);
+    return false;
+  }
+  *job = {command, process_id, output_fds[0], "", false};
+  return true;
+}
+
+void TrimJobOutput(Job* job) {
+  if (job->output.size() > kMaxJobOutputSize) {
+    job->output.erase(0, job->output.size() - kMaxJobOutputSize);
+    job->output_truncated = true;
+  }
+}
+
+// Reads the available output of a job. Returns false once the job closed its
+// end of the pipe.
+bool ReadJobOutput(Job* job) {
+  char buffer[4096];
+  ssize_t result = read(job->output_fd, buffer, sizeof(buffer));
+  if (result < 0 && errno == EINTR) {
+    return true;
+  }
+  if (result <= 0) {
+    return false;
+  }
+  job->output.append(buffer, result);
+  // Trimming only once the output is twice the limit keeps appends cheap.
+  if (job->output.size() > 2 * kMaxJobOutputSize) {
+    TrimJobOutput(job);
+  }
+  return true;
+}
+
+}  // namespace
+
+bool RunBatch(const char* path, uint32_t max_jobs,
+              const SecurityContext* context) {
+  std::vector<Command> commands;
+  if (!ReadCommands(path, &commands)) {
+    return false;
+  }
+
+  // The commands must not consume the batch file when it is read from standard
+  // input, so none of them gets to read it.
+  int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  if (null_fd < 0) {
+    std::cerr << "Unable to open /dev/null: " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  // Every command is started with the same filter, which is only built once.
+  if (context->seccomp_filter.has_value()) {
+    PreloadSeccompFilter(context->seccomp_filter.value());
+  }
+
+  bool all_succeeded = true;
+  size_t next_command = 0;
+  std::vector<Job> running;
+  while (next_command < commands.size() || !running.empty()) {
+    // Commands are started one at a time since starting one stops and ptraces
+    // it, but once started they run in parallel.
+    while (running.size() < max_jobs && next_command < commands.size()) {
+      const Command& command = commands[next_command++];
+      Job job;
+      if (!StartJob(command, context, null_fd, &job)) {
+        ReportCommand(command, "error", "");
+        all_succeeded = false;
+        continue;
+      }
+      running.push_back(std::move(job));
+    }
+    if (running.empty()) {
+      continue;
+    }
+
+    std::vector<struct pollfd> poll_fds;
+    for (const Job& job : running) {
+      poll_fds.push_back({job.output_fd, POLLIN, 0});
+    }
+    if (poll(poll_fds.data(), poll_fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "Unable to wait for command output: " << strerror(errno)
+                << std::endl;
+      close(null_fd);
+      return false;
+    }
+
+    // Finished jobs are removed from the back so the remaining indexes still
+    // match poll_fds.
+    for (size_t i = running.size(); i-- > 0;) {
+      if (poll_fds[i].revents == 0 || ReadJobOutput(&running[i])) {
+        continue;
+      }
+      Job& job = running[i];
+      close(job.output_fd);
+      int status;
+      waitpid(job.process_id, &status, 0);
+      int exit_code = ExitCodeFromStatus(status);
+      TrimJobOutput(&job);
+      if (job.output_truncated) {
+        job.output.insert(0, "[output truncated, last " +
+                                 std::to_string(kMaxJobOutputSize) +
+                                 " bytes follow]\n");
+      }
+      ReportCommand(job.command, "exit=" + std::to_string(exit_code),
+                    job.output);
+      if (exit_code != 0) {
+        all_succeeded = false;
+      }
+      running.erase(running.begin() + i);
+    }
+  }
+
+  close(null_fd);
+  return all_succeeded;
+}
+
+}  // namespace shell_as
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SHELL_AS_BATCH_H_
+#define SHELL_AS_BATCH_H_
+
+#include <stdint.h>
+
+#include "./context.h"
+
+namespace shell_as {
+
+// Runs every command listed in the file at path, or on standard input if path
+// is "-", in the given security context.
+//
+// Each non-empty line that does not start with '#' is one command, run with
+// `/system/bin/sh -c`. Up to max_jobs commands run at the same time. As each
+// command exits, a line of the form "[<line>] exit=<code> <command>" is written
+// to standard output, followed by everything the command wrote to its standard
+// output and error. A command that could not be started is reported with
+// "error" in place of the exit code.
+//
+// Returns true if every command was started and exited with status zero.
+bool RunBatch(const char* path, uint32_t max_jobs,
+              const SecurityContext* context);
+
+}  // namespace shell_as
+
+#endif  // SHELL_AS_BATCH_H_
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Starts a program in a security context repeatedly, the way shell-as does,
+// and writes the latency of the launches and the time spent in each phase as a
+// single line JSON object on standard output.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "../command-line.h"
+#include "../context.h"
+#include "../execute.h"
+#include "../string-utils.h"
+#include "../timing.h"
+
+namespace {
+
+const char kUsage[] =
+    R"(Usage: shell-as-benchmark [--iterations <n>] [options]
+                          [<program> <arguments>...]
+
+Starts the program <n> times, 100 by default, in the security context given by
+the shell-as options that follow, one launch after the other. The output of the
+program is discarded.
+
+Writes a JSON object to standard output with the number of launches, those
+which failed, the distribution of the time from the start of a launch until the
+program runs in its context ("start_us") and until it exited ("total_us"), and
+the phases of the launches as reported by shell-as --timing ("phases").
+)";
+
+constexpr uint32_t kDefaultIterations = 100;
+
+// Writes the minimum, median, 90th and 99th percentile and maximum of times in
+// microseconds as a JSON object.
+void WriteDistribution(std::vector<std::chrono::nanoseconds> times,
+                       std::ostream& out) {
+  if (times.empty()) {
+    out << "{}";
+    return;
+  }
+  std::sort(times.begin(), times.end());
+  auto at = [&times](const double fraction) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               times[static_cast<size_t>(fraction * (times.size() - 1))])
+        .count();
+  };
+  out << "{\"min\":" << at(0) << ",\"p50\":" << at(0.5)
+      << ",\"p90\":" << at(0.9) << ",\"p99\":" << at(0.99)
+      << ",\"max\":" << at(1) << "}";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  uint32_t iterations = kDefaultIterations;
+  if (argc >= 2 && strcmp(argv[1], "--help") == 0) {
+    std::cerr << kUsage;
+    return 0;
+  }
+  if (argc >= 3 && strcmp(argv[1], "--iterations") == 0) {
+    if (!shell_as::StringToUInt32(argv[2], &iterations) || iterations == 0) {
+      std::cerr << "Invalid value for --iterations: " << argv[2] << std::endl;
+      return 1;
+    }
+    // The program name stays first for ParseOptions.
+    argv[2] = argv[0];
+    argc -= 2;
+    argv += 2;
+  }
+
+  bool verbose = false;
+  bool timing = false;
+  auto context = std::make_unique<shell_as::SecurityContext>();
+  char* const* execute_arguments = nullptr;
+  const char* batch_path = nullptr;
+  uint32_t max_jobs = 1;
+  {
+    shell_as::PhaseTimer timer(shell_as::kOptionsPhase,
+                               shell_as::kContextPhase);
+    if (!shell_as::ParseOptions(argc, argv, &verbose, &timing, context.get(),
+                                &execute_arguments, &batch_path, &max_jobs)) {
+      return 1;
+    }
+  }
+  if (batch_path != nullptr) {
+    std::cerr << "--batch can not be benchmarked, repeat a single program."
+              << std::endl;
+    return 1;
+  }
+
+  int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+  if (null_fd < 0) {
+    std::cerr << "Unable to open /dev/null: " << strerror(errno) << std::endl;
+    return 1;
+  }
+  std::vector<std::chrono::nanoseconds> start_times;
+  std::vector<std::chrono::nanoseconds> total_times;
+  uint32_t failures = 0;
+  for (uint32_t i = 0; i < iterations; i++) {
+    const auto start = std::chrono::steady_clock::now();
+    pid_t child;
+    if (!shell_as::StartInContext(execute_arguments, context.get(), null_fd,
+                                  null_fd, null_fd, &child)) {
+      failures++;
+      continue;
+    }
+    const auto started = std::chrono::steady_clock::now();
+    int status;
+    while (waitpid(child, &status, 0) < 0 && errno == EINTR) {
+    }
+    const auto exited = std::chrono::steady_clock::now();
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      failures++;
+    }
+    start_times.push_back(started - start);
+    total_times.push_back(exited - start);
+  }
+  close(null_fd);
+
+  std::cout << "{\"iterations\":" << iterations << ",\"failures\":" << failures
+            << ",\"start_us\":";
+  WriteDistribution(start_times, std::cout);
+  std::cout << ",\"total_us\":";
+  WriteDistribution(total_times, std::cout);
+  std::cout << ",\"phases\":";
+  shell_as::WritePhaseTotals(std::cout);
+  std::cout << "}" << std::endl;
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "./child-memory.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+namespace shell_as {
+
+namespace {
+
+using Word = unsigned long;
+
+// Transfers as much as possible with process_vm_readv or process_vm_writev.
+// Both may stop short at a mapping boundary, so the rest is transferred with
+// further calls. Returns the number of bytes transferred.
+size_t TransferWithProcessVm(const pid_t process, uintptr_t process_address,
+                             uint8_t* bytes, size_t byte_count, bool write) {
+  size_t transferred = 0;
+  while (transferred < byte_count) {
+    struct iovec local = {bytes + transferred, byte_count - transferred};
+    struct iovec remote = {
+        reinterpret_cast<void*>(process_address + transferred),
+        byte_count - transferred};
+    ssize_t result =
+        write ? process_vm_writev(process, &local, 1, &remote, 1, 0)
+              : process_vm_readv(process, &local, 1, &remote, 1, 0);
+    if (result <= 0) {
+      break;
+    }
+    transferred += result;
+  }
+  return transferred;
+}
+
+// Like TransferWithProcessVm, with pread and pwrite on /proc/<pid>/mem.
+size_t TransferWithProcMem(const pid_t process, uintptr_t process_address,
+                           uint8_t* bytes, size_t byte_count, bool write) {
+  std::string mem_path = "/proc/" + std::to_string(process) + "/mem";
+  int fd = open(mem_path.c_str(), (write ? O_WRONLY : O_RDONLY) | O_CLOEXEC);
+  if (fd < 0) {
+    return 0;
+  }
+  size_t transferred = 0;
+  while (transferred < byte_count) {
+    off64_t offset = static_cast<off64_t>(process_address + transferred);
+    ssize_t result =
+        write ? pwrite64(fd, bytes + transferred, byte_count - transferred,
+                         offset)
+              : pread64(fd, bytes + transferred, byte_count - transferred,
+                        offset);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      break;
+    }
+    transferred += result;
+  }
+  close(fd);
+  return transferred;
+}
+
+// Transfers one word at a time with PTRACE_PEEKDATA and PTRACE_POKEDATA. Words
+// only partially covered by the range are read, modified and written back.
+bool TransferWithPtrace(const pid_t process, uintptr_t process_address,
+                        uint8_t* bytes, size_t byte_count, bool write) {
+  while (byte_count != 0) {
+    uintptr_t word_address = process_address & ~(sizeof(Word) - 1);
+    size_t offset = process_address - word_address;
+    size_t chunk = std::min(sizeof(Word) - offset, byte_count);
+
+    Word word = 0;
+    if (!write || chunk != sizeof(Word)) {
+      // PTRACE_PEEKDATA returns the word, so errors are only told apart from
+      // data through errno.
+      errno = 0;
+      word = ptrace(PTRACE_PEEKDATA, process, word_address, nullptr);
+      if (errno != 0) {
+        return false;
+      }
+    }
+    if (write) {
+      memcpy(reinterpret_cast<uint8_t*>(&word) + offset, bytes, chunk);
+      if (ptrace(PTRACE_POKEDATA, process, word_address, word) != 0) {
+        return false;
+      }
+    } else {
+      memcpy(bytes, reinterpret_cast<uint8_t*>(&word) + offset, chunk);
+    }
+
+    process_address += chunk;
+    bytes += chunk;
+    byte_count -= chunk;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool ReadChildMemory(const pid_t process, uintptr_t process_address,
+                     uint8_t* bytes, size_t byte_count) {
+  size_t transferred = TransferWithProcessVm(process, process_address, bytes,
+                                             byte_count, /*write=*/false);
+  transferred += TransferWithProcMem(process, process_address + transferred,
+                                     bytes + transferred,
+                                     byte_count - transferred, /*write=*/false);
+  return TransferWithPtrace(process, process_address + transferred,
+                            bytes + transferred, byte_count - transferred,
+                            /*write=*/false);
+}
+
+bool WriteChildMemory(const pid_t process, uintptr_t process_address,
+                      const uint8_t* bytes, size_t byte_count) {
+  // The transfer functions take a mutable buffer for both directions, but
+  // never modify it when writing.
+  uint8_t* source = const_cast<uint8_t*>(bytes);
+  // Code is mapped read-only, which process_vm_writev refuses, so
+  // /proc/<pid>/mem is tried first.
+  size_t transferred = TransferWithProcMem(process, process_address, source,
+                                           byte_count, /*write=*/true);
+  transferred += TransferWithProcessVm(process, process_address + transferred,
+                                       source + transferred,
+                                       byte_count - transferred, /*write=*/true);
+  return TransferWithPtrace(process, process_address + transferred,
+                            source + transferred, byte_count - transferred,
+                            /*write=*/true);
+}
+
+}  // namespace shell_as
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SHELL_AS_CHILD_MEMORY_H_
+#define SHELL_AS_CHILD_MEMORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace shell_as {
+
+// Copies byte_count bytes at process_address in a stopped, ptraced process
+// into bytes.
+//
+// The bytes are transferred in bulk with process_vm_readv, or through
+// /proc/<pid>/mem where that is not possible, and one word at a time with
+// ptrace as a last resort. Returns false if the memory could not be read.
+bool ReadChildMemory(const pid_t process, uintptr_t process_address,
+                     uint8_t* bytes, size_t byte_count);
+
+// Copies byte_count bytes into a stopped, ptraced process at process_address.
+//
+// Unlike process_vm_writev, this also writes to read-only mappings such as the
+// code of the process. The bytes are written through /proc/<pid>/mem, which
+// allows that for a tracer, then with process_vm_writev, and one word at a time
+// with ptrace as a last resort. Returns false if the memory could not be
+// written.
+bool WriteChildMemory(const pid_t process, uintptr_t process_address,
+                      const uint8_t* bytes, size_t byte_count);
+
+}  // namespace shell_as
+
+#endif  // SHELL_AS_CHILD_MEMORY_H_
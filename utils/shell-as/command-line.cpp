@@ -23,6 +23,7 @@
 
 #include "./context.h"
 #include "./string-utils.h"
+#include "./timing.h"
 
 namespace shell_as {
 
@@ -36,6 +37,21 @@ program that is executed if none is specified is `/bin/system/sh`.
 The following options can be used to define the target security context.
 
 --verbose, -v                      Enables verbose logging.
+--timing, -t                       Prints the time spent in each phase of
+                                   starting the program to standard error as
+                                   a JSON object once it exits. With --batch,
+                                   the times of all commands are added up.
+--batch <file>, -b <file>          Runs every line of the given file, or of
+                                   standard input if file is '-', as a shell
+                                   command in the target security context
+                                   instead of a single program. The context is
+                                   only resolved once for the whole batch. As
+                                   each command exits, a line with its line
+                                   number and exit code is printed, followed by
+                                   its output, of which the last 64 KiB are
+                                   kept.
+--jobs <count>, -j <count>         The number of batch commands that may run at
+                                   the same time. Defaults to 1.
 --uid <uid>, -u <uid>              The target real and effective user ID.
 --gid <gid>, -g <gid>              The target real and effective group ID.
 --groups <gid1,2,..>, -G <1,2,..>  A comma separated list of supplementary group
@@ -79,10 +95,45 @@ following will set the target context to that of process 1234 but override the
 user ID to 0:
 
     shell-as --pid 1234 --uid 0
+
+A batch runs many commands in the same context with a single invocation:
+
+    shell-as --profile untrusted-app --jobs 4 --batch commands.txt
+
+shell-as can also run as a server which resolves each context once and then
+starts commands on behalf of clients, which pass it their standard input, output
+and error. Both --serve and --connect must be the first option. The exit code of
+the client is that of the command:
+
+    shell-as --serve @shell-as &
+    shell-as --connect @shell-as --pid 1234 /system/bin/id
+
+`shell-as --list-contexts` prints the security context of every running
+process, the same context --pid would infer, one process per line.
+
+`shell-as --dump-contexts` writes the same contexts as a snapshot with one JSON
+object per process, and `shell-as --diff <old> <new>` prints the processes whose
+context differs between two snapshots:
+
+    shell-as --dump-contexts > before.jsonl
+    shell-as --dump-contexts > after.jsonl
+    shell-as --diff before.jsonl after.jsonl
 )";
 
 const char* kShellExecvArgs[] = {"/system/bin/sh", nullptr};
 
+const char kShortOptions[] = "+s:hp:u:g:G:f:c:vtP:b:j:";
+const struct option kLongOptions[] = {
+    {"selinux", true, nullptr, 's'}, {"help", false, nullptr, 'h'},
+    {"uid", true, nullptr, 'u'},     {"gid", true, nullptr, 'g'},
+    {"pid", true, nullptr, 'p'},     {"verbose", false, nullptr, 'v'},
+    {"groups", true, nullptr, 'G'},  {"nogroups", false, nullptr, 'G'},
+    {"seccomp", true, nullptr, 'f'}, {"caps", true, nullptr, 'c'},
+    {"profile", true, nullptr, 'P'}, {"batch", true, nullptr, 'b'},
+    {"jobs", true, nullptr, 'j'},    {"timing", false, nullptr, 't'},
+    {nullptr, false, nullptr, 0},
+};
+
 bool ParseGroups(char* line, std::vector<gid_t>* ids) {
   // Allow a null line as a valid input since this method is used to handle both
   // --groups and --nogroups.
@@ -94,30 +145,37 @@ bool ParseGroups(char* line, std::vector<gid_t>* ids) {
 }  // namespace
 
 bool ParseOptions(const int argc, char* const argv[], bool* verbose,
-                  SecurityContext* context, char* const* execv_args[]) {
-  char short_options[] = "+s:hp:u:g:G:f:c:vP:";
-  struct option long_options[] = {
-      {"selinux", true, nullptr, 's'}, {"help", false, nullptr, 'h'},
-      {"uid", true, nullptr, 'u'},     {"gid", true, nullptr, 'g'},
-      {"pid", true, nullptr, 'p'},     {"verbose", false, nullptr, 'v'},
-      {"groups", true, nullptr, 'G'},  {"nogroups", false, nullptr, 'G'},
-      {"seccomp", true, nullptr, 'f'}, {"caps", true, nullptr, 'c'},
-      {"profile", true, nullptr, 'P'},
-  };
+                  bool* timing, SecurityContext* context,
+                  char* const* execv_args[], const char** batch_path,
+                  uint32_t* max_jobs) {
+  // Start from scratch, the server parses the options of many requests.
+  optind = 0;
   int option;
   bool infer_seccomp_filter = false;
   SecurityContext working_context;
   std::vector<gid_t> supplementary_group_ids;
   uint32_t working_id = 0;
-  while ((option = getopt_long(argc, argv, short_options, long_options,
+  while ((option = getopt_long(argc, argv, kShortOptions, kLongOptions,
                                nullptr)) != -1) {
     switch (option) {
       case 'v':
         *verbose = true;
         break;
+      case 't':
+        *timing = true;
+        break;
       case 'h':
         std::cerr << kUsage;
         return false;
+      case 'b':
+        *batch_path = optarg;
+        break;
+      case 'j':
+        if (!StringToUInt32(optarg, max_jobs) || *max_jobs == 0) {
+          std::cerr << "Invalid value for --jobs: " << optarg << std::endl;
+          return false;
+        }
+        break;
       case 'u':
         if (!StringToUInt32(optarg, &working_id)) {
           return false;
@@ -130,13 +188,15 @@ bool ParseOptions(const int argc, char* const argv[], bool* verbose,
         }
         working_context.group_id = working_id;
         break;
-      case 'c':
-        working_context.capabilities = cap_from_text(optarg);
-        if (working_context.capabilities.value() == nullptr) {
+      case 'c': {
+        cap_t capabilities = cap_from_text(optarg);
+        if (capabilities == nullptr) {
           std::cerr << "Unable to parse capabilities" << std::endl;
           return false;
         }
+        working_context.capabilities = Capabilities(capabilities);
         break;
+      }
       case 'G':
         supplementary_group_ids.clear();
         if (!ParseGroups(optarg, &supplementary_group_ids)) {
@@ -165,14 +225,17 @@ bool ParseOptions(const int argc, char* const argv[], bool* verbose,
           return false;
         }
         break;
-      case 'p':
+      case 'p': {
+        PhaseTimer timer(kContextPhase);
         if (!SecurityContextFromProcess(atoi(optarg), &working_context)) {
           return false;
         }
         infer_seccomp_filter = true;
         break;
+      }
       case 'P':
         if (strcmp(optarg, "untrusted-app") == 0) {
+          PhaseTimer timer(kContextPhase);
           if (!SecurityContextFromTestApp(&working_context)) {
             return false;
           }
@@ -198,7 +261,13 @@ bool ParseOptions(const int argc, char* const argv[], bool* verbose,
         SeccompFilterFromUserId(working_context.user_id.value());
   }
 
-  *context = working_context;
+  if (*batch_path != nullptr && optind < argc) {
+    std::cerr << "A program can not be given together with --batch."
+              << std::endl;
+    return false;
+  }
+
+  *context = std::move(working_context);
   if (optind < argc) {
     *execv_args = argv + optind;
   } else {
@@ -207,4 +276,14 @@ bool ParseOptions(const int argc, char* const argv[], bool* verbose,
   return true;
 }
 
+size_t CountOptionArguments(const int argc, char* const argv[]) {
+  optind = 0;
+  int saved_opterr = opterr;
+  opterr = 0;
+  while (getopt_long(argc, argv, kShortOptions, kLongOptions, nullptr) != -1) {
+  }
+  opterr = saved_opterr;
+  return optind;
+}
+
 }  // namespace shell_as
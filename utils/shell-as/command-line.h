@@ -17,6 +17,9 @@
 #ifndef SHELL_AS_COMMAND_LINE_H_
 #define SHELL_AS_COMMAND_LINE_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "./context.h"
 
 namespace shell_as {
@@ -28,9 +31,21 @@ namespace shell_as {
 // statically allocated default value. In both cases the caller should /not/
 // free the memory.
 //
+// The value of timing is set to true if --timing is given.
+//
+// If --batch is given, batch_path is set to its value and max_jobs to the value
+// of --jobs, if any. Both are left untouched otherwise.
+//
 // Returns true on success and false if there is a problem parsing options.
 bool ParseOptions(const int argc, char* const argv[], bool* verbose,
-                  SecurityContext* context, char* const* execv_args[]);
+                  bool* timing, SecurityContext* context,
+                  char* const* execv_args[], const char** batch_path,
+                  uint32_t* max_jobs);
+
+// Returns the index in argv of the program to execute, or argc if there is
+// none, without acting on the options before it. The first value of argv is
+// skipped like the program name given to ParseOptions.
+size_t CountOptionArguments(const int argc, char* const argv[]);
 }  // namespace shell_as
 
 #endif  // SHELL_AS_COMMAND_LINE_H_
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "./context-cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <sstream>
+
+#include "./string-utils.h"
+
+namespace shell_as {
+
+namespace {
+
+// The cache grants whatever context it holds, so it is only trusted if nobody
+// but root could have written it.
+bool IsWritableOnlyByRoot(const struct stat& status) {
+  return status.st_uid == 0 && (status.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+// Creates the directory holding the cache at path if needed, and checks that
+// only root can add files to it.
+bool MakeCacheDirectory(const char* path) {
+  std::string directory = path;
+  size_t slash = directory.rfind('/');
+  if (slash == std::string::npos || slash == 0) {
+    return false;
+  }
+  directory.resize(slash);
+  if (mkdir(directory.c_str(), S_IRWXU) != 0 && errno != EEXIST) {
+    return false;
+  }
+  struct stat status;
+  return lstat(directory.c_str(), &status) == 0 && S_ISDIR(status.st_mode) &&
+         IsWritableOnlyByRoot(status);
+}
+
+bool ReadCacheFile(const char* path, std::string* contents) {
+  int file = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (file == -1) {
+    return false;
+  }
+  struct stat status;
+  if (fstat(file, &status) != 0 || !S_ISREG(status.st_mode) ||
+      !IsWritableOnlyByRoot(status)) {
+    close(file);
+    return false;
+  }
+  char buffer[4096];
+  ssize_t size;
+  while ((size = read(file, buffer, sizeof(buffer))) > 0 ||
+         (size == -1 && errno == EINTR)) {
+    if (size > 0) {
+      contents->append(buffer, size);
+    }
+  }
+  close(file);
+  return size == 0;
+}
+
+}  // namespace
+
+// The cache is a text file. The first line holds the key and each following
+// line one field of the context:
+//
+// key <key>
+// uid <user ID>
+// gid <group ID>
+// groups <group1> <group2> ...
+// selinux <SELinux context>
+// caps <libcap textual capability sets>
+bool LoadCachedContext(const char* path, const std::string& key,
+                       SecurityContext* context) {
+  std::string contents;
+  if (!ReadCacheFile(path, &contents)) {
+    return false;
+  }
+  std::istringstream file(contents);
+  std::string line;
+  if (!std::getline(file, line) || line != "key " + key) {
+    return false;
+  }
+
+  SecurityContext cached;
+  while (std::getline(file, line)) {
+    size_t separator = line.find(' ');
+    std::string name = line.substr(0, separator);
+    std::string value =
+        separator == std::string::npos ? "" : line.substr(separator + 1);
+    uint32_t id;
+    if (name == "uid") {
+      if (!StringToUInt32(value.c_str(), &id)) {
+        return false;
+      }
+      cached.user_id = id;
+    } else if (name == "gid") {
+      if (!StringToUInt32(value.c_str(), &id)) {
+        return false;
+      }
+      cached.group_id = id;
+    } else if (name == "groups") {
+      std::vector<gid_t> ids;
+      if (!SplitIdsAndSkip(line.data(), " ", /*num_to_skip=*/1, &ids)) {
+        return false;
+      }
+      cached.supplementary_group_ids = ids;
+    } else if (name == "selinux") {
+      cached.selinux_context = value;
+    } else if (name == "caps") {
+      cap_t capabilities = cap_from_text(value.c_str());
+      if (capabilities == nullptr) {
+        return false;
+      }
+      cached.capabilities = Capabilities(capabilities);
+    }
+  }
+
+  if (!cached.user_id.has_value() || !cached.group_id.has_value() ||
+      !cached.supplementary_group_ids.has_value() ||
+      !cached.selinux_context.has_value() ||
+      !cached.capabilities.has_value()) {
+    return false;
+  }
+  *context = std::move(cached);
+  return true;
+}
+
+bool SaveCachedContext(const char* path, const std::string& key,
+                       const SecurityContext& context) {
+  if (!context.user_id.has_value() || !context.group_id.has_value() ||
+      !context.supplementary_group_ids.has_value() ||
+      !context.selinux_context.has_value() ||
+      !context.capabilities.has_value()) {
+    return false;
+  }
+  std::string capabilities = context.capabilities->ToText();
+  if (capabilities.empty()) {
+    return false;
+  }
+
+  std::ostringstream contents;
+  contents << "key " << key << "\n";
+  contents << "uid " << context.user_id.value() << "\n";
+  contents << "gid " << context.group_id.value() << "\n";
+  contents << "groups";
+  for (gid_t id : context.supplementary_group_ids.value()) {
+    contents << " " << id;
+  }
+  contents << "\n";
+  contents << "selinux " << context.selinux_context.value() << "\n";
+  contents << "caps " << capabilities << "\n";
+
+  if (!MakeCacheDirectory(path)) {
+    return false;
+  }
+  // Write to a temporary file first so that a concurrent shell-as never reads a
+  // partially written cache. The file is named after the process, so that
+  // concurrent ones don't write to the same file, and must not exist yet.
+  std::string temporary_path =
+      std::string(path) + "." + std::to_string(getpid()) + ".tmp";
+  int file = open(temporary_path.c_str(),
+                  O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+                  S_IRUSR | S_IWUSR);
+  if (file == -1) {
+    return false;
+  }
+  std::string data = contents.str();
+  bool written = write(file, data.data(), data.size()) ==
+                 static_cast<ssize_t>(data.size());
+  close(file);
+  if (!written || rename(temporary_path.c_str(), path) != 0) {
+    unlink(temporary_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace shell_as
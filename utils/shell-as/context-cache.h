@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SHELL_AS_CONTEXT_CACHE_H_
+#define SHELL_AS_CONTEXT_CACHE_H_
+
+#include <string>
+
+#include "./context.h"
+
+namespace shell_as {
+
+// Loads a security context saved by SaveCachedContext.
+//
+// The context is only loaded if the file is owned by root and not writable by
+// anyone else, was saved with the same key and has every field set. Returns
+// false without modifying the given context otherwise.
+bool LoadCachedContext(const char* path, const std::string& key,
+                       SecurityContext* context);
+
+// Saves the user and group IDs, supplementary groups, SELinux context and
+// capabilities of a context to the file at path, along with a key that
+// identifies what the context was derived from. The directory of path is
+// created if missing, and must only be writable by root. Returns true on
+// success.
+bool SaveCachedContext(const char* path, const std::string& key,
+                       const SecurityContext& context);
+
+}  // namespace shell_as
+
+#endif  // SHELL_AS_CONTEXT_CACHE_H_
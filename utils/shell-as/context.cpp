@@ -16,117 +16,334 @@
 
 #include "./context.h"
 
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <private/android_filesystem_config.h>  // For AID_APP_START.
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <string>
+#include <thread>
 
-#include "./string-utils.h"
+#include "./context-cache.h"
 #include "./test-app.h"
 
 namespace shell_as {
 
 namespace {
 
-bool ParseIdFromProcStatusLine(char* line, uid_t* id) {
-  // The user and group ID lines of the status file look like:
-  //
-  // Uid: <real> <effective> <saved> <filesystem>
-  // Gid: <real> <effective> <saved> <filesystem>
-  std::vector<uid_t> ids;
-  if (!SplitIdsAndSkip(line, "\t\n ", /*num_to_skip=*/1, &ids) ||
-      ids.size() < 1) {
+// Where the security context of the test app is kept between invocations. The
+// directory is created by shell-as, and /data/local only lets root do that,
+// unlike /data/local/tmp.
+const char kTestAppContextCachePath[] =
+    "/data/local/shell-as/test-app.context";
+
+// Large enough for the status file of any process, but grown if needed.
+const size_t kInitialStatusBufferSize = 4096;
+
+bool StartsWith(const char* line, const char* line_end, const char* prefix,
+                const char** value) {
+  size_t prefix_size = strlen(prefix);
+  if (static_cast<size_t>(line_end - line) < prefix_size ||
+      memcmp(line, prefix, prefix_size) != 0) {
     return false;
   }
-  *id = ids[0];
+  *value = line + prefix_size;
   return true;
 }
 
-bool ParseGroupsFromProcStatusLine(char* line, std::vector<gid_t>* ids) {
-  // The supplementary groups line of the status file looks like:
-  //
-  // Groups: <group1> <group2> <group3> ...
-  return SplitIdsAndSkip(line, "\t\n ", /*num_to_skip=*/1, ids);
+const char* SkipBlanks(const char* cursor, const char* end) {
+  while (cursor < end && (*cursor == ' ' || *cursor == '\t')) {
+    cursor++;
+  }
+  return cursor;
 }
 
-bool ParseProcStatusFile(const pid_t process_id, uid_t* real_user_id,
-                         gid_t* real_group_id,
-                         std::vector<gid_t>* supplementary_group_ids) {
-  std::string proc_status_path =
-      std::string("/proc/") + std::to_string(process_id) + "/status";
-  FILE* status_file = fopen(proc_status_path.c_str(), "r");
-  if (status_file == nullptr) {
-    std::cerr << "Unable to open '" << proc_status_path << "'" << std::endl;
+// Parses a decimal ID at cursor and advances cursor past it.
+bool ParseId(const char** cursor, const char* end, uint32_t* id) {
+  const char* start = *cursor;
+  uint64_t value = 0;
+  for (; *cursor < end && **cursor >= '0' && **cursor <= '9'; (*cursor)++) {
+    value = value * 10 + (**cursor - '0');
+    if (value > UINT32_MAX) {
+      return false;
+    }
   }
+  *id = value;
+  return *cursor != start;
+}
+
+bool ParseIds(const char* cursor, const char* end, std::vector<gid_t>* ids) {
+  ids->clear();
+  for (cursor = SkipBlanks(cursor, end); cursor < end;
+       cursor = SkipBlanks(cursor, end)) {
+    uint32_t id;
+    if (!ParseId(&cursor, end, &id)) {
+      return false;
+    }
+    ids->push_back(id);
+  }
+  return true;
+}
+
+bool ParseHex(const char* cursor, const char* end, uint64_t* value) {
+  cursor = SkipBlanks(cursor, end);
+  const char* start = cursor;
+  *value = 0;
+  for (; cursor < end && isxdigit(*cursor); cursor++) {
+    int digit = isdigit(*cursor) ? *cursor - '0' : tolower(*cursor) - 'a' + 10;
+    *value = (*value << 4) | digit;
+  }
+  return cursor != start && cursor - start <= 16;
+}
+
+void SetCapabilityFlags(cap_t capabilities, cap_flag_t flag, uint64_t mask) {
+  for (cap_value_t value = 0; value < 64; value++) {
+    if ((mask & (uint64_t{1} << value)) != 0) {
+      cap_set_flag(capabilities, flag, 1, &value, CAP_SET);
+    }
+  }
+}
+
+// Parses the user and group IDs, supplementary groups and capability sets out
+// of the contents of a /proc/<pid>/status file in a single pass.
+//
+// The user and group ID lines of the status file look like:
+//
+// Uid: <real> <effective> <saved> <filesystem>
+// Gid: <real> <effective> <saved> <filesystem>
+//
+// The supplementary groups line looks like:
+//
+// Groups: <group1> <group2> <group3> ...
+//
+// The capability sets are hexadecimal masks on the CapInh, CapPrm and CapEff
+// lines.
+bool ParseProcStatus(const char* status, const size_t status_size,
+                     SecurityContext* context) {
+  uid_t user_id = 0;
+  gid_t group_id = 0;
+  std::vector<gid_t> supplementary_group_ids;
+  uint64_t inheritable = 0;
+  uint64_t permitted = 0;
+  uint64_t effective = 0;
   bool parsed_user = false;
   bool parsed_group = false;
   bool parsed_supplementary_groups = false;
-  while (true) {
-    size_t line_length = 0;
-    char* line = nullptr;
-    if (getline(&line, &line_length, status_file) < 0) {
-      free(line);
-      break;
+  bool parsed_capabilities[3] = {};
+
+  const char* end = status + status_size;
+  for (const char* line = status; line < end;) {
+    const char* line_end =
+        static_cast<const char*>(memchr(line, '\n', end - line));
+    if (line_end == nullptr) {
+      line_end = end;
     }
-    if (strncmp("Uid:", line, 4) == 0) {
-      parsed_user = ParseIdFromProcStatusLine(line, real_user_id);
-    } else if (strncmp("Gid:", line, 4) == 0) {
-      parsed_group = ParseIdFromProcStatusLine(line, real_group_id);
-    } else if (strncmp("Groups:", line, 7) == 0) {
+    const char* value;
+    if (StartsWith(line, line_end, "Uid:", &value)) {
+      value = SkipBlanks(value, line_end);
+      parsed_user = ParseId(&value, line_end, &user_id);
+    } else if (StartsWith(line, line_end, "Gid:", &value)) {
+      value = SkipBlanks(value, line_end);
+      parsed_group = ParseId(&value, line_end, &group_id);
+    } else if (StartsWith(line, line_end, "Groups:", &value)) {
       parsed_supplementary_groups =
-          ParseGroupsFromProcStatusLine(line, supplementary_group_ids);
+          ParseIds(value, line_end, &supplementary_group_ids);
+    } else if (StartsWith(line, line_end, "CapInh:", &value)) {
+      parsed_capabilities[0] = ParseHex(value, line_end, &inheritable);
+    } else if (StartsWith(line, line_end, "CapPrm:", &value)) {
+      parsed_capabilities[1] = ParseHex(value, line_end, &permitted);
+    } else if (StartsWith(line, line_end, "CapEff:", &value)) {
+      parsed_capabilities[2] = ParseHex(value, line_end, &effective);
     }
-    free(line);
+    line = line_end + 1;
+  }
+  if (!parsed_user || !parsed_group || !parsed_supplementary_groups ||
+      !parsed_capabilities[0] || !parsed_capabilities[1] ||
+      !parsed_capabilities[2]) {
+    return false;
+  }
+
+  cap_t capabilities = cap_init();
+  if (capabilities == nullptr) {
+    return false;
   }
-  fclose(status_file);
-  return parsed_user && parsed_group && parsed_supplementary_groups;
+  SetCapabilityFlags(capabilities, CAP_INHERITABLE, inheritable);
+  SetCapabilityFlags(capabilities, CAP_PERMITTED, permitted);
+  SetCapabilityFlags(capabilities, CAP_EFFECTIVE, effective);
+
+  context->user_id = user_id;
+  context->group_id = group_id;
+  context->supplementary_group_ids = std::move(supplementary_group_ids);
+  context->capabilities = Capabilities(capabilities);
+  return true;
 }
 
-}  // namespace
+// Reads the whole /proc/<pid>/status file into buffer, which is reused between
+// calls. Returns the number of bytes read, or -1 on error.
+ssize_t ReadProcStatus(const pid_t process_id, std::vector<char>* buffer) {
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/%d/status", process_id);
+  int status_file = open(path, O_RDONLY | O_CLOEXEC);
+  if (status_file == -1) {
+    return -1;
+  }
+  if (buffer->size() < kInitialStatusBufferSize) {
+    buffer->resize(kInitialStatusBufferSize);
+  }
+  size_t size = 0;
+  while (true) {
+    if (size == buffer->size()) {
+      buffer->resize(buffer->size() * 2);
+    }
+    ssize_t bytes_read =
+        read(status_file, buffer->data() + size, buffer->size() - size);
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_read <= 0) {
+      close(status_file);
+      return bytes_read < 0 ? -1 : size;
+    }
+    size += bytes_read;
+  }
+}
+
+// Derives the context of a process. Error messages are only written if
+// report_errors is set, since processes routinely exit during a bulk scan.
+bool ScrapeProcessContext(const pid_t process_id, std::vector<char>* buffer,
+                          const bool report_errors, SecurityContext* context) {
+  SecurityContext scraped;
+  ssize_t status_size = ReadProcStatus(process_id, buffer);
+  if (status_size < 0 ||
+      !ParseProcStatus(buffer->data(), status_size, &scraped)) {
+    if (report_errors) {
+      std::cerr << "Unable to obtain user and group IDs and capabilities from "
+                << "process " << process_id << std::endl;
+    }
+    return false;
+  }
 
-bool SecurityContextFromProcess(const pid_t process_id,
-                                SecurityContext* context) {
   char* selinux_context;
   if (getpidcon(process_id, &selinux_context) != 0) {
-    std::cerr << "Unable to obtain SELinux context from process " << process_id
-              << std::endl;
+    if (report_errors) {
+      std::cerr << "Unable to obtain SELinux context from process "
+                << process_id << std::endl;
+    }
     return false;
   }
+  scraped.selinux_context = selinux_context;
+  freecon(selinux_context);
 
-  cap_t capabilities = cap_get_pid(process_id);
-  if (capabilities == nullptr) {
-    std::cerr << "Unable to obtain capability set from process " << process_id
-              << std::endl;
-    return false;
+  context->selinux_context = std::move(scraped.selinux_context);
+  context->user_id = scraped.user_id;
+  context->group_id = scraped.group_id;
+  context->supplementary_group_ids = std::move(scraped.supplementary_group_ids);
+  context->capabilities = std::move(scraped.capabilities);
+  return true;
+}
+
+}  // namespace
+
+std::string Capabilities::ToText() const {
+  char* text =
+      capabilities_ != nullptr ? cap_to_text(capabilities_, nullptr) : nullptr;
+  if (text == nullptr) {
+    return "";
   }
+  std::string result(text);
+  cap_free(text);
+  return result;
+}
 
-  uid_t user_id = 0;
-  gid_t group_id = 0;
-  std::vector<gid_t> supplementary_group_ids;
-  if (!ParseProcStatusFile(process_id, &user_id, &group_id,
-                           &supplementary_group_ids)) {
-    std::cerr << "Unable to obtain user and group IDs from process "
-              << process_id << std::endl;
-    return false;
+bool SecurityContextFromProcess(const pid_t process_id,
+                                SecurityContext* context) {
+  std::vector<char> buffer;
+  return ScrapeProcessContext(process_id, &buffer, /*report_errors=*/true,
+                              context);
+}
+
+std::vector<pid_t> ListProcessIds() {
+  std::vector<pid_t> process_ids;
+  DIR* proc = opendir("/proc");
+  if (proc == nullptr) {
+    return process_ids;
+  }
+  for (struct dirent* entry = readdir(proc); entry != nullptr;
+       entry = readdir(proc)) {
+    uint32_t process_id;
+    const char* name = entry->d_name;
+    if (ParseId(&name, name + strlen(name), &process_id) && *name == '\0') {
+      process_ids.push_back(process_id);
+    }
   }
+  closedir(proc);
+  return process_ids;
+}
 
-  context->selinux_context = selinux_context;
-  context->user_id = user_id;
-  context->group_id = group_id;
-  context->supplementary_group_ids = supplementary_group_ids;
-  context->capabilities = capabilities;
-  return true;
+void SecurityContextsFromProcesses(
+    const std::vector<pid_t>& process_ids, size_t thread_count,
+    std::vector<std::optional<SecurityContext>>* contexts) {
+  contexts->assign(process_ids.size(), std::nullopt);
+  thread_count = std::max<size_t>(1, std::min(thread_count, process_ids.size()));
+
+  // Each worker claims the next process with a shared counter and keeps its
+  // own read buffer, so the workers never contend beyond the counter.
+  std::atomic<size_t> next_index{0};
+  auto scrape = [&]() {
+    std::vector<char> buffer;
+    for (size_t i = next_index++; i < process_ids.size(); i = next_index++) {
+      SecurityContext context;
+      if (ScrapeProcessContext(process_ids[i], &buffer,
+                               /*report_errors=*/false, &context)) {
+        (*contexts)[i] = std::move(context);
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < thread_count; i++) {
+    workers.emplace_back(scrape);
+  }
+  scrape();
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
 }
 
 bool SecurityContextFromTestApp(SecurityContext* context) {
+  // The context is reused for as long as the build and the embedded app stay
+  // the same, unless the app was reinstalled under another user ID since.
+  std::string cache_key = GetTestAppContextKey();
+  SecurityContext cached_context;
+  uid_t test_app_user_id;
+  if (LoadCachedContext(kTestAppContextCachePath, cache_key,
+                        &cached_context) &&
+      GetTestAppUserId(&test_app_user_id) &&
+      cached_context.user_id.value() == test_app_user_id) {
+    *context = std::move(cached_context);
+    return true;
+  }
+
   pid_t test_app_pid = 0;
   if (!SetupAndStartTestApp(&test_app_pid)) {
     std::cerr << "Unable to install test app." << std::endl;
     return false;
   }
-  return SecurityContextFromProcess(test_app_pid, context);
+  if (!SecurityContextFromProcess(test_app_pid, context)) {
+    return false;
+  }
+  if (!SaveCachedContext(kTestAppContextCachePath, cache_key, *context)) {
+    std::cerr << "Unable to cache the test app security context." << std::endl;
+  }
+  return true;
 }
 
 SeccompFilter SeccompFilterFromUserId(uid_t user_id) {
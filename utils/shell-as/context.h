@@ -22,6 +22,8 @@
 
 #include <memory>
 #include <optional>
+#include <string>
+#include <utility>
 #include <vector>
 
 namespace shell_as {
@@ -37,13 +39,46 @@ enum SeccompFilter {
   kSystemFilter = 2,
 };
 
+// Owns a libcap capability state and frees it on destruction. Copies duplicate
+// the state, so contexts can be copied and cached without sharing it.
+class Capabilities {
+ public:
+  // Takes ownership of capabilities.
+  explicit Capabilities(cap_t capabilities) : capabilities_(capabilities) {}
+  Capabilities(const Capabilities &other)
+      : capabilities_(other.capabilities_ != nullptr
+                          ? cap_dup(other.capabilities_)
+                          : nullptr) {}
+  Capabilities(Capabilities &&other) noexcept
+      : capabilities_(std::exchange(other.capabilities_, nullptr)) {}
+  Capabilities &operator=(Capabilities other) noexcept {
+    std::swap(capabilities_, other.capabilities_);
+    return *this;
+  }
+  ~Capabilities() {
+    if (capabilities_ != nullptr) {
+      cap_free(capabilities_);
+    }
+  }
+
+  cap_t get() const { return capabilities_; }
+
+  // Returns the libcap textual form of the capability sets.
+  std::string ToText() const;
+
+ private:
+  cap_t capabilities_;
+};
+
+// A security context that owns all of its values, so it can be copied, moved
+// and kept for as long as needed.
 typedef struct SecurityContext {
   std::optional<uid_t> user_id;
   std::optional<gid_t> group_id;
   std::optional<std::vector<gid_t>> supplementary_group_ids;
-  std::optional<char *> selinux_context;
+  std::optional<std::string> selinux_context;
   std::optional<SeccompFilter> seccomp_filter;
-  std::optional<cap_t> capabilities;
+  std::optional<Capabilities> capabilities;
 } SecurityContext;
 
 // Infers the appropriate seccomp filter from a user ID.
@@ -60,6 +95,21 @@ SeccompFilter SeccompFilterFromUserId(uid_t user_id);
 // and not modify the given context.
 bool SecurityContextFromProcess(pid_t process_id, SecurityContext* context);
 
+// Lists the IDs of every process currently running.
+std::vector<pid_t> ListProcessIds();
+
+// Derives the complete security contexts of many processes at once, for example
+// to audit every process on a device.
+//
+// The /proc/<pid>/status file of each process is read with a single read into
+// a buffer reused between processes, and parsed in one pass. The processes are
+// spread across up to thread_count threads. The contexts are stored in the
+// same order as process_ids, with no value for any process whose context could
+// not be determined, such as one that exited during the scan.
+void SecurityContextsFromProcesses(
+    const std::vector<pid_t>& process_ids, size_t thread_count,
+    std::vector<std::optional<SecurityContext>>* contexts);
+
 // Derives a complete security context from the bundled test app.
 //
 // If unable to determine any field of the context this method will return false
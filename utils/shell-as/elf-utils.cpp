@@ -15,59 +15,124 @@
  */
 
 #include <elf.h>
-#include <stdio.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <iostream>
+#include <map>
 #include <string>
+#include <tuple>
 
-#include "./elf.h"
+#include "./elf-utils.h"
 
 namespace shell_as {
 
 namespace {
-// The base address of a PIE binary when loaded with ASLR disabled.
-#if defined(__arm__) || defined(__aarch64__)
-constexpr uint64_t k32BitImageBase = 0xAAAAA000;
-constexpr uint64_t k64BitImageBase = 0x5555555000;
-#else
-constexpr uint64_t k32BitImageBase = 0x56555000;
-constexpr uint64_t k64BitImageBase = 0x555555554000;
-#endif
+// Identifies a version of an executable file.
+typedef std::tuple<dev_t, ino_t, time_t, long> FileVersion;
+
+// Reads the class of the executable of a process from its ELF header. Returns
+// false if it is not an ELF file.
+bool ReadElfClass(const std::string& exe_path, bool* is_64_bit) {
+  int exe_file = open(exe_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (exe_file == -1) {
+    return false;
+  }
+  unsigned char ident[EI_NIDENT];
+  ssize_t read_size = read(exe_file, ident, sizeof(ident));
+  close(exe_file);
+  if (read_size != sizeof(ident) || memcmp(ident, ELFMAG, SELFMAG) != 0) {
+    return false;
+  }
+  if (ident[EI_CLASS] != ELFCLASS32 && ident[EI_CLASS] != ELFCLASS64) {
+    return false;
+  }
+  *is_64_bit = ident[EI_CLASS] == ELFCLASS64;
+  return true;
+}
+
+// Like ReadElfClass, but only reads the header of each version of an
+// executable once. Batches and servers start the same few executables over and
+// over.
+bool GetElfClass(const pid_t process_id, bool* is_64_bit) {
+  static std::map<FileVersion, bool> classes;
+
+  std::string exe_path = "/proc/" + std::to_string(process_id) + "/exe";
+  struct stat exe_stat;
+  if (stat(exe_path.c_str(), &exe_stat) != 0) {
+    return false;
+  }
+  FileVersion version(exe_stat.st_dev, exe_stat.st_ino,
+                      exe_stat.st_mtim.tv_sec, exe_stat.st_mtim.tv_nsec);
+  auto cached = classes.find(version);
+  if (cached != classes.end()) {
+    *is_64_bit = cached->second;
+    return true;
+  }
+  if (!ReadElfClass(exe_path, is_64_bit)) {
+    return false;
+  }
+  classes[version] = *is_64_bit;
+  return true;
+}
+
+// Finds the AT_ENTRY value in the auxiliary vector of a process. The vector is
+// made of pairs of words in the native size of the process.
+template <typename Word>
+bool FindAuxvEntry(const uint8_t* auxv, const size_t auxv_size,
+                   uint64_t* entry_address) {
+  for (size_t offset = 0; offset + 2 * sizeof(Word) <= auxv_size;
+       offset += 2 * sizeof(Word)) {
+    Word pair[2];
+    memcpy(pair, auxv + offset, sizeof(pair));
+    if (pair[0] == AT_NULL) {
+      break;
+    }
+    if (pair[0] == AT_ENTRY) {
+      *entry_address = pair[1];
+      return true;
+    }
+  }
+  return false;
+}
 }  // namespace
 
 bool GetElfEntryPoint(const pid_t process_id, uint64_t* entry_address,
                       bool* is_arm_mode) {
-  uint8_t elf_header_buffer[sizeof(Elf64_Ehdr)];
-  std::string exe_path = "/proc/" + std::to_string(process_id) + "/exe";
-  FILE* exe_file = fopen(exe_path.c_str(), "rb");
-  if (exe_file == nullptr) {
-    std::cerr << "Unable to open executable of process " << process_id
+  bool is_64_bit;
+  if (!GetElfClass(process_id, &is_64_bit)) {
+    std::cerr << "Unable to read executable of process " << process_id
               << std::endl;
     return false;
   }
 
-  int read_size =
-      fread(elf_header_buffer, sizeof(elf_header_buffer), 1, exe_file);
-  fclose(exe_file);
-  if (read_size <= 0) {
-    std::cerr << "Unable to read executable of process " << process_id
+  // The kernel records where it mapped the entry point in the auxiliary vector
+  // during execve, so this works wherever the image was loaded.
+  std::string auxv_path = "/proc/" + std::to_string(process_id) + "/auxv";
+  int auxv_file = open(auxv_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (auxv_file == -1) {
+    std::cerr << "Unable to open auxiliary vector of process " << process_id
               << std::endl;
     return false;
   }
+  uint8_t auxv[4096];
+  size_t auxv_size = 0;
+  ssize_t read_size;
+  while (auxv_size < sizeof(auxv) &&
+         (read_size = read(auxv_file, auxv + auxv_size,
+                           sizeof(auxv) - auxv_size)) > 0) {
+    auxv_size += read_size;
+  }
+  close(auxv_file);
 
-  const Elf32_Ehdr* file_header_32 = (Elf32_Ehdr*)elf_header_buffer;
-  const Elf64_Ehdr* file_header_64 = (Elf64_Ehdr*)elf_header_buffer;
-  // The first handful of bytes of a header do not depend on whether the file is
-  // 32bit vs 64bit.
-  const bool is_pie_binary = file_header_32->e_type == ET_DYN;
-
-  if (file_header_32->e_ident[EI_CLASS] == ELFCLASS32) {
-    *entry_address =
-        file_header_32->e_entry + (is_pie_binary ? k32BitImageBase : 0);
-  } else if (file_header_32->e_ident[EI_CLASS] == ELFCLASS64) {
-    *entry_address =
-        file_header_64->e_entry + (is_pie_binary ? k64BitImageBase : 0);
-  } else {
+  bool found = is_64_bit
+                   ? FindAuxvEntry<uint64_t>(auxv, auxv_size, entry_address)
+                   : FindAuxvEntry<uint32_t>(auxv, auxv_size, entry_address);
+  if (!found) {
+    std::cerr << "No entry point in auxiliary vector of process "
+              << process_id << std::endl;
     return false;
   }
 
@@ -17,13 +17,14 @@
 #ifndef SHELL_AS_ELF_H_
 #define SHELL_AS_ELF_H_
 
+#include <stdint.h>
 #include <sys/types.h>
 
 namespace shell_as {
 
-// Sets entry_address to the process's entry point.
-//
-// This method assumes that PIE binaries are executing with ADDR_NO_RANDOMIZE.
+// Sets entry_address to the process's entry point, as found in its auxiliary
+// vector. This holds wherever the executable was loaded, so ASLR may be left
+// enabled. The process must have completed execve.
 //
 // The is_arm_mode flag is set to true IFF the architecture is 32bit ARM and the
 // expected instruction set for code located at the entry address is not-thumb.
@@ -16,22 +16,36 @@
 
 #include "./execute.h"
 
+#include <errno.h>
 #include <linux/securebits.h>
 #include <linux/uio.h>
-#include <seccomp_policy.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
 #include <sys/capability.h>
-#include <sys/personality.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/ptrace.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
-#include <memory>
 
+#include "./child-memory.h"
 #include "./elf-utils.h"
+#include "./hw-breakpoint.h"
 #include "./registers.h"
+#include "./seccomp-filters.h"
 #include "./shell-code.h"
+#include "./timing.h"
+
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif
 
 namespace shell_as {
 
@@ -41,7 +55,96 @@ namespace {
 // number of capabilities supported by a kernel is 64.
 constexpr cap_value_t kMaxCapabilities = 64;
 
-bool DropPreExecPrivileges(const shell_as::SecurityContext* context) {
+// Everything the child needs to drop its privileges before executing,
+// computed by the parent so that the child only makes system calls. A child
+// started with CLONE_VM runs on the memory of the parent, where allocating or
+// taking a lock the parent may hold is unsafe.
+typedef struct PreExecPrivileges {
+  const shell_as::SecurityContext* context;
+  // Whether the capabilities below are raised at all.
+  bool raise_capabilities;
+  // The capability sets of the parent with all permitted capabilities raised
+  // in every set, for capset.
+  struct __user_cap_header_struct capability_header;
+  struct __user_cap_data_struct capability_data[_LINUX_CAPABILITY_U32S_3];
+  // The capabilities raised in the ambient set, one bit per capability.
+  uint64_t ambient_capabilities;
+} PreExecPrivileges;
+
+// Fills in privileges for context. Returns false if the capabilities of the
+// parent can not be read.
+bool PreparePreExecPrivileges(const shell_as::SecurityContext* context,
+                              PreExecPrivileges* privileges) {
+  *privileges = {};
+  privileges->context = context;
+  if (!context->capabilities.has_value()) {
+    return true;
+  }
+  privileges->raise_capabilities = true;
+
+  // The first step in the child is to raise all the capabilities possible in
+  // all sets including the inheritable set. This defines the superset of
+  // possible capabilities that can be passed on after calling execve. The
+  // child keeps the permitted set of the parent across setresuid, so that set
+  // is raised everywhere.
+  privileges->capability_header.version = _LINUX_CAPABILITY_VERSION_3;
+  privileges->capability_header.pid = 0;
+  if (syscall(__NR_capget, &privileges->capability_header,
+              privileges->capability_data) != 0) {
+    std::cerr << "Unable to read the capabilities of shell-as." << std::endl;
+    return false;
+  }
+  for (auto& data : privileges->capability_data) {
+    data.effective = data.permitted;
+    data.inheritable = data.permitted;
+  }
+
+  // The second step is to raise the /desired/ capability subset in the
+  // ambient capability set. These are the capabilities that will actually be
+  // passed to the process after execve.
+  cap_t desired_capabilities = context->capabilities->get();
+  for (cap_value_t cap = 0; cap < kMaxCapabilities; cap++) {
+    // Skip capability values not supported by the kernel.
+    if (!CAP_IS_SUPPORTED(cap)) {
+      continue;
+    }
+    cap_flag_value_t value = CAP_CLEAR;
+    if (cap_get_flag(desired_capabilities, cap, CAP_PERMITTED, &value) == 0 &&
+        value == CAP_SET) {
+      privileges->ambient_capabilities |= uint64_t{1} << cap;
+    }
+  }
+  return true;
+}
+
+// Writes "<message><value>.\n" to stderr using only async-signal-safe calls,
+// for errors of the child before it executes. Negative values are left out.
+void WriteChildError(const char* message, const int64_t value = -1) {
+  char line[128];
+  size_t length = 0;
+  for (; message[length] != '\0' && length < sizeof(line) - 24; length++) {
+    line[length] = message[length];
+  }
+  if (value >= 0) {
+    char digits[20];
+    size_t count = 0;
+    uint64_t remaining = value;
+    do {
+      digits[count++] = static_cast<char>('0' + remaining % 10);
+      remaining /= 10;
+    } while (remaining > 0);
+    while (count > 0) {
+      line[length++] = digits[--count];
+    }
+  }
+  line[length++] = '.';
+  line[length++] = '\n';
+  write(STDERR_FILENO, line, length);
+}
+
+// Only makes system calls, see PreExecPrivileges.
+bool DropPreExecPrivileges(const PreExecPrivileges* privileges) {
+  const shell_as::SecurityContext* context = privileges->context;
   // The ordering here is important:
   //   (1) The platform's seccomp filters disallow setresgiud, so it must come
   //       before the seccomp drop.
@@ -50,89 +153,54 @@ bool DropPreExecPrivileges(const shell_as::SecurityContext* context) {
   if (context->group_id.has_value() &&
       setresgid(context->group_id.value(), context->group_id.value(),
                 context->group_id.value()) != 0) {
-    std::cerr << "Unable to set group id: " << context->group_id.value()
-              << std::endl;
+    WriteChildError("Unable to set group id: ", context->group_id.value());
     return false;
   }
   if (context->supplementary_group_ids.has_value() &&
       setgroups(context->supplementary_group_ids.value().size(),
                 context->supplementary_group_ids.value().data()) != 0) {
-    std::cerr << "Unable to set supplementary groups." << std::endl;
+    WriteChildError("Unable to set supplementary groups");
     return false;
   }
 
   if (context->seccomp_filter.has_value()) {
-    switch (context->seccomp_filter.value()) {
-      case shell_as::kAppFilter:
-        set_app_seccomp_filter();
-        break;
-      case shell_as::kAppZygoteFilter:
-        set_app_zygote_seccomp_filter();
-        break;
-      case shell_as::kSystemFilter:
-        set_system_seccomp_filter();
-        break;
-    }
+    InstallSeccompFilter(context->seccomp_filter.value());
   }
 
   // This must be set prior to setresuid, otherwise that call will drop the
   // permitted set of capabilities.
   if (prctl(PR_SET_KEEPCAPS, 1, 0, 0, 0) != 0) {
-    std::cerr << "Unable to set keep capabilities." << std::endl;
+    WriteChildError("Unable to set keep capabilities");
     return false;
   }
 
   if (context->user_id.has_value() &&
       setresuid(context->user_id.value(), context->user_id.value(),
                 context->user_id.value()) != 0) {
-    std::cerr << "Unable to set user id: " << context->user_id.value()
-              << std::endl;
+    WriteChildError("Unable to set user id: ", context->user_id.value());
     return false;
   }
 
   // Capabilities must be reacquired after setresuid since it still modifies
   // capabilities, but it leaves the permitted set intact.
-  if (context->capabilities.has_value()) {
-    // The first step is to raise all the capabilities possible in all sets
-    // including the inheritable set. This defines the superset of possible
-    // capabilities that can be passed on after calling execve.
-    //
-    // The reason that all capabilities are raised in the inheritable set is due
-    // to a limitation of libcap. libcap may not contain a capability definition
-    // for all capabilities supported by the kernel. If this occurs, it will
-    // silently ignore requests to raise unknown capabilities via cap_set_flag.
-    //
-    // However, when parsing a cap_t from a text value, libcap will treat "all"
-    // as all possible 64 capability bits as set.
-    cap_t all_capabilities = cap_from_text("all+pie");
-    if (cap_set_proc(all_capabilities) != 0) {
-      std::cerr << "Unable to raise inheritable capability set." << std::endl;
-      cap_free(all_capabilities);
+  if (privileges->raise_capabilities) {
+    struct __user_cap_header_struct header = privileges->capability_header;
+    struct __user_cap_data_struct data[_LINUX_CAPABILITY_U32S_3];
+    memcpy(data, privileges->capability_data, sizeof(data));
+    if (syscall(__NR_capset, &header, data) != 0) {
+      WriteChildError("Unable to raise inheritable capability set");
       return false;
     }
-    cap_free(all_capabilities);
 
-    // The second step is to raise the /desired/ capability subset in the
-    // ambient capability set. These are the capabilities that will actually be
-    // passed to the process after execve.
     if (prctl(PR_CAP_AMBIENT, PR_CAP_AMBIENT_CLEAR_ALL, 0, 0, 0) != 0) {
-      std::cerr << "Unable to clear ambient capabilities." << std::endl;
+      WriteChildError("Unable to clear ambient capabilities");
       return false;
     }
-    cap_t desired_capabilities = context->capabilities.value();
     for (cap_value_t cap = 0; cap < kMaxCapabilities; cap++) {
-      // Skip capability values not supported by the kernel.
-      if (!CAP_IS_SUPPORTED(cap)) {
-        continue;
-      }
-      cap_flag_value_t value = CAP_CLEAR;
-      if (cap_get_flag(desired_capabilities, cap, CAP_PERMITTED, &value) == 0 &&
-          value == CAP_SET) {
-        if (prctl(PR_CAP_AMBIENT, PR_CAP_AMBIENT_RAISE, cap, 0, 0) != 0) {
-          std::cerr << "Unable to raise capability " << cap
-                    << " in the ambient set." << std::endl;
-          return false;
-        }
+      if ((privileges->ambient_capabilities & (uint64_t{1} << cap)) != 0 &&
+          prctl(PR_CAP_AMBIENT, PR_CAP_AMBIENT_RAISE, cap, 0, 0) != 0) {
+        WriteChildError("Unable to raise in the ambient set capability ", cap);
+        return false;
       }
     }
 
@@ -148,42 +216,13 @@ bool DropPreExecPrivileges(const shell_as::SecurityContext* context) {
     int64_t secure_bits = prctl(PR_GET_SECUREBITS, 0, 0, 0, 0);
     if (secure_bits < 0 ||
         prctl(PR_SET_SECUREBITS, secure_bits | SECBIT_NOROOT, 0, 0, 0) != 0) {
-      std::cerr << "Unable to raise SECBIT_NOROOT." << std::endl;
+      WriteChildError("Unable to raise SECBIT_NOROOT");
       return false;
     }
   }
   return true;
 }
 
-uint8_t ReadChildByte(const pid_t process, const uintptr_t address) {
-  uintptr_t data = ptrace(PTRACE_PEEKDATA, process, address, nullptr);
-  return ((uint8_t*)&data)[0];
-}
-
-void WriteChildByte(const pid_t process, const uintptr_t address,
-                    const uint8_t value) {
-  // This is not the most efficient way to write data to a process. However, it
-  // reduces code complexity of handling different word sizes and reading and
-  // writing memory that is not a multiple of the native word size.
-  uintptr_t data = ptrace(PTRACE_PEEKDATA, process, address, nullptr);
-  ((uint8_t*)&data)[0] = value;
-  ptrace(PTRACE_POKEDATA, process, address, data);
-}
-
-void ReadChildMemory(const pid_t process, uintptr_t process_address,
-                     uint8_t* bytes, size_t byte_count) {
-  for (; byte_count != 0; byte_count--, bytes++, process_address++) {
-    *bytes = ReadChildByte(process, process_address);
-  }
-}
-
-void WriteChildMemory(const pid_t process, uintptr_t process_address,
-                      uint8_t const* bytes, size_t byte_count) {
-  for (; byte_count != 0; byte_count--, bytes++, process_address++) {
-    WriteChildByte(process, process_address, *bytes);
-  }
-}
-
 // Executes shell code in a target process.
 //
 // The following assumptions are made:
@@ -207,11 +246,18 @@ bool ExecuteShellCode(const pid_t process, const uint8_t* shell_code,
   registers_iovec.iov_len = sizeof(REGISTER_STRUCT);
   ptrace(PTRACE_GETREGSET, process, 1, &registers_iovec);
 
-  std::unique_ptr<uint8_t[]> memory_backup(new uint8_t[shell_code_size]);
-  ReadChildMemory(process, PROGRAM_COUNTER(registers), memory_backup.get(),
-                  shell_code_size);
-  WriteChildMemory(process, PROGRAM_COUNTER(registers), shell_code,
-                   shell_code_size);
+  uint8_t memory_backup[kMaxShellCodeSize];
+  if (shell_code_size > sizeof(memory_backup)) {
+    std::cerr << "Shell code is too large." << std::endl;
+    return false;
+  }
+  if (!ReadChildMemory(process, PROGRAM_COUNTER(registers), memory_backup,
+                       shell_code_size) ||
+      !WriteChildMemory(process, PROGRAM_COUNTER(registers), shell_code,
+                        shell_code_size)) {
+    std::cerr << "Unable to write shell code to the process." << std::endl;
+    return false;
+  }
 
   // Execute the shell code and wait for the signal that it has finished.
   ptrace(PTRACE_CONT, process, NULL, NULL);
@@ -223,8 +269,12 @@ bool ExecuteShellCode(const pid_t process, const uint8_t* shell_code,
   }
 
   ptrace(PTRACE_SETREGSET, process, 1, &registers_iovec);
-  WriteChildMemory(process, PROGRAM_COUNTER(registers), memory_backup.get(),
-                   shell_code_size);
+  if (!WriteChildMemory(process, PROGRAM_COUNTER(registers), memory_backup,
+                        shell_code_size)) {
+    std::cerr << "Unable to restore the memory under the shell code."
+              << std::endl;
+    return false;
+  }
   return true;
 }
 
@@ -259,12 +309,6 @@ bool StepToEntryPoint(const pid_t process_id) {
     return false;
   }
 
-  int expected_signal = 0;
-  size_t trap_code_size = 0;
-  std::unique_ptr<uint8_t[]> trap_code =
-      GetTrapShellCode(&expected_signal, &trap_code_size);
-  std::unique_ptr<uint8_t[]> backup(new uint8_t[trap_code_size]);
-
   // Set a break point at the entry point declared by the Elf file. When a
   // statically linked binary is executed this will be the first instruction
   // executed.
@@ -273,8 +317,39 @@ bool StepToEntryPoint(const pid_t process_id) {
   // executed first. This brings .so files into memory and resolves shared
   // symbols. Once this process is finished, it jumps to the entry point
   // declared in the Elf file.
-  ReadChildMemory(process_id, entry_address, backup.get(), trap_code_size);
-  WriteChildMemory(process_id, entry_address, trap_code.get(), trap_code_size);
+  //
+  // A hardware breakpoint leaves the memory of the process untouched and stops
+  // before the instruction at the entry point runs, so nothing needs to be
+  // restored afterwards. The trap shell code is used where it is unavailable.
+  if (SetHardwareBreakpoint(process_id, entry_address)) {
+    ptrace(PTRACE_CONT, process_id, NULL, NULL);
+    int status;
+    waitpid(process_id, &status, 0);
+    if (status >> 8 != SIGTRAP) {
+      std::cerr << "Program exited unexpectedly while stepping to entry point."
+                << std::endl;
+      std::cerr << "Expected status " << SIGTRAP << " but encountered "
+                << (status >> 8) << std::endl;
+      return false;
+    }
+    if (!ClearHardwareBreakpoint(process_id)) {
+      std::cerr << "Unable to clear the entry point break point." << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  int expected_signal = 0;
+  size_t trap_code_size = 0;
+  const uint8_t* trap_code = GetTrapShellCode(&expected_signal, &trap_code_size);
+  uint8_t backup[kMaxShellCodeSize];
+
+  if (!ReadChildMemory(process_id, entry_address, backup, trap_code_size) ||
+      !WriteChildMemory(process_id, entry_address, trap_code,
+                        trap_code_size)) {
+    std::cerr << "Unable to set a break point at the entry point." << std::endl;
+    return false;
+  }
   ptrace(PTRACE_CONT, process_id, NULL, NULL);
   int status;
   waitpid(process_id, &status, 0);
@@ -289,14 +364,177 @@ bool StepToEntryPoint(const pid_t process_id) {
   if (!SetProgramCounter(process_id, entry_address)) {
     return false;
   }
-  WriteChildMemory(process_id, entry_address, backup.get(), trap_code_size);
+  if (!WriteChildMemory(process_id, entry_address, backup, trap_code_size)) {
+    std::cerr << "Unable to restore the code at the entry point." << std::endl;
+    return false;
+  }
   return true;
 }
 
-}  // namespace
+// Drops the remaining privileges of a child that has stopped after loading
+// the executable, and lets it run the executable.
+bool DropPostExecPrivileges(const pid_t child,
+                            const shell_as::SecurityContext* context) {
+  // Allow the dynamic linker to run before dropping to a lower SELinux
+  // context. This is required for executing in some very constrained domains
+  // like mediacodec.
+  //
+  // If the context was dropped before the dynamic linker runs, then when the
+  // linker attempts to read /proc/self/exe to determine dynamic symbol
+  // information, SELinux will kill the binary if the domain is not allowed to
+  // read the binary's executable file.
+  //
+  // This happens for example, when attempting to run any toybox binary (id,
+  // sh, etc) as mediacodec.
+  bool stepped;
+  {
+    PhaseTimer timer(kEntryPointPhase);
+    stepped = StepToEntryPoint(child);
+  }
+  if (!stepped) {
+    std::cerr << "Something bad happened stepping to the entry point."
+              << std::endl;
+    return false;
+  }
 
-bool ExecuteInContext(char* const executable_and_args[],
-                      const shell_as::SecurityContext* context) {
+  // Run the SELinux shellcode in the child process before the child can
+  // execute any instructions in the newly loaded executable.
+  if (context->selinux_context.has_value()) {
+    PhaseTimer timer(kShellCodePhase);
+    uint8_t shell_code[kMaxShellCodeSize];
+    size_t shell_code_size =
+        BuildSELinuxShellCode(context->selinux_context->c_str(), shell_code,
+                              sizeof(shell_code));
+    if (shell_code_size == 0) {
+      std::cerr << "SELinux context is too long." << std::endl;
+      return false;
+    }
+    bool success = ExecuteShellCode(child, shell_code, shell_code_size);
+    if (!success) {
+      return false;
+    }
+  }
+
+  // Resume and detach from the child now that the SELinux context has been
+  // updated.
+  PhaseTimer timer(kDetachPhase);
+  ptrace(PTRACE_DETACH, child, NULL, NULL);
+  return true;
+}
+
+// The exit code of a child that could not execute its executable.
+constexpr int kExecFailedExitCode = 127;
+
+// The arguments of RunChild.
+typedef struct ChildArguments {
+  char* const* executable_and_args;
+  PreExecPrivileges privileges;
+  int input_fd;
+  int output_fd;
+  int error_fd;
+} ChildArguments;
+
+// The child side of StartChild. When started with CLONE_VM this runs on the
+// memory of the suspended parent, so it must only make async-signal-safe calls
+// and only leave through execv or _exit: returning would run the clone
+// wrapper's exit path, and exit() would flush the parent's stdio buffers.
+int RunChild(void* argument) {
+  const ChildArguments* arguments = static_cast<ChildArguments*>(argument);
+  if (arguments->input_fd >= 0) {
+    dup2(arguments->input_fd, STDIN_FILENO);
+  }
+  if (arguments->output_fd >= 0) {
+    dup2(arguments->output_fd, STDOUT_FILENO);
+  }
+  if (arguments->error_fd >= 0) {
+    dup2(arguments->error_fd, STDERR_FILENO);
+  }
+
+  // Drop the privileges that can be dropped before executing the new binary
+  // and exit early if there is an issue.
+  {
+    PhaseTimer timer(kPreExecPhase);
+    if (!DropPreExecPrivileges(&arguments->privileges)) {
+      _exit(1);
+    }
+  }
+
+  // A traced process stops with SIGTRAP once execv has loaded the new
+  // executable, which is where the parent takes over. No handshake is needed
+  // before that since nothing is left for the parent to set up.
+  ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+  execv(arguments->executable_and_args[0], arguments->executable_and_args);
+  _exit(kExecFailedExitCode);
+}
+
+// The size of the stack of a child sharing the parent's memory until it
+// executes, below which a guard page is mapped.
+constexpr size_t kChildStackSize = 256 * 1024;
+
+// Starts a child on a stack of its own with CLONE_VM and CLONE_VFORK, which
+// returns once the child executed or exited. Returns -1 if the stack can not
+// be mapped or clone fails.
+pid_t CloneChild(ChildArguments* arguments) {
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  const size_t mapping_size = kChildStackSize + page_size;
+  void* mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (mapping == MAP_FAILED) {
+    return -1;
+  }
+  mprotect(mapping, page_size, PROT_NONE);
+  pid_t child = clone(RunChild, static_cast<uint8_t*>(mapping) + mapping_size,
+                      CLONE_VM | CLONE_VFORK | SIGCHLD, arguments);
+  // The child no longer runs on the stack: it executed or exited.
+  munmap(mapping, mapping_size);
+  return child;
+}
+
+// How long a child may take from being started until it has executed.
+constexpr std::chrono::seconds kExecTimeout(10);
+
+// Waits for a child to stop after executing or to exit, and sets status to
+// what waitpid reported. Returns false if that did not happen within
+// kExecTimeout.
+//
+// A pidfd only becomes readable once the process exits, not when it stops, so
+// the stop is checked for between waits on the pidfd that start short and
+// grow. A child started with CLONE_VFORK has executed by the time clone
+// returns, so its stop is usually there at the first check. Without a pidfd,
+// i.e. on kernels older than 5.3, the waits are plain sleeps.
+bool WaitForExecStop(const pid_t child, const int pidfd, int* status) {
+  const auto deadline = std::chrono::steady_clock::now() + kExecTimeout;
+  std::chrono::nanoseconds step = std::chrono::microseconds(50);
+  while (true) {
+    const pid_t result = waitpid(child, status, WNOHANG);
+    if (result == child) {
+      return true;
+    }
+    if (result < 0 && errno != EINTR) {
+      return false;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) {
+      return false;
+    }
+    const std::chrono::nanoseconds wait =
+        std::min<std::chrono::nanoseconds>(step, deadline - now);
+    const struct timespec timeout = {
+        static_cast<time_t>(wait.count() / 1000000000),
+        static_cast<long>(wait.count() % 1000000000)};
+    struct pollfd poll_fd = {pidfd, POLLIN, 0};
+    ppoll(&poll_fd, pidfd >= 0 ? 1 : 0, &timeout, nullptr);
+    step = std::min<std::chrono::nanoseconds>(step * 2,
+                                              std::chrono::milliseconds(10));
+  }
+}
+
+// Starts a child with RunChild like StartInContext. If pidfd is not null it is
+// set to a pidfd of the child, or to -1 if the kernel does not support them.
+bool StartChild(char* const executable_and_args[],
+                const shell_as::SecurityContext* context, const int input_fd,
+                const int output_fd, const int error_fd, pid_t* process_id,
+                int* pidfd) {
   // Getting an executable running in a lower privileged context is tricky with
   // SELinux. The recommended approach in the documentation is to use setexeccon
   // which sets the context on the next execve call.
@@ -307,76 +545,114 @@ bool ExecuteInContext(char* const executable_and_args[],
   // To work around this, ptrace is used to inject shell code into the new
   // process just after it has executed an execve syscall. This shell code then
   // sets the desired SELinux context.
-  pid_t child = fork();
-  if (child == 0) {
-    // Disabling ASLR makes it easier to determine the entry point of the target
-    // executable.
-    personality(ADDR_NO_RANDOMIZE);
-
-    // Drop the privileges that can be dropped before executing the new binary
-    // and exit early if there is an issue.
-    if (!DropPreExecPrivileges(context)) {
-      exit(1);
-    }
+  ChildArguments arguments = {executable_and_args, {}, input_fd, output_fd,
+                              error_fd};
+  if (!PreparePreExecPrivileges(context, &arguments.privileges)) {
+    return false;
+  }
 
-    ptrace(PTRACE_TRACEME, 0, NULL, NULL);
-    raise(SIGSTOP);  // Wait for the parent process to attach.
-    execv(executable_and_args[0], executable_and_args);
-  } else {
-    // Wait for the child to reach the SIGSTOP line above.
-    int status;
-    waitpid(child, &status, 0);
-    if ((status >> 8) != SIGSTOP) {
-      // If the first status is not SIGSTOP, then the child aborted early
-      // because it was not able to set the user and group IDs.
+  // Sharing the memory with the child until it executes avoids copying the
+  // page tables of the parent, which is most of the cost of a fork. That is
+  // only safe if the child needs no allocation, which building a seccomp
+  // filter that was not preloaded does.
+  const bool share_memory = !context->seccomp_filter.has_value() ||
+                            IsSeccompFilterPreloaded(*context->seccomp_filter);
+  pid_t child;
+  int child_pidfd;
+  int status;
+  bool exec_stopped;
+  {
+    PhaseTimer timer(kExecPhase, kPreExecPhase);
+    child = share_memory ? CloneChild(&arguments) : -1;
+    if (child < 0) {
+      CountForkedChild();
+      child = fork();
+      if (child == 0) {
+        RunChild(&arguments);
+      }
+    }
+    if (child < 0) {
+      std::cerr << "Unable to fork." << std::endl;
       return false;
     }
 
-    // Break inside the child's execv call.
-    ptrace(PTRACE_SETOPTIONS, child, NULL,
-           PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL);
-    ptrace(PTRACE_CONT, child, NULL, NULL);
-    waitpid(child, &status, 0);
-    if (status >> 8 != (SIGTRAP | PTRACE_EVENT_EXEC << 8)) {
+    // Wait for the child to load the executable. The child is not reaped
+    // before this returns, so its pid can not have been reused. Kernels older
+    // than 5.3 have no pidfd_open.
+    child_pidfd = static_cast<int>(syscall(__NR_pidfd_open, child, 0));
+    exec_stopped = WaitForExecStop(child, child_pidfd, &status);
+  }
+  bool started = false;
+  if (!exec_stopped) {
+    std::cerr << "Timed out waiting for " << executable_and_args[0]
+              << " to execute." << std::endl;
+    kill(child, SIGKILL);
+    waitpid(child, nullptr, 0);
+  } else if (!WIFSTOPPED(status) || WSTOPSIG(status) != SIGTRAP) {
+    // The child reports failures to drop its privileges itself.
+    if (WIFEXITED(status) && WEXITSTATUS(status) == kExecFailedExitCode) {
       std::cerr << "Failed to execute " << executable_and_args[0] << std::endl;
-      return false;
     }
-
-    // Allow the dynamic linker to run before dropping to a lower SELinux
-    // context. This is required for executing in some very constrained domains
-    // like mediacodec.
-    //
-    // If the context was dropped before the dynamic linker runs, then when the
-    // linker attempts to read /proc/self/exe to determine dynamic symbol
-    // information, SELinux will kill the binary if the domain is not allowed to
-    // read the binary's executable file.
-    //
-    // This happens for example, when attempting to run any toybox binary (id,
-    // sh, etc) as mediacodec.
-    if (!StepToEntryPoint(child)) {
-      std::cerr << "Something bad happened stepping to the entry point."
-                << std::endl;
-      return false;
+  } else {
+    ptrace(PTRACE_SETOPTIONS, child, NULL, PTRACE_O_EXITKILL);
+    if (DropPostExecPrivileges(child, context)) {
+      started = true;
+    } else {
+      // Do not leave a stopped child behind, e.g. between commands of a batch.
+      kill(child, SIGKILL);
+      waitpid(child, nullptr, 0);
     }
+  }
 
-    // Run the SELinux shellcode in the child process before the child can
-    // execute any instructions in the newly loaded executable.
-    if (context->selinux_context.has_value()) {
-      size_t shell_code_size;
-      std::unique_ptr<uint8_t[]> shell_code = GetSELinuxShellCode(
-          context->selinux_context.value(), &shell_code_size);
-      bool success = ExecuteShellCode(child, shell_code.get(), shell_code_size);
-      if (!success) {
-        return false;
-      }
-    }
+  if (started && pidfd != nullptr) {
+    *pidfd = child_pidfd;
+  } else if (child_pidfd >= 0) {
+    close(child_pidfd);
+  }
+  if (started) {
+    *process_id = child;
+  }
+  return started;
+}
 
-    // Resume and detach from the child now that the SELinux context has been
-    // updated.
-    ptrace(PTRACE_DETACH, child, NULL, NULL);
-    waitpid(child, nullptr, 0);
+}  // namespace
+
+bool StartInContext(char* const executable_and_args[],
+                    const shell_as::SecurityContext* context,
+                    const int input_fd, const int output_fd,
+                    const int error_fd, pid_t* process_id) {
+  return StartChild(executable_and_args, context, input_fd, output_fd,
+                    error_fd, process_id, /*pidfd=*/nullptr);
+}
+
+bool ExecuteInContext(char* const executable_and_args[],
+                      const shell_as::SecurityContext* context) {
+  pid_t child;
+  int pidfd;
+  if (!StartChild(executable_and_args, context, /*input_fd=*/-1,
+                  /*output_fd=*/-1, /*error_fd=*/-1, &child, &pidfd)) {
+    return false;
+  }
+  if (pidfd >= 0) {
+    // A pidfd becomes readable once the process exits, so the wait is not
+    // confused by other children and the reaping waitpid never blocks.
+    struct pollfd poll_fd = {pidfd, POLLIN, 0};
+    while (poll(&poll_fd, 1, -1) < 0 && errno == EINTR) {
+    }
+    close(pidfd);
   }
+  waitpid(child, nullptr, 0);
   return true;
 }
 
+int ExitCodeFromStatus(const int status) {
+  if (WIFEXITED(status)) {
+    return WEXITSTATUS(status);
+  }
+  if (WIFSIGNALED(status)) {
+    return 128 + WTERMSIG(status);
+  }
+  return 1;
+}
+
 }  // namespace shell_as
@@ -17,6 +17,8 @@
 #ifndef SHELL_AS_EXECUTE_H_
 #define SHELL_AS_EXECUTE_H_
 
+#include <sys/types.h>
+
 #include "context.h"
 
 namespace shell_as {
@@ -30,6 +32,24 @@ namespace shell_as {
 // Returns true if the executable was run and false otherwise.
 bool ExecuteInContext(char* const executable_and_args[],
                       const SecurityContext* context);
+
+// Starts a command in the given security context like ExecuteInContext, but
+// returns once the command runs in that context instead of waiting for it to
+// exit.
+//
+// Each of input_fd, output_fd and error_fd that is not negative becomes the
+// standard input, output or error of the command respectively.
+//
+// Returns true if the executable was started, in which case process_id is set
+// to the child process the caller must wait for.
+bool StartInContext(char* const executable_and_args[],
+                    const SecurityContext* context, const int input_fd,
+                    const int output_fd, const int error_fd,
+                    pid_t* process_id);
+
+// Converts a status returned by waitpid into an exit code the way a shell does,
+// with 128 plus the signal number for a command killed by a signal.
+int ExitCodeFromStatus(const int status);
 }  // namespace shell_as
 
 #endif  // SHELL_AS_EXECUTE_H_
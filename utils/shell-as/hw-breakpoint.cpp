@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "./hw-breakpoint.h"
+
+#include <elf.h>
+#include <stddef.h>
+#include <sys/ptrace.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+
+#if defined(__aarch64__)
+#include <asm/ptrace.h>
+#endif
+
+namespace shell_as {
+
+#if defined(__i386__) || defined(__x86_64__)
+
+namespace {
+// DR7 bit enabling DR0 for the process. The zero condition and length bits of
+// DR0 select a breakpoint on instruction execution.
+constexpr unsigned long kDr0LocalEnable = 1;
+
+bool PokeDebugRegister(const pid_t process_id, const int index,
+                       const unsigned long value) {
+  return ptrace(PTRACE_POKEUSER, process_id,
+                offsetof(struct user, u_debugreg) + index * sizeof(long),
+                value) == 0;
+}
+}  // namespace
+
+bool SetHardwareBreakpoint(const pid_t process_id, const uint64_t address) {
+  if (!PokeDebugRegister(process_id, 0, address)) {
+    return false;
+  }
+  return PokeDebugRegister(process_id, 7, kDr0LocalEnable);
+}
+
+bool ClearHardwareBreakpoint(const pid_t process_id) {
+  // DR6 records which breakpoint hit and is never cleared by the CPU.
+  return PokeDebugRegister(process_id, 7, 0) &&
+         PokeDebugRegister(process_id, 6, 0);
+}
+
+#elif defined(__aarch64__)
+
+namespace {
+#ifndef NT_ARM_HW_BREAK
+#define NT_ARM_HW_BREAK 0x402
+#endif
+
+// DBGBCR bits for an enabled breakpoint on a 4 byte A64 instruction at EL0.
+constexpr uint32_t kBreakpointEnable = 1;
+constexpr uint32_t kPrivilegeEl0 = 2 << 1;
+constexpr uint32_t kByteAddressSelectA64 = 0xf << 5;
+
+bool SetBreakpointRegister(const pid_t process_id, const uint64_t address,
+                           const uint32_t control) {
+  struct user_hwdebug_state state = {};
+  struct iovec state_iovec = {&state, sizeof(state)};
+  if (ptrace(PTRACE_GETREGSET, process_id, NT_ARM_HW_BREAK, &state_iovec) !=
+      0) {
+    return false;
+  }
+  // The low byte of dbg_info is the number of breakpoint registers.
+  if ((state.dbg_info & 0xff) == 0) {
+    return false;
+  }
+  state.dbg_regs[0].addr = address;
+  state.dbg_regs[0].ctrl = control;
+  state_iovec.iov_len =
+      offsetof(struct user_hwdebug_state, dbg_regs) + sizeof(state.dbg_regs[0]);
+  return ptrace(PTRACE_SETREGSET, process_id, NT_ARM_HW_BREAK, &state_iovec) ==
+         0;
+}
+}  // namespace
+
+bool SetHardwareBreakpoint(const pid_t process_id, const uint64_t address) {
+  return SetBreakpointRegister(
+      process_id, address,
+      kByteAddressSelectA64 | kPrivilegeEl0 | kBreakpointEnable);
+}
+
+bool ClearHardwareBreakpoint(const pid_t process_id) {
+  return SetBreakpointRegister(process_id, 0, 0);
+}
+
+#else
+
+bool SetHardwareBreakpoint(const pid_t, const uint64_t) { return false; }
+
+bool ClearHardwareBreakpoint(const pid_t) { return false; }
+
+#endif
+
+}  // namespace shell_as
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SHELL_AS_HW_BREAKPOINT_H_
+#define SHELL_AS_HW_BREAKPOINT_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace shell_as {
+
+// Sets a hardware breakpoint on instruction execution at address in a stopped,
+// ptraced process. A process that reaches the address stops with SIGTRAP before
+// executing the instruction there, with the program counter at the address.
+//
+// Unlike a software breakpoint this does not modify the memory of the process.
+// Returns false if hardware breakpoints are not supported, for example on 32bit
+// ARM or when the CPU or hypervisor does not expose any.
+bool SetHardwareBreakpoint(const pid_t process_id, const uint64_t address);
+
+// Removes the breakpoint set by SetHardwareBreakpoint.
+bool ClearHardwareBreakpoint(const pid_t process_id);
+
+}  // namespace shell_as
+
+#endif  // SHELL_AS_HW_BREAKPOINT_H_
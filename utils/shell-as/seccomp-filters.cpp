@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "./seccomp-filters.h"
+
+#include <errno.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <seccomp_policy.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <vector>
+
+#ifndef PTRACE_SECCOMP_GET_FILTER
+#define PTRACE_SECCOMP_GET_FILTER 0x420c
+#endif
+
+namespace shell_as {
+
+namespace {
+
+// The preloaded programs, indexed by SeccompFilter.
+std::vector<struct sock_filter> preloaded_programs[kSystemFilter + 1];
+
+// Installs a filter the way the platform does, building its program.
+bool InstallPlatformFilter(SeccompFilter filter) {
+  switch (filter) {
+    case kAppFilter:
+      return set_app_seccomp_filter();
+    case kAppZygoteFilter:
+      return set_app_zygote_seccomp_filter();
+    case kSystemFilter:
+      return set_system_seccomp_filter();
+  }
+  return false;
+}
+
+// Reads the program of the most recently installed filter of a stopped
+// tracee.
+bool ReadFilterProgram(pid_t tracee, std::vector<struct sock_filter>* program) {
+  long length = ptrace(PTRACE_SECCOMP_GET_FILTER, tracee, 0, nullptr);
+  if (length <= 0) {
+    return false;
+  }
+  program->resize(length);
+  return ptrace(PTRACE_SECCOMP_GET_FILTER, tracee, 0, program->data()) ==
+         length;
+}
+
+}  // namespace
+
+bool PreloadSeccompFilter(SeccompFilter filter) {
+  std::vector<struct sock_filter>& program = preloaded_programs[filter];
+  if (!program.empty()) {
+    return true;
+  }
+
+  pid_t child = fork();
+  if (child < 0) {
+    return false;
+  }
+  if (child == 0) {
+    // Stop once the filter is installed, for the parent to read it back.
+    ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+    if (!InstallPlatformFilter(filter)) {
+      _exit(1);
+    }
+    raise(SIGSTOP);
+    _exit(0);
+  }
+
+  int status;
+  bool read = waitpid(child, &status, 0) == child && WIFSTOPPED(status) &&
+              ReadFilterProgram(child, &program);
+  kill(child, SIGKILL);
+  waitpid(child, nullptr, 0);
+  if (!read) {
+    program.clear();
+  }
+  return read;
+}
+
+bool IsSeccompFilterPreloaded(SeccompFilter filter) {
+  return !preloaded_programs[filter].empty();
+}
+
+bool InstallSeccompFilter(SeccompFilter filter) {
+  const std::vector<struct sock_filter>& program = preloaded_programs[filter];
+  if (program.empty()) {
+    return InstallPlatformFilter(filter);
+  }
+  struct sock_fprog fprog = {static_cast<unsigned short>(program.size()),
+                             const_cast<struct sock_filter*>(program.data())};
+  // Speculative store bypass mitigations are left as the platform leaves
+  // them, so the child runs as an app would.
+  if (syscall(__NR_seccomp, SECCOMP_SET_MODE_FILTER, 0, &fprog) == 0) {
+    return true;
+  }
+  return errno == ENOSYS &&
+         prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &fprog, 0, 0) == 0;
+}
+
+}  // namespace shell_as
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SHELL_AS_SECCOMP_FILTERS_H_
+#define SHELL_AS_SECCOMP_FILTERS_H_
+
+#include "./context.h"
+
+namespace shell_as {
+
+// Builds the BPF program of a seccomp filter once, so that the children
+// started later only have to install it. Meant for batches and servers, which
+// start many children with the same few filters. Returns false if the program
+// could not be obtained, in which case children build the filter themselves.
+//
+// The program is the one the platform installs, read back with
+// PTRACE_SECCOMP_GET_FILTER from a short-lived child which installed it.
+bool PreloadSeccompFilter(SeccompFilter filter);
+
+// Whether the program of filter was preloaded, so installing it allocates
+// nothing.
+bool IsSeccompFilterPreloaded(SeccompFilter filter);
+
+// Installs a seccomp filter on the calling process. A preloaded program is
+// installed without any allocation, which is safe in a child sharing the
+// memory of its parent. Returns true on success.
+bool InstallSeccompFilter(SeccompFilter filter);
+
+}  // namespace shell_as
+
+#endif  // SHELL_AS_SECCOMP_FILTERS_H_
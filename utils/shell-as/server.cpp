@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "./server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "./command-line.h"
+#include "./context.h"
+#include "./execute.h"
+#include "./seccomp-filters.h"
+
+namespace shell_as {
+
+namespace {
+
+const char kShell[] = "/system/bin/sh";
+const size_t kMaxRequestSize = 64 * 1024;
+const int kStdioFdCount = 3;
+
+int child_exit_pipe[2] = {-1, -1};
+
+void HandleChildExit(int) {
+  int saved_errno = errno;
+  char byte = 0;
+  // The pipe is non-blocking, so a full pipe just means a wakeup is pending.
+  (void)!write(child_exit_pipe[1], &byte, sizeof(byte));
+  errno = saved_errno;
+}
+
+bool MakeAddress(const char* socket_path, struct sockaddr_un* address,
+                 socklen_t* address_size) {
+  size_t path_size = strlen(socket_path);
+  if (path_size == 0 || path_size >= sizeof(address->sun_path)) {
+    std::cerr << "Invalid socket path: " << socket_path << std::endl;
+    return false;
+  }
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  memcpy(address->sun_path, socket_path, path_size);
+  if (socket_path[0] == '@') {
+    address->sun_path[0] = '\0';
+  }
+  *address_size = offsetof(struct sockaddr_un, sun_path) + path_size;
+  return true;
+}
+
+void SendExitCode(const int client_fd, const int32_t exit_code) {
+  // The client may have gone away, which is not the server's problem.
+  send(client_fd, &exit_code, sizeof(exit_code), MSG_NOSIGNAL);
+}
+
+bool IsClientTrusted(const int client_fd) {
+  struct ucred credentials;
+  socklen_t credentials_size = sizeof(credentials);
+  if (getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &credentials,
+                 &credentials_size) != 0) {
+    return false;
+  }
+  return credentials.uid == getuid();
+}
+
+// Receives a request and splits it into its arguments and stdio fds. Does not
+// wait for it, the server only calls it once the client is readable.
+bool ReceiveRequest(const int client_fd, std::vector<std::string>* arguments,
+                    int stdio_fds[kStdioFdCount]) {
+  std::unique_ptr<char[]> buffer(new char[kMaxRequestSize]);
+  struct iovec payload = {buffer.get(), kMaxRequestSize};
+  char control[CMSG_SPACE(sizeof(int) * kStdioFdCount)];
+  struct msghdr message = {};
+  message.msg_iov = &payload;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  ssize_t size =
+      recvmsg(client_fd, &message, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+  if (size <= 0) {
+    return false;
+  }
+
+  bool has_fds = false;
+  for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr;
+       header = CMSG_NXTHDR(&message, header)) {
+    if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    size_t fd_count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int* fds = reinterpret_cast<int*>(CMSG_DATA(header));
+    if (fd_count == kStdioFdCount && !has_fds) {
+      memcpy(stdio_fds, fds, sizeof(int) * kStdioFdCount);
+      has_fds = true;
+    } else {
+      for (size_t i = 0; i < fd_count; i++) {
+        close(fds[i]);
+      }
+    }
+  }
+  if (!has_fds) {
+    return false;
+  }
+  if ((message.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0 ||
+      buffer[size - 1] != '\0') {
+    for (int i = 0; i < kStdioFdCount; i++) {
+      close(stdio_fds[i]);
+    }
+    return false;
+  }
+
+  for (ssize_t start = 0; start < size;) {
+    std::string argument(buffer.get() + start);
+    start += argument.size() + 1;
+    arguments->push_back(std::move(argument));
+  }
+  return true;
+}
+
+// Returns the context for the given options, resolving it on first use.
+const SecurityContext* GetContext(
+    std::map<std::string, SecurityContext>* contexts,
+    std::vector<std::string> options) {
+  std::string key;
+  for (const std::string& option : options) {
+    key += option;
+    key += '\0';
+  }
+  auto found = contexts->find(key);
+  if (found != contexts->end()) {
+    return &found->second;
+  }
+
+  std::vector<char*> argv;
+  argv.push_back(const_cast<char*>("shell-as"));
+  for (std::string& argument : options) {
+    argv.push_back(argument.data());
+  }
+  argv.push_back(nullptr);
+
+  bool verbose = false;
+  bool timing = false;
+  char* const* execv_args = nullptr;
+  const char* batch_path = nullptr;
+  uint32_t max_jobs = 1;
+  SecurityContext context;
+  if (!ParseOptions(argv.size() - 1, argv.data(), &verbose, &timing,
+                    &context, &execv_args, &batch_path, &max_jobs)) {
+    return nullptr;
+  }
+  if (batch_path != nullptr) {
+    std::cerr << "--batch can not be used through the server." << std::endl;
+    return nullptr;
+  }
+  return &((*contexts)[key] = std::move(context));
+}
+
+// Starts the command of a request. Returns the process running it, or -1.
+pid_t StartRequest(
+    const int client_fd,
+    std::map<std::string, SecurityContext>* contexts) {
+  std::vector<std::string> arguments;
+  int stdio_fds[kStdioFdCount];
+  if (!ReceiveRequest(client_fd, &arguments, stdio_fds)) {
+    return -1;
+  }
+
+  std::vector<char*> argv;
+  argv.push_back(const_cast<char*>("shell-as"));
+  for (std::string& argument : arguments) {
+    argv.push_back(argument.data());
+  }
+  argv.push_back(nullptr);
+  size_t program_index = CountOptionArguments(argv.size() - 1, argv.data());
+
+  pid_t process_id = -1;
+  const SecurityContext* context = GetContext(
+      contexts, std::vector<std::string>(arguments.begin(),
+                                         arguments.begin() + program_index - 1));
+  if (context != nullptr) {
+    char* const default_program[] = {const_cast<char*>(kShell), nullptr};
+    char* const* program = program_index < argv.size() - 1
+                               ? argv.data() + program_index
+                               : default_program;
+    if (!StartInContext(program, context, stdio_fds[0], stdio_fds[1],
+                        stdio_fds[2], &process_id)) {
+      process_id = -1;
+    }
+  }
+  for (int i = 0; i < kStdioFdCount; i++) {
+    close(stdio_fds[i]);
+  }
+  return process_id;
+}
+
+}  // namespace
+
+bool Serve(const char* socket_path) {
+  struct sockaddr_un address;
+  socklen_t address_size;
+  if (!MakeAddress(socket_path, &address, &address_size)) {
+    return false;
+  }
+  int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0 ||
+      bind(listen_fd, reinterpret_cast<struct sockaddr*>(&address),
+           address_size) != 0 ||
+      listen(listen_fd, SOMAXCONN) != 0) {
+    std::cerr << "Unable to listen on " << socket_path << ": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+
+  // The filters are built before the SIGCHLD handler is installed, which
+  // would otherwise reap the children used to build them.
+  for (SeccompFilter filter : {kAppFilter, kAppZygoteFilter, kSystemFilter}) {
+    PreloadSeccompFilter(filter);
+  }
+
+  // Child exits are turned into readable events on a pipe, so the server can
+  // wait for clients and children at the same time.
+  if (pipe2(child_exit_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+    std::cerr << "Unable to create a pipe: " << strerror(errno) << std::endl;
+    return false;
+  }
+  struct sigaction action = {};
+  action.sa_handler = HandleChildExit;
+  action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &action, nullptr);
+
+  std::map<std::string, SecurityContext> contexts;
+  // The client connection waiting for each running command.
+  std::map<pid_t, int> clients;
+  // The connections of trusted clients which did not send their request yet.
+  // They are only read from once readable, so a client which never sends one
+  // does not hold up the others.
+  std::vector<int> pending_clients;
+  while (true) {
+    std::vector<struct pollfd> poll_fds = {{listen_fd, POLLIN, 0},
+                                           {child_exit_pipe[0], POLLIN, 0}};
+    for (int client_fd : pending_clients) {
+      poll_fds.push_back({client_fd, POLLIN, 0});
+    }
+    if (poll(poll_fds.data(), poll_fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "Unable to wait for requests: " << strerror(errno)
+                << std::endl;
+      return false;
+    }
+
+    for (size_t i = 2; i < poll_fds.size(); i++) {
+      if (poll_fds[i].revents == 0) {
+        continue;
+      }
+      int client_fd = poll_fds[i].fd;
+      pending_clients.erase(std::find(pending_clients.begin(),
+                                      pending_clients.end(), client_fd));
+      pid_t process_id = StartRequest(client_fd, &contexts);
+      if (process_id < 0) {
+        SendExitCode(client_fd, -1);
+        close(client_fd);
+      } else {
+        clients[process_id] = client_fd;
+      }
+    }
+
+    if (poll_fds[0].revents != 0) {
+      int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (client_fd >= 0) {
+        if (IsClientTrusted(client_fd)) {
+          pending_clients.push_back(client_fd);
+        } else {
+          SendExitCode(client_fd, -1);
+          close(client_fd);
+        }
+      }
+    }
+
+    if (poll_fds[1].revents != 0) {
+      char bytes[64];
+      while (read(child_exit_pipe[0], bytes, sizeof(bytes)) > 0) {
+      }
+      int status;
+      pid_t process_id;
+      while ((process_id = waitpid(-1, &status, WNOHANG)) > 0) {
+        auto client = clients.find(process_id);
+        if (client == clients.end()) {
+          continue;
+        }
+        SendExitCode(client->second, ExitCodeFromStatus(status));
+        close(client->second);
+        clients.erase(client);
+      }
+    }
+  }
+}
+
+int ExecuteOnServer(const char* socket_path, const int argc,
+                    char* const argv[]) {
+  struct sockaddr_un address;
+  socklen_t address_size;
+  if (!MakeAddress(socket_path, &address, &address_size)) {
+    return 1;
+  }
+  int server_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (server_fd < 0 ||
+      connect(server_fd, reinterpret_cast<struct sockaddr*>(&address),
+              address_size) != 0) {
+    std::cerr << "Unable to connect to " << socket_path << ": "
+              << strerror(errno) << std::endl;
+    return 1;
+  }
+
+  std::string request;
+  for (int i = 0; i < argc; i++) {
+    request += argv[i];
+    request += '\0';
+  }
+  if (request.empty() || request.size() > kMaxRequestSize) {
+    std::cerr << "Invalid request size." << std::endl;
+    return 1;
+  }
+  struct iovec payload = {request.data(), request.size()};
+  int stdio_fds[kStdioFdCount] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  char control[CMSG_SPACE(sizeof(stdio_fds))] = {};
+  struct msghdr message = {};
+  message.msg_iov = &payload;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(stdio_fds));
+  memcpy(CMSG_DATA(header), stdio_fds, sizeof(stdio_fds));
+  if (sendmsg(server_fd, &message, MSG_NOSIGNAL) < 0) {
+    std::cerr << "Unable to send the request: " << strerror(errno)
+              << std::endl;
+    return 1;
+  }
+
+  int32_t exit_code;
+  ssize_t received;
+  do {
+    received = recv(server_fd, &exit_code, sizeof(exit_code), 0);
+  } while (received < 0 && errno == EINTR);
+  close(server_fd);
+  if (received != sizeof(exit_code)) {
+    std::cerr << "Lost the connection to the server." << std::endl;
+    return 1;
+  }
+  if (exit_code < 0) {
+    std::cerr << "The server was unable to run the command." << std::endl;
+    return 1;
+  }
+  return exit_code;
+}
+
+}  // namespace shell_as
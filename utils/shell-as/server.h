@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SHELL_AS_SERVER_H_
+#define SHELL_AS_SERVER_H_
+
+namespace shell_as {
+
+// Runs a server that executes commands in security contexts on behalf of
+// clients connected to the Unix socket at socket_path. A socket_path starting
+// with '@' names an abstract socket. Only clients with the same user ID as the
+// server are served. Only returns on error.
+//
+// Each request is one SOCK_SEQPACKET message holding the shell-as options and
+// the program to run as NUL-terminated strings, in the same form as on the
+// command line, along with the client's standard input, output and error. The
+// security context of each distinct set of options is resolved once and reused
+// by later requests, so for example a --pid context is that of the process at
+// the time of the first request. Once the command exits, its exit code is sent
+// back as a 32-bit integer, or -1 if it could not be started.
+bool Serve(const char* socket_path);
+
+// Runs a command through the server listening at socket_path. The arguments are
+// the shell-as options and program to run, and the command uses the caller's
+// standard input, output and error.
+//
+// Returns the exit code of the command, or 1 if it could not be run.
+int ExecuteOnServer(const char* socket_path, const int argc,
+                    char* const argv[]);
+
+}  // namespace shell_as
+
+#endif  // SHELL_AS_SERVER_H_
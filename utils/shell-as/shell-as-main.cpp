@@ -14,20 +14,95 @@
  * limitations under the License.
  */
 
+#include <string.h>
+
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include "./batch.h"
 #include "./command-line.h"
 #include "./context.h"
 #include "./execute.h"
+#include "./server.h"
+#include "./snapshot.h"
+#include "./timing.h"
+
+namespace {
+
+// Prints the security context of every running process, one per line.
+bool ListContexts() {
+  std::vector<pid_t> process_ids = shell_as::ListProcessIds();
+  if (process_ids.empty()) {
+    std::cerr << "Unable to list processes." << std::endl;
+    return false;
+  }
+  std::vector<std::optional<shell_as::SecurityContext>> contexts;
+  shell_as::SecurityContextsFromProcesses(
+      process_ids, std::thread::hardware_concurrency(), &contexts);
+
+  for (size_t i = 0; i < process_ids.size(); i++) {
+    if (!contexts[i].has_value()) {
+      continue;
+    }
+    const shell_as::SecurityContext& context = contexts[i].value();
+    std::cout << process_ids[i] << " uid=" << context.user_id.value()
+              << " gid=" << context.group_id.value() << " groups=";
+    const char* separator = "";
+    for (gid_t id : context.supplementary_group_ids.value()) {
+      std::cout << separator << id;
+      separator = ",";
+    }
+    std::cout << " selinux=" << context.selinux_context.value() << " caps='"
+              << context.capabilities->ToText() << "'" << std::endl;
+  }
+  return true;
+}
+
+}  // namespace
 
 int main(const int argc, char* const argv[]) {
+  // Server mode and its clients never resolve a context themselves, so they are
+  // handled before the options are parsed.
+  if (argc == 3 && strcmp(argv[1], "--serve") == 0) {
+    return !shell_as::Serve(argv[2]);
+  }
+  if (argc >= 3 && strcmp(argv[1], "--connect") == 0) {
+    return shell_as::ExecuteOnServer(argv[2], argc - 3, argv + 3);
+  }
+  if (argc == 2 && strcmp(argv[1], "--list-contexts") == 0) {
+    return !ListContexts();
+  }
+  if (argc == 2 && strcmp(argv[1], "--dump-contexts") == 0) {
+    return !shell_as::DumpContexts(std::cout);
+  }
+  if (argc == 4 && strcmp(argv[1], "--diff") == 0) {
+    // Like diff, exit with 1 if the snapshots differ and 2 on error.
+    bool differ = false;
+    if (!shell_as::DiffContexts(argv[2], argv[3], std::cout, &differ)) {
+      return 2;
+    }
+    return differ ? 1 : 0;
+  }
+
   bool verbose = false;
+  bool timing = false;
   auto context = std::make_unique<shell_as::SecurityContext>();
   char* const* execute_arguments = nullptr;
-  if (!shell_as::ParseOptions(argc, argv, &verbose, context.get(),
-                              &execute_arguments)) {
+  const char* batch_path = nullptr;
+  uint32_t max_jobs = 1;
+  bool parsed;
+  {
+    shell_as::PhaseTimer timer(shell_as::kOptionsPhase,
+                               shell_as::kContextPhase);
+    parsed = shell_as::ParseOptions(argc, argv, &verbose, &timing,
+                                    context.get(), &execute_arguments,
+                                    &batch_path, &max_jobs);
+  }
+  if (!parsed) {
     return 1;
   }
 
@@ -83,11 +158,19 @@ int main(const int argc, char* const argv[]) {
     if (!context->capabilities.has_value()) {
       std::cerr << "<no value>";
     } else {
-      std::cerr << "'" << cap_to_text(context->capabilities.value(), nullptr)
-                << "'";
+      std::cerr << "'" << context->capabilities->ToText() << "'";
     }
     std::cerr << std::endl;
   }
 
-  return !shell_as::ExecuteInContext(execute_arguments, context.get());
+  bool success;
+  if (batch_path != nullptr) {
+    success = shell_as::RunBatch(batch_path, max_jobs, context.get());
+  } else {
+    success = shell_as::ExecuteInContext(execute_arguments, context.get());
+  }
+  if (timing) {
+    shell_as::WriteTimingReport(std::cerr);
+  }
+  return !success;
 }
@@ -16,9 +16,12 @@
 
 #include "./shell-code.h"
 
-#include <sys/mman.h>
-#include <sys/types.h>
-#include <unistd.h>
+#include <string.h>
+
+// The shell code is assembled into the read-only data of shell-as rather than
+// its text, since it is only copied into other processes and never run here.
+// That keeps it readable without changing any page protections, even where
+// code is mapped execute-only.
 
 // Shell code that sets the SELinux context of the current process.
 //
@@ -27,8 +30,8 @@
 // the shell code will stop the current process with SIGSTOP.
 //
 // This shell code must be self-contained and position-independent.
-extern "C" void __setcon_shell_code_start();
-extern "C" void __setcon_shell_code_end();
+extern "C" const uint8_t __setcon_shell_code_start[];
+extern "C" const uint8_t __setcon_shell_code_end[];
 
 // Shell code that stops execution of the current process by raising a signal.
 // The specific signal that is raised is given in __trap_shell_code_signal.
@@ -36,50 +39,28 @@ extern "C" void __setcon_shell_code_end();
 // This shell code can be used to inject break points into a traced process.
 //
 // The shell code must not modify any registers other than the program counter.
-extern "C" void __trap_shell_code_start();
-extern "C" void __trap_shell_code_end();
-extern "C" int __trap_shell_code_signal;
+extern "C" const uint8_t __trap_shell_code_start[];
+extern "C" const uint8_t __trap_shell_code_end[];
+extern "C" const int __trap_shell_code_signal;
 
 namespace shell_as {
 
-namespace {
-uintptr_t PageStart(void (*addr)()) {
-  return ((uintptr_t)addr & ~(getpagesize() - 1));
-}
-
-void EnsureShellcodeReadable(void (*start)(), void (*end)()) {
-  mprotect((void*)PageStart(start),
-           PageStart(end) - PageStart(start) + getpagesize(),
-           PROT_READ | PROT_EXEC);
-}
-}  // namespace
-
-std::unique_ptr<uint8_t[]> GetSELinuxShellCode(
-    char* selinux_context, size_t* total_size) {
-  EnsureShellcodeReadable(&__setcon_shell_code_start, &__setcon_shell_code_end);
-
-  size_t shell_code_size = (uintptr_t)&__setcon_shell_code_end -
-                           (uintptr_t)&__setcon_shell_code_start;
+size_t BuildSELinuxShellCode(const char* selinux_context, uint8_t* buffer,
+                             size_t buffer_size) {
+  size_t shell_code_size = __setcon_shell_code_end - __setcon_shell_code_start;
   size_t selinux_context_size = strlen(selinux_context) + 1 /* null byte */;
-  *total_size = shell_code_size + selinux_context_size;
-
-  std::unique_ptr<uint8_t[]> shell_code(new uint8_t[*total_size]);
-  memcpy(shell_code.get(), (void*)&__setcon_shell_code_start, shell_code_size);
-  memcpy(shell_code.get() + shell_code_size, selinux_context,
-         selinux_context_size);
-  return shell_code;
+  size_t total_size = shell_code_size + selinux_context_size;
+  if (total_size > buffer_size) {
+    return 0;
+  }
+  memcpy(buffer, __setcon_shell_code_start, shell_code_size);
+  memcpy(buffer + shell_code_size, selinux_context, selinux_context_size);
+  return total_size;
 }
 
-std::unique_ptr<uint8_t[]> GetTrapShellCode(int* expected_signal,
-                                            size_t* total_size) {
-  EnsureShellcodeReadable(&__trap_shell_code_start, &__trap_shell_code_end);
-
+const uint8_t* GetTrapShellCode(int* expected_signal, size_t* size) {
   *expected_signal = __trap_shell_code_signal;
-
-  *total_size =
-      (uintptr_t)&__trap_shell_code_end - (uintptr_t)&__trap_shell_code_start;
-  std::unique_ptr<uint8_t[]> shell_code(new uint8_t[*total_size]);
-  memcpy(shell_code.get(), (void*)&__trap_shell_code_start, *total_size);
-  return shell_code;
+  *size = __trap_shell_code_end - __trap_shell_code_start;
+  return __trap_shell_code_start;
 }
 }  // namespace shell_as
@@ -18,23 +18,30 @@
 #define SHELL_AS_SHELL_CODE_H_
 
 #include <selinux/selinux.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 
-#include <memory>
-
 #include "context.h"
 
 namespace shell_as {
 
-// Returns shell code that when executed will set the current process's SElinux
-// context to the given value and then SIGSTOP itself.
-std::unique_ptr<uint8_t[]> GetSELinuxShellCode(
-    char* selinux_context, size_t* total_size);
+// An upper bound for the size of any shell code payload, so that payloads and
+// the memory they replace can be kept on the stack.
+constexpr size_t kMaxShellCodeSize = 4096;
+
+// Writes shell code that when executed will set the current process's SELinux
+// context to the given value and then SIGSTOP itself to buffer.
+//
+// Returns the size of the shell code, or zero if it does not fit in buffer.
+size_t BuildSELinuxShellCode(const char* selinux_context, uint8_t* buffer,
+                             size_t buffer_size);
 
 // Returns shell code that when executed will halt the current process and raise
 // a signal. The specific signal is returned in the expected_signal argument.
-std::unique_ptr<uint8_t[]> GetTrapShellCode(int* expected_signal,
-                                            size_t* total_size);
+//
+// The returned code is part of shell-as and must not be freed.
+const uint8_t* GetTrapShellCode(int* expected_signal, size_t* size);
 }  // namespace shell_as
 
 #endif  // SHELL_AS_SHELL_CODE_H_
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "./snapshot.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "./context.h"
+
+namespace shell_as {
+
+namespace {
+
+const char kSeccompFilterNames[][11] = {"app", "app-zygote", "system"};
+
+// Reads the start of a small /proc/<pid>/ file. Returns an empty string on
+// error.
+std::string ReadProcFile(const pid_t process_id, const char* name) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/%s", process_id, name);
+  int file = open(path, O_RDONLY | O_CLOEXEC);
+  if (file == -1) {
+    return "";
+  }
+  char buffer[256];
+  ssize_t bytes_read = read(file, buffer, sizeof(buffer));
+  close(file);
+  return bytes_read > 0 ? std::string(buffer, bytes_read) : "";
+}
+
+std::string ProcessName(const pid_t process_id) {
+  std::string cmdline = ReadProcFile(process_id, "cmdline");
+  std::string name = cmdline.substr(0, cmdline.find('\0'));
+  if (!name.empty()) {
+    return name;
+  }
+  // Kernel threads have no command line, so ps style brackets around the
+  // thread name set them apart.
+  std::string comm = ReadProcFile(process_id, "comm");
+  return "[" + comm.substr(0, comm.find('\n')) + "]";
+}
+
+void WriteJsonString(std::ostream& out, const std::string& value) {
+  out << '"';
+  for (unsigned char c : value) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (c < 0x20) {
+      char escaped[7];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out << escaped;
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+}
+
+// Removes the leading "pid" member from a snapshot record.
+std::string RecordWithoutProcessId(const std::string& record) {
+  const char prefix[] = "{\"pid\":";
+  if (record.compare(0, sizeof(prefix) - 1, prefix) != 0) {
+    return record;
+  }
+  size_t separator = record.find(',');
+  if (separator == std::string::npos) {
+    return record;
+  }
+  return "{" + record.substr(separator + 1);
+}
+
+// Counts the records of a snapshot, without their process IDs.
+bool ReadSnapshot(const char* path, std::map<std::string, int>* records) {
+  std::ifstream file(path);
+  if (!file) {
+    std::cerr << "Unable to open snapshot " << path << std::endl;
+    return false;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    if (!line.empty()) {
+      (*records)[RecordWithoutProcessId(line)]++;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+bool DumpContexts(std::ostream& out) {
+  std::vector<pid_t> process_ids = ListProcessIds();
+  if (process_ids.empty()) {
+    std::cerr << "Unable to list processes." << std::endl;
+    return false;
+  }
+  std::vector<std::optional<SecurityContext>> contexts;
+  SecurityContextsFromProcesses(process_ids, std::thread::hardware_concurrency(),
+                                &contexts);
+
+  for (size_t i = 0; i < process_ids.size(); i++) {
+    if (!contexts[i].has_value()) {
+      continue;
+    }
+    const SecurityContext& context = contexts[i].value();
+    out << "{\"pid\":" << process_ids[i] << ",\"name\":";
+    WriteJsonString(out, ProcessName(process_ids[i]));
+    out << ",\"uid\":" << context.user_id.value()
+        << ",\"gid\":" << context.group_id.value() << ",\"groups\":[";
+    const char* separator = "";
+    for (gid_t id : context.supplementary_group_ids.value()) {
+      out << separator << id;
+      separator = ",";
+    }
+    out << "],\"selinux\":";
+    WriteJsonString(out, context.selinux_context.value());
+    out << ",\"caps\":";
+    WriteJsonString(out, context.capabilities->ToText());
+    out << ",\"seccomp\":\""
+        << kSeccompFilterNames[SeccompFilterFromUserId(
+               context.user_id.value())]
+        << "\"}\n";
+  }
+  out.flush();
+  return true;
+}
+
+bool DiffContexts(const char* old_path, const char* new_path,
+                  std::ostream& out, bool* differ) {
+  std::map<std::string, int> old_records;
+  std::map<std::string, int> new_records;
+  if (!ReadSnapshot(old_path, &old_records) ||
+      !ReadSnapshot(new_path, &new_records)) {
+    return false;
+  }
+
+  // Both maps are sorted, so a single merge pass finds every record whose
+  // count changed.
+  *differ = false;
+  auto old_record = old_records.begin();
+  auto new_record = new_records.begin();
+  while (old_record != old_records.end() || new_record != new_records.end()) {
+    int count_change;
+    const std::string* record;
+    if (new_record == new_records.end() ||
+        (old_record != old_records.end() &&
+         old_record->first < new_record->first)) {
+      record = &old_record->first;
+      count_change = -old_record->second;
+      old_record++;
+    } else if (old_record == old_records.end() ||
+               new_record->first < old_record->first) {
+      record = &new_record->first;
+      count_change = new_record->second;
+      new_record++;
+    } else {
+      record = &old_record->first;
+      count_change = new_record->second - old_record->second;
+      old_record++;
+      new_record++;
+    }
+    for (; count_change < 0; count_change++) {
+      out << "- " << *record << "\n";
+      *differ = true;
+    }
+    for (; count_change > 0; count_change--) {
+      out << "+ " << *record << "\n";
+      *differ = true;
+    }
+  }
+  out.flush();
+  return true;
+}
+
+}  // namespace shell_as
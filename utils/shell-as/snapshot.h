@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SHELL_AS_SNAPSHOT_H_
+#define SHELL_AS_SNAPSHOT_H_
+
+#include <ostream>
+
+namespace shell_as {
+
+// Writes a snapshot of the security context of every running process to out,
+// as one JSON object per line:
+//
+// {"pid":1,"name":"/system/bin/init","uid":0,"gid":0,"groups":[],
+//  "selinux":"u:r:init:s0","caps":"=ep","seccomp":"system"}
+//
+// The name is the first argument of the process's command line, or the
+// bracketed thread name for kernel threads. The seccomp filter is the one
+// inferred from the user ID. Returns false if the processes could not be
+// listed.
+bool DumpContexts(std::ostream& out);
+
+// Compares two snapshots written by DumpContexts and writes each record only
+// found in the old snapshot prefixed by "- ", and each record only found in the
+// new one prefixed by "+ ", without their process IDs. Records are compared
+// without process IDs so the same process started again does not count as a
+// difference.
+//
+// Sets differ to whether the snapshots differ. Returns false if a snapshot could
+// not be read.
+bool DiffContexts(const char* old_path, const char* new_path,
+                  std::ostream& out, bool* differ);
+
+}  // namespace shell_as
+
+#endif  // SHELL_AS_SNAPSHOT_H_
@@ -16,14 +16,22 @@
 
 #include "./test-app.h"
 
+#include <android-base/properties.h>
+#include <dirent.h>
 #include <fcntl.h>
-#include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <subprocess.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "./string-utils.h"
 
@@ -37,17 +45,92 @@ void GetTestApk(uint8_t **apk, size_t *length);
 
 namespace {
 
-// The staging path for the test app APK.
+// The package name of the test app.
+const char kTestAppPackage[] = "com.android.google.tools.security.shell_as";
+
+// The staging path for the test app APK, on devices without cmd.
 const char kTestAppApkStagingPath[] = "/data/local/tmp/shell-as-test-app.apk";
 
-// Writes the test app to a staging location and then installs the APK via the
-// 'pm' utility. The app is granted runtime permissions on installation. Returns
-// true if the app is installed successfully.
-bool InstallTestApp() {
+// The data directory of the test app, owned by the app's user ID.
+const char kTestAppDataPath[] =
+    "/data/data/com.android.google.tools.security.shell_as";
+
+// The native binder client which runs the shell commands of system services.
+// Calling it directly skips the shell scripts of pm and am, and the Java
+// runtime they start on older builds.
+const char kCmdPath[] = "/system/bin/cmd";
+
+// How long pm and am may take, e.g. to install the APK on a slow device.
+constexpr std::chrono::minutes kPackageManagerTimeout(2);
+
+bool HasCmd() {
+  static const bool has_cmd = access(kCmdPath, X_OK) == 0;
+  return has_cmd;
+}
+
+// A system service and the tool which runs its shell commands where cmd is
+// not available.
+struct ServiceCommand {
+  const char *service;
+  const char *fallback_tool;
+};
+
+const ServiceCommand kPackageService = {"package", "/system/bin/pm"};
+const ServiceCommand kActivityService = {"activity", "/system/bin/am"};
+
+// Runs a shell command of a system service, with input as its standard input.
+// Returns true if it succeeded, with its standard output in output if that is
+// not null.
+bool RunServiceCommand(const ServiceCommand &command,
+                       const std::vector<std::string> &args,
+                       std::string *output = nullptr,
+                       std::string_view input = {}) {
+  std::vector<std::string> command_line;
+  if (HasCmd()) {
+    command_line = {kCmdPath, command.service};
+  } else {
+    command_line = {command.fallback_tool};
+  }
+  command_line.insert(command_line.end(), args.begin(), args.end());
+
+  android::test::subprocess::SubprocessOptions options;
+  options.timeout = kPackageManagerTimeout;
+  options.input = input;
+  android::test::subprocess::SubprocessResult result =
+      android::test::subprocess::RunSubprocess(command_line, options);
+  if (output) {
+    *output = result.output;
+  }
+  return result.Succeeded();
+}
+
+// Returns true if the installed test app is the one embedded in this binary.
+bool IsTestAppUpToDate() {
+  // pm prints a "package:<path>" line for the APK of an installed package.
+  std::string pm_output;
+  const char prefix[] = "package:";
+  if (!RunServiceCommand(kPackageService, {"path", kTestAppPackage},
+                         &pm_output) ||
+      strncmp(pm_output.c_str(), prefix, sizeof(prefix) - 1) != 0) {
+    return false;
+  }
+  std::string installed_path = pm_output.substr(
+      sizeof(prefix) - 1, pm_output.find('\n') - (sizeof(prefix) - 1));
+
+  std::ifstream installed_file(installed_path, std::ios::binary);
+  std::vector<uint8_t> installed_apk(
+      (std::istreambuf_iterator<char>(installed_file)),
+      std::istreambuf_iterator<char>());
   uint8_t *apk = nullptr;
   size_t apk_size = 0;
   GetTestApk(&apk, &apk_size);
+  return installed_apk.size() == apk_size &&
+         memcmp(installed_apk.data(), apk, apk_size) == 0;
+}
 
+// Writes the APK to a staging location, for a pm which can't read it from its
+// standard input. Returns true if the whole APK was written.
+bool StageTestApk(const uint8_t *apk, size_t apk_size) {
   int staging_file = open(kTestAppApkStagingPath, O_WRONLY | O_CREAT | O_TRUNC,
                           S_IRUSR | S_IWUSR);
   if (staging_file == -1) {
@@ -61,63 +144,104 @@ bool InstallTestApp() {
     std::cerr << "Unable to write entire test app APK." << std::endl;
     return false;
   }
+  return true;
+}
+
+// Installs the test app with the package manager. The app is granted runtime
+// permissions on installation. Returns true if the app is installed
+// successfully.
+//
+// With cmd, the APK is streamed from memory into the install session, which
+// reads its standard input for the -S size given.
+bool InstallTestApp() {
+  uint8_t *apk = nullptr;
+  size_t apk_size = 0;
+  GetTestApk(&apk, &apk_size);
 
-  const char cmd_template[] = "pm install -g %s > /dev/null 2> /dev/null";
-  char system_cmd[sizeof(cmd_template) + sizeof(kTestAppApkStagingPath) + 1] =
-      {};
-  sprintf(system_cmd, cmd_template, kTestAppApkStagingPath);
-  return system(system_cmd) == 0;
+  if (HasCmd()) {
+    return RunServiceCommand(
+        kPackageService, {"install", "-g", "-S", std::to_string(apk_size)},
+        /*output=*/nullptr,
+        std::string_view(reinterpret_cast<const char *>(apk), apk_size));
+  }
+  return StageTestApk(apk, apk_size) &&
+         RunServiceCommand(kPackageService,
+                           {"install", "-g", kTestAppApkStagingPath});
 }
 
 // Uninstalls the test app if it is installed. This method is a no-op if the app
 // is not installed.
 void UninstallTestApp() {
-  system(
-      "pm uninstall com.android.google.tools.security.shell_as"
-      " > /dev/null 2> /dev/null");
+  RunServiceCommand(kPackageService, {"uninstall", kTestAppPackage});
 }
 
 // Starts the main activity of the test app. This is necessary as some aspects
 // of the security context can only be inferred from a running process.
+//
+// The -W flag makes am wait until the launch has completed, so the app process
+// exists by the time this returns.
 bool StartTestApp() {
-  return system(
-             "am start-activity "
-             "com.android.google.tools.security.shell_as/"
-             ".MainActivity"
-             " > /dev/null 2> /dev/null") == 0;
+  return RunServiceCommand(
+      kActivityService,
+      {"start-activity", "-W",
+       std::string(kTestAppPackage) + "/.MainActivity"});
 }
 
 // Obtain the process ID of the test app and returns true if it is running.
 // Returns false otherwise.
+//
+// The app process is found by its command line, which the zygote sets to the
+// package name, by reading /proc directly rather than forking pgrep.
 bool GetTestAppProcessId(pid_t *test_app_pid) {
-  FILE *pgrep = popen(
-      "pgrep -f "
-      "com.android.google.tools.security.shell_as",
-      "r");
-  if (!pgrep) {
-    std::cerr << "Unable to execute pgrep." << std::endl;
+  DIR *proc = opendir("/proc");
+  if (!proc) {
+    std::cerr << "Unable to open /proc." << std::endl;
     return false;
   }
 
-  char pgrep_output[128];
-  memset(pgrep_output, 0, sizeof(pgrep_output));
-  int bytes_read = fread(pgrep_output, 1, sizeof(pgrep_output) - 1, pgrep);
-  pclose(pgrep);
-  if (bytes_read <= 0) {
-    // Unable to find the process. This may happen if the app is still starting
-    // up.
-    return false;
+  bool found = false;
+  const size_t package_size = sizeof(kTestAppPackage);
+  for (struct dirent *entry = readdir(proc); entry != nullptr && !found;
+       entry = readdir(proc)) {
+    uint32_t process_id;
+    if (!StringToUInt32(entry->d_name, &process_id)) {
+      continue;
+    }
+    std::string cmdline_path = std::string("/proc/") + entry->d_name +
+                               "/cmdline";
+    int cmdline_file = open(cmdline_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (cmdline_file == -1) {
+      // The process may have exited since the directory was listed.
+      continue;
+    }
+    // The terminator is compared as well, so a longer first argument with the
+    // same prefix, like that of a ":remote" process, does not match.
+    char cmdline[sizeof(kTestAppPackage)] = {};
+    ssize_t bytes_read = read(cmdline_file, cmdline, sizeof(cmdline));
+    close(cmdline_file);
+    if (bytes_read >= static_cast<ssize_t>(package_size) &&
+        memcmp(cmdline, kTestAppPackage, package_size) == 0) {
+      *test_app_pid = process_id;
+      found = true;
+    }
   }
-  return StringToUInt32(pgrep_output, (uint32_t *)test_app_pid);
+  closedir(proc);
+  return found;
 }
 }  // namespace
 
 bool SetupAndStartTestApp(pid_t *test_app_pid) {
-  UninstallTestApp();
+  // Reinstalling and restarting the app takes seconds, so both are skipped
+  // when the installed app is already this binary's and already running.
+  if (!IsTestAppUpToDate()) {
+    UninstallTestApp();
 
-  if (!InstallTestApp()) {
-    std::cerr << "Unable to install test app." << std::endl;
-    return false;
+    if (!InstallTestApp()) {
+      std::cerr << "Unable to install test app." << std::endl;
+      return false;
+    }
+  } else if (GetTestAppProcessId(test_app_pid)) {
+    return true;
   }
 
   if (!StartTestApp()) {
@@ -125,12 +249,39 @@ bool SetupAndStartTestApp(pid_t *test_app_pid) {
     return false;
   }
 
-  for (int i = 0; i < 5; i++) {
+  // The process normally exists as soon as am returns. Should am return early,
+  // keep looking for up to five seconds with a short interval.
+  for (int i = 0; i < 500; i++) {
     if (GetTestAppProcessId(test_app_pid)) {
       return true;
     }
-    sleep(1);
+    usleep(10 * 1000);
   }
   return false;
 }
+
+std::string GetTestAppContextKey() {
+  uint8_t *apk = nullptr;
+  size_t apk_size = 0;
+  GetTestApk(&apk, &apk_size);
+  // 64-bit FNV-1a. The hash only needs to notice a different APK.
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t i = 0; i < apk_size; i++) {
+    hash = (hash ^ apk[i]) * 0x100000001b3;
+  }
+  char hash_string[17];
+  snprintf(hash_string, sizeof(hash_string), "%016llx",
+           static_cast<unsigned long long>(hash));
+  return android::base::GetProperty("ro.build.fingerprint", "") + " " +
+         hash_string;
+}
+
+bool GetTestAppUserId(uid_t *user_id) {
+  struct stat data_stat;
+  if (stat(kTestAppDataPath, &data_stat) != 0) {
+    return false;
+  }
+  *user_id = data_stat.st_uid;
+  return true;
+}
 }  // namespace shell_as
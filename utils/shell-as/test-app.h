@@ -19,13 +19,26 @@
 
 #include <sys/types.h>
 
+#include <string>
+
 namespace shell_as {
 
 // Installs and launches the embedded shell-as test app. The test app requests
 // and is granted all non-system permissions defined by the OS. The test_app_pid
 // parameter is set to the process ID of the running test app. Returns true if
 // successful.
+//
+// The app is only reinstalled if the installed app differs from the embedded
+// one, and only started if it is not already running.
 bool SetupAndStartTestApp(pid_t *test_app_pid);
+
+// Returns a key that identifies the security context of the test app: the
+// build fingerprint of the device and a hash of the embedded test app APK.
+std::string GetTestAppContextKey();
+
+// Obtains the user ID the installed test app runs as. Returns false if the app
+// is not installed.
+bool GetTestAppUserId(uid_t *user_id);
 }
 
 #endif  // SHELL_AS_TEST_APP_H_
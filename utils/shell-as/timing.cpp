@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "./timing.h"
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+namespace shell_as {
+
+namespace {
+
+typedef struct PhaseTotal {
+  uint32_t count;
+  std::chrono::nanoseconds time;
+} PhaseTotal;
+
+typedef struct Totals {
+  PhaseTotal phases[kPhaseCount];
+  uint32_t forked_children;
+} Totals;
+
+// The phases are timed on a single thread, except for kPreExecPhase which the
+// child adds while the parent waits for it to execute. The totals are mapped
+// shared, so that a child which had to be forked rather than started on the
+// parent's memory adds its time to the parent's totals instead of to a copy.
+// Should the mapping fail, the time of forked children is left in kExecPhase,
+// which the report marks.
+Totals fallback_totals;
+Totals* const totals = [] {
+  void* mapping = mmap(nullptr, sizeof(Totals), PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  return mapping == MAP_FAILED ? &fallback_totals
+                               : static_cast<Totals*>(mapping);
+}();
+
+const char* const kPhaseNames[kPhaseCount] = {
+    "options",     "context",    "pre_exec", "exec",
+    "entry_point", "shell_code", "detach",
+};
+
+}  // namespace
+
+void AddPhaseTime(const Phase phase, const std::chrono::nanoseconds duration) {
+  totals->phases[phase].count++;
+  totals->phases[phase].time += duration;
+}
+
+std::chrono::nanoseconds GetPhaseTime(const Phase phase) {
+  return totals->phases[phase].time;
+}
+
+void CountForkedChild() { totals->forked_children++; }
+
+PhaseTimer::PhaseTimer(const Phase phase, const std::optional<Phase> nested)
+    : phase_(phase),
+      nested_(nested),
+      start_(std::chrono::steady_clock::now()),
+      nested_start_(nested.has_value() ? GetPhaseTime(nested.value())
+                                       : std::chrono::nanoseconds(0)) {}
+
+PhaseTimer::~PhaseTimer() {
+  std::chrono::nanoseconds duration = std::chrono::steady_clock::now() - start_;
+  if (nested_.has_value()) {
+    duration -= GetPhaseTime(nested_.value()) - nested_start_;
+  }
+  AddPhaseTime(phase_, duration);
+}
+
+void WritePhaseTotals(std::ostream& out) {
+  out << "{";
+  for (int phase = 0; phase < kPhaseCount; phase++) {
+    out << (phase == 0 ? "" : ",") << "\"" << kPhaseNames[phase]
+        << "\":{\"count\":" << totals->phases[phase].count << ",\"us\":"
+        << std::chrono::duration_cast<std::chrono::microseconds>(
+               totals->phases[phase].time)
+               .count()
+        << "}";
+  }
+  out << ",\"forked\":{\"count\":" << totals->forked_children
+      << ",\"pre_exec_in_exec\":"
+      << (totals == &fallback_totals && totals->forked_children > 0 ? "true"
+                                                                   : "false")
+      << "}}";
+}
+
+void WriteTimingReport(std::ostream& out) {
+  WritePhaseTotals(out);
+  out << std::endl;
+}
+
+}  // namespace shell_as
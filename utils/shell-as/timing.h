@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef SHELL_AS_TIMING_H_
+#define SHELL_AS_TIMING_H_
+
+#include <chrono>
+#include <optional>
+#include <ostream>
+
+namespace shell_as {
+
+// The phases of an invocation that --timing breaks its latency down into.
+typedef enum Phase {
+  kOptionsPhase,     // Parsing options, less inferring the context.
+  kContextPhase,     // Inferring the context from a process or the test app.
+  kPreExecPhase,     // DropPreExecPrivileges in the child.
+  kExecPhase,        // Starting the child until it stops after execve.
+  kEntryPointPhase,  // StepToEntryPoint.
+  kShellCodePhase,   // Building and running the SELinux shell code.
+  kDetachPhase,      // Detaching from the child.
+  kPhaseCount,
+} Phase;
+
+// Adds duration to the total time spent in phase.
+void AddPhaseTime(const Phase phase, const std::chrono::nanoseconds duration);
+
+// Returns the total time spent in phase so far.
+std::chrono::nanoseconds GetPhaseTime(const Phase phase);
+
+// Counts a child that was forked because it could not share the memory of the
+// parent until it executes.
+void CountForkedChild();
+
+// Adds the time from its construction to its destruction to a phase, less the
+// time added to the nested phase meanwhile, if any.
+class PhaseTimer {
+ public:
+  explicit PhaseTimer(const Phase phase,
+                      const std::optional<Phase> nested = std::nullopt);
+  ~PhaseTimer();
+
+  PhaseTimer(const PhaseTimer&) = delete;
+  PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+ private:
+  const Phase phase_;
+  const std::optional<Phase> nested_;
+  const std::chrono::steady_clock::time_point start_;
+  const std::chrono::nanoseconds nested_start_;
+};
+
+// Writes the number of times each phase was entered and the total time spent
+// in it as a JSON object. Times are in microseconds. The "forked" member counts
+// the children that were forked, and its "pre_exec_in_exec" member is true if
+// their pre_exec time could not be told apart and was counted in exec.
+void WritePhaseTotals(std::ostream& out);
+
+// Writes WritePhaseTotals as a single line.
+void WriteTimingReport(std::ostream& out);
+}  // namespace shell_as
+
+#endif  // SHELL_AS_TIMING_H_